@@ -0,0 +1,174 @@
+#ifndef _CLOCK_H
+#define _CLOCK_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Clock
+//
+// The one place the CPU clock is known. Everything that divides the clock
+// down (the U(S)ART baud rate, the SPI clock, the timers and <util/delay.h>)
+// gets its numbers from here at compile time, so changing the clock is a
+// matter of changing F_CPU (and the fuses) instead of hunting down magic
+// numbers.
+//
+// The Makefile passes F_CPU for each target with -D, to match that target's
+// fuses. Include this before <util/delay.h>.
+//
+// With CLOCK_SCALING, the CPU can also run at CLOCK_IDLE_F_CPU while there's
+// nothing to do (cube/common/cpu_clock.h), so everything that divides the
+// clock gets a second set of numbers for that.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/////////////////// Clock Settings /////////////////////////////////////////////
+
+// The CPU clock. The fuses the Makefile writes to the cubes (0x62) divide the
+// 8 MHz internal oscillator by 8.
+#ifndef F_CPU
+  #define F_CPU (1000000UL)
+#endif
+
+// The baud rate the U(S)ART runs at.
+#ifndef UART_BAUD
+  #define UART_BAUD (9600UL)
+#endif
+
+// Whether cpu_clock_idle can slow the CPU down with CLKPR.
+#ifndef CLOCK_SCALING
+  #define CLOCK_SCALING (0)
+#endif
+
+// How much slower the CPU runs while it's idle, as the CLKPS bits of CLKPR
+// (which divide by 2 to that power). 3 divides 8 MHz back down to 1 MHz.
+#define CLOCK_IDLE_CLKPS (3)
+#define CLOCK_IDLE_F_CPU (F_CPU >> CLOCK_IDLE_CLKPS)
+
+// How far the actual baud rate is allowed to be from UART_BAUD, in tenths of
+// a percent. Past about 2% characters start coming through garbled.
+#define CLOCK_UART_MAX_ERROR_PERMILLE (20)
+
+/////////////////// U(S)ART ////////////////////////////////////////////////////
+
+// Double speed mode halves the divider, which gives finer steps between baud
+// rates. It's only turned off if the divider wouldn't fit in UBRR0 otherwise.
+#define CLOCK_UART_UBRR_AT(clock, divider) \
+  (((clock) + (divider) * UART_BAUD / 2) / ((divider) * UART_BAUD) - 1)
+#define CLOCK_UART_UBRR_FOR(divider) CLOCK_UART_UBRR_AT(F_CPU, divider)
+
+#define CLOCK_UART_ERROR_PERMILLE_OF(actual) ( \
+  ((actual) > UART_BAUD ? (actual) - UART_BAUD : UART_BAUD - (actual)) * 1000 / UART_BAUD)
+
+#if CLOCK_UART_UBRR_FOR(8UL) <= 4095
+  #define CLOCK_UART_U2X     (1)
+  #define CLOCK_UART_DIVIDER (8UL)
+#else
+  #define CLOCK_UART_U2X     (0)
+  #define CLOCK_UART_DIVIDER (16UL)
+#endif
+
+// What goes in UBRR0.
+#define CLOCK_UART_UBRR CLOCK_UART_UBRR_FOR(CLOCK_UART_DIVIDER)
+
+// The baud rate that UBRR0 actually gives.
+#define CLOCK_UART_ACTUAL_BAUD (F_CPU / (CLOCK_UART_DIVIDER * (CLOCK_UART_UBRR + 1)))
+
+#define CLOCK_UART_ERROR_PERMILLE CLOCK_UART_ERROR_PERMILLE_OF(CLOCK_UART_ACTUAL_BAUD)
+
+#if CLOCK_UART_UBRR > 4095
+  #error "UART_BAUD is too slow for F_CPU."
+#endif
+
+#if CLOCK_UART_ERROR_PERMILLE > CLOCK_UART_MAX_ERROR_PERMILLE
+  #error "UART_BAUD can't be made accurately enough from F_CPU."
+#endif
+
+// The same again, for CLOCK_IDLE_F_CPU.
+#if CLOCK_SCALING
+  #if CLOCK_UART_UBRR_AT(CLOCK_IDLE_F_CPU, 8UL) <= 4095
+    #define CLOCK_UART_IDLE_U2X     (1)
+    #define CLOCK_UART_IDLE_DIVIDER (8UL)
+  #else
+    #define CLOCK_UART_IDLE_U2X     (0)
+    #define CLOCK_UART_IDLE_DIVIDER (16UL)
+  #endif
+
+  #define CLOCK_UART_IDLE_UBRR CLOCK_UART_UBRR_AT(CLOCK_IDLE_F_CPU, CLOCK_UART_IDLE_DIVIDER)
+
+  #define CLOCK_UART_IDLE_ACTUAL_BAUD \
+    (CLOCK_IDLE_F_CPU / (CLOCK_UART_IDLE_DIVIDER * (CLOCK_UART_IDLE_UBRR + 1)))
+
+  #if CLOCK_UART_IDLE_UBRR > 4095
+    #error "UART_BAUD is too slow for CLOCK_IDLE_F_CPU."
+  #endif
+
+  #if CLOCK_UART_ERROR_PERMILLE_OF(CLOCK_UART_IDLE_ACTUAL_BAUD) > CLOCK_UART_MAX_ERROR_PERMILLE
+    #error "UART_BAUD can't be made accurately enough from CLOCK_IDLE_F_CPU."
+  #endif
+#endif
+
+/////////////////// Timer 1 ////////////////////////////////////////////////////
+
+// Timer 1 runs from the 1/1024 prescaler. Milliseconds turn into timer counts
+// with a shift, which is off by 2.4% at the usual clocks (1024 isn't 1000)
+// but costs next to nothing.
+#if F_CPU == 1000000UL
+  #define CLOCK_TIMER1_MS_SHIFT (0)
+#elif F_CPU == 2000000UL
+  #define CLOCK_TIMER1_MS_SHIFT (1)
+#elif F_CPU == 4000000UL
+  #define CLOCK_TIMER1_MS_SHIFT (2)
+#elif F_CPU == 8000000UL
+  #define CLOCK_TIMER1_MS_SHIFT (3)
+#elif F_CPU == 16000000UL
+  #define CLOCK_TIMER1_MS_SHIFT (4)
+#else
+  #error "F_CPU has to be 1, 2, 4, 8 or 16 MHz for Timer 1."
+#endif
+
+// The longest timer_start can wait before Timer 1 overflows.
+#define CLOCK_TIMER1_MAX_MS (0xFFFFUL >> CLOCK_TIMER1_MS_SHIFT)
+
+// Timer 1 counts slower while the CPU is idle, so the shift is smaller.
+#if CLOCK_SCALING
+  #if CLOCK_TIMER1_MS_SHIFT < CLOCK_IDLE_CLKPS
+    #error "CLOCK_IDLE_F_CPU is too slow for Timer 1."
+  #endif
+  #define CLOCK_TIMER1_IDLE_MS_SHIFT (CLOCK_TIMER1_MS_SHIFT - CLOCK_IDLE_CLKPS)
+#endif
+
+/////////////////// Timer 0 ////////////////////////////////////////////////////
+
+// Timer 0 interrupts once per millisecond, from the smallest prescaler that
+// fits a millisecond into its 8 bits.
+#if F_CPU / 8UL / 1000UL <= 256
+  #define CLOCK_TIMER0_PRESCALER (8UL)
+  #define CLOCK_TIMER0_CS        (_BV(CS01))
+#elif F_CPU / 64UL / 1000UL <= 256
+  #define CLOCK_TIMER0_PRESCALER (64UL)
+  #define CLOCK_TIMER0_CS        (_BV(CS01) | _BV(CS00))
+#else
+  #define CLOCK_TIMER0_PRESCALER (256UL)
+  #define CLOCK_TIMER0_CS        (_BV(CS02))
+#endif
+
+// What goes in OCR0A. 1 MHz / 8 = 8 MHz / 64 = 125 counts per millisecond.
+#define CLOCK_TIMER0_OCR0A (F_CPU / CLOCK_TIMER0_PRESCALER / 1000UL - 1)
+
+#if (F_CPU / CLOCK_TIMER0_PRESCALER) % 1000UL != 0
+  #warning "Timer 0 can't count exact milliseconds at this F_CPU."
+#endif
+
+// While the CPU is idle, Timer 0 runs from a prescaler that's smaller by as
+// much as the clock is, so it keeps counting at the same rate and OCR0A (and
+// timer_now_us) don't have to change.
+#if CLOCK_SCALING
+  #if CLOCK_TIMER0_PRESCALER == 64UL && CLOCK_IDLE_CLKPS == 3
+    #define CLOCK_TIMER0_IDLE_CS (_BV(CS01))
+  #elif CLOCK_TIMER0_PRESCALER == 256UL && CLOCK_IDLE_CLKPS == 2
+    #define CLOCK_TIMER0_IDLE_CS (_BV(CS01) | _BV(CS00))
+  #else
+    #error "Timer 0 has no prescaler for CLOCK_IDLE_F_CPU."
+  #endif
+#endif
+
+#endif
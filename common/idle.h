@@ -0,0 +1,49 @@
+#ifndef _IDLE_H
+#define _IDLE_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Idle
+//
+// Waiting without spinning. IDLE_UNTIL puts the CPU in SLEEP_MODE_IDLE until
+// some interrupt comes in, checks the condition, and goes back to sleep until
+// it's true. Idle keeps every peripheral and timer running, so whatever was
+// being waited on carries on, and waking up takes a few cycles.
+//
+// Whatever makes the condition true has to come with an interrupt (the end of
+// a U(S)ART or SPI transfer, INT0 from the transceiver, a timer), or be
+// checked often enough by one, like Timer 0's tick.
+//
+// The deeper sleep modes stop Timer 0 and Timer 1, which the millisecond
+// clock and the timeouts run on, so they're not used here.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+// The condition is checked with interrupts off. sei() holds off interrupts
+// for one more instruction, so one that makes it true can't come in between
+// checking and going to sleep. With interrupts already off, nothing could
+// wake us up, so this spins instead.
+#define IDLE_UNTIL(condition) do { \
+    uint8_t idle_sreg = SREG; \
+    if ((idle_sreg & _BV(SREG_I)) == 0) { \
+      while (!(condition)); \
+    } \
+    else { \
+      cli(); \
+      while (!(condition)) { \
+        set_sleep_mode(SLEEP_MODE_IDLE); \
+        sleep_enable(); \
+        sei(); \
+        sleep_cpu(); \
+        sleep_disable(); \
+        cli(); \
+      } \
+      SREG = idle_sreg; \
+    } \
+  } while (0)
+
+#endif
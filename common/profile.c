@@ -0,0 +1,187 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Profile
+//
+// Keeps each probe's counts, and reads the time for them. See profile.h.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "profile.h"
+
+#if PROFILE
+
+#ifndef SIMULATION
+  #include <avr/io.h>
+  #include <avr/pgmspace.h>
+  #include "clock.h"
+  #include "uart.h"
+#else
+  #include <stdio.h>
+  #include <time.h>
+  // Every simulated node gets its own probes.
+  #include "node_state.h"
+  #define PROGMEM
+  #define PSTR(s) (s)
+#endif
+
+/////////////////// Type Definitions ///////////////////////////////////////////
+
+typedef struct {
+  uint16_t count;
+  uint16_t shortest;
+  uint16_t longest;         // anything over UINT16_MAX counts is UINT16_MAX
+  uint32_t total;
+} profile_counts_t;
+
+//////////////// Static Variable Definitions ///////////////////////////////////
+
+#ifndef SIMULATION
+volatile profile_time_t profile_tick_base = 0;
+#define PROFILE_STATE static
+#else
+#define PROFILE_STATE NODE_STATE
+#endif
+
+PROFILE_STATE profile_counts_t probes[PROFILE_PROBE_COUNT];
+
+static const char name_trx_transmit[] PROGMEM = "trx_transmit_payload";
+static const char name_spi_transfer[] PROGMEM = "spi_transfer";
+static const char name_adc_isr[] PROGMEM = "ISR(ADC_vect)";
+static const char name_launch_check[] PROGMEM = "launch check";
+
+static const char * const names[PROFILE_PROBE_COUNT] PROGMEM = {
+  [PROFILE_TRX_TRANSMIT] = name_trx_transmit,
+  [PROFILE_SPI_TRANSFER] = name_spi_transfer,
+  [PROFILE_ADC_ISR] = name_adc_isr,
+  [PROFILE_LAUNCH_CHECK] = name_launch_check,
+};
+
+/////////////////// Private Function Bodies ////////////////////////////////////
+
+#ifndef SIMULATION
+
+// Timer 0 counts from whichever prescaler its CS0 bits picked.
+static uint16_t timer0_prescaler(void) {
+  switch (TCCR0B & (_BV(CS02) | _BV(CS01) | _BV(CS00))) {
+    case _BV(CS00):               return 1;
+    case _BV(CS01):               return 8;
+    case _BV(CS01) | _BV(CS00):   return 64;
+    case _BV(CS02):               return 256;
+    case _BV(CS02) | _BV(CS00):   return 1024;
+    default:                      return 0;
+  }
+}
+
+// Timer 0 counts to microseconds. F_CPU is a whole number of MHz (clock.h
+// makes sure of it for Timer 1), so this stays in 32 bits for anything up
+// to a few seconds. Totals go to ms a thousand counts at a time instead.
+static uint32_t to_us(uint32_t counts) {
+  return counts * timer0_prescaler() / (F_CPU / 1000000UL);
+}
+
+static uint32_t to_ms(uint32_t counts) {
+  return to_us(counts / 1000);
+}
+
+#define PROFILE_PRINT(format, ...) uart_transmit_formatted_message_P(format, ##__VA_ARGS__)
+#define PROFILE_LINE_DONE() UART_WAIT_UNTIL_DONE()
+#define PROFILE_NAME "%S"
+
+#else
+
+#define to_us(counts) (counts)
+#define to_ms(counts) ((counts) / 1000)
+#define PROFILE_PRINT(format, ...) printf(format, ##__VA_ARGS__)
+#define PROFILE_LINE_DONE()
+#define PGM_P const char *
+#define pgm_read_word(p) (*(p))
+#define PROFILE_NAME "%s"
+
+#endif
+
+/////////////////// Public Function Bodies /////////////////////////////////////
+
+#ifndef SIMULATION
+
+profile_time_t profile_now(void) {
+
+  uint8_t sreg = SREG;
+  SREG &= ~_BV(SREG_I);
+
+  profile_time_t base = profile_tick_base;
+  uint8_t count = TCNT0;
+
+  // The compare match already happened, but the ISR hasn't had its turn yet
+  // (interrupts were off, or this is an ISR). If the count is still near the
+  // top, the match came after it was read, and it's already right.
+  if ((TIFR0 & _BV(OCF0A)) != 0 && count < (OCR0A >> 1)) {
+    base += OCR0A + 1;
+  }
+
+  SREG = sreg;
+  return base + count;
+}
+
+#else
+
+profile_time_t profile_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (profile_time_t) ((uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000);
+}
+
+#endif
+
+void profile_record(profile_probe_t probe, profile_time_t start) {
+
+  profile_time_t elapsed = profile_now() - start;
+  uint16_t clipped = elapsed > UINT16_MAX ? UINT16_MAX : (uint16_t) elapsed;
+  profile_counts_t *counts = &probes[probe];
+
+  if (counts->count == 0 || clipped < counts->shortest) counts->shortest = clipped;
+  if (clipped > counts->longest) counts->longest = clipped;
+  counts->total += elapsed;
+  counts->count++;
+
+}
+
+void profile_print(void) {
+
+  PROFILE_PRINT(PSTR("::: Profile (us) :::\r\n"));
+  PROFILE_LINE_DONE();
+
+  for (uint8_t i = 0; i < PROFILE_PROBE_COUNT; i++) {
+
+    // An ISR could be adding to it, so take a copy first.
+#ifndef SIMULATION
+    uint8_t sreg = SREG;
+    SREG &= ~_BV(SREG_I);
+#endif
+    profile_counts_t counts = probes[i];
+#ifndef SIMULATION
+    SREG = sreg;
+#endif
+
+    if (counts.count == 0) continue;
+
+    PROFILE_PRINT(PSTR(PROFILE_NAME ": n %u, min %lu, avg %lu, max %lu, total %lu ms\r\n"),
+      (PGM_P) pgm_read_word(&names[i]),
+      counts.count,
+      (unsigned long) to_us(counts.shortest),
+      (unsigned long) to_us(counts.total / counts.count),
+      (unsigned long) to_us(counts.longest),
+      (unsigned long) to_ms(counts.total));
+    PROFILE_LINE_DONE();
+
+  }
+
+}
+
+void profile_reset(void) {
+  for (uint8_t i = 0; i < PROFILE_PROBE_COUNT; i++) {
+    profile_counts_t none = { 0, 0, 0, 0 };
+    probes[i] = none;
+  }
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Profile
+//
+// Probes that time the hot paths, so there's something to go on besides
+// guessing when deciding what to make faster. Put PROFILE_BEGIN(probe) at the
+// start of the code and PROFILE_END(probe) at the end, and every pass through
+// adds to that probe's count, shortest, longest and total time.
+// profile_print writes them all out.
+//
+// On the ATMega the time is read from Timer 0, which is already counting out
+// the 1 ms tick (cube/common/timer.c, rover/timer.c). Its ISR adds a whole
+// tick's worth of counts to a running total with PROFILE_TICK(), and the
+// count in TCNT0 fills in the rest, so a timestamp is a few instructions and
+// no extra timer. A count is 8 cycles on the cubes and 256 on the rover, and
+// nothing is timed unless the tick is running. In the simulation, the time
+// comes from the host's monotonic clock, in microseconds.
+//
+// Probes are compiled out unless PROFILE is 1. Build with -DPROFILE=1.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+
+#ifndef PROFILE
+  #define PROFILE (0)
+#endif
+
+///////////////////// Type Definitions /////////////////////////////////////////
+
+// Everything there's a probe for. Add new ones before PROFILE_PROBE_COUNT,
+// and their names to profile.c.
+typedef enum {
+  PROFILE_TRX_TRANSMIT,     // trx_transmit_payload, acks and retransmissions included
+  PROFILE_SPI_TRANSFER,     // spi_transfer
+  PROFILE_ADC_ISR,          // ISR(ADC_vect) on the rover
+  PROFILE_LAUNCH_CHECK,     // the rover's launch check, in the Timer 0 ISR
+  PROFILE_PROBE_COUNT
+} profile_probe_t;
+
+// A timestamp, in Timer 0 counts (microseconds in the simulation). It wraps
+// around, so only the difference between two of them means anything.
+typedef uint32_t profile_time_t;
+
+/////////////////// Public Function Prototypes /////////////////////////////////
+
+#if PROFILE
+
+// Where time is counted from. Only the Timer 0 ISR changes it.
+extern volatile profile_time_t profile_tick_base;
+
+#define PROFILE_BEGIN(probe) profile_time_t profile_start_##probe = profile_now()
+#define PROFILE_END(probe) profile_record(probe, profile_start_##probe)
+
+// Goes in the ISR of whatever keeps Timer 0 ticking, once per compare match.
+#define PROFILE_TICK() (profile_tick_base += OCR0A + 1)
+
+// The time right now. Safe to call from an interrupt handler.
+profile_time_t profile_now(void);
+
+// Adds one pass through probe, from start until now.
+void profile_record(profile_probe_t probe, profile_time_t start);
+
+// Writes every probe that has been passed through to the UART (stdout in the
+// simulation), a line each, in microseconds.
+void profile_print(void);
+
+// Starts every probe over.
+void profile_reset(void);
+
+#else
+
+#define PROFILE_BEGIN(probe)
+#define PROFILE_END(probe)
+#define PROFILE_TICK()
+#define profile_print()
+#define profile_reset()
+
+#endif
+
+#endif
@@ -15,6 +15,7 @@
 #include <stdio.h>
 
 #include "spi.h"
+#include "profile.h"
 
 //////////////////// Private Defines ///////////////////////////////////////////
 
@@ -61,25 +62,49 @@
 #define SPI_SPR_64    (             _BV(SPR1) )
 #define SPI_SPR_128   ( _BV(SPR0) | _BV(SPR1) )
 #define SPI_SPR_MASK  ( _BV(SPR1) | _BV(SPR0) )
-#if SPI_CLOCK_IDEAL_PRESCALAR <= 4
-  #define SPI_SPR (SPI_SPR_4 & SPI_SPR_MASK)
-#elif SPI_CLOCK_IDEAL_PRESCALAR <= 16
-  #define SPI_SPR (SPI_SPR_16 & SPI_SPR_MASK)
-#elif SPI_CLOCK_IDEAL_PRESCALAR <= 64
-  #define SPI_SPR (SPI_SPR_64 & SPI_SPR_MASK)
-#elif SPI_CLOCK_IDEAL_PRESCALAR <= 128
-  #define SPI_SPR (SPI_SPR_128 & SPI_SPR_MASK)
+
+// SPI2X doubles the clock from the SPR setting, which fills in the odd
+// prescalers. 128 is the slowest there is.
+#if SPI_CPU_FREQUENCY_HZ / 2 <= SPI_MAX_FREQUENCY_HZ
+  #define SPI_SPR   SPI_SPR_4
+  #define SPI_SPI2X _BV(SPI2X)
+#elif SPI_CPU_FREQUENCY_HZ / 4 <= SPI_MAX_FREQUENCY_HZ
+  #define SPI_SPR   SPI_SPR_4
+  #define SPI_SPI2X (0)
+#elif SPI_CPU_FREQUENCY_HZ / 8 <= SPI_MAX_FREQUENCY_HZ
+  #define SPI_SPR   SPI_SPR_16
+  #define SPI_SPI2X _BV(SPI2X)
+#elif SPI_CPU_FREQUENCY_HZ / 16 <= SPI_MAX_FREQUENCY_HZ
+  #define SPI_SPR   SPI_SPR_16
+  #define SPI_SPI2X (0)
+#elif SPI_CPU_FREQUENCY_HZ / 32 <= SPI_MAX_FREQUENCY_HZ
+  #define SPI_SPR   SPI_SPR_64
+  #define SPI_SPI2X _BV(SPI2X)
+#elif SPI_CPU_FREQUENCY_HZ / 64 <= SPI_MAX_FREQUENCY_HZ
+  #define SPI_SPR   SPI_SPR_64
+  #define SPI_SPI2X (0)
 #else
-  #define SPI_SPR (SPI_SPR_128 & SPI_SPR_MASK)
+  #define SPI_SPR   SPI_SPR_128
+  #define SPI_SPI2X (0)
 #endif
 
+//////////////////// Private Type Definitions //////////////////////////////////
+
+// A transaction from spi_start_transaction.
+typedef struct {
+  const spi_message_element_t        *message;
+  spi_message_element_t              *response;
+  spi_transaction_length_t            length;
+  spi_transaction_complete_callback_t callback;
+} spi_queued_transaction_t;
+
 //////////////////// Static Variable Definitions ///////////////////////////////
 
 // The message currently being received.
-static spi_message_element_t receive_message_buffer[SPI_TRANSACTION_MAX_LENGTH];
+static spi_message_element_t *receive_message_buffer;
 
 // The message currently being transmitted.
-static spi_message_element_t transmit_message_buffer[SPI_TRANSACTION_MAX_LENGTH];
+static const spi_message_element_t *transmit_message_buffer;
 
 // The index of the transaction bit that is currently being transmitted and received.
 static spi_transaction_index_t transaction_index;
@@ -88,11 +113,29 @@ static spi_transaction_index_t transaction_index;
 static spi_transaction_length_t current_transaction_length;
 
 // The callback that will be executed once the current transaction finishes.
-static void (*current_transaction_complete_callback)(
-  const spi_message_element_t *received_message,
-  spi_transaction_length_t received_message_length
+static spi_transaction_complete_callback_t current_transaction_complete_callback;
+
+// Transactions waiting for the current one to finish, oldest at queue_head.
+// transaction_step takes them off the front (queue_head moves on and
+// queue_count goes down), and spi_start_transaction adds them at
+// queue_head + queue_count, both with interrupts off.
+static spi_queued_transaction_t queue[SPI_QUEUE_LENGTH];
+static uint8_t queue_head = 0;
+static uint8_t queue_count = 0;
+
+//////////////////// Private Function Prototypes ///////////////////////////////
+
+// Starts the given transaction running from the interrupt.
+static void begin_transaction(
+  const spi_queued_transaction_t *transaction
 );
 
+// Handles the byte that just finished shifting, and starts the next one.
+static void transaction_step(void);
+
+// Runs whatever is running or queued to the end, without the interrupt.
+static void finish_transactions(void);
+
 //////////////////// Public Function Bodies ////////////////////////////////////
 
 // Initialize the SPI, including configuring the appropriate pins.
@@ -129,87 +172,149 @@ void spi_initialize(void) {
     | SPI_SPR     // Configures the SPI prescaler.
   );
 
+  // The rest of the prescaler.
+  SPSR = SPI_SPI2X;
+
 }
 
-// Transmits a message over the SPI. The response of the slave is placed in the
-// buffer passed in as the first argument, beginning with given beginning index.
-// Any elements before that index are discarded. The message to transmit is 
-// composed of a number of "sections." Each section consists of a buffer, 
-// containing the data to transmit, and an integer, respresenting the number of 
-// bytes in the section. For example,
-//
-// spi_execute_transaction(response, 1, 2, section1, section1_length, section2, section2_length);
-//
-// The third argument gives the number of sections that compose the message. If
-// a section is given as "NULL", that section is filled with 0x00.
-void spi_execute_transaction(
-  spi_message_element_t *response,
-  spi_transaction_index_t response_beginning_index,
-  uint8_t section_count,
-  ...
+// Transmits a message over the SPI, one section after another.
+void spi_transfer(
+  const spi_section_t *sections,
+  uint8_t section_count
 ) {
 
-  va_list args;
-  va_start(args, section_count);
-
-  spi_message_element_t *section = va_arg(args, spi_message_element_t*);
-  int section_length = va_arg(args, int);
-  int section_index = 0;
+  PROFILE_BEGIN(PROFILE_SPI_TRANSFER);
 
-  spi_transaction_index_t next_element_index = 0;
-  spi_message_element_t next_element;
-  spi_message_element_t received_element;
+  // Whatever was started in the background goes first.
+  finish_transactions();
 
   // Select the device.
   SPI_PORT &= ~_BV(SPI_SS_INDEX);
 
-  // The transaction will run no longer than the maximum length defined in the
-  // header. However, in normal operation, this loop will be broken as soon as
-  // the full message has been sent.
-  for (spi_transaction_index_t i = 0; i < SPI_TRANSACTION_MAX_LENGTH; i++) {
+  for (uint8_t s = 0; s < section_count; s++) {
+
+    const spi_message_element_t *transmit = sections[s].transmit;
+    spi_message_element_t *receive = sections[s].receive;
+    spi_transaction_length_t remaining = sections[s].length;
+
+    // The data register isn't buffered on the way out, so each byte has to
+    // finish before the next one goes in.
+    spi_message_element_t next_element = 0;
+    while (remaining-- > 0) {
+      if (transmit != NULL) next_element = *transmit++;
+      SPDR = next_element;
+      while ((SPSR & _BV(SPIF)) == 0);
+      spi_message_element_t received_element = SPDR;
+      if (receive != NULL) *receive++ = received_element;
+    }
 
-    // If that was the last character of the section,
-    if (next_element_index == section_length) {
+  }
 
-      // If that was the last section,
-      section_index = section_index + 1;
-      if (section_index == section_count) {
+  // Release the device.
+  SPI_PORT |= _BV(SPI_SS_INDEX);
 
-        // The transaction is over.
-        break;
+  PROFILE_END(PROFILE_SPI_TRANSFER);
 
-      } else {
+}
 
-        // Move on to the next section.
-        section = va_arg(args, spi_message_element_t*);
-        section_length = va_arg(args, int);
-        next_element_index = 0;
+uint8_t spi_start_transaction(
+  const spi_message_element_t *message,
+  spi_message_element_t *response,
+  spi_transaction_length_t length,
+  spi_transaction_complete_callback_t callback
+) {
 
-      }
-    }
+  if (length == 0) return 1;
 
-    if (section == NULL) {
-      next_element = 0;
-    } else {
-      next_element = *(section + next_element_index);
-    }
+  spi_queued_transaction_t transaction = { message, response, length, callback };
 
-    SPDR = next_element;
+  uint8_t sreg = SREG;
+  cli();
 
-    next_element_index = next_element_index + 1;
+  if (!SPI_BUSY) {
+    begin_transaction(&transaction);
+  }
+  else if (queue_count < SPI_QUEUE_LENGTH) {
+    queue[(queue_head + queue_count) % SPI_QUEUE_LENGTH] = transaction;
+    queue_count++;
+  }
+  else {
+    SREG = sreg;
+    return 0;
+  }
 
-    while ((SPSR & _BV(SPIF)) == 0);
+  SREG = sreg;
+  return 1;
 
-    received_element = SPDR;
-    if ((response != NULL) && (i >= response_beginning_index)) {
-      *(response + i - response_beginning_index) = received_element;
-    }
+}
+
+//////////////////// Private Function Bodies ///////////////////////////////////
+
+static void begin_transaction(
+  const spi_queued_transaction_t *transaction
+) {
+
+  transmit_message_buffer = transaction->message;
+  receive_message_buffer = transaction->response;
+  current_transaction_length = transaction->length;
+  current_transaction_complete_callback = transaction->callback;
+  transaction_index = 0;
+
+  // Select the device, and let the interrupt take it from here.
+  SPI_PORT &= ~_BV(SPI_SS_INDEX);
+  SPCR |= _BV(SPIE);
+  SPDR = (transmit_message_buffer == NULL) ? 0 : transmit_message_buffer[0];
 
+}
+
+static void transaction_step(void) {
+
+  spi_message_element_t received_element = SPDR;
+  if (receive_message_buffer != NULL) {
+    receive_message_buffer[transaction_index] = received_element;
   }
+  transaction_index++;
 
-  // Release the device.
+  if (transaction_index < current_transaction_length) {
+    SPDR = (transmit_message_buffer == NULL) ? 0 : transmit_message_buffer[transaction_index];
+    return;
+  }
+
+  // Release the device. Nothing is running while the callback does its thing.
   SPI_PORT |= _BV(SPI_SS_INDEX);
+  SPCR &= ~_BV(SPIE);
 
-  va_end(args);
+  if (current_transaction_complete_callback != NULL) {
+    current_transaction_complete_callback(receive_message_buffer, current_transaction_length);
+  }
+
+  // The callback might have started something itself, in which case the
+  // queue waits behind it.
+  if (queue_count > 0 && !SPI_BUSY) {
+    spi_queued_transaction_t *next = &queue[queue_head];
+    queue_head = (queue_head + 1) % SPI_QUEUE_LENGTH;
+    queue_count--;
+    begin_transaction(next);
+  }
+
+}
+
+static void finish_transactions(void) {
+
+  // The interrupt can't be left to do it, since we might be in another
+  // interrupt handler. Keep it from running while we do its job.
+  uint8_t sreg = SREG;
+  cli();
+
+  while (SPI_BUSY) {
+    while ((SPSR & _BV(SPIF)) == 0);
+    transaction_step();
+  }
+
+  SREG = sreg;
+
+}
 
+ISR(SPI_STC_vect) {
+  transaction_step();
 }
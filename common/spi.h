@@ -12,11 +12,12 @@
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-#include <stdarg.h>
-
 #include <avr/io.h>
 #include <avr/interrupt.h>
 
+#include "clock.h"
+#include "idle.h"
+
 /////////////////// SPI Settings ///////////////////////////////////////////////
 
 // Determines the SPI data order.
@@ -36,21 +37,27 @@
 #define SPI_CLOCK_PHASE_SAMPLE_TRIALING 1
 #define SPI_CLOCK_PHASE   SPI_CLOCK_PHASE_SAMPLE_LEADING
 
-// The "Ideal" prescaler that the SPI clock should have, relative to the 
-// CPU clock. The true SPI prescaler might not have this exact value, due to
-// limitations 
-#define SPI_CLOCK_IDEAL_PRESCALER 128;
+// The CPU clock the SPI clock is divided down from.
+#define SPI_CPU_FREQUENCY_HZ F_CPU
 
-// The frequency of the SPI clock in MHz. The true frequency of the SPI clock
-// may not be exactly this.
-#define SPI_FREQUENCY_MHZ (1)
+// The fastest the SPI clock is allowed to run. The SPI clock is the CPU clock
+// divided by the smallest prescaler (2 through 128) that doesn't go over
+// this. The nRF24L01+ can take up to 10MHz.
+#define SPI_MAX_FREQUENCY_HZ (4000000UL)
 
-#define SPI_TRANSACTION_MAX_LENGTH (64)
+// How many transactions spi_start_transaction can have waiting behind the one
+// that's running.
+#define SPI_QUEUE_LENGTH (4)
 
 /////////////////// SPI macros /////////////////////////////////////////////////
 
-// Waits until the current SPI transaction has concluded.
-#define SPI_WAIT_UNTIL_DONE() while ((SPCR & _BV(SPIE)) != 0)
+// Waits until the current SPI transaction has concluded. SPIE stays set for
+// as long as spi_start_transaction has anything running or queued, so this
+// needs interrupts to be enabled. The CPU sleeps in between.
+#define SPI_WAIT_UNTIL_DONE() IDLE_UNTIL((SPCR & _BV(SPIE)) == 0)
+
+// Whether a transaction from spi_start_transaction is running.
+#define SPI_BUSY ((SPCR & _BV(SPIE)) != 0)
 
 /////////////////// SPI Type Definitions ///////////////////////////////////////
 
@@ -60,27 +67,55 @@ typedef uint16_t spi_transaction_index_t;
 
 typedef uint16_t spi_transaction_length_t;
 
+// One piece of a transaction from spi_transfer. length bytes go out from
+// transmit, or zeros if it's NULL, and the same number come back into
+// receive, unless it's NULL.
+typedef struct {
+  const spi_message_element_t *transmit;
+  spi_message_element_t       *receive;
+  spi_transaction_length_t     length;
+} spi_section_t;
+
+// Runs from the SPI interrupt once a transaction from spi_start_transaction
+// is done. The device is already released, and the next transaction hasn't
+// started, so it's fine to call spi_transfer from here.
+typedef void (*spi_transaction_complete_callback_t)(
+  const spi_message_element_t *received_message,
+  spi_transaction_length_t received_message_length
+);
+
 /////////////////// Public Function Prototypes /////////////////////////////////
 
 // Initialize the SPI, including configuring the appropriate pins.
 void spi_initialize(void);
 
-// Transmits a message over the SPI. The response of the slave is placed in the
-// buffer passed in as the first argument, beginning with given beginning index.
-// Any elements before that index are discarded. The message to transmit is 
-// composed of a number of "sections." Each section consists of a buffer, 
-// containing the data to transmit, and an integer, respresenting the number of 
-// bytes in the section. For example,
+// Transmits a message over the SPI, made up of a number of sections in a row
+// with the device selected the whole time. For example, to write a register
+// and keep the status byte that comes back with the instruction,
 //
-// spi_execute_transaction(response, 1, 2, section1, section1_length, section2, section2_length);
+// spi_section_t sections[] = {
+//   { &instruction, &status, 1 },
+//   { &value,       NULL,    1 },
+// };
+// spi_transfer(sections, 2);
+void spi_transfer(
+  const spi_section_t *sections,
+  uint8_t section_count
+);
+
+// Starts transmitting a message in the background and returns right away. The
+// bytes shift out from the SPI interrupt, and the device's response goes in
+// response, which may be NULL. Both buffers have to stay put until the
+// callback, which may also be NULL, runs. If a transaction is already
+// running, this one waits its turn. Returns 0 if there's no room in the queue.
 //
-// The third argument gives the number of sections that compose the message. If
-// a section is given as "NULL", that section is filled with 0x00.
-void spi_execute_transaction(
+// spi_transfer finishes everything that's queued before starting,
+// so transactions always go out in the order they were asked for.
+uint8_t spi_start_transaction(
+  const spi_message_element_t *message,
   spi_message_element_t *response,
-  spi_transaction_index_t response_beginning_index, 
-  uint8_t section_count,
-  ...
+  spi_transaction_length_t length,
+  spi_transaction_complete_callback_t callback
 );
 
 #endif
\ No newline at end of file
@@ -14,18 +14,62 @@
 #include <stdio.h>
 
 #include "uart.h"
+#include "clock.h"
 
 //////////////// Static Variable Definitions ///////////////////////////////////
 
-// The message that is currently being transmitted.
+// Where messages are formatted before they go into the ring.
 static uart_message_element_t message_buffer[UART_MESSAGE_MAX_LENGTH];
 
-// The index of the final element in the current message. Once this element has
-// been transmitted, the message has been fully transmitted.
-static uart_message_index_t message_index_final_element;
-
-// The element that the U(S)ART will transmit next.
-static uart_message_index_t message_index_current_element;
+// Characters waiting to be transmitted. Only the interrupt moves
+// tx_ring_tail, and only uart_transmit_formatted_message moves tx_ring_head,
+// which isn't meant to be called from interrupt handlers.
+// They count up forever and wrap around; head - tail is how many are waiting.
+static uart_message_element_t tx_ring[UART_TX_RING_LENGTH];
+static volatile uint8_t tx_ring_head = 0;
+static volatile uint8_t tx_ring_tail = 0;
+
+#if (UART_TX_RING_LENGTH & (UART_TX_RING_LENGTH - 1)) != 0 || UART_TX_RING_LENGTH > 128
+#error "UART_TX_RING_LENGTH must be a power of two, no more than 128."
+#endif
+
+#define TX_RING_FREE() (UART_TX_RING_LENGTH - (uint8_t) (tx_ring_head - tx_ring_tail))
+
+// Characters that have been received. This time the interrupt moves the head
+// and everyone else moves the tail.
+static uart_message_element_t rx_ring[UART_RX_RING_LENGTH];
+static volatile uint8_t rx_ring_head = 0;
+static volatile uint8_t rx_ring_tail = 0;
+static volatile uint16_t rx_overruns = 0;
+
+#if (UART_RX_RING_LENGTH & (UART_RX_RING_LENGTH - 1)) != 0 || UART_RX_RING_LENGTH > 128
+#error "UART_RX_RING_LENGTH must be a power of two, no more than 128."
+#endif
+
+// Whether anything has been transmitted yet. TXC0 only ever gets set by a
+// character going out, so until then it can't say we're done.
+static volatile uint8_t tx_used = 0;
+
+#if CLOCK_SCALING
+// Set by the falling edge of a start bit on RXD (PD0), cleared by the
+// receive interrupt. An edge that turns out to be noise leaves it set until
+// the next character, which only keeps the clock at full speed until then.
+static volatile uint8_t rx_busy = 0;
+#endif
+
+//////////////// Private Function Prototypes ///////////////////////////////////
+
+// Copies a message into the ring, following UART_OVERFLOW_POLICY. Returns
+// how much of it made it.
+static uart_message_length_t enqueue(
+  const uart_message_element_t *message,
+  uart_message_length_t length
+);
+
+// Queues what vsnprintf left in the message buffer, given what it returned.
+static uart_message_length_t enqueue_formatted(
+  int formatted_character_count
+);
 
 //////////////// Public Function Bodies ////////////////////////////////////////
 
@@ -48,12 +92,22 @@ void uart_initialize(void) {
     _BV(UCSZ00) 
   ;
 
+  // Selects a baud rate of UART_BAUD, worked out from F_CPU in clock.h.
+#if CLOCK_UART_U2X
   UCSR0A |= _BV(U2X0);
-  UBRR0 = 12;    // Select a baud rate of 9600 (Assuming 1MHz clock).
+#else
+  UCSR0A &= ~_BV(U2X0);
+#endif
+  UBRR0 = CLOCK_UART_UBRR;
 
   // Initialize the appropriate pins.
   // I don't think there's any pin configuration to do??
 
+#if CLOCK_SCALING
+  // A pin change interrupt on RXD, to see characters starting.
+  PCMSK2 |= _BV(PCINT16);
+  PCICR |= _BV(PCIE2);
+#endif
 
   // Reenables global interrupts.
   SREG |= _BV(SREG_I);
@@ -72,60 +126,183 @@ uart_message_length_t uart_transmit_formatted_message(
 
   va_list args;
   va_start(args, message_format);
-  
-  // If a message is already being transmitted, a new one cannot be started.
-  // The status is determined by checking the interrupt enable bit.
-  uint8_t interrupt_enabled;
-  interrupt_enabled = UCSR0B & _BV(UDRIE0);
-  if (interrupt_enabled != 0) {
-    return 0;
-  }
 
   // Prints the formatted message into the uart message buffer.
-  uart_message_length_t formatted_character_count;
+  int formatted_character_count;
   formatted_character_count = vsnprintf(
-    message_buffer, 
-    UART_MESSAGE_MAX_LENGTH, 
-    message_format, 
+    (char*) message_buffer,
+    UART_MESSAGE_MAX_LENGTH,
+    (const char*) message_format,
     args
   );
 
-  // Determine the possibly-truncated length of the message.
+  va_end(args);
+
+  return enqueue_formatted(formatted_character_count);
+
+}
+
+// Transmits a formatted message whose format string is in flash. Otherwise
+// the same as uart_transmit_formatted_message.
+uart_message_length_t uart_transmit_formatted_message_P(
+  const char *message_format,
+  ...
+) {
+
+  va_list args;
+  va_start(args, message_format);
+
+  int formatted_character_count;
+  formatted_character_count = vsnprintf_P(
+    (char*) message_buffer,
+    UART_MESSAGE_MAX_LENGTH,
+    message_format,
+    args
+  );
+
+  va_end(args);
+
+  return enqueue_formatted(formatted_character_count);
+
+}
+
+// Queues bytes to be transmitted exactly as they are.
+uart_message_length_t uart_transmit_bytes(
+  const uart_message_element_t *bytes,
+  uart_message_length_t length
+) {
+  return enqueue(bytes, length);
+}
+
+uint8_t uart_receive_available(void) {
+  return (uint8_t) (rx_ring_head - rx_ring_tail);
+}
+
+uint8_t uart_try_receive(
+  uart_message_element_t *element
+) {
+  if (rx_ring_head == rx_ring_tail) return 0;
+  *element = rx_ring[rx_ring_tail & (UART_RX_RING_LENGTH - 1)];
+  rx_ring_tail++;
+  return 1;
+}
+
+uint16_t uart_receive_overruns(void) {
+  uint8_t sreg = SREG;
+  SREG &= ~_BV(SREG_I);
+  uint16_t overruns = rx_overruns;
+  SREG = sreg;
+  return overruns;
+}
+
+uint8_t uart_transmit_done(void) {
+  if (!tx_used) return 1;
+  return (UCSR0B & _BV(UDRIE0)) == 0 && (UCSR0A & _BV(TXC0)) != 0;
+}
+
+uint8_t uart_receiving(void) {
+#if CLOCK_SCALING
+  return rx_busy;
+#else
+  return 0;
+#endif
+}
+
+//////////////// Private Function Bodies ///////////////////////////////////////
+
+static uart_message_length_t enqueue_formatted(
+  int formatted_character_count
+) {
+
+  // Determine the possibly-truncated length of the message. vsnprintf always
+  // leaves room for the terminator, which doesn't get sent.
   uart_message_length_t message_length;
-  if(formatted_character_count > UART_MESSAGE_MAX_LENGTH) {
-    message_length = UART_MESSAGE_MAX_LENGTH;
+  if (formatted_character_count < 0) {
+    message_length = 0;
+  } else if (formatted_character_count >= UART_MESSAGE_MAX_LENGTH) {
+    message_length = UART_MESSAGE_MAX_LENGTH - 1;
   } else {
     message_length = formatted_character_count;
   }
 
-  message_index_final_element = message_length - 1;
+  return enqueue(message_buffer, message_length);
 
-  va_end(args);
+}
+
+static uart_message_length_t enqueue(
+  const uart_message_element_t *message,
+  uart_message_length_t length
+) {
 
-  // Begin the transmission.
-  message_index_current_element = 0;
-  UDR0 = message_buffer[0];
-  UCSR0B |= _BV(UDRIE0);
+#if UART_OVERFLOW_POLICY == UART_OVERFLOW_DROP
+  if (length > TX_RING_FREE()) return 0;
+#endif
 
-  return message_length;
+  uart_message_index_t i;
+  for (i = 0; i < length; i++) {
+
+#if UART_OVERFLOW_POLICY == UART_OVERFLOW_BLOCK
+    // With interrupts on, the transmit interrupt makes room while we sleep.
+    if (TX_RING_FREE() == 0) {
+      if ((SREG & _BV(SREG_I)) == 0) break;
+      IDLE_UNTIL(TX_RING_FREE() != 0);
+    }
+#endif
+
+    tx_ring[tx_ring_head & (UART_TX_RING_LENGTH - 1)] = message[i];
+    tx_ring_head++;
+
+    // Make sure the transmit interrupt is running.
+    tx_used = 1;
+    UCSR0B |= _BV(UDRIE0);
+  }
+
+  return i;
 
 }
 
 ///////////// Interrupt Service Routines ///////////////////////////////////////
 
 // Transmit data empty interrupt handler. Either transmits the next character or
-// updates static variables to reflect that the message has finished.
+// turns itself off once the ring is empty.
 ISR(USART_UDRE_vect) {
 
-  // If that was the final element, the message has finished.
-  if (message_index_current_element == message_index_final_element) {
+  if (tx_ring_head == tx_ring_tail) {
     UCSR0B &= ~_BV(UDRIE0); // Disable the interrupt
     return;
   }
 
-  message_index_current_element++;
-  UDR0 = message_buffer[message_index_current_element];
+  // TXC0 is cleared by writing a 1 to it, and the error flags have to be
+  // written as 0. It gets set again once this one is all the way out with
+  // nothing after it.
+  UCSR0A = (UCSR0A & (_BV(U2X0) | _BV(MPCM0))) | _BV(TXC0);
+  UDR0 = tx_ring[tx_ring_tail & (UART_TX_RING_LENGTH - 1)];
+  tx_ring_tail++;
+
+}
+
+// Data received interrupt handler. Puts the character in the ring, if there's
+// room for it.
+ISR(USART_RX_vect) {
+
+  uart_message_element_t element = UDR0;
+#if CLOCK_SCALING
+  rx_busy = 0;
+#endif
+
+  if ((uint8_t) (rx_ring_head - rx_ring_tail) >= UART_RX_RING_LENGTH) {
+    rx_overruns++;
+    return;
+  }
+
+  rx_ring[rx_ring_head & (UART_RX_RING_LENGTH - 1)] = element;
+  rx_ring_head++;
 
 }
 
-// The user must provide their own data received handler.
\ No newline at end of file
+#if CLOCK_SCALING
+// RXD changed. Going low outside of a character is a start bit.
+ISR(PCINT2_vect) {
+  if ((PIND & _BV(PD0)) == 0) rx_busy = 1;
+}
+#endif
@@ -12,15 +12,39 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#include "idle.h"
 
 ///////////////////// UART Settings ////////////////////////////////////////////
 
-#define UART_MESSAGE_MAX_LENGTH (256)
+// The longest a single formatted message can be. Anything past this is cut
+// off.
+#define UART_MESSAGE_MAX_LENGTH (128)
+
+// Messages wait in a ring buffer this long while the U(S)ART sends them out
+// in the background. Must be a power of two, no more than 128.
+#define UART_TX_RING_LENGTH (128)
+
+// What uart_transmit_formatted_message does when a message doesn't fit in
+// what's left of the ring buffer. UART_OVERFLOW_DROP throws the whole message
+// away. UART_OVERFLOW_BLOCK waits for room, unless interrupts are off
+// (nothing would ever make room), in which case it drops the rest.
+#define UART_OVERFLOW_DROP  (0)
+#define UART_OVERFLOW_BLOCK (1)
+#define UART_OVERFLOW_POLICY UART_OVERFLOW_BLOCK
+
+// Received characters wait in a ring buffer this long until someone asks for
+// them. Anything that arrives while it's full is lost. Must be a power of
+// two, no more than 128.
+#define UART_RX_RING_LENGTH (64)
 
-/////////////////// SPI macros /////////////////////////////////////////////////
+/////////////////// UART macros ////////////////////////////////////////////////
 
-// Waits until the UART message currently being transmitted has finished.
-#define UART_WAIT_UNTIL_DONE() while((UCSR0B & _BV(UDRIE0)) != 0)
+// Waits until everything that has been queued has been transmitted. Only
+// needed before something that would cut the transmission off, like a
+// reset, powering down or changing the clock.
+#define UART_WAIT_UNTIL_DONE() IDLE_UNTIL(uart_transmit_done())
 
 ///////////////////// Type Definitions /////////////////////////////////////////
 
@@ -38,14 +62,51 @@ typedef uint16_t uart_message_length_t;
 // Initializes the U(S)ART, including configuring the appropriate pins.
 void uart_initialize(void);
 
-// Transmits a formatted message over the U(S)ART. Returns the number of
-// characters that will be transmitted. If the message cannot be transmitted at
-// this time, returns 0. If the message to be transmitted cannot fit in the
-// message buffer, transmits as many characters as possible and discards the
-// rest.
+// Queues a formatted message to be transmitted over the U(S)ART, and returns
+// without waiting for it to go out. Returns the number of characters that
+// will be transmitted, which is 0 if UART_OVERFLOW_POLICY dropped it. If the
+// message is longer than UART_MESSAGE_MAX_LENGTH, transmits as many
+// characters as possible and discards the rest.
 uart_message_length_t uart_transmit_formatted_message(
   const uart_message_element_t *message_format,
   ...
 );
 
+// The same, but the format string is in flash, which saves copying it into
+// SRAM at startup. Use it with PSTR:
+// uart_transmit_formatted_message_P(PSTR("Got %d\r\n"), count);
+// A %S in the format prints a string that's in flash too.
+uart_message_length_t uart_transmit_formatted_message_P(
+  const char *message_format,
+  ...
+);
+
+// Queues raw bytes to be transmitted, the same way. Returns how many will be.
+uart_message_length_t uart_transmit_bytes(
+  const uart_message_element_t *bytes,
+  uart_message_length_t length
+);
+
+// How many received characters are waiting.
+uint8_t uart_receive_available(void);
+
+// Takes the oldest received character, without waiting. Returns 0 if nothing
+// has come in.
+uint8_t uart_try_receive(
+  uart_message_element_t *element
+);
+
+// How many received characters have been lost to a full ring buffer.
+uint16_t uart_receive_overruns(void);
+
+// Whether everything queued has gone all the way out, stop bit and all. The
+// transmit interrupt turns itself off as soon as the last character is
+// handed to the U(S)ART, which is a whole character too early for that.
+uint8_t uart_transmit_done(void);
+
+// Whether a character is on its way in right now, from its start bit to the
+// receive interrupt. Only kept track of with CLOCK_SCALING, which mustn't
+// change the baud rate halfway through one; otherwise always 0.
+uint8_t uart_receiving(void);
+
 #endif
\ No newline at end of file
@@ -1,26 +1,136 @@
 #include "address_resolution.h"
+#include "data_link.h"
+#include "address.h"
+#include "node_state.h"
 
-uint32_t resolve_data_link_addr(byte network_addr) {
-    // We have, like, four devices total. Let's not make this hard on ourselves.
+#include <stddef.h>
+
+#ifndef SIMULATION
+#include "timer.h"
+#else
+#include "sim_trx.h"
+#endif
+
+// body[0] = what this is
+// body[1] = network address being asked about (a query) or the sender's
+// body[2-5] = the sender's data link address, low byte first
+#define RESOLVE_OP_QUERY (1)
+#define RESOLVE_OP_ANNOUNCE (2)
+#define RESOLVE_PACKET_LEN (PACKET_HEADER_LEN + 6)
+
+typedef enum {
+    ENTRY_EMPTY = 0,
+    ENTRY_RESOLVED,
+    ENTRY_PENDING,  // asking around, and using the guess until someone answers
+    ENTRY_DELETED   // keeps the probe chain going for the entries after it
+} entry_state_t;
+
+typedef struct {
+    byte network_addr;
+    byte state;
+    byte age;       // seconds for resolved entries, queries sent for pending
     uint32_t data_link_addr;
-    switch (network_addr) {
-    case 0x3A:
-        data_link_addr = 0x3A3A3A3A;
-        break;
-    case 0x3B:
-        data_link_addr = 0x3B3B3B3B;
-        break;
-    case 0x3C:
-        data_link_addr = 0x3C3C3C3C;
-        break;
-    case 0x3F:
-        data_link_addr = 0x3F3F3F3F;
-        break;
-    default:
-        data_link_addr = network_addr;
-        break;
-    }
-    return data_link_addr;
+} entry_t;
+
+NODE_STATE entry_t table[ADDRESS_RESOLUTION_TABLE_LEN];
+
+NODE_STATE timer_delay_ms_t next_tick_time;
+NODE_STATE byte seconds_since_announce = 0;
+
+// Our network address repeated four times.
+static uint32_t guess_data_link_addr(byte network_addr) {
+    return 0x01010101UL * network_addr;
+}
+
+// Groups and broadcasts have nobody to ask.
+static bool is_fixed(byte network_addr) {
+    return network_addr == NETWORK_ADDR_NONE
+        || network_addr == NETWORK_GROUP_ALL_CUBES
+        || network_addr == NETWORK_ADDR_BEACON
+        || network_addr == NETWORK_ADDR_RESOLVE;
+}
+
+// Open addressing with linear probing, starting from the low bits of the
+// address. With this few nodes they almost never collide.
+static entry_t* find(byte network_addr) {
+    byte slot = network_addr & (ADDRESS_RESOLUTION_TABLE_LEN - 1);
+    for (byte i = 0; i < ADDRESS_RESOLUTION_TABLE_LEN; i++) {
+        entry_t* entry = &table[slot];
+        if (entry->state == ENTRY_EMPTY) return NULL;
+        if (entry->state != ENTRY_DELETED && entry->network_addr == network_addr) return entry;
+        slot = (slot + 1) & (ADDRESS_RESOLUTION_TABLE_LEN - 1);
+    }
+    return NULL;
+}
+
+// A free slot for a new entry. If the table is full, the oldest resolved
+// entry makes room.
+static entry_t* make_room(byte network_addr) {
+    byte slot = network_addr & (ADDRESS_RESOLUTION_TABLE_LEN - 1);
+    entry_t* oldest = NULL;
+    for (byte i = 0; i < ADDRESS_RESOLUTION_TABLE_LEN; i++) {
+        entry_t* entry = &table[slot];
+        if (entry->state == ENTRY_EMPTY || entry->state == ENTRY_DELETED) return entry;
+        if (entry->state == ENTRY_RESOLVED && (oldest == NULL || entry->age > oldest->age)) oldest = entry;
+        slot = (slot + 1) & (ADDRESS_RESOLUTION_TABLE_LEN - 1);
+    }
+    return oldest;
+}
+
+static void learn(byte network_addr, uint32_t data_link_addr) {
+    if (is_fixed(network_addr) || network_addr == MY_NETWORK_ADDR) return;
+
+    entry_t* entry = find(network_addr);
+    if (entry == NULL) entry = make_room(network_addr);
+    if (entry == NULL) return;
+
+    entry->network_addr = network_addr;
+    entry->state = ENTRY_RESOLVED;
+    entry->age = 0;
+    entry->data_link_addr = data_link_addr;
+}
+
+static void send(byte op, byte network_addr) {
+
+    frame_buffer_t frame;
+    byte* packet = FRAME_PACKET(frame);
+
+    packet[0] = RESOLVE_PACKET_LEN;
+    packet[1] = NETWORK_ADDR_RESOLVE;
+    packet[2] = MY_NETWORK_ADDR;
+    packet[3] = 0;
+    packet[4] = 1 | PACKET_PRIORITY_CONTROL;
+
+    byte* body = &packet[PACKET_HEADER_LEN];
+    body[0] = op;
+    body[1] = network_addr;
+    for (byte i = 0; i < 4; i++) {
+        body[2 + i] = (byte) (MY_DATA_LINK_ADDR >> (8 * i));
+    }
+
+    data_link_broadcast(frame, RESOLVE_PACKET_LEN, resolve_data_link_addr(NETWORK_ADDR_RESOLVE));
+}
+
+uint32_t resolve_data_link_addr(byte network_addr) {
+
+    if (network_addr == MY_NETWORK_ADDR) return MY_DATA_LINK_ADDR;
+
+    // Announcements and queries share the beacons' pipe.
+    if (network_addr == NETWORK_ADDR_RESOLVE) network_addr = NETWORK_ADDR_BEACON;
+    if (is_fixed(network_addr)) return guess_data_link_addr(network_addr);
+
+    entry_t* entry = find(network_addr);
+    if (entry != NULL) return entry->data_link_addr;
+
+    // Never heard of it. Use the guess while address_resolution_poll asks.
+    entry = make_room(network_addr);
+    if (entry != NULL) {
+        entry->network_addr = network_addr;
+        entry->state = ENTRY_PENDING;
+        entry->age = 0;
+        entry->data_link_addr = guess_data_link_addr(network_addr);
+    }
+    return guess_data_link_addr(network_addr);
 }
 
 byte resolve_network_addr(byte port) {
@@ -28,3 +138,55 @@ byte resolve_network_addr(byte port) {
     // more elaborate. But for now...
     return port;
 }
+
+void address_resolution_initialize(void) {
+    data_link_listen_on(resolve_data_link_addr(NETWORK_ADDR_RESOLVE));
+    send(RESOLVE_OP_ANNOUNCE, MY_NETWORK_ADDR);
+    next_tick_time = timer_now_ms() + 1000;
+}
+
+// In the simulator, timer_now_ms runs on the virtual clock, so this does
+// the same there.
+void address_resolution_poll(void) {
+    if ((int16_t) (timer_now_ms() - next_tick_time) < 0) return;
+    next_tick_time += 1000;
+
+    if (++seconds_since_announce >= ADDRESS_RESOLUTION_ANNOUNCE_S) {
+        seconds_since_announce = 0;
+        send(RESOLVE_OP_ANNOUNCE, MY_NETWORK_ADDR);
+    }
+
+    for (byte i = 0; i < ADDRESS_RESOLUTION_TABLE_LEN; i++) {
+        entry_t* entry = &table[i];
+
+        if (entry->state == ENTRY_PENDING) {
+            if (entry->age++ < ADDRESS_RESOLUTION_QUERY_TRIES) {
+                send(RESOLVE_OP_QUERY, entry->network_addr);
+            }
+            else {
+                // Nobody answered. The guess will have to do for a while.
+                entry->state = ENTRY_RESOLVED;
+                entry->age = 0;
+            }
+        }
+        else if (entry->state == ENTRY_RESOLVED) {
+            if (++entry->age >= ADDRESS_RESOLUTION_MAX_AGE_S) entry->state = ENTRY_DELETED;
+        }
+    }
+}
+
+void address_resolution_receive(byte* packet) {
+
+    if (packet[0] < RESOLVE_PACKET_LEN) return;
+
+    byte* body = &packet[PACKET_HEADER_LEN];
+    uint32_t data_link_addr = 0;
+    for (byte i = 0; i < 4; i++) {
+        data_link_addr |= (uint32_t) body[2 + i] << (8 * i);
+    }
+    learn(packet[2], data_link_addr);
+
+    if (body[0] == RESOLVE_OP_QUERY && body[1] == MY_NETWORK_ADDR) {
+        send(RESOLVE_OP_ANNOUNCE, MY_NETWORK_ADDR);
+    }
+}
@@ -13,7 +13,45 @@
     see how the TCP/IP stack does it. It's a little bizarre.
 */
 
+/*
+    Nobody's data link address is written down anywhere but their own
+    address.h. Every node announces its own to NETWORK_ADDR_RESOLVE when it
+    starts up and every ADDRESS_RESOLUTION_ANNOUNCE_S after that, and
+    everyone who hears it writes it down. When we need an address we haven't
+    heard, we guess the network address repeated four times (which is how
+    every cube so far has been set up) and ask around for the real one.
+    Entries that haven't been heard from in ADDRESS_RESOLUTION_MAX_AGE_S are
+    forgotten.
+
+    Announcements and queries go to NETWORK_ADDR_RESOLVE, on the same
+    data link address as the route discovery beacons.
+
+    Frames don't say who sent them, so announcements and queries are the
+    only thing we can learn from. Each one carries its sender's data link
+    address.
+*/
+
+// How many addresses we can remember. Must be a power of two.
+#define ADDRESS_RESOLUTION_TABLE_LEN (8)
+
+#define ADDRESS_RESOLUTION_ANNOUNCE_S (60)
+#define ADDRESS_RESOLUTION_MAX_AGE_S (180)
+
+// How many times we ask for an address before settling for the guess.
+#define ADDRESS_RESOLUTION_QUERY_TRIES (3)
+
 uint32_t resolve_data_link_addr(byte network_addr);
 byte resolve_network_addr(byte port);
 
+// Start listening for announcements and queries, and announce ourselves.
+void address_resolution_initialize(void);
+
+// Send queries and announcements, and age the table. Call it often; it only
+// does anything once a second. Needs timer_clock_initialize.
+void address_resolution_poll(void);
+
+// Learn from an announcement or query. network_rx and network_poll hand
+// them over.
+void address_resolution_receive(byte* packet);
+
 #endif
@@ -0,0 +1,38 @@
+#include "arena.h"
+#include "uart.h"
+
+#include <avr/io.h>
+
+_Static_assert(sizeof(arena_t) <= ARENA_SRAM_BUDGET, "The arena is over ARENA_SRAM_BUDGET.");
+
+arena_t arena;
+
+// From the linker: where the static variables start, and where they end.
+// The stack starts at RAMEND and grows down toward _end.
+extern byte __data_start;
+extern byte _end;
+
+// Runs before the static variables are set up, with nothing on the stack
+// yet, so it can paint everything above _end.
+void arena_paint_stack(void) __attribute__((naked, used, section(".init1")));
+
+void arena_paint_stack(void) {
+    byte* p = &_end;
+    while (p <= (byte*) RAMEND) *p++ = ARENA_STACK_PAINT;
+}
+
+uint16_t arena_stack_unused(void) {
+    byte* p = &_end;
+    while (p <= (byte*) RAMEND && *p == ARENA_STACK_PAINT) p++;
+    return (uint16_t) (p - &_end);
+}
+
+void arena_report(void) {
+    uint16_t statics = (uint16_t) (&_end - &__data_start);
+    uint16_t stack_room = (uint16_t) ((byte*) RAMEND - &_end + 1);
+    uint16_t unused = arena_stack_unused();
+
+    uart_transmit_formatted_message_P(PSTR("SRAM: %u static (arena %u), stack used %u of %u\r\n"),
+        statics, (uint16_t) sizeof(arena_t), stack_room - unused, stack_room);
+    UART_WAIT_UNTIL_DONE();
+}
@@ -0,0 +1,59 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "networking_constants.h"
+
+/*
+    The big buffers, all in one place. Instead of living on the stack of
+    whoever uses them, they're members of one statically allocated arena, so
+    the linker (and avr-size) counts them, and they can't push the stack into
+    everything else. Each application lists its buffers in its own
+    arena_slots.h:
+
+    #define ARENA_SLOTS(ARENA_SLOT) \
+        ARENA_SLOT(message, MAX_MESSAGE_LEN)
+
+    and gets at them with ARENA_BUFFER(message) and ARENA_LEN(message). Code
+    that needs a buffer to be a certain size says so with ARENA_REQUIRE, which
+    fails the build if it isn't. The whole arena has to fit in
+    ARENA_SRAM_BUDGET.
+
+    The stack is checked at runtime instead. Before main runs, everything
+    between the end of the static variables and the top of RAM is painted
+    with ARENA_STACK_PAINT. The stack wipes out the paint as it grows, so
+    however much paint is left is how close the stack has ever come to the
+    static variables.
+*/
+
+#include "arena_slots.h"
+
+#ifndef ARENA_SRAM_BUDGET
+#define ARENA_SRAM_BUDGET (768)
+#endif
+
+#define ARENA_STACK_PAINT (0xC5)
+
+#define ARENA_MEMBER(name, len) byte name[len];
+
+typedef struct {
+    ARENA_SLOTS(ARENA_MEMBER)
+} arena_t;
+
+extern arena_t arena;
+
+#define ARENA_BUFFER(name) (arena.name)
+#define ARENA_LEN(name) (sizeof(((arena_t*) 0)->name))
+#define ARENA_REQUIRE(name, len) \
+    _Static_assert(ARENA_LEN(name) >= (len), "The arena's " #name " buffer is too small.")
+
+// How many bytes of stack have never been used. If this gets near 0, the
+// stack has probably run into the static variables at some point.
+uint16_t arena_stack_unused(void);
+
+// Print how SRAM is split up, and how much of the stack has been used, to
+// the UART.
+void arena_report(void);
+
+#endif
@@ -0,0 +1,105 @@
+#include "channel.h"
+#include "trx.h"
+#include "timer.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+
+// eeprom[3] = channel, eeprom[4] = the channel with every bit flipped.
+// If they don't match, nothing has been saved yet.
+#define CHANNEL_EEPROM_ADDR (3)
+#define CHANNEL_EEPROM_CHECK_ADDR (4)
+
+static bool switch_pending = false;
+static byte pending_channel;
+static timer_delay_ms_t switch_time;
+
+void channel_load(void) {
+    byte channel = eeprom_read_byte((uint8_t*) CHANNEL_EEPROM_ADDR);
+    byte check = eeprom_read_byte((uint8_t*) CHANNEL_EEPROM_CHECK_ADDR);
+    if ((byte) ~channel != check || channel > TRX_CHANNEL_MAX) return;
+    trx_set_channel(channel);
+}
+
+void channel_switch(byte channel) {
+    trx_set_channel(channel);
+    log_flush(); // so these don't get mixed up with the log's writes
+    eeprom_update_byte((uint8_t*) CHANNEL_EEPROM_ADDR, channel);
+    eeprom_update_byte((uint8_t*) CHANNEL_EEPROM_CHECK_ADDR, (byte) ~channel);
+    switch_pending = false;
+}
+
+// Going from the top down means ties go to the higher channels,
+// which are further from Wi-Fi.
+byte channel_scan(byte* ranked, byte count) {
+
+    byte ranked_busy[CHANNEL_RANK_MAX];
+    byte ranked_len = 0;
+
+    if (count > CHANNEL_RANK_MAX) count = CHANNEL_RANK_MAX;
+
+    for (int channel = CHANNEL_SCAN_LAST; channel >= CHANNEL_SCAN_FIRST; channel--) {
+        byte busy = trx_channel_activity((byte) channel, CHANNEL_SCAN_SAMPLES);
+
+        // Find where it goes, then scoot everything after it down one.
+        byte place = ranked_len;
+        while (place > 0 && busy < ranked_busy[place - 1]) place--;
+        if (place >= count) continue;
+
+        if (ranked_len < count) ranked_len++;
+        for (byte i = ranked_len - 1; i > place; i--) {
+            ranked[i] = ranked[i - 1];
+            ranked_busy[i] = ranked_busy[i - 1];
+        }
+        ranked[place] = (byte) channel;
+        ranked_busy[place] = busy;
+    }
+
+    return ranked_busy[0];
+}
+
+byte channel_build_command(char* message, byte channel) {
+    return (byte) snprintf_P(message, CHANNEL_COMMAND_LEN, PSTR("CH:%d"), channel);
+}
+
+bool channel_parse_command(char* message) {
+
+    char* command = strstr_P(message, PSTR("CH:"));
+    if (command == NULL) return false;
+
+    // Just the digits, please.
+    int channel = 0;
+    char* digit = command + 3;
+    if (*digit < '0' || *digit > '9') return false;
+    while (*digit >= '0' && *digit <= '9') {
+        channel = channel * 10 + (*digit - '0');
+        if (channel > TRX_CHANNEL_MAX) return false;
+        digit++;
+    }
+
+    channel_request((byte) channel);
+    return true;
+}
+
+void channel_request(byte channel) {
+
+    if (channel > TRX_CHANNEL_MAX) return;
+
+    if (channel == trx_get_channel()) {
+        switch_pending = false;
+        return;
+    }
+
+    pending_channel = channel;
+    switch_time = timer_now_ms() + CHANNEL_SWITCH_DELAY_MS;
+    switch_pending = true;
+}
+
+void channel_poll(void) {
+    if (!switch_pending) return;
+    if ((int16_t) (timer_now_ms() - switch_time) < 0) return;
+    channel_switch(pending_channel);
+}
@@ -0,0 +1,64 @@
+#ifndef _CHANNEL_H
+#define _CHANNEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "networking_constants.h"
+
+/*
+    Everybody has to be on the same radio channel, and some channels are a
+    lot noisier than others (Wi-Fi lives on the low ones). So the rover's
+    transceiver listens to all of them, picks the quietest, and tells
+    everyone else to move there with a "CH:<channel>" message. Everyone
+    waits CHANNEL_SWITCH_DELAY_MS before actually moving, so the message can
+    finish making its way through the network first. The channel is kept in
+    the EEPROM, so everyone comes back up on it after a reset.
+*/
+
+// Channels the scan looks at. Above 83 is outside the 2.4 GHz band in a lot
+// of places.
+#define CHANNEL_SCAN_FIRST (0)
+#define CHANNEL_SCAN_LAST (83)
+
+// How many times the scan listens to each channel.
+#define CHANNEL_SCAN_SAMPLES (8)
+
+// Most channels channel_scan will rank.
+#define CHANNEL_RANK_MAX (8)
+
+// Time between hearing about a new channel and moving to it.
+#define CHANNEL_SWITCH_DELAY_MS (10000)
+
+// Longest message channel_build_command writes, with the terminator.
+#define CHANNEL_COMMAND_LEN (8)
+
+// Go to the channel saved in the EEPROM, if there is one.
+// Call this after trx_initialize.
+void channel_load(void);
+
+// Move to a channel now and remember it.
+void channel_switch(byte channel);
+
+// Listen to every channel and write the quietest count of them to ranked,
+// quietest first. count can't be more than CHANNEL_RANK_MAX. Returns how busy the quietest one was, out of
+// CHANNEL_SCAN_SAMPLES.
+byte channel_scan(byte* ranked, byte count);
+
+// Write the text form of the message that tells everyone to move to a
+// channel. Returns its length.
+byte channel_build_command(char* message, byte channel);
+
+// Get ready to move to a channel CHANNEL_SWITCH_DELAY_MS from now.
+// channel_poll does the actual move. Naming the channel we're already on
+// calls off a move.
+void channel_request(byte channel);
+
+// If the message is the text form of the command, "CH:<channel>", call
+// channel_request and return true. The cubes normally get COMMAND_CHANNEL
+// instead (see command.h).
+bool channel_parse_command(char* message);
+
+// Move to the new channel once it's time. Needs timer_clock_initialize.
+void channel_poll(void);
+
+#endif
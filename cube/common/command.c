@@ -0,0 +1,103 @@
+#include "command.h"
+#include "channel.h"
+#include "digital_io.h"
+#include "stats.h"
+
+#include <string.h>
+#include <avr/pgmspace.h>
+
+// Each opcode's handler, and how many bytes of arguments it takes. Indexed
+// by opcode, so finding one doesn't depend on how many there are.
+typedef struct {
+    byte arg_len;
+    void (*handler)(const byte* args);
+} command_entry_t;
+
+static void command_led(const byte* args) {
+    LED_set(args[0] & LED_WHITE);
+}
+
+static void command_channel(const byte* args) {
+    channel_request(args[0]);
+}
+
+static void command_stats(const byte* args) {
+    stats_print();
+    if (args[0] != 0) stats_reset();
+}
+
+static const command_entry_t commands[COMMAND_OPCODE_COUNT] = {
+    [COMMAND_LED] = { 1, command_led },
+    [COMMAND_CHANNEL] = { 1, command_channel },
+    [COMMAND_STATS] = { 1, command_stats },
+};
+
+byte command_build(byte* message, byte opcode, byte arg) {
+    message[0] = COMMAND_MARK;
+    message[1] = opcode;
+    message[2] = arg;
+    return 3;
+}
+
+void command_envelope_clear(command_envelope_t* envelope) {
+    envelope->len = 0;
+}
+
+bool command_envelope_add(command_envelope_t* envelope, byte opcode, byte arg) {
+    if (envelope->len == 0) {
+        envelope->message[0] = COMMAND_MARK;
+        envelope->len = 1;
+    }
+    if (envelope->len + 2 > COMMAND_ENVELOPE_LEN) return false;
+    envelope->message[envelope->len++] = opcode;
+    envelope->message[envelope->len++] = arg;
+    return true;
+}
+
+#if COMMAND_TEXT_FALLBACK
+// Indexed by color, so the name's position is the LED_* value. In flash.
+static const char led_names[][8] PROGMEM = {
+    "OFF", "BLUE", "GREEN", "CYAN", "RED", "MAGENTA", "YELLOW", "WHITE"
+};
+
+// Look for "LED:<color>" once, instead of once per color.
+static bool command_handle_text(char* message) {
+
+    if (channel_parse_command(message)) return true;
+
+    char* color = strstr_P(message, PSTR("LED:"));
+    if (color == NULL) return false;
+    color += 4;
+
+    for (byte i = 0; i < sizeof(led_names) / sizeof(led_names[0]); i++) {
+        size_t len = strlen_P(led_names[i]);
+        if (strncmp_P(color, led_names[i], len) == 0) {
+            LED_set(i);
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+bool command_handle(byte* message, uint16_t message_len) {
+
+    if (COMMAND_IS_BINARY(message, message_len)) {
+        uint16_t i = 1;
+        while (i < message_len) {
+            byte opcode = message[i];
+            if (opcode >= COMMAND_OPCODE_COUNT) return false;
+            const command_entry_t* entry = &commands[opcode];
+            if (message_len - i - 1 < entry->arg_len) return false;
+            entry->handler(&message[i + 1]);
+            i += 1 + entry->arg_len;
+        }
+        return true;
+    }
+
+#if COMMAND_TEXT_FALLBACK
+    return command_handle_text((char*) message);
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,66 @@
+#ifndef _COMMAND_H
+#define _COMMAND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "networking_constants.h"
+
+/*
+    Commands the cubes act on, like changing the LED or moving to another
+    radio channel. A command is a few bytes:
+
+    message[0]          = COMMAND_MARK
+    message[1]          = opcode (command_opcode_t)
+    message[2..]        = that opcode's arguments
+
+    More commands can follow, opcode by opcode, so several of them can go
+    in one message (an envelope). They're carried out in order.
+
+    Text never starts with COMMAND_MARK, so anything else is treated as text,
+    and searched for the old "LED:GREEN" and "CH:<channel>" forms. That's
+    slower, but handy for typing commands in by hand through the bridge. Set
+    COMMAND_TEXT_FALLBACK to 0 to leave it out.
+*/
+
+#define COMMAND_MARK (0x01)
+
+#ifndef COMMAND_TEXT_FALLBACK
+#define COMMAND_TEXT_FALLBACK (1)
+#endif
+
+typedef enum {
+    COMMAND_LED = 0x00,         // color (LED_* in digital_io.h)
+    COMMAND_CHANNEL = 0x01,     // channel, see channel_request
+    COMMAND_STATS = 0x02,       // 1 to start the counts over after printing them (stats.h)
+    COMMAND_OPCODE_COUNT
+} command_opcode_t;
+
+// Longest command command_build writes.
+#define COMMAND_MAX_LEN (3)
+
+// How much an envelope holds. A full one still goes as one COMPACT segment.
+#define COMMAND_ENVELOPE_LEN (MAX_SEGMENT_LEN - COMPACT_SEGMENT_HEADER_LEN)
+
+typedef struct {
+    byte len;       // 0 if it's empty
+    byte message[COMMAND_ENVELOPE_LEN];
+} command_envelope_t;
+
+#define COMMAND_IS_BINARY(message, message_len) ((message_len) >= 2 && (message)[0] == COMMAND_MARK)
+
+// Write a command with a one-byte argument. Returns its length.
+byte command_build(byte* message, byte opcode, byte arg);
+
+// Empty an envelope.
+void command_envelope_clear(command_envelope_t* envelope);
+
+// Add a command with a one-byte argument to an envelope. Returns false if
+// there isn't room for it.
+bool command_envelope_add(command_envelope_t* envelope, byte opcode, byte arg);
+
+// Do what the message says. Text has to be null-terminated.
+// Returns true if it was all commands we know. Anything after one we don't
+// know is skipped, since there's no telling how long it is.
+bool command_handle(byte* message, uint16_t message_len);
+
+#endif
@@ -0,0 +1,137 @@
+#include "compress.h"
+
+#ifndef SIMULATION
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_byte(address) (*(address))
+#endif
+
+// Entry n is code 0x80 + n. Entries shorter than COMPRESS_MAX_TOKEN_LEN are
+// padded with zeros. The compressor always takes the longest entry that
+// matches, so it's fine for one entry to start another.
+static const char dictionary[][COMPRESS_MAX_TOKEN_LEN] PROGMEM = {
+    // Commands
+    ". LED:", "LED:", "GREEN", "CYAN", "RED", "MAGENTA", "YELLOW", "WHITE",
+    "BLUE", "OFF", "CH:", "\r\n",
+
+    // Words
+    "This ", "this ", " is ", "the ", "The ", " you", "you", "ing ",
+    "ing", "and ", "tion", " are ", " of ", " to ", "color", "Is ",
+    "Do ", "like ", "when ", "pretty", "sure", "over", "ocean", "cookie",
+    "ated", "ed ", "er ", "es ", "re ", "ly ",
+
+    // Pairs
+    "e ", "s ", "t ", "d ", "y ", "o ", ". ", ", ", "? ",
+    "th", "he", "in", "er", "an", "re", "on", "at", "en", "nd",
+    "ti", "es", "or", "te", "of", "ed", "is", "it", "al", "ar",
+    "st", "to", "nt", "ng", "se", "ha", "as", "ou", "io", "le",
+    "ve", "co", "me", "de", "hi", "ri", "ro", "ic", "ne", "ea",
+    "ra", "ce", "li", "ch", "ll", "be", "ma", "si", "om", "ur",
+};
+
+#define COMPRESS_DICTIONARY_LEN (sizeof(dictionary) / sizeof(dictionary[0]))
+
+// 0xFF is COMPRESS_ESCAPE, so there are 127 codes to go around.
+_Static_assert(COMPRESS_DICTIONARY_LEN <= 0x7F, "The dictionary can't have more than 127 entries.");
+
+// How many bytes of in, from the start, match entry. 0 if it doesn't all
+// match.
+static byte compress_match(const byte* in, uint16_t in_len, byte entry) {
+    byte len = 0;
+    while (len < COMPRESS_MAX_TOKEN_LEN) {
+        byte c = pgm_read_byte(&dictionary[entry][len]);
+        if (c == 0) break;
+        if (len >= in_len || in[len] != c) return 0;
+        len++;
+    }
+    return len;
+}
+
+uint16_t compress(const byte* in, uint16_t in_len, byte* out, uint16_t out_len) {
+
+    uint16_t o = 0;
+
+    for (uint16_t i = 0; i < in_len; ) {
+
+        byte best_len = 0;
+        byte best_entry = 0;
+        for (byte entry = 0; entry < COMPRESS_DICTIONARY_LEN; entry++) {
+            byte len = compress_match(&in[i], in_len - i, entry);
+            if (len > best_len) {
+                best_len = len;
+                best_entry = entry;
+            }
+        }
+
+        if (best_len > 1) {
+            if (o >= out_len) return 0;
+            out[o++] = 0x80 + best_entry;
+            i += best_len;
+        }
+        else if (in[i] < 0x80) {
+            if (o >= out_len) return 0;
+            out[o++] = in[i++];
+        }
+        else {
+            if (o + 2 > out_len) return 0;
+            out[o++] = COMPRESS_ESCAPE;
+            out[o++] = in[i++];
+        }
+    }
+
+    return o;
+}
+
+void decompress_init(compress_state_t* state) {
+    state->escaped = false;
+}
+
+byte decompress_byte(compress_state_t* state, byte in, byte* out) {
+
+    if (state->escaped) {
+        state->escaped = false;
+        out[0] = in;
+        return 1;
+    }
+    if (in == COMPRESS_ESCAPE) {
+        state->escaped = true;
+        return 0;
+    }
+    if (in < 0x80) {
+        out[0] = in;
+        return 1;
+    }
+
+    // A code that isn't in our dictionary came from someone with a bigger
+    // one. There's no way to know what it was.
+    byte entry = in - 0x80;
+    if (entry >= COMPRESS_DICTIONARY_LEN) {
+        out[0] = '?';
+        return 1;
+    }
+
+    byte len = 0;
+    while (len < COMPRESS_MAX_TOKEN_LEN) {
+        byte c = pgm_read_byte(&dictionary[entry][len]);
+        if (c == 0) break;
+        out[len++] = c;
+    }
+    return len;
+}
+
+uint16_t decompress(const byte* in, uint16_t in_len, byte* out, uint16_t out_len) {
+
+    compress_state_t state;
+    byte token[COMPRESS_MAX_TOKEN_LEN];
+    uint16_t o = 0;
+
+    decompress_init(&state);
+
+    for (uint16_t i = 0; i < in_len; i++) {
+        byte len = decompress_byte(&state, in[i], token);
+        for (byte j = 0; j < len && o < out_len; j++) out[o++] = token[j];
+    }
+
+    return o;
+}
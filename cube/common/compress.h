@@ -0,0 +1,46 @@
+#ifndef _COMPRESS_H
+#define _COMPRESS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "networking_constants.h"
+
+/*
+    A tiny compressor for the text that goes between the cubes, like the
+    rover's "LED:GREEN" commands. Instead of learning anything from the
+    message, it swaps common pieces of text for one-byte codes from a fixed
+    dictionary in flash, which everyone has the same copy of:
+
+    0x00 - 0x7F         that byte (plain ASCII)
+    0x80 - 0xFE         dictionary entry (code - 0x80)
+    0xFF, b             the byte b, for anything that isn't ASCII
+
+    Decompressing needs no RAM to speak of (one byte of state), and can be
+    done a byte at a time, so it works on a message as it streams in.
+*/
+
+// The longest a dictionary entry is, which is also the most one compressed
+// byte can turn into.
+#define COMPRESS_MAX_TOKEN_LEN (8)
+
+#define COMPRESS_ESCAPE (0xFF)
+
+typedef struct {
+    bool escaped;   // the last byte was COMPRESS_ESCAPE
+} compress_state_t;
+
+// Compress in into out. Returns how long the result is, or 0 if it doesn't
+// fit in out_len bytes.
+uint16_t compress(const byte* in, uint16_t in_len, byte* out, uint16_t out_len);
+
+void decompress_init(compress_state_t* state);
+
+// Decompress one byte. Puts what it turns into in out, which has to have room
+// for COMPRESS_MAX_TOKEN_LEN bytes, and returns how many that is.
+byte decompress_byte(compress_state_t* state, byte in, byte* out);
+
+// Decompress all of in. Anything past out_len bytes is cut off.
+// Returns how much went in out.
+uint16_t decompress(const byte* in, uint16_t in_len, byte* out, uint16_t out_len);
+
+#endif
@@ -0,0 +1,98 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// CPU Clock
+//
+// See cpu_clock.h.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "cpu_clock.h"
+
+#if CLOCK_SCALING
+
+#include "uart.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/power.h>
+
+/////////////////// Static Variable Definitions ////////////////////////////////
+
+static volatile uint8_t idle = 0;
+
+/////////////////// Private Function Prototypes ////////////////////////////////
+
+// Changes the clock and everything that depends on it. Interrupts have to be
+// off.
+static void switch_clock(uint8_t to_idle);
+
+/////////////////// Public Function Bodies /////////////////////////////////////
+
+void cpu_clock_full_speed(void) {
+
+  if (!idle) return;
+
+  // Interrupts are off in an ISR, and the U(S)ART would never finish. A
+  // character coming in only takes a character's time to finish, too.
+  if ((SREG & _BV(SREG_I)) != 0) {
+    IDLE_UNTIL(uart_transmit_done() && !uart_receiving());
+  }
+
+  uint8_t sreg = SREG;
+  SREG &= ~_BV(SREG_I);
+  switch_clock(0);
+  SREG = sreg;
+
+}
+
+void cpu_clock_idle(void) {
+
+  if (idle) return;
+
+  // Not while a character is going out or coming in, since the baud rate
+  // would change halfway through it. Checked with interrupts off, so one
+  // can't start in between.
+  uint8_t sreg = SREG;
+  SREG &= ~_BV(SREG_I);
+  if (uart_transmit_done() && !uart_receiving()) switch_clock(1);
+  SREG = sreg;
+
+}
+
+uint8_t cpu_clock_is_idle(void) {
+  return idle;
+}
+
+/////////////////// Private Function Bodies ////////////////////////////////////
+
+static void switch_clock(uint8_t to_idle) {
+
+  // Timer 1 counts 2^CLOCK_IDLE_CLKPS times slower while idle, so move it to
+  // where it would have got to at the new speed.
+  if (to_idle) {
+    TCNT1 >>= CLOCK_IDLE_CLKPS;
+    OCR1A >>= CLOCK_IDLE_CLKPS;
+  }
+  else {
+    TCNT1 <<= CLOCK_IDLE_CLKPS;
+    OCR1A <<= CLOCK_IDLE_CLKPS;
+  }
+
+  // Timer 0 keeps counting at the same rate, if it's running.
+  if ((TCCR0B & (_BV(CS02) | _BV(CS01) | _BV(CS00))) != 0) {
+    TCCR0B = to_idle ? CLOCK_TIMER0_IDLE_CS : CLOCK_TIMER0_CS;
+  }
+
+  // The baud rate, from the divider clock.h picked for each clock. UCSR0A
+  // is written whole, the way the transmit interrupt does it: |= would read
+  // TXC0 and write it back as 1, which clears it, and uart_transmit_done
+  // would wait on it until something else got sent.
+  UCSR0A = (UCSR0A & _BV(MPCM0)) | ((to_idle ? CLOCK_UART_IDLE_U2X : CLOCK_UART_U2X) ? _BV(U2X0) : 0);
+  UBRR0 = to_idle ? CLOCK_UART_IDLE_UBRR : CLOCK_UART_UBRR;
+
+  clock_prescale_set(to_idle ? (clock_div_t) CLOCK_IDLE_CLKPS : clock_div_1);
+  idle = to_idle;
+
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef _CPU_CLOCK_H
+#define _CPU_CLOCK_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// CPU Clock
+//
+// Runs the CPU at full speed (F_CPU) while there's work to do, and slows it
+// down with CLKPR to CLOCK_IDLE_F_CPU while there isn't. Cubes built with the
+// 8 MHz profile (CUBE_CLOCK_MHZ=8 in the Makefile) turn this on with
+// CLOCK_SCALING; otherwise these do nothing.
+//
+// Switching reprograms everything that divides the clock, from the numbers
+// clock.h works out for both speeds: the U(S)ART's baud rate, Timer 0's
+// prescaler, so the millisecond clock doesn't notice, and Timer 1's count and
+// compare value, so a timer_start that's running still goes off on time. The
+// SPI just runs slower.
+//
+// <util/delay.h> is worked out for F_CPU at compile time, so delays take
+// 2^CLOCK_IDLE_CLKPS times longer while idle. The transceiver goes back to
+// full speed before it transmits; anything else that needs its delays to be
+// right should call cpu_clock_full_speed first.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include "cube_parameters.h"
+
+#if CLOCK_SCALING
+
+// Back to F_CPU, if we weren't already. Outside of interrupts, characters
+// still going out of or coming into the U(S)ART at the idle baud rate get to
+// finish first.
+void cpu_clock_full_speed(void);
+
+// Down to CLOCK_IDLE_F_CPU, unless the U(S)ART is still sending or
+// receiving a character.
+void cpu_clock_idle(void);
+
+// Whether the CPU is running at CLOCK_IDLE_F_CPU.
+uint8_t cpu_clock_is_idle(void);
+
+#else
+
+#define cpu_clock_full_speed()
+#define cpu_clock_idle()
+#define cpu_clock_is_idle() (0)
+
+#endif
+
+#endif
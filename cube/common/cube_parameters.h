@@ -3,6 +3,9 @@
 
 // Note: required for <util/delay.h>.
 // You may need to include parameters.h before including <util/delay.h>.
-#define F_CPU 1000000UL
+// F_CPU comes from the Makefile, by way of clock.h.
+#ifndef SIMULATION
+#include "clock.h"
+#endif
 
 #endif
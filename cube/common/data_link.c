@@ -1,6 +1,7 @@
 #include "data_link.h"
 #include "address.h"
-#include "uart.h"
+#include "log_level.h"
+#include "node_state.h"
 
 
 #ifndef SIMULATION
@@ -11,49 +12,481 @@
 #endif
 
 
-// frame[0] = frame length
+// A frame is just a packet. There's no data link header.
+//
+// Or a few packets, one after the other. Every packet starts with its own
+// length, and an unused byte is always 0, so the receiver can tell where
+// each one ends and whether there's another one after it.
+
+#if FRAME_HEADER_LEN != 0
+#error "Aggregated frames need packets to start right at the beginning of the frame."
+#endif
+
+// Packets from data_link_tx_queued for the same next hop, waiting to go out
+// together.
+NODE_STATE frame_buffer_t tx_aggregate;
+NODE_STATE byte tx_aggregate_len = 0;
+NODE_STATE uint32_t tx_aggregate_addr;
+
+// The rest of an aggregated frame we've only handed out part of.
+NODE_STATE frame_buffer_t rx_aggregate;
+NODE_STATE byte rx_aggregate_offset = 0;
+
+// See data_link_get_stats.
+NODE_STATE data_link_stats_t stats;
+
+// Take the next packet out of rx_aggregate, if there is one.
+bool data_link_next_aggregated(byte* frame) {
+
+    if (rx_aggregate_offset == 0) return false;
+
+    byte packet_len = rx_aggregate[rx_aggregate_offset];
+    for (byte i = 0; i < MAX_FRAME_LEN; i++) {
+        frame[i] = i < packet_len ? rx_aggregate[rx_aggregate_offset + i] : 0;
+    }
+
+    rx_aggregate_offset += packet_len;
+    if (rx_aggregate_offset >= MAX_FRAME_LEN
+        || rx_aggregate[rx_aggregate_offset] < PACKET_HEADER_LEN
+        || rx_aggregate_offset + rx_aggregate[rx_aggregate_offset] > MAX_FRAME_LEN) {
+        rx_aggregate_offset = 0;
+    }
+    stats.packets_unpacked++;
+    return true;
+}
+
+// A frame just came in. If there's more than one packet in it, keep
+// everything after the first one for later.
+void data_link_split_aggregated(byte* frame) {
+
+    byte packet_len = frame[0];
+    if (packet_len < PACKET_HEADER_LEN || packet_len >= MAX_FRAME_LEN) return;
+
+    byte next_len = frame[packet_len];
+    if (next_len < PACKET_HEADER_LEN || packet_len + next_len > MAX_FRAME_LEN) return;
+
+    for (byte i = 0; i < MAX_FRAME_LEN; i++) {
+        rx_aggregate[i] = frame[i];
+        if (i >= packet_len) frame[i] = 0;
+    }
+    rx_aggregate_offset = packet_len;
+}
+
+#if DATA_LINK_FEC
+
+// A parity frame:
+// [0]      DATA_LINK_FEC_PARITY, which is too long to be a packet
+// [1]      how many frames it's for
+// [2]      the network address they came from, which is packet[2] in all of
+//          them, since bursts aren't relayed
+// [3-4]    CRC-16 of those frames one after the other, each padded out to
+//          DATA_LINK_FEC_LEN bytes, high byte first
+// [5-31]   the first DATA_LINK_FEC_LEN bytes of those frames, XORed together
+#define DATA_LINK_FEC_PARITY (0xFF)
+#define DATA_LINK_FEC_LEN (MAX_FRAME_LEN - DATA_LINK_FEC_RESERVE)
+#define DATA_LINK_FEC_GROUPS_MAX ((DATA_LINK_TX_BURST_MAX + DATA_LINK_FEC_GROUP - 1) / DATA_LINK_FEC_GROUP)
+
+// Other nodes' frames can come in between a group's, so we hold on to a
+// couple of groups' worth.
+#define DATA_LINK_FEC_HELD (2 * DATA_LINK_FEC_GROUP)
+
+// The last DATA_LINK_FEC_HELD frames sent to us, oldest first from
+// fec_rx_next. A frame that's been used up has a length of 0.
+NODE_STATE byte fec_rx_frames[DATA_LINK_FEC_HELD][DATA_LINK_FEC_LEN];
+NODE_STATE byte fec_rx_next = 0;
+
+// CRC-16, polynomial 0x1021, over one frame padded out to DATA_LINK_FEC_LEN.
+uint16_t data_link_fec_crc(uint16_t crc, byte* frame, byte frame_len) {
+    for (byte i = 0; i < DATA_LINK_FEC_LEN; i++) {
+        crc ^= (uint16_t) (i < frame_len ? frame[i] : 0) << 8;
+        for (byte bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+// Makes the parity frame for count frames. Returns false if one of them is
+// too long to be covered by it, or isn't ours.
+bool data_link_fec_build_parity(byte** frames, byte* frame_lens, byte count, byte* parity) {
+
+    uint16_t crc = 0xFFFF;
+
+    for (byte i = 0; i < MAX_FRAME_LEN; i++) parity[i] = 0;
+    parity[0] = DATA_LINK_FEC_PARITY;
+    parity[1] = count;
+    parity[2] = MY_NETWORK_ADDR;
+
+    for (byte f = 0; f < count; f++) {
+        if (frame_lens[f] > DATA_LINK_FEC_LEN || frames[f][2] != MY_NETWORK_ADDR) return false;
+        for (byte i = 0; i < frame_lens[f]; i++) {
+            parity[DATA_LINK_FEC_RESERVE + i] ^= frames[f][i];
+        }
+        crc = data_link_fec_crc(crc, frames[f], frame_lens[f]);
+    }
+    parity[3] = crc >> 8;
+    parity[4] = crc & 0xFF;
+    return true;
+}
+
+// CRC of a group of count held frames in order, with extra (if not NULL)
+// put in before the one at position at.
+uint16_t data_link_fec_group_crc(byte** group, byte count, byte* extra, byte at) {
+    uint16_t crc = 0xFFFF;
+    for (byte k = 0; k <= count; k++) {
+        if (extra != NULL && k == at) crc = data_link_fec_crc(crc, extra, extra[0]);
+        if (k < count) crc = data_link_fec_crc(crc, group[k], group[k][0]);
+    }
+    return crc;
+}
+
+// A frame just came in. Anything but a parity frame is kept in case the
+// parity frame after it needs it, and returns true. A parity frame returns
+// true only if it rebuilt the one frame of its group we missed, which is
+// left in frame in its place.
+bool data_link_fec_rx(byte* frame) {
+
+    if (frame[0] != DATA_LINK_FEC_PARITY) {
+        if (data_link_last_rx_pipe() != 0) return true;
+        for (byte i = 0; i < DATA_LINK_FEC_LEN; i++) {
+            fec_rx_frames[fec_rx_next][i] = frame[i];
+        }
+        fec_rx_next = (fec_rx_next + 1) % DATA_LINK_FEC_HELD;
+        return true;
+    }
+
+    byte count = frame[1];
+    byte sender = frame[2];
+    uint16_t crc = ((uint16_t) frame[3] << 8) | frame[4];
+    if (count == 0 || count > DATA_LINK_FEC_GROUP) return false;
+
+    // The newest count frames we have from the sender, oldest first.
+    byte* group[DATA_LINK_FEC_GROUP];
+    byte found = 0;
+    for (byte j = 1; j <= DATA_LINK_FEC_HELD && found < count; j++) {
+        byte* held = fec_rx_frames[(byte) (fec_rx_next + DATA_LINK_FEC_HELD - j) % DATA_LINK_FEC_HELD];
+        if (held[0] == 0 || held[2] != sender) continue;
+        for (byte k = found; k > 0; k--) group[k] = group[k - 1];
+        group[0] = held;
+        found++;
+    }
+
+    bool rebuilt_ok = false;
+    byte rebuilt[DATA_LINK_FEC_LEN];
+
+    if (found == count && data_link_fec_group_crc(group, count, NULL, 0) == crc) {
+        // Nothing missing.
+    } else if (found >= count - 1 && count > 1) {
+        // Rebuild from the newest count - 1, then find where it goes: the
+        // CRC only matches with every frame right and in the right place.
+        byte** newest = &group[found - (count - 1)];
+        for (byte i = 0; i < DATA_LINK_FEC_LEN; i++) rebuilt[i] = frame[DATA_LINK_FEC_RESERVE + i];
+        for (byte k = 0; k < count - 1; k++) {
+            for (byte i = 0; i < newest[k][0] && i < DATA_LINK_FEC_LEN; i++) rebuilt[i] ^= newest[k][i];
+        }
+        if (rebuilt[0] >= PACKET_HEADER_LEN && rebuilt[0] <= DATA_LINK_FEC_LEN && rebuilt[2] == sender) {
+            for (byte p = 0; p < count && !rebuilt_ok; p++) {
+                rebuilt_ok = data_link_fec_group_crc(newest, count - 1, rebuilt, p) == crc;
+            }
+        }
+    }
+
+    // Used up, so the next group's parity frame won't count them again.
+    for (byte k = 0; k < found; k++) group[k][0] = 0;
+
+    if (!rebuilt_ok) return false;
+    for (byte i = 0; i < MAX_FRAME_LEN; i++) frame[i] = i < rebuilt[0] ? rebuilt[i] : 0;
+    stats.fec_rebuilt++;
+    return true;
+}
+
+#else
+#define data_link_fec_rx(frame) (true)
+#endif
+
+data_link_tx_result data_link_tx_now(byte* frame, byte payload_len, uint32_t addr);
 
 // ---------------------------- NETWORKING INTERFACE ---------------------------
 
-// This blocking function gets a payload from the data link layer
-// and writes it to the buffer.
+// This blocking function gets a frame from the radio
+// and writes it straight into the caller's frame buffer.
+// The payload is left at FRAME_PACKET(frame).
 // It returns if it was successful (false if timed out).
-data_link_rx_result data_link_rx(byte* buffer, byte buf_len, timer_delay_ms_t timeout_ms) {
+// If there are queued packets, we give them DATA_LINK_AGGREGATE_WAIT_MS
+// to get some company before sending them.
+data_link_rx_result data_link_rx(byte* frame, timer_delay_ms_t timeout_ms) {
 
-    byte rxframe[TRX_PAYLOAD_LENGTH];
+    // This came in with the last frame, so timer_elapsed_ms is still right.
+    if (data_link_next_aggregated(frame)) return DATA_LINK_RX_SUCCESS;
 
-    trx_reception_outcome_t outcome = trx_receive_payload(rxframe, timeout_ms);
-    if (outcome == TRX_RECEPTION_ERROR) return DATA_LINK_RX_ERROR;
-    if (outcome == TRX_RECEPTION_TIMEOUT) return DATA_LINK_RX_TIMEOUT;
+    trx_reception_outcome_t outcome;
+    do {
+        if (tx_aggregate_len > 0 && (timeout_ms > DATA_LINK_AGGREGATE_WAIT_MS || timeout_ms == TRX_TIMEOUT_INDEFINITE)) {
+            outcome = trx_receive_payload(frame, DATA_LINK_AGGREGATE_WAIT_MS);
+            if (outcome == TRX_RECEPTION_TIMEOUT) {
+                data_link_flush();
+                if (timeout_ms != TRX_TIMEOUT_INDEFINITE) timeout_ms -= DATA_LINK_AGGREGATE_WAIT_MS;
+                outcome = trx_receive_payload(frame, timeout_ms);
+            }
+        }
+        else {
+            data_link_flush();
+            outcome = trx_receive_payload(frame, timeout_ms);
+        }
 
-    for (int i = 0; i < buf_len && i < TRX_PAYLOAD_LENGTH - FRAME_HEADER_LEN; i++)
-        buffer[i] = rxframe[i+FRAME_HEADER_LEN];
+        if (outcome == TRX_RECEPTION_ERROR) {
+            stats.rx_errors++;
+            return DATA_LINK_RX_ERROR;
+        }
+        if (outcome == TRX_RECEPTION_TIMEOUT) return DATA_LINK_RX_TIMEOUT;
 
+        stats.frames_received++;
+
+    // A parity frame that didn't rebuild anything is nothing to hand over.
+    // The wait starts over, a frame's worth longer than it would have been.
+    } while (!data_link_fec_rx(frame));
+
+    data_link_split_aggregated(frame);
+    return DATA_LINK_RX_SUCCESS;
+}
+
+
+// Start listening in the background. data_link_poll picks up the frames.
+void data_link_listen(void) {
+    trx_start_listening();
+}
+
+bool data_link_rx_pending(void) {
+    return rx_aggregate_offset != 0 || trx_rx_pending() != 0;
+}
+
+// Like data_link_rx, but it doesn't wait.
+// Queued packets go out as soon as there's nothing else to do.
+data_link_rx_result data_link_poll(byte* frame) {
+
+    if (data_link_next_aggregated(frame)) return DATA_LINK_RX_SUCCESS;
+
+    trx_reception_outcome_t outcome;
+    do {
+        outcome = trx_try_dequeue(frame);
+        if (outcome == TRX_RECEPTION_ERROR) {
+            stats.rx_errors++;
+            return DATA_LINK_RX_ERROR;
+        }
+        if (outcome == TRX_RECEPTION_TIMEOUT) {
+            if (tx_aggregate_len > 0) {
+                data_link_flush();
+                trx_start_listening();
+            }
+            return DATA_LINK_RX_TIMEOUT;
+        }
+
+        stats.frames_received++;
+    } while (!data_link_fec_rx(frame));
+
+    data_link_split_aggregated(frame);
     return DATA_LINK_RX_SUCCESS;
 }
 
 
-data_link_tx_result data_link_tx(byte* payload, byte payload_len, uint32_t addr) {
+// Anything queued for this next hop has to go first,
+// or the packets would show up out of order.
+data_link_tx_result data_link_tx(byte* frame, byte payload_len, uint32_t addr) {
+    data_link_flush();
+    return data_link_tx_now(frame, payload_len, addr);
+}
+
+// Add a packet to the frame for its next hop. It goes out once the frame
+// can't fit another ACK packet.
+data_link_tx_result data_link_tx_queued(byte* frame, byte payload_len, uint32_t addr) {
+
+    if (payload_len > MAX_FRAME_LEN - FRAME_HEADER_LEN) {
+        payload_len = MAX_FRAME_LEN - FRAME_HEADER_LEN;
+    }
+
+    if (tx_aggregate_len > 0 && (addr != tx_aggregate_addr || tx_aggregate_len + payload_len > MAX_FRAME_LEN)) {
+        data_link_flush();
+    }
+
+    for (byte i = 0; i < payload_len; i++) {
+        tx_aggregate[tx_aggregate_len + i] = frame[i];
+    }
+    tx_aggregate_len += payload_len;
+    tx_aggregate_addr = addr;
+    stats.packets_queued++;
+
+    if (MAX_FRAME_LEN - tx_aggregate_len < DATA_LINK_AGGREGATE_MIN_ROOM) {
+        return data_link_flush();
+    }
+
+    return DATA_LINK_TX_SUCCESS;
+}
+
+data_link_tx_result data_link_flush(void) {
+
+    if (tx_aggregate_len == 0) return DATA_LINK_TX_SUCCESS;
+
+    byte len = tx_aggregate_len;
+    tx_aggregate_len = 0;
+    return data_link_tx_now(tx_aggregate, len, tx_aggregate_addr);
+}
+
+
+// The payload is already in place at FRAME_PACKET(frame).
+// Only the bytes it uses go out over the air.
+data_link_tx_result data_link_tx_now(byte* frame, byte payload_len, uint32_t addr) {
 
     trx_transmission_outcome_t result;
 
-    // initialize
-    byte payload_zero_pad[TRX_PAYLOAD_LENGTH];
-    for (int i = 0; i < TRX_PAYLOAD_LENGTH; i++) {
-        payload_zero_pad[i] = 0;
+    if (payload_len > MAX_FRAME_LEN - FRAME_HEADER_LEN) {
+        payload_len = MAX_FRAME_LEN - FRAME_HEADER_LEN;
     }
 
-    // set length
-    payload_zero_pad[0] = payload_len;
+    result = trx_transmit_payload(addr, frame, payload_len + FRAME_HEADER_LEN);
+    stats.frames_sent++;
 
-    // fill payload
-    for (int i = 0; i < payload_len && i < TRX_PAYLOAD_LENGTH - FRAME_HEADER_LEN; i++) {
-        payload_zero_pad[i + FRAME_HEADER_LEN] = payload[i];
+    if (result == TRX_TRANSMISSION_FAILURE) {
+        stats.frames_failed++;
+        LOG_DEBUG(DATA_LINK, "[DEBUG] No ack for a frame to %08lx\r\n", (unsigned long) addr);
+        return DATA_LINK_TX_FAILURE;
     }
 
-    result = trx_transmit_payload(addr, payload_zero_pad, TRX_PAYLOAD_LENGTH);
+    return DATA_LINK_TX_SUCCESS;
+}
+
+
+bool data_link_listen_on(uint32_t addr) {
+    return trx_add_rx_address(addr) != TRX_PIPE_NONE;
+}
+
+byte data_link_last_rx_pipe(void) {
+    return trx_last_rx_pipe();
+}
+
+// Same as data_link_tx, except nobody is going to ack it.
+data_link_tx_result data_link_broadcast(byte* frame, byte payload_len, uint32_t addr) {
 
-    if (result == TRX_TRANSMISSION_FAILURE) return DATA_LINK_TX_FAILURE;
+    if (payload_len > MAX_FRAME_LEN - FRAME_HEADER_LEN) {
+        payload_len = MAX_FRAME_LEN - FRAME_HEADER_LEN;
+    }
+
+    stats.frames_sent++;
+    if (trx_broadcast_payload(addr, frame, payload_len + FRAME_HEADER_LEN) == TRX_TRANSMISSION_FAILURE) {
+        stats.frames_failed++;
+        return DATA_LINK_TX_FAILURE;
+    }
 
     return DATA_LINK_TX_SUCCESS;
 }
+
+
+// The ack frame goes out with the radio's own acknowledgement,
+// so there's no addressing to do.
+void data_link_set_ack_frame(byte* frame, byte payload_len) {
+
+    if (payload_len > MAX_FRAME_LEN - FRAME_HEADER_LEN) {
+        payload_len = MAX_FRAME_LEN - FRAME_HEADER_LEN;
+    }
+
+    trx_set_ack_payload(frame, payload_len + FRAME_HEADER_LEN);
+}
+
+void data_link_clear_ack_frame(void) {
+    trx_clear_ack_payload();
+}
+
+bool data_link_ack_frame_sent(void) {
+    return trx_ack_payload_sent() != 0;
+}
+
+
+// Same as data_link_tx, but the radio keeps its TX FIFO full
+// so the frames go out as fast as they can be acked.
+byte data_link_tx_burst(byte** frames, byte* payload_lens, byte count, uint32_t addr) {
+
+    byte frame_lens[DATA_LINK_TX_BURST_MAX];
+    trx_transmission_outcome_t outcomes[DATA_LINK_TX_BURST_MAX];
+    byte delivered = 0;
+
+    if (count > DATA_LINK_TX_BURST_MAX) count = DATA_LINK_TX_BURST_MAX;
+
+    data_link_flush();
+
+    for (byte i = 0; i < count; i++) {
+        byte payload_len = payload_lens[i];
+        if (payload_len > MAX_FRAME_LEN - FRAME_HEADER_LEN) {
+            payload_len = MAX_FRAME_LEN - FRAME_HEADER_LEN;
+        }
+        frame_lens[i] = payload_len + FRAME_HEADER_LEN;
+    }
+
+#if DATA_LINK_FEC
+    // The parity frame for each group goes right after it, in the same burst.
+    byte* all_frames[DATA_LINK_TX_BURST_MAX + DATA_LINK_FEC_GROUPS_MAX];
+    byte all_lens[DATA_LINK_TX_BURST_MAX + DATA_LINK_FEC_GROUPS_MAX];
+    trx_transmission_outcome_t all_outcomes[DATA_LINK_TX_BURST_MAX + DATA_LINK_FEC_GROUPS_MAX];
+    frame_buffer_t parity[DATA_LINK_FEC_GROUPS_MAX];
+    byte frame_at[DATA_LINK_TX_BURST_MAX];
+    byte parity_at[DATA_LINK_FEC_GROUPS_MAX];
+    byte all_count = 0;
+
+    for (byte start = 0; start < count; start += DATA_LINK_FEC_GROUP) {
+        byte group = start / DATA_LINK_FEC_GROUP;
+        byte group_len = count - start < DATA_LINK_FEC_GROUP ? count - start : DATA_LINK_FEC_GROUP;
+
+        for (byte i = start; i < start + group_len; i++) {
+            frame_at[i] = all_count;
+            all_frames[all_count] = frames[i];
+            all_lens[all_count++] = frame_lens[i];
+        }
+
+        // A parity frame for one frame is just a copy of it.
+        parity_at[group] = 0;
+        if (group_len > 1 && data_link_fec_build_parity(&frames[start], &frame_lens[start], group_len, parity[group])) {
+            parity_at[group] = all_count;
+            all_frames[all_count] = parity[group];
+            all_lens[all_count++] = MAX_FRAME_LEN;
+            stats.fec_parity_sent++;
+        }
+    }
+
+    trx_transmit_burst(addr, all_frames, all_lens, all_count, all_outcomes);
+
+    // Back to one outcome per frame, and the number of frames in each group
+    // the next hop didn't ack.
+    byte missed[DATA_LINK_FEC_GROUPS_MAX] = { 0 };
+    for (byte i = 0; i < count; i++) {
+        outcomes[i] = all_outcomes[frame_at[i]];
+        if (outcomes[i] != TRX_TRANSMISSION_SUCCESS) missed[i / DATA_LINK_FEC_GROUP]++;
+    }
+#else
+    trx_transmit_burst(addr, frames, frame_lens, count, outcomes);
+#endif
+
+    for (byte i = 0; i < count; i++) {
+        if (outcomes[i] == TRX_TRANSMISSION_SUCCESS) delivered |= 1 << i;
+        else stats.frames_failed++;
+
+#if DATA_LINK_FEC
+        // The next hop has everything it needs to rebuild this one.
+        byte group = i / DATA_LINK_FEC_GROUP;
+        if (outcomes[i] != TRX_TRANSMISSION_SUCCESS && missed[group] == 1
+            && parity_at[group] != 0 && all_outcomes[parity_at[group]] == TRX_TRANSMISSION_SUCCESS) {
+            delivered |= 1 << i;
+            stats.fec_covered++;
+        }
+#endif
+    }
+    stats.frames_sent += count;
+
+    return delivered;
+}
+
+data_link_stats_t data_link_get_stats(void) {
+    return stats;
+}
+
+void data_link_reset_stats(void) {
+    data_link_stats_t none = { 0 };
+    stats = none;
+}
@@ -18,8 +18,97 @@ typedef enum {
 
 bool data_link_push_to_fifo(byte* buffer, byte buf_len);
 
-data_link_rx_result data_link_rx(byte* buffer, byte buf_len, uint16_t timeout_ms);
+// Receive a whole frame into a frame_buffer_t.
+// The payload starts at FRAME_PACKET(frame).
+data_link_rx_result data_link_rx(byte* frame, uint16_t timeout_ms);
 
-data_link_tx_result data_link_tx(byte* payload, byte payload_len, uint32_t addr);
+// Leave the radio listening so data_link_poll can find frames.
+void data_link_listen(void);
+
+// Receive a whole frame if one has arrived, without waiting.
+// DATA_LINK_RX_TIMEOUT means nothing has.
+data_link_rx_result data_link_poll(byte* frame);
+
+// Whether data_link_poll would find something right now.
+bool data_link_rx_pending(void);
+
+// Transmit a frame_buffer_t whose payload is already at FRAME_PACKET(frame).
+data_link_tx_result data_link_tx(byte* frame, byte payload_len, uint32_t addr);
+
+// Small packets, like acks, don't need a whole frame to themselves.
+// data_link_tx_queued holds on to a packet in case more come along for the
+// same next hop, and sends them all in one frame. The frame goes out when
+// it's full, when something for another next hop comes along, or when the
+// radio has nothing else for us: data_link_poll finding nothing, or
+// data_link_rx waiting DATA_LINK_AGGREGATE_WAIT_MS without anything showing
+// up. The payload is copied, so the frame can be reused right away.
+#define DATA_LINK_AGGREGATE_WAIT_MS (5)
+
+// Once there's less room than this left, there's no point waiting for more.
+// It's the size of an ACK packet.
+#define DATA_LINK_AGGREGATE_MIN_ROOM (PACKET_HEADER_LEN + ACK_SEGMENT_HEARDER_LEN)
+
+data_link_tx_result data_link_tx_queued(byte* frame, byte payload_len, uint32_t addr);
+
+// Send whatever data_link_tx_queued is holding on to, right now.
+data_link_tx_result data_link_flush(void);
+
+// Also listen on this address, for frames meant for more than one node.
+// Returns false if the radio can't listen on any more addresses.
+bool data_link_listen_on(uint32_t addr);
+
+// Which pipe the last frame from data_link_rx or data_link_poll came in on.
+// 0 means it was sent to us in particular.
+byte data_link_last_rx_pipe(void);
+
+// Transmit a frame to an address any number of nodes might be listening on
+// with data_link_listen_on. Nobody acks it, so success just means it went out.
+data_link_tx_result data_link_broadcast(byte* frame, byte payload_len, uint32_t addr);
+
+// Have the radio send this frame back with its acknowledgement of the next
+// frame it receives. Only the node that sent that frame will see it.
+void data_link_set_ack_frame(byte* frame, byte payload_len);
+
+// Stop sending the ack frame, if it hasn't gone out yet.
+void data_link_clear_ack_frame(void);
+
+// Whether the ack frame has gone out since data_link_set_ack_frame.
+bool data_link_ack_frame_sent(void);
+
+// The most frames data_link_tx_burst takes at once.
+#define DATA_LINK_TX_BURST_MAX (8)
+
+// Transmit several frame_buffer_t's to the same address back-to-back.
+// Returns a bitmap: bit i is set if frames[i] was delivered.
+byte data_link_tx_burst(byte** frames, byte* payload_lens, byte count, uint32_t addr);
+
+// With DATA_LINK_FEC (networking_constants.h), every DATA_LINK_FEC_GROUP
+// frames of a burst are followed by a parity frame: all of them XORed
+// together. A receiver that's missing one frame of the group rebuilds it from
+// the others and the parity frame, and data_link_rx or data_link_poll hands
+// it over as if it had come in last. A frame the next hop never acked counts
+// as delivered if it was the only one in its group and the parity frame got
+// through. Only bursts have parity frames, since all of a burst's packets
+// come from us: the parity frame names that sender, and a receiver only
+// counts that sender's frames in the group, so other nodes' frames in
+// between don't get mixed in.
+#define DATA_LINK_FEC_GROUP (4)
+
+// What the data link layer has done since data_link_reset_stats. The counts
+// wrap around.
+typedef struct {
+    uint16_t frames_sent;       // broadcasts and bursts included
+    uint16_t frames_failed;     // the next hop never acked
+    uint16_t frames_received;
+    uint16_t rx_errors;
+    uint16_t packets_queued;    // through data_link_tx_queued, to share a frame
+    uint16_t packets_unpacked;  // that came in behind another packet in a frame
+    uint16_t fec_parity_sent;   // parity frames, with DATA_LINK_FEC
+    uint16_t fec_covered;       // frames the next hop can rebuild without an ack
+    uint16_t fec_rebuilt;       // frames we rebuilt from a parity frame
+} data_link_stats_t;
+
+data_link_stats_t data_link_get_stats(void);
+void data_link_reset_stats(void);
 
 #endif
\ No newline at end of file
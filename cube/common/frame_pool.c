@@ -0,0 +1,38 @@
+#include "frame_pool.h"
+#include "node_state.h"
+
+#if FRAME_POOL_LEN > 8
+#error "FRAME_POOL_LEN can't be more than 8."
+#endif
+
+NODE_STATE frame_buffer_t pool[FRAME_POOL_LEN];
+
+// Bit i is set if pool[i] is handed out.
+NODE_STATE byte in_use = 0;
+
+byte frame_pool_alloc(void) {
+    for (byte i = 0; i < FRAME_POOL_LEN; i++) {
+        if (!(in_use & (1 << i))) {
+            in_use |= (1 << i);
+            return i;
+        }
+    }
+    return FRAME_POOL_NONE;
+}
+
+void frame_pool_free(byte index) {
+    if (index >= FRAME_POOL_LEN) return;
+    in_use &= ~(1 << index);
+}
+
+byte* frame_pool_frame(byte index) {
+    return pool[index];
+}
+
+byte frame_pool_available(void) {
+    byte available = 0;
+    for (byte i = 0; i < FRAME_POOL_LEN; i++) {
+        if (!(in_use & (1 << i))) available++;
+    }
+    return available;
+}
@@ -0,0 +1,39 @@
+#ifndef _FRAME_POOL_H
+#define _FRAME_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "networking_constants.h"
+
+/*
+    A fixed set of frame_buffer_t's to hand out, for frames that have to
+    outlive the function that got them, like packets a relay is holding on
+    to until it can forward them. All of it is allocated up front, so how
+    much SRAM it takes is known at compile time: FRAME_POOL_LEN frames of
+    MAX_FRAME_LEN bytes, plus a byte.
+
+    Frames are handed out by index, which is what the lists that keep track
+    of them use to point at each other.
+*/
+
+// Must be 8 or less.
+#ifndef FRAME_POOL_LEN
+#define FRAME_POOL_LEN (4)
+#endif
+
+#define FRAME_POOL_NONE (0xFF)
+
+// Take a frame out of the pool. Returns FRAME_POOL_NONE if they're all in
+// use.
+byte frame_pool_alloc(void);
+
+// Put a frame back.
+void frame_pool_free(byte index);
+
+// The frame itself.
+byte* frame_pool_frame(byte index);
+
+// How many frames are left.
+byte frame_pool_available(void);
+
+#endif
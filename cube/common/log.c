@@ -1,31 +1,107 @@
 #include "log.h"
 #include "uart.h"
+#include "idle.h"
 
+#include <avr/io.h>
+#include <avr/interrupt.h>
 #include <avr/eeprom.h>
 
 /*
     EEPROM Layout
 
-    eeprom[0]           = initialization identifier; if not 0x77, needs init
-    eeprom[1..2]        = message count; used to determine next message slot
-    eeprom[2..63]       = <reserved>
+    eeprom[0]           = initialization identifier; if not LOG_IDENTIFIER, needs init
+    eeprom[1..2]        = <reserved> (used to be the message count)
+    eeprom[3..4]        = radio channel, and its complement (see channel.c)
+    eeprom[5..7]        = <reserved>
+    eeprom[8..15]       = what's in the stream store (see stream_store.c)
+    eeprom[16..63]      = <reserved>
+
+    eeprom[64..511]     = the log, LOG_BLOCK_COUNT blocks of LOG_BLOCK_LEN bytes
+    eeprom[512..1023]   = the stream store
+
+    The split between the log and the stream store is LOG_EEPROM_END.
+
+    The log is append-only. Each message is one record, starting at the block
+    after the last one, and taking as many blocks as it needs:
+
+    record[0]           = LOG_RECORD_MARK if this block starts a record
+    record[1..2]        = sequence number, low byte first
+    record[3]           = source address of the message
+    record[4]           = length of the message, n
+    record[5..n+4]      = the message
+    record[n+5]         = CRC-8 of record[1..n+4]
+
+    When a record doesn't fit before the end of the log, it goes at the start
+    instead, over the oldest records. Every cell gets written about as often
+    as every other, and nothing is rewritten on every message the way the
+    message count used to be.
+
+    Nothing keeps track of where the newest record is. At startup, init_log
+    walks the blocks; a record is good if its mark and CRC check out, and the
+    newest is the one with the highest sequence number. A record that was
+    only partly written when the power went, or partly written over, fails
+    its CRC and is skipped. The mark is written last so that a record isn't
+    there at all until the rest of it is.
+
+    Writes
+
+    Each EEPROM byte takes about 3.4 ms to write, so log_message doesn't wait
+    for them. It puts the record into a RAM ring and returns, and the EEPROM
+    ready interrupt writes the ring out a byte at a time in the background,
+    skipping bytes that already hold the right value. log_message only waits
+    if the ring fills up.
+
+    Whatever's still in the ring is lost if the power goes. There's no
+    warning before a brownout reset on the ATmega328P, so log_flush is the
+    hook: call it before anything that's known to be coming (a reset, going
+    to sleep, turning the power off) and before touching the EEPROM any other
+    way. A record that was cut off is skipped at startup like any other.
+*/
 
-    eeprom[64]          = source address of message in slot 0
-    eeprom[65..66]      = length of message in slot 0
-    eeprom[67..127]     = <reserved>
+#define LOG_IDENTIFIER (0x78)
 
-    eeprom[128]         = source address of message in slot 1
-    eeprom[129..130]    = length of message in slot 1
-    eeprom[131..191]    = <reserved>
+#define LOG_START (64)
+#define LOG_END (LOG_EEPROM_END)
+#define LOG_BLOCK_LEN (16)
+#define LOG_BLOCK_COUNT ((LOG_END - LOG_START) / LOG_BLOCK_LEN)
 
-    eeprom[192]         = source address of message in slot 2
-    eeprom[193..194]    = length of message in slot 2
-    eeprom[195..255]    = <reserved>
+#define LOG_RECORD_MARK (0x5A)
+#define LOG_RECORD_HEADER_LEN (5)
+#define LOG_RECORD_BLOCKS(message_len) ((LOG_RECORD_HEADER_LEN + (message_len) + 1 + LOG_BLOCK_LEN - 1) / LOG_BLOCK_LEN)
 
-    eeprom[256..511]    = message slot 0
-    eeprom[512..767]    = message slot 1
-    eeprom[768..1023]   = message slot 2
-*/
+#define LOG_BLOCK_NONE (0xFF)
+
+// How many messages print_log prints.
+#define LOG_PRINT_COUNT (3)
+
+// Where the next record goes, and its sequence number.
+static uint8_t next_block = 0;
+static uint16_t next_sequence = 0;
+
+// Bytes waiting to be written. Only the interrupt moves write_ring_tail, and
+// only log_message moves write_ring_head. They count up forever and wrap
+// around, like the rings in uart.c.
+static byte write_ring[LOG_WRITE_RING_LEN];
+static volatile uint8_t write_ring_head = 0;
+static volatile uint8_t write_ring_tail = 0;
+
+#if (LOG_WRITE_RING_LEN & (LOG_WRITE_RING_LEN - 1)) != 0 || LOG_WRITE_RING_LEN > 128
+#error "LOG_WRITE_RING_LEN must be a power of two, no more than 128."
+#endif
+
+// Records being written. The bytes after the mark come through the ring in
+// order; once there are none left, the mark goes in.
+typedef struct {
+    uint16_t addr;      // where the next byte from the ring goes
+    uint16_t remaining; // how many more bytes from the ring are this record's
+    uint16_t mark_addr;
+} log_pending_record_t;
+
+#define LOG_PENDING_RECORDS (2)
+
+static volatile log_pending_record_t pending[LOG_PENDING_RECORDS];
+static volatile uint8_t pending_head = 0;
+static volatile uint8_t pending_tail = 0;
 
 
 
@@ -35,54 +111,92 @@
 
 // ---------------- Private functions -------------
 
-uint16_t get_message_count() {
-    return (eeprom_read_byte((uint8_t*)1) << 8) + (eeprom_read_byte((uint8_t*)2) << 0);
+static uint8_t* block_addr(uint8_t block) {
+    return (uint8_t*) (LOG_START + (uint16_t) block * LOG_BLOCK_LEN);
 }
 
-void set_message_count(uint16_t count) {
-    uint8_t top = (count & 0xFF00) >> 8;
-    uint8_t bot = (count & 0x00FF) >> 0;
-    eeprom_update_byte((uint8_t*)1, top);
-    eeprom_update_byte((uint8_t*)2, bot);
-    return;
+// CRC-8, polynomial 0x07.
+static uint8_t crc8_update(uint8_t crc, uint8_t data) {
+    crc ^= data;
+    for (uint8_t i = 0; i < 8; i++) {
+        crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+    }
+    return crc;
 }
 
-uint8_t get_message_source(uint8_t slot) {
-    size_t addr = 64*(slot+1);
-    return eeprom_read_byte((uint8_t*)addr);
-}
+// If a good record starts at this block, fill in its header and return
+// true.
+static bool read_record(uint8_t block, uint8_t* header) {
 
-void set_message_source(uint8_t source, uint8_t slot) {
-    size_t addr = 64*(slot+1);
-    eeprom_update_byte((uint8_t*)addr, source);
-    return;
+    uint8_t* addr = block_addr(block);
+    eeprom_read_block(header, addr, LOG_RECORD_HEADER_LEN);
+    if (header[0] != LOG_RECORD_MARK) return false;
+
+    uint8_t len = header[4];
+    if (block + LOG_RECORD_BLOCKS(len) > LOG_BLOCK_COUNT) return false;
+
+    uint8_t crc = 0;
+    for (uint8_t i = 1; i < LOG_RECORD_HEADER_LEN; i++) crc = crc8_update(crc, header[i]);
+    addr += LOG_RECORD_HEADER_LEN;
+    for (uint8_t i = 0; i < len; i++) crc = crc8_update(crc, eeprom_read_byte(addr++));
+
+    return crc == eeprom_read_byte(addr);
 }
 
-uint16_t get_message_len(uint8_t slot) {
-    size_t top_addr = 64*(slot+1) + 1;
-    size_t bot_addr = top_addr + 1;
-    return (eeprom_read_byte((uint8_t*)top_addr) << 8) + (eeprom_read_byte((uint8_t*)bot_addr) << 0);
+static uint16_t record_sequence(uint8_t* header) {
+    return header[1] | (header[2] << 8);
 }
 
-void set_message_len(uint16_t len, uint8_t slot) {
-    size_t top_addr = 64*(slot+1) + 1;
-    size_t bot_addr = top_addr + 1;
-    uint8_t top = (len & 0xFF00) >> 8;
-    uint8_t bot = (len & 0x00FF) >> 0;
-    eeprom_update_byte((uint8_t*)top_addr, top);
-    eeprom_update_byte((uint8_t*)bot_addr, bot);
-    return;
+// The block the record with this sequence number starts at, or
+// LOG_BLOCK_NONE.
+static uint8_t find_record(uint16_t sequence, uint8_t* header) {
+    for (uint8_t block = 0; block < LOG_BLOCK_COUNT; ) {
+        if (read_record(block, header)) {
+            if (record_sequence(header) == sequence) return block;
+            block += LOG_RECORD_BLOCKS(header[4]);
+        }
+        else block++;
+    }
+    return LOG_BLOCK_NONE;
 }
 
-void get_message(byte* buffer, uint16_t buf_len, uint8_t slot) {
-    size_t base_addr = 256*(slot+1);
-    eeprom_read_block(buffer, (void*)base_addr, buf_len); // void pointer ???? not on my christian minecraft server
-    return;
+// Hand a byte to the interrupt, waiting for room if there isn't any. The
+// EEPROM interrupt makes room, and wakes us up when it does.
+static void write_byte(byte data) {
+    IDLE_UNTIL((uint8_t) (write_ring_head - write_ring_tail) < LOG_WRITE_RING_LEN);
+    write_ring[write_ring_head & (LOG_WRITE_RING_LEN - 1)] = data;
+    write_ring_head++;
+    EECR |= _BV(EERIE);
 }
 
-void set_message(byte* message, uint16_t message_len, uint8_t slot) {
-    size_t base_addr = 256*(slot+1);
-    eeprom_update_block(message, (void*)base_addr, message_len);
+// Find where the newest record ends.
+static void find_head(void) {
+
+    uint8_t header[LOG_RECORD_HEADER_LEN];
+    bool found = false;
+
+    next_block = 0;
+    next_sequence = 0;
+
+    for (uint8_t block = 0; block < LOG_BLOCK_COUNT; ) {
+        if (!read_record(block, header)) {
+            block++;
+            continue;
+        }
+        uint8_t blocks = LOG_RECORD_BLOCKS(header[4]);
+        uint16_t sequence = record_sequence(header);
+
+        // Sequence numbers wrap, but all the ones in the log are close
+        // together.
+        if (!found || (int16_t) (sequence - next_sequence) >= 0) {
+            found = true;
+            next_sequence = sequence + 1;
+            next_block = block + blocks;
+        }
+        block += blocks;
+    }
+
+    if (next_block >= LOG_BLOCK_COUNT) next_block = 0;
     return;
 }
 
@@ -96,62 +210,157 @@ void set_message(byte* message, uint16_t message_len, uint8_t slot) {
 
 void log_message(byte* message, uint16_t message_len, uint8_t message_source) {
 
-    // What is our message count?
-    uint16_t message_count = get_message_count();
-
-    // Get what the next available slot is.
-    uint8_t next_slot = message_count % 3;
+    if (message_len > LOG_MAX_MESSAGE_LEN) message_len = LOG_MAX_MESSAGE_LEN;
+
+    uint8_t blocks = LOG_RECORD_BLOCKS(message_len);
+    if (next_block + blocks > LOG_BLOCK_COUNT) next_block = 0;
+
+    uint8_t header[LOG_RECORD_HEADER_LEN];
+    header[0] = LOG_RECORD_MARK;
+    header[1] = next_sequence & 0xFF;
+    header[2] = next_sequence >> 8;
+    header[3] = message_source;
+    header[4] = message_len;
+
+    // Wait for one of the records being written to finish, if it has to.
+    IDLE_UNTIL((uint8_t) (pending_head - pending_tail) < LOG_PENDING_RECORDS);
+
+    // Everything but the mark goes through the ring, then the interrupt
+    // writes the mark.
+    uint16_t addr = (uint16_t) block_addr(next_block);
+    volatile log_pending_record_t* record = &pending[pending_head & (LOG_PENDING_RECORDS - 1)];
+    record->addr = addr + 1;
+    record->remaining = LOG_RECORD_HEADER_LEN - 1 + message_len + 1;
+    record->mark_addr = addr;
+    pending_head++;
+
+    uint8_t crc = 0;
+    for (uint8_t i = 1; i < LOG_RECORD_HEADER_LEN; i++) {
+        crc = crc8_update(crc, header[i]);
+        write_byte(header[i]);
+    }
+    for (uint8_t i = 0; i < message_len; i++) {
+        crc = crc8_update(crc, message[i]);
+        write_byte(message[i]);
+    }
+    write_byte(crc);
 
-    // Let's log the info.
-    set_message_count(message_count + 1);
-    set_message_source(message_source, next_slot);
-    set_message_len(message_len, next_slot);
-    set_message(message, message_len, next_slot);
+    next_block += blocks;
+    if (next_block >= LOG_BLOCK_COUNT) next_block = 0;
+    next_sequence++;
 
     return;
 }
 
 void print_log() {
 
-    char message_buf[256];
+    char message_buf[LOG_PRINT_CHUNK_LEN + 1];
+    uint8_t header[LOG_RECORD_HEADER_LEN];
 
-    uart_transmit_formatted_message("::: Log of Messages :::\r\n");
-    UART_WAIT_UNTIL_DONE();
+    log_flush();
 
-    // What is our message count?
-    uint16_t message_count = get_message_count();
-    uart_transmit_formatted_message("This cube has received %d messages.\r\n\r\n", message_count);
+    uart_transmit_formatted_message_P(PSTR("::: Log of Messages :::\r\n"));
     UART_WAIT_UNTIL_DONE();
 
-
-    // Get what the next available slot is.
-    uint8_t slot = message_count % 3;
-
+    // The sequence numbers start at 0, so the next one is how many messages
+    // there have been.
+    uart_transmit_formatted_message_P(PSTR("This cube has received %u messages.\r\n\r\n"), next_sequence);
+    UART_WAIT_UNTIL_DONE();
 
     // Print the latest messages in the log.
-    for (int i = 0; i < 3 && message_count > i; i++) {
-        slot = (slot == 0 ? 2 : slot - 1);
+    for (uint16_t i = 1; i <= LOG_PRINT_COUNT && i <= next_sequence; i++) {
 
-        uart_transmit_formatted_message("===== Logged message from %02x =====\r\n", get_message_source(slot));
-        UART_WAIT_UNTIL_DONE();
+        uint8_t block = find_record(next_sequence - i, header);
+        if (block == LOG_BLOCK_NONE) break; // written over
 
-        get_message(message_buf, 256, slot);
-        message_buf[255] = '\0'; // force null termination just in case
-        uart_transmit_formatted_message(message_buf);
+        uart_transmit_formatted_message_P(PSTR("===== Logged message from %02x =====\r\n"), header[3]);
         UART_WAIT_UNTIL_DONE();
 
-        uart_transmit_formatted_message("====================================\r\n\r\n");
+        // A piece at a time, so the whole message doesn't have to fit in RAM.
+        uint8_t* addr = block_addr(block) + LOG_RECORD_HEADER_LEN;
+        uint8_t remaining = header[4];
+        while (remaining > 0) {
+            uint8_t len = remaining < LOG_PRINT_CHUNK_LEN ? remaining : LOG_PRINT_CHUNK_LEN;
+            eeprom_read_block(message_buf, addr, len);
+            message_buf[len] = '\0';
+            uart_transmit_formatted_message_P(PSTR("%s"), message_buf);
+            UART_WAIT_UNTIL_DONE();
+            addr += len;
+            remaining -= len;
+        }
+
+        uart_transmit_formatted_message_P(PSTR("\r\n====================================\r\n\r\n"));
         UART_WAIT_UNTIL_DONE();
     }
 
     return;
 }
 
+void log_flush(void) {
+    IDLE_UNTIL(pending_head == pending_tail);
+    return;
+}
+
 void init_log() {
     uint8_t identifier = eeprom_read_byte((uint8_t*)0);
-    if (identifier != 0x77) {
-        eeprom_write_byte((uint8_t*)0, 0x77);
-        set_message_count(0);
+    if (identifier != LOG_IDENTIFIER) {
+        // Knock out anything that looks like a record, including whatever the
+        // old layout left behind.
+        for (uint8_t block = 0; block < LOG_BLOCK_COUNT; block++) {
+            eeprom_update_byte(block_addr(block), 0xFF);
+        }
+        eeprom_write_byte((uint8_t*)0, LOG_IDENTIFIER);
     }
+    find_head();
     return;
 }
+
+
+
+
+
+
+
+// ---------------- Interrupt handlers -------------
+
+// EEPROM ready. Starts writing the next byte, or turns itself off once
+// there's nothing to write.
+ISR(EE_READY_vect) {
+
+    if (pending_head == pending_tail) {
+        EECR &= ~_BV(EERIE);
+        return;
+    }
+
+    volatile log_pending_record_t* record = &pending[pending_tail & (LOG_PENDING_RECORDS - 1)];
+    uint16_t addr;
+    byte data;
+
+    if (record->remaining > 0) {
+        // log_message hasn't gotten this far yet. It turns the interrupt
+        // back on when it puts in another byte.
+        if (write_ring_head == write_ring_tail) {
+            EECR &= ~_BV(EERIE);
+            return;
+        }
+        data = write_ring[write_ring_tail & (LOG_WRITE_RING_LEN - 1)];
+        write_ring_tail++;
+        addr = record->addr++;
+        record->remaining--;
+    }
+    else {
+        data = LOG_RECORD_MARK;
+        addr = record->mark_addr;
+        pending_tail++;
+    }
+
+    // Like eeprom_update_byte, leave it alone if it's already right. The
+    // interrupt comes right back, since nothing is being written.
+    EEAR = addr;
+    EECR |= _BV(EERE);
+    if (EEDR == data) return;
+
+    EEDR = data;
+    EECR |= _BV(EEMPE);
+    EECR |= _BV(EEPE);
+}
@@ -2,17 +2,42 @@
 #define _LOG_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "networking_constants.h"
 
+// Longer messages are cut off.
+#define LOG_MAX_MESSAGE_LEN (255)
+
+// How much of a message print_log reads into RAM at a time.
+#define LOG_PRINT_CHUNK_LEN (32)
+
+// The log gets the EEPROM from address 64 up to here. The rest is where
+// stream_store.c keeps a large message.
+#ifndef LOG_EEPROM_END
+#define LOG_EEPROM_END (512)
+#endif
+
+// How many bytes can be waiting to be written to the EEPROM. log_message
+// returns right away for messages up to this long, less 5 bytes of record.
+#ifndef LOG_WRITE_RING_LEN
+#define LOG_WRITE_RING_LEN (128)
+#endif
+
 // Store a message in the EEPROM.
-// To avoid excessive EEPROM writes, this function stores messages
-// similar to a circular buffer.
+// Messages are appended to a log that wraps around over the oldest ones, so
+// the writes are spread evenly over the EEPROM. See log.c.
 void log_message(byte* message, uint16_t message_len, uint8_t message_source);
 
+// Wait until everything log_message was given is in the EEPROM. Call this
+// before a reset or power down, and before anything else reads or writes
+// the EEPROM.
+void log_flush(void);
+
 // Print the last three stored messages.
 void print_log();
 
-// Completely erase the log.
+// Find the end of the log, or set it up if it's never been. Call this before
+// the others.
 void init_log();
 
 #endif
@@ -0,0 +1,61 @@
+#ifndef _LOG_LEVEL_H
+#define _LOG_LEVEL_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Log Level
+//
+// Debug output that can be compiled out. Each module prints through these
+// macros with a level, and anything below that module's level never makes it
+// into the build, strings and all. A flight build can set LOG_LEVEL to
+// LOG_LEVEL_OFF to drop all of it.
+//
+// Set LOG_LEVEL, or one module's level, here or with -D on the command line.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#define LOG_LEVEL_TRACE (0) // every attempt at everything
+#define LOG_LEVEL_DEBUG (1) // every frame and segment
+#define LOG_LEVEL_INFO  (2) // things worth knowing, like timeouts
+#define LOG_LEVEL_WARN  (3) // things going wrong
+#define LOG_LEVEL_OFF   (4)
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// Each module prints at this level and up.
+#ifndef LOG_MODULE_TRX
+#define LOG_MODULE_TRX LOG_LEVEL
+#endif
+#ifndef LOG_MODULE_DATA_LINK
+#define LOG_MODULE_DATA_LINK LOG_LEVEL
+#endif
+#ifndef LOG_MODULE_NETWORK
+#define LOG_MODULE_NETWORK LOG_LEVEL
+#endif
+#ifndef LOG_MODULE_TRANSPORT
+#define LOG_MODULE_TRANSPORT LOG_LEVEL
+#endif
+
+#ifndef SIMULATION
+#include "uart.h"
+// The format strings stay in flash.
+#define LOG_PRINT(format, ...) uart_transmit_formatted_message_P(PSTR(format), ##__VA_ARGS__)
+#else
+#include <stdio.h>
+#define LOG_PRINT(...) printf(__VA_ARGS__)
+#endif
+
+// Whether a module prints at a level, for output that doesn't go through
+// LOG_PRINT. For example, if (LOG_ENABLED(DEBUG, NETWORK)) print_packet(p);
+#define LOG_ENABLED(level, module) (LOG_LEVEL_##level >= LOG_MODULE_##module)
+
+// LOG_WARN(TRX, "[WARNING] Lost %d\r\n", count);
+#define LOG_AT(level, module, ...) do { if (LOG_ENABLED(level, module)) LOG_PRINT(__VA_ARGS__); } while (0)
+#define LOG_TRACE(module, ...) LOG_AT(TRACE, module, __VA_ARGS__)
+#define LOG_DEBUG(module, ...) LOG_AT(DEBUG, module, __VA_ARGS__)
+#define LOG_INFO(module, ...)  LOG_AT(INFO,  module, __VA_ARGS__)
+#define LOG_WARN(module, ...)  LOG_AT(WARN,  module, __VA_ARGS__)
+
+#endif
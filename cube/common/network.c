@@ -3,102 +3,559 @@
 #include "data_link.h"
 #include "address.h"
 #include "routing_table.h"
-#include "digital_io.h"
+#include "route_discovery.h"
+#include "frame_pool.h"
+#include "log_level.h"
+#include "node_state.h"
 
 #ifndef SIMULATION
 #include "cube_parameters.h"
+#include "digital_io.h"
 #include "print_data.h"
 #include "uart.h"
-#include <util/delay.h>
+#include "timer.h"
+#define NETWORK_NOW_MS() timer_now_ms()
 #else
+#include "sim_trx.h"
 #include "sim_delay.h"
 #include <stdio.h>
 #include "sim_print_data.h"
+#define NETWORK_NOW_MS() ((uint16_t) (sim_now_us() / 1000))
+#define LED_blink(color)
 #endif
 
 #define NETWORK_DELAY_MS (1)
 
+// How many (source, packet ID) pairs every node remembers. When a radio ack
+// gets lost, the same packet comes in again, and it shouldn't be forwarded or
+// delivered twice. The transport layer's own retransmissions get new IDs, so
+// they still get through and get acked.
+#define NETWORK_DUPLICATE_CACHE_LEN (8)
+
+NODE_STATE network_forward_counts_t forward_counts = { 0, 0, 0, 0, 0, 0, 0 };
+
+NODE_STATE byte next_packet_id = 0;
+
+// Most recently seen first.
+NODE_STATE byte seen_src[NETWORK_DUPLICATE_CACHE_LEN];
+NODE_STATE byte seen_id[NETWORK_DUPLICATE_CACHE_LEN];
+NODE_STATE byte seen_count = 0;
+
+// Whether we've already had this packet. If we haven't, now we have.
+static bool network_seen_before(byte* packet) {
+
+    byte i;
+    for (i = 0; i < seen_count; i++) {
+        if (seen_src[i] == packet[2] && seen_id[i] == packet[3]) break;
+    }
+    bool seen = i < seen_count;
+
+    // Move it (or the new one) to the front, and let the oldest fall off.
+    if (!seen && seen_count < NETWORK_DUPLICATE_CACHE_LEN) seen_count++;
+    if (i >= seen_count) i = seen_count - 1;
+    for (; i > 0; i--) {
+        seen_src[i] = seen_src[i - 1];
+        seen_id[i] = seen_id[i - 1];
+    }
+    seen_src[0] = packet[2];
+    seen_id[0] = packet[3];
+
+    if (seen) forward_counts.duplicates++;
+    return seen;
+}
+
+static void network_write_header(byte* packet, byte packet_len, byte dest_network_addr, byte src_network_addr, byte priority) {
+    packet[0] = packet_len;
+    packet[1] = dest_network_addr;
+    packet[2] = src_network_addr;
+    packet[3] = next_packet_id++;
+    packet[4] = NETWORK_DEFAULT_TTL | priority;
+}
+
 // packet[0] = length of packet
 // packet[1] = final destination network address
 // packet[2] = original source network address
-// rest is payload
+// packet[3] = packet ID, which counts up with every packet the source sends
+// packet[4] = hop limit and flags
+// rest is payload, then the hop trace if PACKET_FLAG_HOP_TRACE is set
+
+#if NETWORK_HOP_TRACE
+// The hop trace is a list of (address, milliseconds held) pairs, with how
+// many there are in the very last byte of the packet. It keeps the pairs it
+// has once it runs out of room.
+
+// The source starts the list. There's always room, since the transport layer
+// leaves NETWORK_HOP_TRACE_RESERVE bytes free.
+static void network_hop_trace_start(byte* packet) {
+    byte len = packet[0];
+    if (len + 3 > MAX_PACKET_LEN) return;
+    packet[len] = MY_NETWORK_ADDR;
+    packet[len + 1] = 0;
+    packet[len + 2] = 1;
+    packet[0] = len + 3;
+    packet[4] |= PACKET_FLAG_HOP_TRACE;
+}
+
+static void network_hop_trace_add(byte* packet, uint16_t received_ms) {
+    if (!(packet[4] & PACKET_FLAG_HOP_TRACE)) return;
+
+    byte len = packet[0];
+    if (len + 2 > MAX_PACKET_LEN) return;
+
+    uint16_t held_ms = NETWORK_NOW_MS() - received_ms;
+    byte hops = packet[len - 1];
+    packet[len - 1] = MY_NETWORK_ADDR;
+    packet[len] = held_ms > 0xFF ? 0xFF : (byte) held_ms;
+    packet[len + 1] = hops + 1;
+    packet[0] = len + 2;
+}
+#endif
+
+// Take the hop trace off a packet that got where it was going, so the layer
+// above never sees it, and trace where the time went.
+static void network_hop_trace_finish(byte* packet) {
+    if (!(packet[4] & PACKET_FLAG_HOP_TRACE)) return;
+
+    byte len = packet[0];
+    byte hops = packet[len - 1];
+    byte trailer_len = 2 * hops + 1;
+    if (trailer_len + PACKET_HEADER_LEN > len) return;
+
+    byte* hop = &packet[len - trailer_len];
+    for (byte i = 0; i < hops; i++, hop += 2) {
+        if (LOG_ENABLED(DEBUG, NETWORK)) print_trace(TRACE_HOP, packet[2], packet[1], hop[0], hop[1]);
+    }
+
+    packet[0] = len - trailer_len;
+    packet[4] &= ~PACKET_FLAG_HOP_TRACE;
+}
+
+// The fast path for packets that are just passing through. The frame goes
+// back out exactly as it came in, with nothing copied or rebuilt and nothing
+// printed, to wherever the routing table says it goes next. Only packets
+// small enough to share a frame, like acks, wait in the data link queue.
+// The only things that change are the hop limit and, with NETWORK_HOP_TRACE,
+// the hop trace. Returns whether anything was sent.
+static bool network_forward(byte* frame, uint16_t received_ms) {
+
+    byte* packet = FRAME_PACKET(frame);
+    byte next_hop_addr = routing_table(packet[1]);
+
+    if (next_hop_addr == NETWORK_ADDR_NONE || next_hop_addr == MY_NETWORK_ADDR) {
+        forward_counts.dropped++;
+        return false;
+    }
+
+    // Probably going around in circles.
+    if ((packet[4] & PACKET_TTL_MASK) <= 1) {
+        forward_counts.expired++;
+        return false;
+    }
+    packet[4]--;
+
+#if NETWORK_HOP_TRACE
+    network_hop_trace_add(packet, received_ms);
+#else
+    (void) received_ms;
+#endif
+
+    if (LOG_ENABLED(TRACE, NETWORK)) print_trace_packet(TRACE_FORWARD, packet);
+
+    data_link_tx_result result;
+    if (packet[0] < DATA_LINK_AGGREGATE_MIN_ROOM) {
+        result = data_link_tx_queued(frame, packet[0], resolve_data_link_addr(next_hop_addr));
+    }
+    else {
+        result = data_link_tx(frame, packet[0], resolve_data_link_addr(next_hop_addr));
+    }
+
+    if (result == DATA_LINK_TX_FAILURE) forward_counts.failed++;
+    else forward_counts.forwarded++;
+    return true;
+}
+
+// Store and forward. While more frames are still waiting to be read, packets
+// to forward go into frames from the frame pool instead of out one by one as
+// they're read. That gets them out of the radio's receive ring quickly, so
+// the upstream node can keep sending, and lets the acks and control packets
+// among them go first. Each next hop has its own queue for each class, so
+// packets for the same next hop go out back to back, and each queue keeps
+// its own order.
+#define NETWORK_FORWARD_NEXT_HOPS (4)
+#define NETWORK_FORWARD_URGENT (0)
+#define NETWORK_FORWARD_DATA (1)
+#define NETWORK_FORWARD_CLASSES (2)
+
+typedef struct {
+    byte next_hop;                          // NETWORK_ADDR_NONE if unused
+    byte head[NETWORK_FORWARD_CLASSES];     // frame pool indexes
+    byte tail[NETWORK_FORWARD_CLASSES];
+} network_hop_queue_t;
+
+NODE_STATE network_hop_queue_t hop_queues[NETWORK_FORWARD_NEXT_HOPS];
+
+// For each frame in the pool that's waiting, the one after it in the same
+// queue, and when it came in.
+NODE_STATE byte queued_after[FRAME_POOL_LEN];
+NODE_STATE uint16_t queued_received_ms[FRAME_POOL_LEN];
+
+NODE_STATE byte queued_frames = 0;
+
+static byte network_forward_class(byte* packet) {
+    if ((packet[4] & PACKET_PRIORITY_MASK) == PACKET_PRIORITY_DATA) return NETWORK_FORWARD_DATA;
+    return NETWORK_FORWARD_URGENT;
+}
+
+// The queue for a next hop, or a new one. NULL if all of them are taken.
+static network_hop_queue_t* network_hop_queue(byte next_hop_addr) {
+    network_hop_queue_t* unused = NULL;
+    for (byte i = 0; i < NETWORK_FORWARD_NEXT_HOPS; i++) {
+        network_hop_queue_t* queue = &hop_queues[i];
+        if (queue->next_hop == next_hop_addr && queued_frames > 0) return queue;
+        if (unused == NULL && (queue->next_hop == NETWORK_ADDR_NONE || queued_frames == 0 ||
+            (queue->head[NETWORK_FORWARD_URGENT] == FRAME_POOL_NONE && queue->head[NETWORK_FORWARD_DATA] == FRAME_POOL_NONE))) {
+            unused = queue;
+        }
+    }
+    if (unused != NULL) {
+        unused->next_hop = next_hop_addr;
+        for (byte class = 0; class < NETWORK_FORWARD_CLASSES; class++) {
+            unused->head[class] = FRAME_POOL_NONE;
+            unused->tail[class] = FRAME_POOL_NONE;
+        }
+    }
+    return unused;
+}
+
+// Copy a packet into the pool to forward later. Returns false if there's no
+// room for it.
+static bool network_forward_store(byte* frame, uint16_t received_ms) {
+
+    byte* packet = FRAME_PACKET(frame);
+    byte next_hop_addr = routing_table(packet[1]);
+
+    network_hop_queue_t* queue = network_hop_queue(next_hop_addr);
+    if (queue == NULL) return false;
+
+    byte index = frame_pool_alloc();
+    if (index == FRAME_POOL_NONE) return false;
+
+    byte* stored = frame_pool_frame(index);
+    for (byte i = 0; i < MAX_FRAME_LEN; i++) stored[i] = frame[i];
+    queued_received_ms[index] = received_ms;
+    queued_after[index] = FRAME_POOL_NONE;
+
+    byte class = network_forward_class(packet);
+    if (queue->tail[class] == FRAME_POOL_NONE) queue->head[class] = index;
+    else queued_after[queue->tail[class]] = index;
+    queue->tail[class] = index;
+
+    queued_frames++;
+    return true;
+}
+
+// Send everything waiting in one class, one next hop at a time, oldest
+// first. Returns whether anything was sent.
+static bool network_forward_drain_class(byte class) {
+    bool sent = false;
+    for (byte i = 0; i < NETWORK_FORWARD_NEXT_HOPS && queued_frames > 0; i++) {
+        network_hop_queue_t* queue = &hop_queues[i];
+        if (queue->next_hop == NETWORK_ADDR_NONE) continue;
+
+        while (queue->head[class] != FRAME_POOL_NONE) {
+            byte index = queue->head[class];
+            queue->head[class] = queued_after[index];
+            if (queue->head[class] == FRAME_POOL_NONE) queue->tail[class] = FRAME_POOL_NONE;
+
+            sent |= network_forward(frame_pool_frame(index), queued_received_ms[index]);
+            frame_pool_free(index);
+            queued_frames--;
+        }
+    }
+    return sent;
+}
+
+// Send everything that's waiting, most urgent first.
+static bool network_forward_drain(void) {
+    if (queued_frames == 0) return false;
+    bool sent = network_forward_drain_class(NETWORK_FORWARD_URGENT);
+    sent |= network_forward_drain_class(NETWORK_FORWARD_DATA);
+    return sent;
+}
+
+// Forward a packet now, or store it if there are more frames to read first.
+// Anything waiting that's at least as urgent goes out before it.
+// Returns whether anything was sent.
+static bool network_forward_queued(byte* frame, uint16_t received_ms) {
+
+    if (data_link_rx_pending() && network_forward_store(frame, received_ms)) return false;
+
+    // Nothing's waiting behind it, or there's no room. Urgent packets don't
+    // wait for data, but data waits for everything.
+    bool sent = network_forward_drain_class(NETWORK_FORWARD_URGENT);
+    if (network_forward_class(FRAME_PACKET(frame)) == NETWORK_FORWARD_URGENT) {
+        sent |= network_forward(frame, received_ms);
+        sent |= network_forward_drain_class(NETWORK_FORWARD_DATA);
+    }
+    else {
+        sent |= network_forward_drain_class(NETWORK_FORWARD_DATA);
+        sent |= network_forward(frame, received_ms);
+    }
+    return sent;
+}
+
+network_forward_counts_t network_forward_counts(void) {
+    return forward_counts;
+}
+
+void network_reset_forward_counts(void) {
+    network_forward_counts_t none = { 0, 0, 0, 0, 0, 0, 0 };
+    forward_counts = none;
+}
 
-// This blocking function gets a payload from the network layer
-// and writes it to the buffer.
+// This blocking function gets a packet from the network layer
+// and leaves it in the frame buffer.
+// The payload ends up at FRAME_SEGMENT(frame).
 // It returns whether it successfully received a packet.
 // Note that the timeout will reset every time it receives a packet.
 // This behavior is as such because the programmer is lazy.
-network_rx_result network_rx(byte* buffer, byte buf_len, uint16_t timeout_ms) {
+network_rx_result network_rx(byte* frame, uint16_t timeout_ms) {
 
-    byte packet_len;
-    byte packet[MAX_PACKET_LEN];
+    byte* packet = FRAME_PACKET(frame);
 
     data_link_rx_result result;
 
     // Repeat this until we get something that's for me,
     // or until one of our things times out.
     while(true) {
-        uart_transmit_formatted_message("Trying to receive a packet.\r\n");
-        UART_WAIT_UNTIL_DONE();
+        LOG_TRACE(NETWORK, "Trying to receive a packet.\r\n");
+
+        // Caught up, so anything held back can go before we wait.
+        if (!data_link_rx_pending()) network_forward_drain();
 
-        result = data_link_rx(packet, MAX_PACKET_LEN, timeout_ms);
+        result = data_link_rx(frame, timeout_ms);
         if (result == DATA_LINK_RX_ERROR) {
-            uart_transmit_formatted_message("[WARNING] Error in network_rx\r\n");
-            UART_WAIT_UNTIL_DONE();
+            LOG_WARN(NETWORK, "[WARNING] Error in network_rx\r\n");
             return NETWORK_RX_ERROR;
         }
         if (result == DATA_LINK_RX_TIMEOUT) {
-            uart_transmit_formatted_message("[INFO] Timeout in network_rx\r\n");
-            UART_WAIT_UNTIL_DONE();
+            LOG_INFO(NETWORK, "[INFO] Timeout in network_rx\r\n");
             return NETWORK_RX_TIMEOUT;
         }
 
+        uint16_t received_ms = NETWORK_NOW_MS();
         LED_blink(LED_OFF);
 
-        uart_transmit_formatted_message("Received a packet: ");
-        UART_WAIT_UNTIL_DONE();
-        print_packet(packet);
+        if (LOG_ENABLED(DEBUG, NETWORK)) print_trace_packet(TRACE_FRAME_RX, packet);
+
+#if ROUTE_DISCOVERY
+        // Beacons stop here.
+        if (packet[1] == NETWORK_ADDR_BEACON) {
+            route_discovery_receive(packet);
+            continue;
+        }
+#endif
 
-        packet_len = packet[0];
+        if (packet[1] == NETWORK_ADDR_RESOLVE) {
+            address_resolution_receive(packet);
+            continue;
+        }
 
-        // Packet is for me. Copy data and return true.
+        if (network_seen_before(packet)) continue;
+
+        // Packet is for me. The payload is already where the caller wants it.
         if (packet[1] == MY_NETWORK_ADDR) {
-            for (byte i = 0; i < packet_len - PACKET_HEADER_LEN && i < buf_len; i++) {
-                buffer[i] = packet[i + PACKET_HEADER_LEN];
-            }
+            network_hop_trace_finish(packet);
+            forward_counts.delivered++;
             return NETWORK_RX_SUCCESS;
         }
 
-        // Packet is not for me. Forward it and try again.
-        network_tx(&packet[PACKET_HEADER_LEN], packet_len - PACKET_HEADER_LEN, packet[1], packet[2]);
+#ifdef MY_GROUP_ADDR
+        // Packet is for my group. Pass it on to the rest of the group first,
+        // then keep it.
+        if (packet[1] == MY_GROUP_ADDR) {
+            if (routing_table(packet[1]) != NETWORK_ADDR_NONE) network_forward_queued(frame, received_ms);
+            network_hop_trace_finish(packet);
+            forward_counts.delivered++;
+            return NETWORK_RX_SUCCESS;
+        }
+#endif
+
+        // Packet is not for me. Forward the same frame and try again.
+        network_forward_queued(frame, received_ms);
     }
 }
 
-// Transmit to the specified network address.
-network_tx_result network_tx(byte* payload, byte payload_len, byte dest_network_addr, byte src_network_addr) {
+// Start listening in the background. network_poll picks up the packets.
+void network_listen(void) {
+    data_link_listen();
+}
 
-    _delay_ms(NETWORK_DELAY_MS);
+// Check for a packet without waiting.
+// If one arrived that isn't for us, forward it and report that there was
+// nothing. The radio is left listening either way.
+network_rx_result network_poll(byte* frame) {
 
-    data_link_tx_result result;
-    byte packet_len = payload_len + PACKET_HEADER_LEN;
-    byte packet[packet_len];
+    byte* packet = FRAME_PACKET(frame);
 
-    packet[0] = packet_len;
-    packet[1] = dest_network_addr;
-    packet[2] = src_network_addr;
-    for (byte i = 0; i < payload_len && i < MAX_PACKET_LEN - PACKET_HEADER_LEN; i++) {
-        packet[i + PACKET_HEADER_LEN] = payload[i];
+    data_link_rx_result result = data_link_poll(frame);
+    if (result == DATA_LINK_RX_ERROR) return NETWORK_RX_ERROR;
+    if (result == DATA_LINK_RX_TIMEOUT) {
+        // Caught up, so anything held back can go now.
+        if (network_forward_drain()) network_listen();
+        return NETWORK_RX_TIMEOUT;
     }
-    byte next_hop_addr = routing_table(dest_network_addr);
+
+    uint16_t received_ms = NETWORK_NOW_MS();
+    if (LOG_ENABLED(DEBUG, NETWORK)) print_trace_packet(TRACE_FRAME_RX, packet);
+
+#if ROUTE_DISCOVERY
+    if (packet[1] == NETWORK_ADDR_BEACON) {
+        route_discovery_receive(packet);
+        return NETWORK_RX_TIMEOUT;
+    }
+#endif
+
+    if (packet[1] == NETWORK_ADDR_RESOLVE) {
+        address_resolution_receive(packet);
+        return NETWORK_RX_TIMEOUT;
+    }
+
+    if (network_seen_before(packet)) return NETWORK_RX_TIMEOUT;
+
+    if (packet[1] == MY_NETWORK_ADDR) {
+        network_hop_trace_finish(packet);
+        forward_counts.delivered++;
+        return NETWORK_RX_SUCCESS;
+    }
+
+#ifdef MY_GROUP_ADDR
+    if (packet[1] == MY_GROUP_ADDR) {
+        if (routing_table(packet[1]) != NETWORK_ADDR_NONE && network_forward_queued(frame, received_ms)) {
+            network_listen();
+        }
+        network_hop_trace_finish(packet);
+        forward_counts.delivered++;
+        return NETWORK_RX_SUCCESS;
+    }
+#endif
+
+    if (network_forward_queued(frame, received_ms)) network_listen();
+    return NETWORK_RX_TIMEOUT;
+}
+
+// Fill in the header of a packet about to go out, and return its length.
+byte network_prepare_packet(byte* frame, byte payload_len, byte dest_network_addr, byte src_network_addr, byte priority) {
+
+    byte* packet = FRAME_PACKET(frame);
+
+    if (payload_len > MAX_PACKET_LEN - PACKET_HEADER_LEN) {
+        payload_len = MAX_PACKET_LEN - PACKET_HEADER_LEN;
+    }
+    byte packet_len = payload_len + PACKET_HEADER_LEN;
+
+    network_write_header(packet, packet_len, dest_network_addr, src_network_addr, priority);
+#if NETWORK_HOP_TRACE
+    network_hop_trace_start(packet);
+    packet_len = packet[0];
+#endif
 
     LED_blink(LED_OFF);
-    uart_transmit_formatted_message("Transmitting a packet: ");
-    UART_WAIT_UNTIL_DONE();
-    print_packet(packet);
+    if (LOG_ENABLED(DEBUG, NETWORK)) print_trace_packet(TRACE_FRAME_TX, packet);
+    forward_counts.sent++;
+
+    return packet_len;
+}
 
-    result = data_link_tx(packet, packet_len, resolve_data_link_addr(next_hop_addr));
+// Transmit to the specified network address.
+// The payload is already in the frame, so we just fill in our header.
+network_tx_result network_tx(byte* frame, byte payload_len, byte dest_network_addr, byte src_network_addr, byte priority) {
+
+    timer_wait_ms(NETWORK_DELAY_MS);
+
+    data_link_tx_result result;
+    byte packet_len = network_prepare_packet(frame, payload_len, dest_network_addr, src_network_addr, priority);
+    byte next_hop_addr = routing_table(dest_network_addr);
+
+    result = data_link_tx(frame, packet_len, resolve_data_link_addr(next_hop_addr));
+
+    if (result == DATA_LINK_TX_FAILURE) return NETWORK_TX_FAILURE;
+
+    return NETWORK_TX_SUCCESS;
+}
+
+// Same as network_tx, but the data link layer can hold on to it
+// and share a frame with other packets for the same next hop.
+// Only acks go this way, so they get PACKET_PRIORITY_ACK.
+network_tx_result network_tx_queued(byte* frame, byte payload_len, byte dest_network_addr, byte src_network_addr) {
+
+    data_link_tx_result result;
+    byte packet_len = network_prepare_packet(frame, payload_len, dest_network_addr, src_network_addr, PACKET_PRIORITY_ACK);
+    byte next_hop_addr = routing_table(dest_network_addr);
+
+    result = data_link_tx_queued(frame, packet_len, resolve_data_link_addr(next_hop_addr));
 
     if (result == DATA_LINK_TX_FAILURE) return NETWORK_TX_FAILURE;
 
     return NETWORK_TX_SUCCESS;
 }
+
+// Whoever sends us the next frame gets this one back, so it had better be
+// the destination itself.
+bool network_set_ack_packet(byte* frame, byte payload_len, byte dest_network_addr, byte src_network_addr) {
+
+    if (routing_table(dest_network_addr) != dest_network_addr) return false;
+
+    byte* packet = FRAME_PACKET(frame);
+
+    if (payload_len > MAX_PACKET_LEN - PACKET_HEADER_LEN) {
+        payload_len = MAX_PACKET_LEN - PACKET_HEADER_LEN;
+    }
+    byte packet_len = payload_len + PACKET_HEADER_LEN;
+
+    network_write_header(packet, packet_len, dest_network_addr, src_network_addr, PACKET_PRIORITY_ACK);
+
+    data_link_set_ack_frame(frame, packet_len);
+    return true;
+}
+
+void network_clear_ack_packet(void) {
+    data_link_clear_ack_frame();
+}
+
+bool network_ack_packet_sent(void) {
+    return data_link_ack_frame_sent();
+}
+
+// Everything is going to the same place, so every frame has the same next hop.
+byte network_tx_burst(byte** frames, byte* payload_lens, byte count, byte dest_network_addr, byte src_network_addr) {
+
+    timer_wait_ms(NETWORK_DELAY_MS);
+
+    byte packet_lens[DATA_LINK_TX_BURST_MAX];
+    if (count > DATA_LINK_TX_BURST_MAX) count = DATA_LINK_TX_BURST_MAX;
+
+    LED_blink(LED_OFF);
+    for (byte i = 0; i < count; i++) {
+        byte* packet = FRAME_PACKET(frames[i]);
+        byte payload_len = payload_lens[i];
+
+        if (payload_len > MAX_PACKET_LEN - PACKET_HEADER_LEN) {
+            payload_len = MAX_PACKET_LEN - PACKET_HEADER_LEN;
+        }
+        packet_lens[i] = payload_len + PACKET_HEADER_LEN;
+
+        network_write_header(packet, packet_lens[i], dest_network_addr, src_network_addr, PACKET_PRIORITY_DATA);
+#if NETWORK_HOP_TRACE
+        network_hop_trace_start(packet);
+        packet_lens[i] = packet[0];
+#endif
+
+        // Print them all first so the printing doesn't hold up the burst.
+        if (LOG_ENABLED(DEBUG, NETWORK)) print_trace_packet(TRACE_FRAME_TX, packet);
+    }
+
+    forward_counts.sent += count;
+    byte next_hop_addr = routing_table(dest_network_addr);
+    return data_link_tx_burst(frames, packet_lens, count, resolve_data_link_addr(next_hop_addr));
+}
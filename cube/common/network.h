@@ -16,11 +16,62 @@ typedef enum {
     NETWORK_TX_FAILURE
 } network_tx_result;
 
+// What happened to the packets that were only passing through, and how many
+// started or ended here.
+typedef struct {
+    uint16_t sent;       // packets we were the source of
+    uint16_t delivered;  // packets for us (or our group) handed up
+    uint16_t forwarded;  // sent on to the next hop
+    uint16_t failed;     // the next hop never acked
+    uint16_t dropped;    // nowhere to send them
+    uint16_t expired;    // out of hops, probably stuck in a loop
+    uint16_t duplicates; // already seen, so not forwarded or delivered again
+} network_forward_counts_t;
+
 // This function blocks and waits until it receives a packet
 // destined for us. It might even forward packets while waiting.
 // How fun!
-network_rx_result network_rx(byte* buffer, byte buf_len, uint16_t timeout_ms);
+// The packet is received into a frame_buffer_t, and its
+// payload is left at FRAME_SEGMENT(frame).
+network_rx_result network_rx(byte* frame, uint16_t timeout_ms);
+
+// Leave the radio listening so network_poll can find packets.
+void network_listen(void);
+
+// Like network_rx, but it only looks at what has already arrived.
+// Packets that aren't for us are forwarded.
+// NETWORK_RX_TIMEOUT means nothing for us has arrived.
+network_rx_result network_poll(byte* frame);
+
+// The payload must already be at FRAME_SEGMENT(frame).
+// The network header is written in front of it, with priority
+// (PACKET_PRIORITY_DATA or PACKET_PRIORITY_CONTROL) for relays to go by.
+network_tx_result network_tx(byte* frame, byte payload_len, byte dest_network_addr, byte src_network_addr, byte priority);
+
+// Leave a packet for dest_network_addr to pick up the next time it sends us
+// something. It rides back on the data link acknowledgement, so this only
+// works if dest_network_addr is one hop away. Returns false if it isn't.
+bool network_set_ack_packet(byte* frame, byte payload_len, byte dest_network_addr, byte src_network_addr);
+
+// Stop offering the ack packet, if it hasn't been picked up yet.
+void network_clear_ack_packet(void);
+
+// Whether something picked up the ack packet since network_set_ack_packet.
+bool network_ack_packet_sent(void);
+
+// Like network_tx, but the packet may wait a moment to share a frame with
+// others for the same next hop. See data_link_tx_queued. This is for acks,
+// and relays send them ahead of data (PACKET_PRIORITY_ACK).
+network_tx_result network_tx_queued(byte* frame, byte payload_len, byte dest_network_addr, byte src_network_addr);
+
+// Like network_tx, but for several frames going to the same place.
+// They go out back-to-back, up to DATA_LINK_TX_BURST_MAX of them.
+// Returns a bitmap: bit i is set if frames[i] made it to the next hop.
+byte network_tx_burst(byte** frames, byte* payload_lens, byte count, byte dest_network_addr, byte src_network_addr);
 
-network_tx_result network_tx(byte* payload, byte payload_len, byte dest_network_addr, byte src_network_addr);
+// How many packets have been forwarded since network_reset_forward_counts
+// (or reset), and how many duplicates were thrown away.
+network_forward_counts_t network_forward_counts(void);
+void network_reset_forward_counts(void);
 
 #endif
@@ -5,19 +5,91 @@
 
 typedef uint8_t byte;
 
+// Multicast group addresses. A packet sent to a group is delivered to every
+// node whose MY_GROUP_ADDR matches, and forwarded along the group's route
+// until it reaches NETWORK_ADDR_NONE.
+#define NETWORK_ADDR_NONE (0x00)
+#define NETWORK_GROUP_ALL_CUBES (0x30)
+
+// Route discovery beacons go here. Every node listens, nobody forwards them.
+#define NETWORK_ADDR_BEACON (0x31)
+
+// Who-has-this-address queries and announcements go here. See
+// address_resolution.h.
+#define NETWORK_ADDR_RESOLVE (0x32)
+
+// The data link layer has no header. The radio knows how long every frame is,
+// and the packet inside starts with its own length anyway.
 #define MAX_FRAME_LEN (32)
-#define FRAME_HEADER_LEN (1)
+#define FRAME_HEADER_LEN (0)
+
+// If this is 1, bursts go out with parity frames so a receiver can rebuild
+// a frame it missed (see DATA_LINK_FEC_GROUP in data_link.h). A parity frame
+// needs DATA_LINK_FEC_RESERVE bytes of its own for a header, so packets get
+// that much smaller.
+#ifndef DATA_LINK_FEC
+#define DATA_LINK_FEC (0)
+#endif
+#if DATA_LINK_FEC
+#define DATA_LINK_FEC_RESERVE (5)
+#else
+#define DATA_LINK_FEC_RESERVE (0)
+#endif
+
+#define MAX_PACKET_LEN (MAX_FRAME_LEN - FRAME_HEADER_LEN - DATA_LINK_FEC_RESERVE)
+#define PACKET_HEADER_LEN (5)
 
-#define MAX_PACKET_LEN (31)
-#define PACKET_HEADER_LEN (3)
+// packet[4] holds the hop limit and flags. Every hop takes one off the hop
+// limit, and a packet that runs out isn't forwarded, so a routing loop can't
+// keep one going forever.
+#define PACKET_TTL_MASK (0x0F)
+#define PACKET_FLAG_HOP_TRACE (0x10)
+#define NETWORK_DEFAULT_TTL (8)
 
-#define MAX_SEGMENT_LEN (28) 
+// Also in packet[4]: how urgent the packet is. Relays with a backlog send
+// acks and control packets before data, since an ack that waits too long
+// gets its segment sent all over again.
+#define PACKET_PRIORITY_MASK (0x60)
+#define PACKET_PRIORITY_DATA (0x00)
+#define PACKET_PRIORITY_ACK (0x20)
+#define PACKET_PRIORITY_CONTROL (0x40)
+
+// If this is 1, every packet picks up a trailer on its way: each node it
+// passes through adds its address and how many milliseconds it held on to
+// the packet. The destination takes it off and traces it as TRACE_HOP
+// records. Segments get smaller to make room for NETWORK_HOP_TRACE_MAX_HOPS
+// entries.
+#ifndef NETWORK_HOP_TRACE
+#define NETWORK_HOP_TRACE (0)
+#endif
+#define NETWORK_HOP_TRACE_MAX_HOPS (4)
+#if NETWORK_HOP_TRACE
+#define NETWORK_HOP_TRACE_RESERVE (2 * NETWORK_HOP_TRACE_MAX_HOPS + 1)
+#else
+#define NETWORK_HOP_TRACE_RESERVE (0)
+#endif
+
+#define MAX_SEGMENT_LEN (MAX_PACKET_LEN - PACKET_HEADER_LEN - NETWORK_HOP_TRACE_RESERVE)
 #define START_SEGMENT_HEADER_LEN (8)
 #define DATA_SEGMENT_HEADER_LEN (8)
 #define END_SEGMENT_HEADER_LEN (6)
 #define ACK_SEGMENT_HEARDER_LEN (6)
+#define SACK_SEGMENT_HEADER_LEN (8)
+#define COMPACT_SEGMENT_HEADER_LEN (5)
 
 #define MAX_MESSAGE_LEN (256)
 #define MESSAGE_HEADER_LEN (1)
 
+// One whole radio frame, with room at the front for every layer's header.
+// Each layer writes its header in place and hands the same buffer down,
+// so nothing is copied between the transport layer and the radio.
+// frame[0-4]   = network header
+// frame[5-31]  = segment
+typedef byte frame_buffer_t[MAX_FRAME_LEN];
+
+#define FRAME_PACKET_OFFSET (FRAME_HEADER_LEN)
+#define FRAME_SEGMENT_OFFSET (FRAME_HEADER_LEN + PACKET_HEADER_LEN)
+#define FRAME_PACKET(frame) (&(frame)[FRAME_PACKET_OFFSET])
+#define FRAME_SEGMENT(frame) (&(frame)[FRAME_SEGMENT_OFFSET])
+
 #endif
\ No newline at end of file
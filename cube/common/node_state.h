@@ -0,0 +1,20 @@
+#ifndef _NODE_STATE_H
+#define _NODE_STATE_H
+
+// Everything the networking stack remembers between calls is declared
+// NODE_STATE instead of static. On a cube that's all it is.
+//
+// The multi-node simulator (cube/sim/multi) builds with SIM_MULTI_NODE and
+// runs every node on its own thread, so there each node gets its own copy:
+// its own routing table, its own transport contexts, its own radio. The
+// addresses come from that thread's node too (cube/sim/multi/address.h).
+// Passing a context pointer around instead would cost the cubes flash and
+// cycles on every access for the simulator's sake.
+
+#ifdef SIM_MULTI_NODE
+#define NODE_STATE static _Thread_local
+#else
+#define NODE_STATE static
+#endif
+
+#endif
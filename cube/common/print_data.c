@@ -1,6 +1,7 @@
 #include "print_data.h"
 #include "transport.h"
 #include "uart.h"
+#include "timer.h"
 
 /*
 
@@ -20,18 +21,12 @@ void print_segment(byte* segment) {
     // segment[5-6] = total length of message
 
     case SEGID_START_OF_MESSAGE:
-        uart_transmit_formatted_message("\t\tLength of segment:          %d\r\n", segment[0]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tSequence number:            %d\r\n", segment[1]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tDestination port number:    %02x\r\n", segment[2]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tSource port number:         %02x\r\n", segment[3]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tSegment identifier:         %02x (START_OF_MESSAGE)\r\n", segment[4]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tTotal message length:       %d\r\n", ((segment[5] & 0xFF00) << 8) + ((segment[6] & 0x00FF) << 0));
-        UART_WAIT_UNTIL_DONE();
+        uart_transmit_formatted_message_P(PSTR("\t\tLength of segment:          %d\r\n"), segment[0]);
+        uart_transmit_formatted_message_P(PSTR("\t\tSequence number:            %d\r\n"), segment[1]);
+        uart_transmit_formatted_message_P(PSTR("\t\tDestination port number:    %02x\r\n"), segment[2]);
+        uart_transmit_formatted_message_P(PSTR("\t\tSource port number:         %02x\r\n"), segment[3]);
+        uart_transmit_formatted_message_P(PSTR("\t\tSegment identifier:         %02x (START_OF_MESSAGE)\r\n"), segment[4]);
+        uart_transmit_formatted_message_P(PSTR("\t\tTotal message length:       %d\r\n"), ((segment[5] & 0xFF00) << 8) + ((segment[6] & 0x00FF) << 0));
         break;
 
     // DATA segment:
@@ -44,18 +39,12 @@ void print_segment(byte* segment) {
     // rest is payload
 
     case SEGID_DATA:
-        uart_transmit_formatted_message("\t\tLength of segment:          %d\r\n", segment[0]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tSequence number:            %d\r\n", segment[1]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tDestination port number:    %02x\r\n", segment[2]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tSource port number:         %02x\r\n", segment[3]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tSegment identifier:         %02x (DATA)\r\n", segment[4]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tStart address:              %02x\r\n", ((segment[5] & 0xFF00) << 8) + ((segment[6] & 0x00FF) << 0));
-        UART_WAIT_UNTIL_DONE();
+        uart_transmit_formatted_message_P(PSTR("\t\tLength of segment:          %d\r\n"), segment[0]);
+        uart_transmit_formatted_message_P(PSTR("\t\tSequence number:            %d\r\n"), segment[1]);
+        uart_transmit_formatted_message_P(PSTR("\t\tDestination port number:    %02x\r\n"), segment[2]);
+        uart_transmit_formatted_message_P(PSTR("\t\tSource port number:         %02x\r\n"), segment[3]);
+        uart_transmit_formatted_message_P(PSTR("\t\tSegment identifier:         %02x (DATA)\r\n"), segment[4]);
+        uart_transmit_formatted_message_P(PSTR("\t\tStart address:              %02x\r\n"), ((segment[5] & 0xFF00) << 8) + ((segment[6] & 0x00FF) << 0));
         break;
 
     // END_OF_MESSAGE segment:
@@ -66,16 +55,11 @@ void print_segment(byte* segment) {
     // segment[4] = segment identifier = 0x09, END_OF_MESSAGE
 
     case SEGID_END_OF_MESSAGE:
-        uart_transmit_formatted_message("\t\tLength of segment:          %d\r\n", segment[0]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tSequence number:            %d\r\n", segment[1]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tDestination port number:    %02x\r\n", segment[2]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tSource port number:         %02x\r\n", segment[3]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tSegment identifier:         %02x (END_OF_MESSAGE)\r\n", segment[4]);
-        UART_WAIT_UNTIL_DONE();
+        uart_transmit_formatted_message_P(PSTR("\t\tLength of segment:          %d\r\n"), segment[0]);
+        uart_transmit_formatted_message_P(PSTR("\t\tSequence number:            %d\r\n"), segment[1]);
+        uart_transmit_formatted_message_P(PSTR("\t\tDestination port number:    %02x\r\n"), segment[2]);
+        uart_transmit_formatted_message_P(PSTR("\t\tSource port number:         %02x\r\n"), segment[3]);
+        uart_transmit_formatted_message_P(PSTR("\t\tSegment identifier:         %02x (END_OF_MESSAGE)\r\n"), segment[4]);
         break;
 
     // ACK segment:
@@ -86,29 +70,19 @@ void print_segment(byte* segment) {
     // segment[4] = segment identifier = 0x0A, ACK
 
     case SEGID_ACK:
-        uart_transmit_formatted_message("\t\tLength of segment:          %d\r\n", segment[0]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tSequence number:            %d\r\n", segment[1]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tDestination port number:    %02x\r\n", segment[2]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tSource port number:         %02x\r\n", segment[3]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tSegment identifier:         %02x (ACK)\r\n", segment[4]);
-        UART_WAIT_UNTIL_DONE();
+        uart_transmit_formatted_message_P(PSTR("\t\tLength of segment:          %d\r\n"), segment[0]);
+        uart_transmit_formatted_message_P(PSTR("\t\tSequence number:            %d\r\n"), segment[1]);
+        uart_transmit_formatted_message_P(PSTR("\t\tDestination port number:    %02x\r\n"), segment[2]);
+        uart_transmit_formatted_message_P(PSTR("\t\tSource port number:         %02x\r\n"), segment[3]);
+        uart_transmit_formatted_message_P(PSTR("\t\tSegment identifier:         %02x (ACK)\r\n"), segment[4]);
         break;
 
     default:
-        uart_transmit_formatted_message("\t\tLength of segment:          %d\r\n", segment[0]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tSequence number:            %d\r\n", segment[1]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tDestination port number:    %02x\r\n", segment[2]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tSource port number:         %02x\r\n", segment[3]);
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("\t\tSegment identifier:         %02x (INVALID)\r\n", segment[4]);
-        UART_WAIT_UNTIL_DONE();
+        uart_transmit_formatted_message_P(PSTR("\t\tLength of segment:          %d\r\n"), segment[0]);
+        uart_transmit_formatted_message_P(PSTR("\t\tSequence number:            %d\r\n"), segment[1]);
+        uart_transmit_formatted_message_P(PSTR("\t\tDestination port number:    %02x\r\n"), segment[2]);
+        uart_transmit_formatted_message_P(PSTR("\t\tSource port number:         %02x\r\n"), segment[3]);
+        uart_transmit_formatted_message_P(PSTR("\t\tSegment identifier:         %02x (INVALID)\r\n"), segment[4]);
         break;
     }
 }
@@ -118,21 +92,19 @@ void print_packet(byte* packet) {
     // packet[0] = length of packet
     // packet[1] = final destination network address
     // packet[2] = original source network address
+    // packet[3] = packet ID
+    // packet[4] = hop limit and flags
     // rest is payload
 
-    uart_transmit_formatted_message("\t========== Packet ==========\r\n");
-    UART_WAIT_UNTIL_DONE();
-    uart_transmit_formatted_message("\tPacket length:    %d\r\n", packet[0]);
-    UART_WAIT_UNTIL_DONE();
-    uart_transmit_formatted_message("\tDestination addr: %02x\r\n", packet[1]);
-    UART_WAIT_UNTIL_DONE();
-    uart_transmit_formatted_message("\tSource addr:      %02x\r\n", packet[2]);
-    UART_WAIT_UNTIL_DONE();
-    uart_transmit_formatted_message("\tPayload:\r\n");
-    UART_WAIT_UNTIL_DONE();
+    uart_transmit_formatted_message_P(PSTR("\t========== Packet ==========\r\n"));
+    uart_transmit_formatted_message_P(PSTR("\tPacket length:    %d\r\n"), packet[0]);
+    uart_transmit_formatted_message_P(PSTR("\tDestination addr: %02x\r\n"), packet[1]);
+    uart_transmit_formatted_message_P(PSTR("\tSource addr:      %02x\r\n"), packet[2]);
+    uart_transmit_formatted_message_P(PSTR("\tPacket ID:        %d\r\n"), packet[3]);
+    uart_transmit_formatted_message_P(PSTR("\tHops left:        %d\r\n"), packet[4] & PACKET_TTL_MASK);
+    uart_transmit_formatted_message_P(PSTR("\tPayload:\r\n"));
     print_segment(&packet[PACKET_HEADER_LEN]);
-    uart_transmit_formatted_message("\t============================\r\n");
-    UART_WAIT_UNTIL_DONE();
+    uart_transmit_formatted_message_P(PSTR("\t============================\r\n"));
 
 }
 */
@@ -143,30 +115,30 @@ void print_segment(byte* segment) {
 
         int segtype = segment[4];
 
-        uart_transmit_formatted_message("SegID %02x ", segtype);
-        UART_WAIT_UNTIL_DONE();
+        uart_transmit_formatted_message_P(PSTR("SegID %02x "), segtype);
 
         switch(segtype) {
         
         case SEGID_START_OF_MESSAGE:
-            uart_transmit_formatted_message("(START_OF_MESSAGE)");
-            UART_WAIT_UNTIL_DONE();
+            uart_transmit_formatted_message_P(PSTR("(START_OF_MESSAGE)"));
             break;
         case SEGID_DATA:
-            uart_transmit_formatted_message("(DATA)");
-            UART_WAIT_UNTIL_DONE();
+            uart_transmit_formatted_message_P(PSTR("(DATA)"));
             break;
         case SEGID_END_OF_MESSAGE:
-            uart_transmit_formatted_message("(END_OF_MESSAGE)");
-            UART_WAIT_UNTIL_DONE();
+            uart_transmit_formatted_message_P(PSTR("(END_OF_MESSAGE)"));
             break;
         case SEGID_ACK:
-            uart_transmit_formatted_message("(ACK)");
-            UART_WAIT_UNTIL_DONE();
+            uart_transmit_formatted_message_P(PSTR("(ACK)"));
+            break;
+        case SEGID_SACK:
+            uart_transmit_formatted_message_P(PSTR("(SACK)"));
+            break;
+        case SEGID_COMPACT:
+            uart_transmit_formatted_message_P(PSTR("(COMPACT)"));
             break;
         default:
-            uart_transmit_formatted_message("(INVALID)");
-            UART_WAIT_UNTIL_DONE();
+            uart_transmit_formatted_message_P(PSTR("(INVALID)"));
             break;
         }
 
@@ -175,9 +147,44 @@ void print_segment(byte* segment) {
 }
 
 void print_packet(byte* packet) {
-    uart_transmit_formatted_message("<");
-    UART_WAIT_UNTIL_DONE();
+    uart_transmit_formatted_message_P(PSTR("<"));
     print_segment(&packet[PACKET_HEADER_LEN]);
-    uart_transmit_formatted_message(">\r\n");
-    UART_WAIT_UNTIL_DONE();
+    uart_transmit_formatted_message_P(PSTR(">\r\n"));
+}
+
+#if !PRINT_DATA_BINARY_TRACE
+static const char* trace_event_name(trace_event_t event) {
+    switch (event) {
+    case TRACE_FRAME_TX:  return "TX";
+    case TRACE_FRAME_RX:  return "RX";
+    case TRACE_FORWARD:   return "FWD";
+    case TRACE_ACK:       return "ACK";
+    case TRACE_RETRY:     return "RETRY";
+    case TRACE_TIMEOUT:   return "TIMEOUT";
+    case TRACE_HOP:       return "HOP";
+    default:              return "?";
+    }
+}
+#endif
+
+void print_trace(trace_event_t event, byte a, byte b, byte c, byte d) {
+#if PRINT_DATA_BINARY_TRACE
+    timer_delay_ms_t now = timer_now_ms();
+    byte record[TRACE_RECORD_LEN] = {
+        TRACE_SYNC, event, now & 0xFF, now >> 8, a, b, c, d
+    };
+    uart_transmit_bytes(record, TRACE_RECORD_LEN);
+#else
+    uart_transmit_formatted_message_P(PSTR("%s %02x %02x %02x %02x\r\n"), trace_event_name(event), a, b, c, d);
+#endif
+}
+
+void print_trace_packet(trace_event_t event, byte* packet) {
+#if PRINT_DATA_BINARY_TRACE
+    byte* segment = &packet[PACKET_HEADER_LEN];
+    print_trace(event, packet[1], packet[2], segment[4], segment[1]);
+#else
+    uart_transmit_formatted_message_P(PSTR("%s %02x->%02x "), trace_event_name(event), packet[2], packet[1]);
+    print_packet(packet);
+#endif
 }
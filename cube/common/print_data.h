@@ -4,8 +4,37 @@
 #include "networking_constants.h"
 #include <stdio.h>
 
+// If this is 1, protocol events go out as TRACE_RECORD_LEN byte binary
+// records instead of text, which is a small fraction of the UART time. Run
+// the output through build/trace_decode to read it. Anything else still
+// printed with uart_transmit_formatted_message passes through as text.
+#define PRINT_DATA_BINARY_TRACE (0)
+
+// Binary records: TRACE_SYNC, the event, the low and high bytes of
+// timer_now_ms, then the four bytes of detail. TRACE_SYNC never shows up in
+// the text we print.
+#define TRACE_SYNC (0xA5)
+#define TRACE_RECORD_LEN (8)
+
+// Protocol events that get traced as they happen.
+typedef enum {
+    TRACE_FRAME_TX  = 0x01, // a: dest, b: src, c: segment id, d: seq
+    TRACE_FRAME_RX  = 0x02, // same
+    TRACE_FORWARD   = 0x03, // same
+    TRACE_ACK       = 0x04, // a: seq, b: dest port, c: source port
+    TRACE_RETRY     = 0x05, // a: dest port, b: seq, c: attempt
+    TRACE_TIMEOUT   = 0x06, // a: port, b-c: the RTO that ran out, high byte first
+    TRACE_HOP       = 0x07  // a: source, b: dest, c: a node on the way, d: ms it held the packet
+} trace_event_t;
+
 void print_segment(byte* segment);
 
 void print_packet(byte* packet);
 
+// Traces an event with up to four bytes of detail.
+void print_trace(trace_event_t event, byte a, byte b, byte c, byte d);
+
+// Traces a packet going by.
+void print_trace_packet(trace_event_t event, byte* packet);
+
 #endif
@@ -0,0 +1,214 @@
+#include "route_discovery.h"
+#include "routing_table.h"
+#include "address_resolution.h"
+#include "data_link.h"
+#include "address.h"
+#include "node_state.h"
+
+#ifndef SIMULATION
+#include "timer.h"
+#else
+#include "sim_trx.h"
+#endif
+
+#if ROUTE_DISCOVERY
+
+#if !ROUTING_TABLE_OVERLAY
+#error "ROUTE_DISCOVERY needs ROUTING_TABLE_OVERLAY."
+#endif
+
+// A beacon's payload is a list of these, one per route:
+// entry[0] = destination
+// entry[1] = the sender's next hop to it
+// entry[2] = hops
+// entry[3] = cost
+#define BEACON_ENTRY_LEN (4)
+#define BEACON_ENTRIES_MAX ((MAX_PACKET_LEN - PACKET_HEADER_LEN) / BEACON_ENTRY_LEN)
+
+// Half credit for a neighbor we just heard from for the first time.
+#define NEIGHBOR_HISTORY_NEW (0x0F)
+
+typedef struct {
+    byte next_hop;  // NETWORK_ADDR_NONE if we don't know a route
+    byte hops;
+    byte cost;
+    byte age;       // beacons since we last heard about it
+} route_t;
+
+// Everything is indexed by ROUTING_TABLE_COLUMN of the address.
+NODE_STATE route_t routes[ROUTING_TABLE_COLUMNS];
+
+// Bit 0 is whether the neighbor's beacon made it this interval,
+// bit 1 the interval before, and so on.
+NODE_STATE byte neighbor_history[ROUTING_TABLE_COLUMNS];
+
+NODE_STATE timer_delay_ms_t next_beacon_time;
+
+// Beacons take turns listing routes if there are too many for one.
+NODE_STATE byte next_entry_column = 0;
+
+// Only real nodes get routes: not us, groups or the beacon address.
+static bool is_other_node(byte addr) {
+    if (!ROUTING_TABLE_IN_BLOCK(addr)) return false;
+    if (addr == MY_NETWORK_ADDR) return false;
+    if (addr == NETWORK_ADDR_BEACON) return false;
+#ifdef MY_GROUP_ADDR
+    if (addr == MY_GROUP_ADDR) return false;
+#endif
+    if (addr == NETWORK_GROUP_ALL_CUBES) return false;
+    return true;
+}
+
+// ROUTE_DISCOVERY_LINK_COST_FULL times 8 over how many of the last 8
+// beacons made it, rounded up.
+static byte link_cost(byte neighbor_addr) {
+    byte history = neighbor_history[ROUTING_TABLE_COLUMN(neighbor_addr)];
+    byte heard = 0;
+    while (history) {
+        heard += history & 1;
+        history >>= 1;
+    }
+    if (heard == 0) return ROUTE_DISCOVERY_COST_INFINITY;
+    return (ROUTE_DISCOVERY_LINK_COST_FULL * 8 + heard - 1) / heard;
+}
+
+// Nothing we know of gets there, so try it directly.
+static void forget_route(byte column) {
+    routes[column].next_hop = NETWORK_ADDR_NONE;
+    routes[column].cost = ROUTE_DISCOVERY_COST_INFINITY;
+    routing_table_set(TOPOLOGY_ADDR_BLOCK | column, TOPOLOGY_ADDR_BLOCK | column);
+}
+
+// A neighbor says it can get to dest_addr. Take it if it's cheaper than what
+// we have, or if it's the neighbor we already go through, since then it's
+// the latest word on our own route.
+static void consider_route(byte dest_addr, byte neighbor_addr, byte hops, uint16_t cost) {
+
+    byte column = ROUTING_TABLE_COLUMN(dest_addr);
+    route_t* route = &routes[column];
+    bool current = route->next_hop == neighbor_addr;
+
+    if (hops > ROUTE_DISCOVERY_MAX_HOPS || cost >= ROUTE_DISCOVERY_COST_INFINITY) {
+        if (current) forget_route(column);
+        return;
+    }
+
+    if (!current && route->next_hop != NETWORK_ADDR_NONE && cost >= route->cost) return;
+
+    if (!current) routing_table_set(dest_addr, neighbor_addr);
+    route->next_hop = neighbor_addr;
+    route->hops = hops;
+    route->cost = (byte) cost;
+    route->age = 0;
+}
+
+static void send_beacon(void) {
+
+    frame_buffer_t frame;
+    byte* entry = FRAME_SEGMENT(frame);
+    byte entries = 0;
+
+    // Pick up where the last beacon left off.
+    byte column = next_entry_column;
+    for (byte i = 0; i < ROUTING_TABLE_COLUMNS && entries < BEACON_ENTRIES_MAX; i++) {
+        route_t* route = &routes[column];
+        if (route->next_hop != NETWORK_ADDR_NONE) {
+            entry[0] = TOPOLOGY_ADDR_BLOCK | column;
+            entry[1] = route->next_hop;
+            entry[2] = route->hops;
+            entry[3] = route->cost;
+            entry += BEACON_ENTRY_LEN;
+            entries++;
+        }
+        column = (column + 1) % ROUTING_TABLE_COLUMNS;
+    }
+    next_entry_column = column;
+
+    byte* packet = FRAME_PACKET(frame);
+    packet[0] = PACKET_HEADER_LEN + entries * BEACON_ENTRY_LEN;
+    packet[1] = NETWORK_ADDR_BEACON;
+    packet[2] = MY_NETWORK_ADDR;
+    packet[3] = 0;
+    packet[4] = 1 | PACKET_PRIORITY_CONTROL;
+
+    data_link_broadcast(frame, packet[0], resolve_data_link_addr(NETWORK_ADDR_BEACON));
+}
+
+// Once a beacon interval: everyone's link history moves along, and routes
+// nobody has mentioned in a while go away.
+static void age_routes(void) {
+
+    for (byte column = 0; column < ROUTING_TABLE_COLUMNS; column++) {
+        neighbor_history[column] <<= 1;
+    }
+
+    for (byte column = 0; column < ROUTING_TABLE_COLUMNS; column++) {
+        route_t* route = &routes[column];
+        if (route->next_hop == NETWORK_ADDR_NONE) continue;
+
+        route->age++;
+        if (route->age > ROUTE_DISCOVERY_ROUTE_LIFETIME ||
+            neighbor_history[ROUTING_TABLE_COLUMN(route->next_hop)] == 0) {
+            forget_route(column);
+        }
+    }
+}
+
+void route_discovery_initialize(void) {
+
+    for (byte column = 0; column < ROUTING_TABLE_COLUMNS; column++) {
+        routes[column].next_hop = NETWORK_ADDR_NONE;
+        routes[column].cost = ROUTE_DISCOVERY_COST_INFINITY;
+        neighbor_history[column] = 0;
+    }
+
+    // address_resolution_initialize already listens on the beacons' pipe.
+
+    // The first beacon goes out right away.
+    next_beacon_time = timer_now_ms();
+}
+
+void route_discovery_poll(void) {
+
+    if ((int16_t) (timer_now_ms() - next_beacon_time) < 0) return;
+    next_beacon_time = timer_now_ms() + ROUTE_DISCOVERY_INTERVAL_MS +
+        ROUTING_TABLE_COLUMN(MY_NETWORK_ADDR) * ROUTE_DISCOVERY_JITTER_MS;
+
+    age_routes();
+    send_beacon();
+}
+
+void route_discovery_receive(byte* packet) {
+
+    // The length came off the air, and the entries get read straight out of
+    // the frame.
+    if (packet[0] < PACKET_HEADER_LEN || packet[0] > MAX_PACKET_LEN) return;
+    if ((packet[0] - PACKET_HEADER_LEN) % BEACON_ENTRY_LEN != 0) return;
+
+    byte neighbor_addr = packet[2];
+    if (!is_other_node(neighbor_addr)) return;
+
+    byte* history = &neighbor_history[ROUTING_TABLE_COLUMN(neighbor_addr)];
+    *history = (*history == 0) ? NEIGHBOR_HISTORY_NEW : (*history | 1);
+
+    uint16_t link = link_cost(neighbor_addr);
+    consider_route(neighbor_addr, neighbor_addr, 1, link);
+
+    byte entries = (packet[0] - PACKET_HEADER_LEN) / BEACON_ENTRY_LEN;
+    byte* entry = &packet[PACKET_HEADER_LEN];
+    for (byte i = 0; i < entries; i++, entry += BEACON_ENTRY_LEN) {
+
+        if (!is_other_node(entry[0]) || entry[0] == neighbor_addr) continue;
+
+        // The neighbor goes through us. Telling it back to it is how loops
+        // start, so as far as we're concerned it doesn't have a route.
+        if (entry[1] == MY_NETWORK_ADDR) {
+            consider_route(entry[0], neighbor_addr, ROUTE_DISCOVERY_MAX_HOPS + 1, ROUTE_DISCOVERY_COST_INFINITY);
+            continue;
+        }
+
+        consider_route(entry[0], neighbor_addr, entry[2] + 1, entry[3] + link);
+    }
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef _ROUTE_DISCOVERY_H
+#define _ROUTE_DISCOVERY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "networking_constants.h"
+
+/*
+    Once the cubes are scattered on the ground, nobody knows who can hear
+    whom, so the routes in topology.h are just a first guess. With route
+    discovery on, every node broadcasts a beacon to NETWORK_ADDR_BEACON every
+    ROUTE_DISCOVERY_INTERVAL_MS, listing the routes it knows with their hop
+    counts and costs. Whoever hears it learns a one-hop route to the sender,
+    plus everything the sender can reach at the sender's cost plus the cost
+    of the link between them. The cheapest route wins, and goes into the
+    routing table overlay.
+
+    The cost of a link comes from how many of the neighbor's last 8 beacons
+    made it: ROUTE_DISCOVERY_LINK_COST_FULL if all of them did, twice that if
+    half of them did, and so on. A route that
+    hasn't been heard about for ROUTE_DISCOVERY_ROUTE_LIFETIME beacons is
+    dropped, and its destination is sent to directly in the hope that it's
+    in range.
+
+    Beacons aren't acknowledged, so they only reach nodes that are awake.
+*/
+
+// Set to 1 to turn route discovery on. Needs ROUTING_TABLE_OVERLAY.
+#ifndef ROUTE_DISCOVERY
+#define ROUTE_DISCOVERY (0)
+#endif
+
+// Time between beacons. Each node adds a little, by address, so beacons
+// from different nodes drift apart instead of colliding every time.
+#define ROUTE_DISCOVERY_INTERVAL_MS (2000)
+#define ROUTE_DISCOVERY_JITTER_MS (8)
+
+// Beacons a route can go without being heard before it's dropped.
+#define ROUTE_DISCOVERY_ROUTE_LIFETIME (4)
+
+// A link that got every beacon through costs this much. One that got half
+// of them through costs twice as much, and so on.
+#define ROUTE_DISCOVERY_LINK_COST_FULL (8)
+
+// Routes this expensive, or this many hops long, might as well not exist.
+// This is what stops two nodes that lost a destination from counting up to
+// infinity teaching it to each other.
+#define ROUTE_DISCOVERY_COST_INFINITY (128)
+#define ROUTE_DISCOVERY_MAX_HOPS (8)
+
+// Get ready to send beacons. Call it after timer_clock_initialize and
+// address_resolution_initialize, which listens for them.
+void route_discovery_initialize(void);
+
+// Send a beacon and age the routes once it's time. Call it often.
+void route_discovery_poll(void);
+
+// Learn from a beacon packet. network_rx and network_poll hand them over.
+void route_discovery_receive(byte* packet);
+
+#endif
@@ -0,0 +1,74 @@
+#include "routing_table.h"
+#include "address.h"
+#include "node_state.h"
+
+#ifndef SIMULATION
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_byte(address) (*(address))
+#endif
+
+#if !TOPOLOGY_RUNTIME
+
+#define ROUTING_TABLE_MY_ROW TOPOLOGY_ROW(MY_NETWORK_ADDR)
+
+#if ROUTING_TABLE_MY_ROW < 0
+#error "MY_NETWORK_ADDR isn't a node in topology.h."
+#endif
+
+// Every node's routes end up in flash, since they're all generated from the
+// same list, but only this node's row ever gets read. Anything topology.h
+// leaves out is 0, which is NETWORK_ADDR_NONE.
+#define ROUTING_TABLE_ENTRY(from, to, next_hop) \
+    [TOPOLOGY_ROW(from)][ROUTING_TABLE_COLUMN(to)] = (next_hop),
+
+static const byte routing_table_flash[TOPOLOGY_NODE_COUNT][ROUTING_TABLE_COLUMNS] PROGMEM = {
+    TOPOLOGY_ROUTES(ROUTING_TABLE_ENTRY)
+};
+
+#endif
+
+#if ROUTING_TABLE_OVERLAY
+// Routes set at runtime, which win over the ones in flash. Bit n of
+// routing_table_overridden says whether column n has one.
+NODE_STATE byte routing_table_overridden[(ROUTING_TABLE_COLUMNS + 7) / 8];
+NODE_STATE byte routing_table_overlay[ROUTING_TABLE_COLUMNS];
+
+#define ROUTING_TABLE_OVERRIDDEN_BYTE(column) (routing_table_overridden[(column) >> 3])
+#define ROUTING_TABLE_OVERRIDDEN_BIT(column) (1 << ((column) & 7))
+#endif
+
+byte routing_table(byte final_addr) {
+    if (!ROUTING_TABLE_IN_BLOCK(final_addr)) return NETWORK_ADDR_NONE;
+
+    byte column = ROUTING_TABLE_COLUMN(final_addr);
+#if ROUTING_TABLE_OVERLAY
+    if (ROUTING_TABLE_OVERRIDDEN_BYTE(column) & ROUTING_TABLE_OVERRIDDEN_BIT(column)) {
+        return routing_table_overlay[column];
+    }
+#endif
+#if TOPOLOGY_RUNTIME
+    return NETWORK_ADDR_NONE;
+#else
+    return pgm_read_byte(&routing_table_flash[ROUTING_TABLE_MY_ROW][column]);
+#endif
+}
+
+#if ROUTING_TABLE_OVERLAY
+bool routing_table_set(byte final_addr, byte next_hop_addr) {
+    if (!ROUTING_TABLE_IN_BLOCK(final_addr)) return false;
+
+    byte column = ROUTING_TABLE_COLUMN(final_addr);
+    routing_table_overlay[column] = next_hop_addr;
+    ROUTING_TABLE_OVERRIDDEN_BYTE(column) |= ROUTING_TABLE_OVERRIDDEN_BIT(column);
+    return true;
+}
+
+void routing_table_forget(byte final_addr) {
+    if (!ROUTING_TABLE_IN_BLOCK(final_addr)) return;
+
+    byte column = ROUTING_TABLE_COLUMN(final_addr);
+    ROUTING_TABLE_OVERRIDDEN_BYTE(column) &= ~ROUTING_TABLE_OVERRIDDEN_BIT(column);
+}
+#endif
@@ -0,0 +1,37 @@
+#ifndef _ROUTING_TABLE_H
+#define _ROUTING_TABLE_H
+
+#include <stdbool.h>
+
+#include "networking_constants.h"
+#include "topology.h"
+
+// Addresses index the table by where they are in TOPOLOGY_ADDR_BLOCK.
+#define ROUTING_TABLE_COLUMNS (1 << TOPOLOGY_COLUMN_BITS)
+#define ROUTING_TABLE_IN_BLOCK(addr) (((addr) & (0xFF & ~(ROUTING_TABLE_COLUMNS - 1))) == TOPOLOGY_ADDR_BLOCK)
+#define ROUTING_TABLE_COLUMN(addr) ((addr) & (ROUTING_TABLE_COLUMNS - 1))
+
+// Whether routes can be changed at runtime. Costs 18 bytes of SRAM.
+#ifndef ROUTING_TABLE_OVERLAY
+#define ROUTING_TABLE_OVERLAY (1)
+#endif
+
+#if TOPOLOGY_RUNTIME && !ROUTING_TABLE_OVERLAY
+#error "TOPOLOGY_RUNTIME needs ROUTING_TABLE_OVERLAY."
+#endif
+
+// The next hop toward final_addr, or NETWORK_ADDR_NONE if there isn't one.
+// Comes from topology.h unless routing_table_set has said otherwise (or
+// always from routing_table_set, with TOPOLOGY_RUNTIME).
+byte routing_table(byte final_addr);
+
+#if ROUTING_TABLE_OVERLAY
+// Sends everything for final_addr through next_hop_addr from now on, until
+// routing_table_forget. Returns false if final_addr can't be routed at all.
+bool routing_table_set(byte final_addr, byte next_hop_addr);
+
+// Goes back to the route from topology.h.
+void routing_table_forget(byte final_addr);
+#endif
+
+#endif
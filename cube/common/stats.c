@@ -0,0 +1,63 @@
+#include "stats.h"
+#include "data_link.h"
+#include "network.h"
+#include "transport.h"
+#include "address.h"
+#include "log_level.h"
+#include "profile.h"
+
+#ifndef SIMULATION
+#include "trx.h"
+// The lines are longer than the transmit ring is forgiving of.
+#define STATS_LINE_DONE() UART_WAIT_UNTIL_DONE()
+#else
+#include "sim_trx.h"
+#define STATS_LINE_DONE()
+#endif
+
+void stats_print(void) {
+
+    trx_link_stats_t link = trx_get_link_stats();
+    data_link_stats_t frames = data_link_get_stats();
+    network_forward_counts_t packets = network_forward_counts();
+    transport_stats_t segments = transport_get_stats();
+
+    LOG_PRINT("::: Stats for %02x :::\r\n", MY_NETWORK_ADDR);
+    STATS_LINE_DONE();
+    LOG_PRINT("trx: tx %u, retx %u, lost %u\r\n",
+        link.transmissions, link.retransmissions, link.lost);
+    STATS_LINE_DONE();
+    LOG_PRINT("data link: tx %u, failed %u, rx %u, errors %u, queued %u, unpacked %u\r\n",
+        frames.frames_sent, frames.frames_failed, frames.frames_received,
+        frames.rx_errors, frames.packets_queued, frames.packets_unpacked);
+    STATS_LINE_DONE();
+#if DATA_LINK_FEC
+    LOG_PRINT("fec: parity %u, covered %u, rebuilt %u\r\n",
+        frames.fec_parity_sent, frames.fec_covered, frames.fec_rebuilt);
+    STATS_LINE_DONE();
+#endif
+    LOG_PRINT("network: tx %u, rx %u, fwd %u, failed %u, dropped %u, expired %u, dup %u\r\n",
+        packets.sent, packets.delivered, packets.forwarded, packets.failed,
+        packets.dropped, packets.expired, packets.duplicates);
+    STATS_LINE_DONE();
+    LOG_PRINT("transport: segs %u, retries %u, timeouts %u, acks tx %u rx %u\r\n",
+        segments.segments, segments.retries, segments.timeouts,
+        segments.acks_sent, segments.acks_received);
+    STATS_LINE_DONE();
+    LOG_PRINT("messages: tx %u, failed %u, rx %u, dropped %u, %lu bytes\r\n",
+        segments.messages_sent, segments.messages_failed,
+        segments.messages_received, segments.messages_dropped,
+        (unsigned long) segments.bytes_delivered);
+    STATS_LINE_DONE();
+
+    // Nothing, unless it's a PROFILE build.
+    profile_print();
+}
+
+void stats_reset(void) {
+    trx_reset_link_stats();
+    data_link_reset_stats();
+    network_reset_forward_counts();
+    transport_reset_stats();
+    profile_reset();
+}
@@ -0,0 +1,36 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Stats
+//
+// Every layer counts what it does, as it does it, so a slow network can be
+// asked where the time is going instead of guessed at:
+//
+//   trx_get_link_stats      radio transmissions, automatic retransmissions,
+//                           payloads that ran out of them (MAX_RT)
+//   data_link_get_stats     frames sent, failed and received, packets that
+//                           shared a frame, parity frames (DATA_LINK_FEC)
+//   network_forward_counts  packets sent, delivered, forwarded, dropped,
+//                           expired and thrown away as duplicates
+//   transport_get_stats     segments, retries, RTO timeouts, acks, messages
+//                           sent, failed and received, bytes delivered
+//
+// Each count is a single increment where it happens, into its layer's own
+// struct. This only gathers them up for a person to read.
+//
+// The bridge (cube/rover_trx) prints them when it sees BRIDGE_STATS outside
+// a frame, and any cube does when it gets a COMMAND_STATS. A PROFILE build
+// prints the probes' times after them (profile.h).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// Print every layer's counts, a line per layer. To the UART on a cube, and
+// stdout in the simulation.
+void stats_print(void);
+
+// Start every layer's counts over.
+void stats_reset(void);
+
+#endif
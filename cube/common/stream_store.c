@@ -0,0 +1,118 @@
+#include "stream_store.h"
+#include "uart.h"
+
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+
+/*
+    eeprom[8]       = source port of the message
+    eeprom[9..10]   = length of the message, low byte first
+    eeprom[11..12]  = how much of it has been stored, low byte first
+    eeprom[13]      = 1 once the whole message is stored
+    eeprom[14]      = check byte, every byte of eeprom[8..13] XORed
+                      together with STREAM_STORE_CHECK
+    eeprom[STREAM_STORE_START..] = the message
+
+    If the check byte is wrong, the store is empty.
+*/
+
+#define STREAM_STORE_HEADER_ADDR (8)
+#define STREAM_STORE_CHECK (0xA5)
+
+typedef struct {
+    byte source_port;
+    uint16_t message_len;
+    uint16_t stored_len;
+    byte complete;
+    byte check;
+} stream_store_header_t;
+
+static byte stream_store_check(stream_store_header_t* header) {
+    byte* bytes = (byte*) header;
+    byte check = STREAM_STORE_CHECK;
+    for (byte i = 0; i < sizeof(*header) - 1; i++) check ^= bytes[i];
+    return check;
+}
+
+static bool stream_store_load(stream_store_header_t* header) {
+    eeprom_read_block(header, (const void*) STREAM_STORE_HEADER_ADDR, sizeof(*header));
+    return header->check == stream_store_check(header);
+}
+
+static void stream_store_save(stream_store_header_t* header) {
+    header->check = stream_store_check(header);
+    eeprom_update_block(header, (void*) STREAM_STORE_HEADER_ADDR, sizeof(*header));
+}
+
+static uint16_t stream_store_resume(byte source_port, uint16_t message_len) {
+
+    stream_store_header_t header;
+
+    log_flush(); // so these don't get mixed up with the log's writes
+
+    // Is this the one we were in the middle of?
+    if (stream_store_load(&header)
+            && !header.complete
+            && header.source_port == source_port
+            && header.message_len == message_len) {
+        return header.stored_len;
+    }
+
+    header.source_port = source_port;
+    header.message_len = message_len;
+    header.stored_len = 0;
+    header.complete = 0;
+    stream_store_save(&header);
+    return 0;
+}
+
+static void stream_store_write(byte source_port, uint16_t offset, byte* bytes, byte len) {
+
+    stream_store_header_t header;
+
+    log_flush();
+
+    if (!stream_store_load(&header) || header.complete || header.source_port != source_port) return;
+    if (offset != header.stored_len) return;
+
+    if (offset < STREAM_STORE_LEN) {
+        uint16_t fits = STREAM_STORE_LEN - offset;
+        eeprom_update_block(bytes, (void*) (STREAM_STORE_START + offset), len < fits ? len : fits);
+    }
+
+    // The data goes in before the header says it's there.
+    header.stored_len = offset + len;
+    stream_store_save(&header);
+}
+
+static void stream_store_done(byte source_port, uint16_t message_len) {
+
+    stream_store_header_t header;
+
+    log_flush();
+
+    if (!stream_store_load(&header) || header.source_port != source_port) return;
+    header.complete = 1;
+    stream_store_save(&header);
+
+    uart_transmit_formatted_message_P(PSTR("Stored a %u byte message from %02x\r\n"), message_len, source_port);
+    UART_WAIT_UNTIL_DONE();
+}
+
+const transport_sink_t stream_store_sink = {
+    .resume = stream_store_resume,
+    .write = stream_store_write,
+    .done = stream_store_done
+};
+
+uint16_t stream_store_length(byte* source_port) {
+    stream_store_header_t header;
+    if (!stream_store_load(&header) || !header.complete) return 0;
+    if (source_port != NULL) *source_port = header.source_port;
+    return header.message_len < STREAM_STORE_LEN ? header.message_len : STREAM_STORE_LEN;
+}
+
+void stream_store_read(uint16_t offset, byte* bytes, uint16_t len) {
+    log_flush();
+    eeprom_read_block(bytes, (const void*) (STREAM_STORE_START + offset), len);
+}
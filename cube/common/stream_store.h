@@ -0,0 +1,39 @@
+#ifndef _STREAM_STORE_H
+#define _STREAM_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "networking_constants.h"
+#include "transport.h"
+#include "log.h"
+
+#include <avr/io.h>
+
+/*
+    A transport_sink_t (see transport.h) that keeps one large message in the
+    part of the EEPROM the log doesn't use. Each DATA segment is written
+    straight to its offset as it comes in, and how far it's gotten is saved
+    along with it, so a message that breaks off, even across a reset, picks
+    up where it left off the next time the sender tries.
+
+    Only one message is kept. A new one, or one from someone else, takes its
+    place. Anything past STREAM_STORE_LEN bytes is dropped, so a message
+    that long comes out cut short.
+
+    The on-chip EEPROM only has room for a few hundred bytes. A bigger
+    external memory can stand in for it by providing the same three calls.
+*/
+
+#define STREAM_STORE_START (LOG_EEPROM_END)
+#define STREAM_STORE_LEN (E2END + 1 - STREAM_STORE_START)
+
+extern const transport_sink_t stream_store_sink;
+
+// How long the stored message is, and who sent it. 0 if there isn't a
+// whole one.
+uint16_t stream_store_length(byte* source_port);
+
+// Copy bytes [offset .. offset + len) of the stored message into bytes.
+void stream_store_read(uint16_t offset, byte* bytes, uint16_t len);
+
+#endif
@@ -0,0 +1,157 @@
+#include "telemetry.h"
+#include "transport.h"
+#include "network.h"
+#include "routing_table.h"
+#include "trx.h"
+#include "timer.h"
+#include "uart.h"
+#include "address.h"
+#include "cube_parameters.h"
+
+#include <avr/io.h>
+#include <util/delay.h>
+
+// Reports from the cubes behind us, waiting to go out with ours. A newer
+// report from the same cube replaces the old one.
+static byte children[TELEMETRY_MAX_RECORDS - 1][TELEMETRY_RECORD_LEN];
+static byte child_count = 0;
+
+// The report being sent. It has to stay put until the transport layer is
+// done with it.
+static byte report[TELEMETRY_MAX_LEN];
+
+static timer_delay_ms_t next_report_ms;
+
+static void telemetry_put16(byte* at, uint16_t value) {
+    at[0] = value & 0xFF;
+    at[1] = value >> 8;
+}
+
+static uint16_t telemetry_get16(byte* at) {
+    return at[0] | (at[1] << 8);
+}
+
+// Measure the 1.1 V bandgap reference against the supply, which works out
+// what the supply is without any extra parts.
+static byte telemetry_battery(void) {
+
+    ADMUX = _BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
+#if F_CPU <= 1600000UL
+    ADCSRA = _BV(ADEN) | _BV(ADPS1) | _BV(ADPS0);   // divide by 8
+#else
+    ADCSRA = _BV(ADEN) | _BV(ADPS2) | _BV(ADPS1);   // divide by 64
+#endif
+
+    // The reference needs a moment after it's switched in.
+    _delay_ms(1);
+
+    ADCSRA |= _BV(ADSC);
+    while (ADCSRA & _BV(ADSC));
+    uint16_t reading = ADC;
+    ADCSRA = 0;
+
+    if (reading == 0) return 0xFF;
+    uint32_t supply_mv = 1100UL * 1024UL / reading;
+    supply_mv /= TELEMETRY_BATTERY_STEP_MV;
+    return supply_mv > 0xFF ? 0xFF : (byte) supply_mv;
+}
+
+static void telemetry_fill_record(byte* record, uint16_t messages_received) {
+    trx_link_stats_t link = trx_get_link_stats();
+    network_forward_counts_t forward = network_forward_counts();
+    transport_stats_t transport = transport_get_stats();
+
+    record[0] = MY_NETWORK_ADDR;
+    telemetry_put16(&record[1], messages_received);
+    telemetry_put16(&record[3], link.transmissions);
+    telemetry_put16(&record[5], link.retransmissions);
+    telemetry_put16(&record[7], link.lost);
+    telemetry_put16(&record[9], forward.forwarded);
+    record[11] = telemetry_battery();
+    telemetry_put16(&record[12], transport.retries);
+    telemetry_put16(&record[14], transport.timeouts);
+}
+
+void telemetry_initialize(void) {
+    child_count = 0;
+    // Spread the cubes out a little so they don't all report at once.
+    next_report_ms = timer_now_ms() + TELEMETRY_INTERVAL_MS + ROUTING_TABLE_COLUMN(MY_NETWORK_ADDR) * 64;
+}
+
+void telemetry_poll(uint16_t messages_received) {
+
+    if ((int16_t) (timer_now_ms() - next_report_ms) < 0) return;
+    if (transport_send_status() == TRANSPORT_ASYNC_BUSY) return;
+
+    next_report_ms += TELEMETRY_INTERVAL_MS;
+
+    byte* record = &report[TELEMETRY_HEADER_LEN];
+    telemetry_fill_record(record, messages_received);
+    record += TELEMETRY_RECORD_LEN;
+
+    for (byte i = 0; i < child_count; i++) {
+        for (byte j = 0; j < TELEMETRY_RECORD_LEN; j++) record[j] = children[i][j];
+        record += TELEMETRY_RECORD_LEN;
+    }
+
+    report[0] = TELEMETRY_MARK;
+    report[1] = 1 + child_count;
+
+    // Our parent is whoever we'd send anything for the transceiver through.
+    byte parent = routing_table(TELEMETRY_SINK_ADDR);
+    if (parent == NETWORK_ADDR_NONE) return;
+
+    // If this one doesn't make it, the children's records are lost with it,
+    // but they'll send new ones next time.
+    if (transport_send_async(report, TELEMETRY_HEADER_LEN + report[1] * TELEMETRY_RECORD_LEN, parent)) {
+        child_count = 0;
+    }
+}
+
+bool telemetry_receive(byte* message, uint16_t message_len) {
+
+    if (message_len < TELEMETRY_HEADER_LEN || message[0] != TELEMETRY_MARK) return false;
+
+    byte count = message[1];
+    if (message_len < TELEMETRY_HEADER_LEN + (uint16_t) count * TELEMETRY_RECORD_LEN) return true;
+
+    for (byte i = 0; i < count; i++) {
+        byte* record = &message[TELEMETRY_HEADER_LEN + i * TELEMETRY_RECORD_LEN];
+        if (record[0] == MY_NETWORK_ADDR) continue;
+
+        byte slot = 0;
+        while (slot < child_count && children[slot][0] != record[0]) slot++;
+        if (slot == child_count) {
+            if (child_count >= TELEMETRY_MAX_RECORDS - 1) continue; // no room
+            child_count++;
+        }
+        for (byte j = 0; j < TELEMETRY_RECORD_LEN; j++) children[slot][j] = record[j];
+    }
+    return true;
+}
+
+bool telemetry_print(byte* message, uint16_t message_len) {
+
+    if (message_len < TELEMETRY_HEADER_LEN || message[0] != TELEMETRY_MARK) return false;
+
+    byte count = message[1];
+    if (message_len < TELEMETRY_HEADER_LEN + (uint16_t) count * TELEMETRY_RECORD_LEN) return true;
+
+    uart_transmit_formatted_message_P(PSTR("::: Telemetry, %d cubes :::\r\n"), count);
+    UART_WAIT_UNTIL_DONE();
+    for (byte i = 0; i < count; i++) {
+        byte* record = &message[TELEMETRY_HEADER_LEN + i * TELEMETRY_RECORD_LEN];
+        uart_transmit_formatted_message_P(PSTR("%02x: rx %u, tx %u, retx %u, lost %u, fwd %u, retries %u, timeouts %u, %u mV\r\n"),
+            record[0],
+            telemetry_get16(&record[1]),
+            telemetry_get16(&record[3]),
+            telemetry_get16(&record[5]),
+            telemetry_get16(&record[7]),
+            telemetry_get16(&record[9]),
+            telemetry_get16(&record[12]),
+            telemetry_get16(&record[14]),
+            record[11] * TELEMETRY_BATTERY_STEP_MV);
+        UART_WAIT_UNTIL_DONE();
+    }
+    return true;
+}
@@ -0,0 +1,70 @@
+#ifndef _TELEMETRY_H
+#define _TELEMETRY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "networking_constants.h"
+
+/*
+    Every TELEMETRY_INTERVAL_MS, each cube sends the rover's transceiver a
+    report of how it's doing. Instead of every report making its own way
+    there, each one only goes as far as the next hop toward the transceiver
+    (the cube's parent). The parent keeps it, and sends it along with its own
+    next report. So each cube sends one message per interval, however many
+    cubes are behind it, and the transceiver gets a snapshot of the whole
+    network at once. A report from far away takes an interval per hop to
+    get there.
+
+    message[0]          = TELEMETRY_MARK
+    message[1]          = how many records follow
+    then TELEMETRY_RECORD_LEN bytes per cube:
+
+    record[0]           = network address
+    record[1..2]        = messages it received
+    record[3..4]        = frames it sent (trx_link_stats_t)
+    record[5..6]        = automatic retransmissions those took
+    record[7..8]        = frames that ran out of retransmissions
+    record[9..10]       = packets it forwarded
+    record[11]          = supply voltage, in TELEMETRY_BATTERY_STEP_MV steps
+    record[12..13]      = transport segments sent again (transport_stats_t)
+    record[14..15]      = times an ack took longer than the RTO
+
+    Counts are 16 bits, low byte first, and wrap around. Retransmissions per
+    frame sent stand in for signal strength, which the radio doesn't report.
+*/
+
+#define TELEMETRY_MARK (0x02)
+
+// Where all the reports end up.
+#define TELEMETRY_SINK_ADDR (0x3F)
+
+#ifndef TELEMETRY_INTERVAL_MS
+#define TELEMETRY_INTERVAL_MS (30000)
+#endif
+
+#define TELEMETRY_RECORD_LEN (16)
+#define TELEMETRY_HEADER_LEN (2)
+#define TELEMETRY_BATTERY_STEP_MV (20)
+
+// Most records one report carries: ours, plus everyone behind us.
+#define TELEMETRY_MAX_RECORDS (4)
+
+#define TELEMETRY_MAX_LEN (TELEMETRY_HEADER_LEN + TELEMETRY_MAX_RECORDS * TELEMETRY_RECORD_LEN)
+
+// Get ready to send reports. Call it after timer_clock_initialize.
+void telemetry_initialize(void);
+
+// Send a report once it's time, through transport_send_async.
+// messages_received is how many messages the application got.
+// Call it often, with transport_poll.
+void telemetry_poll(uint16_t messages_received);
+
+// If the message is a report, keep its records for our next one and return
+// true.
+bool telemetry_receive(byte* message, uint16_t message_len);
+
+// If the message is a report, print its records to the UART and return true.
+// For the transceiver.
+bool telemetry_print(byte* message, uint16_t message_len);
+
+#endif
@@ -5,35 +5,162 @@
 // Provides functions for using the ATMega's 16-bit Timer/Counter 1 for basic
 // timing delays in situations that do not require interrupts.
 //
+// Also provides a free-running millisecond clock on Timer/Counter 0, for code
+// that can't sit and wait on Timer 1.
+//
 ////////////////////////////////////////////////////////////////////////////////
 
 #include "timer.h"
 #include "cube_parameters.h"
+#include "cpu_clock.h"
+#include "idle.h"
+#include "profile.h"
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+
+/////////////////// Private Defines ////////////////////////////////////////////
+
+// Timer 0 counts to this in CTC mode once per millisecond.
+#define TIMER_CLOCK_OCR0A CLOCK_TIMER0_OCR0A
+
+// Timer 1 counts slower while the CPU is idle (cpu_clock.h), and Timer 0
+// needs a different prescaler to keep up.
+#if CLOCK_SCALING
+  #define TIMER1_MS_SHIFT (cpu_clock_is_idle() ? CLOCK_TIMER1_IDLE_MS_SHIFT : CLOCK_TIMER1_MS_SHIFT)
+  #define TIMER0_CS       (cpu_clock_is_idle() ? CLOCK_TIMER0_IDLE_CS : CLOCK_TIMER0_CS)
+#else
+  #define TIMER1_MS_SHIFT CLOCK_TIMER1_MS_SHIFT
+  #define TIMER0_CS       CLOCK_TIMER0_CS
+#endif
+
+/////////////////// Static Variable Definitions ////////////////////////////////
+
+static volatile timer_delay_ms_t timer_clock_ms = 0;
+
+// For timer_now_us: the millisecond clock is only 16 bits, so count its
+// wraparounds.
+static uint32_t timer_clock_high_ms = 0;
+static timer_delay_ms_t timer_clock_last_ms = 0;
+
+// Set by the Timer 1 compare interrupt, which clears OCF1A on its way in.
+static volatile uint8_t timer_expired = 0;
 
 /////////////////// Public Function Bodies /////////////////////////////////////
 
 void timer_start(timer_delay_ms_t delay_ms) {
 
-    // Sets the timer count to 0.
+    // Sets the timer count to 0, and forgets it ever went off.
     TCNT1 = 0;
+    TIFR1 |= _BV(OCF1A);
+    timer_expired = 0;
 
-    // Loads the delay value into the compare register.
-#if F_CPU == 1000000
-    OCR1A = delay_ms;
-#elif F_CPU == 8000000
-    OCR1A = delay_ms << 3;
-#else
-    #error "F_CPU has invalid value."
-#endif
+    // Loads the delay value into the compare register. Anything past
+    // CLOCK_TIMER1_MAX_MS overflows.
+    OCR1A = delay_ms << TIMER1_MS_SHIFT;
 
     // Starts running the timer in CTC-OCR1A mode from the 1/1024 prescaler.
     TCCR1B = (_BV(WGM12) | _BV(CS12) | _BV(CS10));
 
+    // Wakes up whoever is waiting for it.
+    TIMSK1 |= _BV(OCIE1A);
+
 }
 
 void timer_stop(void) {
+    TIMSK1 &= ~_BV(OCIE1A);
     TIFR1 |= _BV(OCF1A);
     TCCR1B = 0;
-}
\ No newline at end of file
+    timer_expired = 0;
+}
+
+uint8_t timer_done(void) {
+    return timer_expired || (TIFR1 & _BV(OCF1A)) != 0;
+}
+
+timer_delay_ms_t timer_elapsed_ms(void) {
+    return TCNT1 >> TIMER1_MS_SHIFT;
+}
+
+void timer_clock_initialize(void) {
+
+    timer_clock_ms = 0;
+    timer_clock_high_ms = 0;
+    timer_clock_last_ms = 0;
+    TCNT0 = 0;
+    OCR0A = TIMER_CLOCK_OCR0A;
+
+    // CTC-OCR0A mode.
+    TCCR0A = _BV(WGM01);
+
+    // Starts running the timer from the prescaler clock.h picked for F_CPU
+    // (1/8 at 1 MHz, 1/64 at 8 MHz).
+    TCCR0B = TIMER0_CS;
+
+    TIMSK0 |= _BV(OCIE0A);
+    SREG |= _BV(SREG_I);
+
+}
+
+timer_delay_ms_t timer_now_ms(void) {
+
+    // Reading 16 bits takes two instructions, so don't let the ISR sneak in
+    // between them.
+    uint8_t sreg = SREG;
+    SREG &= ~_BV(SREG_I);
+    timer_delay_ms_t now = timer_clock_ms;
+    SREG = sreg;
+
+    return now;
+}
+
+uint32_t timer_now_us(void) {
+
+    uint8_t sreg = SREG;
+    SREG &= ~_BV(SREG_I);
+
+    timer_delay_ms_t ms = timer_clock_ms;
+    uint8_t count = TCNT0;
+
+    // The millisecond is up, but its ISR hasn't had its turn yet (interrupts
+    // were off, or this is an ISR). If the count is still near the top, the
+    // match came after it was read.
+    if ((TIFR0 & _BV(OCF0A)) != 0 && count < (TIMER_CLOCK_OCR0A >> 1)) ms++;
+
+    if (ms < timer_clock_last_ms) timer_clock_high_ms += 0x10000UL;
+    timer_clock_last_ms = ms;
+
+    SREG = sreg;
+
+    return (timer_clock_high_ms + ms) * 1000UL
+        + (uint32_t) count * CLOCK_TIMER0_PRESCALER / (F_CPU / 1000000UL);
+}
+
+void timer_wait_ms(timer_delay_ms_t delay_ms) {
+
+    // Nothing would wake us up.
+    if ((TIMSK0 & _BV(OCIE0A)) == 0 || (SREG & _BV(SREG_I)) == 0) {
+        while (delay_ms-- > 0) _delay_ms(1);
+        return;
+    }
+
+    // The next tick could come right away, so it takes one more to be sure.
+    timer_delay_ms_t until = timer_now_ms() + delay_ms + 1;
+    IDLE_UNTIL((int16_t) (timer_now_ms() - until) >= 0);
+
+}
+
+///////////// Interrupt Service Routines ///////////////////////////////////////
+
+// One more millisecond has gone by.
+ISR(TIMER0_COMPA_vect) {
+    PROFILE_TICK();
+    timer_clock_ms++;
+}
+
+// The timer from timer_start has gone off. It keeps counting, but TIMER_DONE
+// stays true until the next timer_start or timer_stop.
+ISR(TIMER1_COMPA_vect) {
+    timer_expired = 1;
+}
@@ -3,7 +3,11 @@
 // Timer
 //
 // Provides functions for using the ATMega's 16-bit Timer/Counter 1 for basic
-// timing delays in situations that do not require interrupts.
+// timing delays. Its compare interrupt only marks the timer done, so
+// IDLE_UNTIL(TIMER_DONE) can sleep until then.
+//
+// Also provides a free-running millisecond clock on Timer/Counter 0, for code
+// that can't sit and wait on Timer 1.
 //
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -15,7 +19,7 @@
 /////////////////// Timer Macros ///////////////////////////////////////////////
 
 // Whether the timer has "gone off".
-#define TIMER_DONE ((TIFR1 & _BV(OCF1A)) != 0)
+#define TIMER_DONE (timer_done())
 
 /////////////////// Timer Type Definitions /////////////////////////////////////
 
@@ -30,4 +34,32 @@ void timer_start(timer_delay_ms_t delay_ms);
 // Stops the timer.
 void timer_stop(void);
 
+// Whether the timer has gone off since timer_start, with or without
+// interrupts on.
+uint8_t timer_done(void);
+
+// Returns how many milliseconds the timer ran for since timer_start was last
+// called. Stopping the timer freezes this value until the next timer_start.
+timer_delay_ms_t timer_elapsed_ms(void);
+
+// Starts the millisecond clock on Timer 0 and enables global interrupts.
+// Timer 1 is left alone, so timer_start and timer_stop still work.
+void timer_clock_initialize(void);
+
+// Milliseconds since timer_clock_initialize was called. This wraps around
+// every 65.5 seconds, so compare two times by subtracting them.
+timer_delay_ms_t timer_now_ms(void);
+
+// Microseconds since timer_clock_initialize was called, from the millisecond
+// clock and how far Timer 0 has counted into the next millisecond (8 us at a
+// time at 1 or 8 MHz). It keeps count of timer_now_ms wrapping around, so it
+// lasts about 71 minutes, but only if it's called at least once every 65
+// seconds.
+uint32_t timer_now_us(void);
+
+// Waits at least this many milliseconds, asleep (idle.h) until Timer 0's
+// tick says it's time. Before timer_clock_initialize, or with interrupts off,
+// it's _delay_ms.
+void timer_wait_ms(timer_delay_ms_t delay_ms);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,72 @@
+#ifndef _TOPOLOGY_H
+#define _TOPOLOGY_H
+
+// The whole network on one page. Every node's routing table is built from
+// this, so a topology change is an edit here and a rebuild of every node.
+//
+// Right now it's a chain:
+//
+//     cube0 (3A) -- cube1 (3B) -- cube2 (3C) -- rover_trx (3F)
+//
+// Every network address, group addresses included, has to be in the
+// TOPOLOGY_ADDR_BLOCK block of 2^TOPOLOGY_COLUMN_BITS so it can index the
+// routing table directly.
+//
+// With TOPOLOGY_RUNTIME set (the multi-node simulator), none of this is used:
+// whoever starts each node gives it its routes with routing_table_set, and
+// the block is 0x00 to 0x3F so there's room for dozens of nodes.
+
+#ifndef TOPOLOGY_RUNTIME
+#define TOPOLOGY_RUNTIME (0)
+#endif
+
+#if TOPOLOGY_RUNTIME
+
+#define TOPOLOGY_ADDR_BLOCK (0x00)
+#define TOPOLOGY_COLUMN_BITS (6)
+
+#else
+
+#define TOPOLOGY_ADDR_BLOCK (0x30)
+#define TOPOLOGY_COLUMN_BITS (4)
+
+// Each node's row in the routing table, or -1 if it isn't a node.
+#define TOPOLOGY_NODE_COUNT (4)
+#define TOPOLOGY_ROW(addr) ( \
+    (addr) == 0x3A ? 0 : \
+    (addr) == 0x3B ? 1 : \
+    (addr) == 0x3C ? 2 : \
+    (addr) == 0x3F ? 3 : -1)
+
+// TOPOLOGY_ROUTE(from, to, next_hop): the next hop each node uses to get to
+// each destination. A destination that isn't listed for a node is
+// unreachable from it (NETWORK_ADDR_NONE). For a group, the route is where the
+// packet goes after this node has kept its copy, and NETWORK_ADDR_NONE ends it.
+#define TOPOLOGY_ROUTES(TOPOLOGY_ROUTE) \
+    TOPOLOGY_ROUTE(0x3A, 0x3A, 0x3A) \
+    TOPOLOGY_ROUTE(0x3A, 0x3B, 0x3B) \
+    TOPOLOGY_ROUTE(0x3A, 0x3C, 0x3B) \
+    TOPOLOGY_ROUTE(0x3A, 0x3F, 0x3B) \
+    TOPOLOGY_ROUTE(0x3A, NETWORK_GROUP_ALL_CUBES, NETWORK_ADDR_NONE) \
+    \
+    TOPOLOGY_ROUTE(0x3B, 0x3A, 0x3A) \
+    TOPOLOGY_ROUTE(0x3B, 0x3B, 0x3B) \
+    TOPOLOGY_ROUTE(0x3B, 0x3C, 0x3C) \
+    TOPOLOGY_ROUTE(0x3B, 0x3F, 0x3C) \
+    TOPOLOGY_ROUTE(0x3B, NETWORK_GROUP_ALL_CUBES, 0x3A) \
+    \
+    TOPOLOGY_ROUTE(0x3C, 0x3A, 0x3B) \
+    TOPOLOGY_ROUTE(0x3C, 0x3B, 0x3B) \
+    TOPOLOGY_ROUTE(0x3C, 0x3C, 0x3C) \
+    TOPOLOGY_ROUTE(0x3C, 0x3F, 0x3F) \
+    TOPOLOGY_ROUTE(0x3C, NETWORK_GROUP_ALL_CUBES, 0x3B) \
+    \
+    TOPOLOGY_ROUTE(0x3F, 0x3A, 0x3C) \
+    TOPOLOGY_ROUTE(0x3F, 0x3B, 0x3C) \
+    TOPOLOGY_ROUTE(0x3F, 0x3C, 0x3C) \
+    TOPOLOGY_ROUTE(0x3F, 0x3F, 0x3F) \
+    TOPOLOGY_ROUTE(0x3F, NETWORK_GROUP_ALL_CUBES, 0x3C)
+
+#endif
+
+#endif
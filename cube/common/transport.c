@@ -1,8 +1,8 @@
 /*
     Welcome to a bit of a bizarre transport layer.
-    It only works with one message sender at a time. This is because we only
-    expect one sender at a time. A more correct transport layer is more
-    complicated and a little impractical for our tiny microcontroller.
+    It can put together messages from a couple of senders at once, keeping
+    a small context for each source port. A more correct transport layer is
+    more complicated and a little impractical for our tiny microcontroller.
 
     This transport layer abuses the "port" concept. Normally, an endpoint
     is uniquely identified by a network address and port number pair.
@@ -14,16 +14,22 @@
 #include "address_resolution.h"
 #include "transport.h"
 #include "network.h"
+#include "data_link.h"
+#include "compress.h"
 #include "address.h"
 #include "cube_parameters.h"
+#include "log_level.h"
+#include "node_state.h"
 
 #ifndef SIMULATION
 #include "trx.h"
-#include <util/delay.h>
+#include "print_data.h"
+#include "timer.h"
+#include "arena.h"
 #else
 #include "sim_trx.h"
 #include "sim_delay.h"
-#include "print_data.h"
+#include "sim_print_data.h"
 #include <stdio.h>
 #endif
 
@@ -33,14 +39,124 @@
 // a network from being overwhelmed by throttling its own output!
 
 
+// How long to wait for an ack before we know anything about the path.
+// After that, the timeout adapts to the round trip times we measure.
 #define TRANSPORT_TX_ACK_TIMEOUT_MS (1500)
 #define TRANSPORT_TX_ACK_DELAY_MS (250)
 #define TRANSPORT_TX_SEGMENT_SPACING_MS (250)
 #define TRANSPORT_TX_RETRY_DELAY_MS (250)
 #define TRANSPORT_TX_ATTEMPT_LIMIT (10)
 
+// Which protocol transport_tx uses. The sender announces its choice in the
+// START_OF_MESSAGE segment, so a receiver handles either mode regardless of
+// this setting. Stop-and-wait is the original alternating-bit protocol and is
+// kept for compatibility.
+#define TRANSPORT_MODE_STOP_AND_WAIT (0)
+#define TRANSPORT_MODE_SELECTIVE_REPEAT (1)
+#define TRANSPORT_TX_MODE TRANSPORT_MODE_SELECTIVE_REPEAT
+
+// Selective repeat sends this many DATA segments before it waits for acks.
+// The receiver tracks at most TRANSPORT_MAX_WINDOW_SIZE segments ahead of
+// the first one it is missing, so the window must not be larger than that.
+#define TRANSPORT_MAX_WINDOW_SIZE (8)
+#define TRANSPORT_TX_WINDOW_SIZE (4)
+
+// Gap between back-to-back segments (and acks) inside one window.
+// The receiver has to get back into RX mode between frames.
+#define TRANSPORT_TX_WINDOW_SPACING_MS (50)
+
+#if TRANSPORT_TX_WINDOW_SIZE > TRANSPORT_MAX_WINDOW_SIZE
+#error "TRANSPORT_TX_WINDOW_SIZE cannot be larger than TRANSPORT_MAX_WINDOW_SIZE."
+#endif
+
+// Hand the whole window to the radio at once instead of one segment at a
+// time. The radio keeps its TX FIFO full, so the window goes out with no
+// spacing at all. The receiver's RX FIFO and ring buffer have to be able to
+// hold a whole window for this to work. Costs a frame buffer per segment in
+// the window.
+#define TRANSPORT_TX_USE_BURST (1)
 
-// four segment types: START_OF_MESSAGE, DATA, END_OF_MESSAGE, ACK
+#if TRANSPORT_TX_USE_BURST && TRANSPORT_TX_WINDOW_SIZE > DATA_LINK_TX_BURST_MAX
+#error "TRANSPORT_TX_WINDOW_SIZE cannot be larger than DATA_LINK_TX_BURST_MAX when bursting."
+#endif
+
+// Bounds for the adaptive ack timeout. The receiver always waits
+// TRANSPORT_TX_ACK_DELAY_MS before it acks, so anything less can't work.
+// The upper bound also has to fit in the 16-bit timer at 8 MHz.
+#define TRANSPORT_TX_RTO_MIN_MS (TRANSPORT_TX_ACK_DELAY_MS + 100)
+#define TRANSPORT_TX_RTO_MAX_MS (6000)
+
+// How many senders we can put messages together for at the same time, and
+// how much of each message we keep. Every context costs
+// TRANSPORT_RX_BUFFER_LEN bytes of SRAM, which come out of the arena's
+// transport_rx slot (see arena.h): 512 of the 328P's 2 KB with these.
+// If the application only uses transport_rx_stream, set
+// TRANSPORT_RX_BUFFER_LEN to 0. That gets rid of the buffers, and of transport_rx.
+#define TRANSPORT_RX_CONTEXT_COUNT (2)
+#define TRANSPORT_RX_BUFFER_LEN (MAX_MESSAGE_LEN)
+
+// Messages that fit in one segment go as a single COMPACT segment instead of
+// START_OF_MESSAGE, DATA and END_OF_MESSAGE.
+#define TRANSPORT_TX_USE_COMPACT (1)
+
+// Messages are compressed (see compress.h) when that makes them shorter. The
+// sender says so in the START_OF_MESSAGE (or the COMPACT sequence number), so
+// a receiver handles compressed messages regardless of this setting. Only
+// messages up to TRANSPORT_COMPRESS_MAX_LEN long are compressed, which is
+// how much stack it costs to send one.
+#define TRANSPORT_TX_USE_COMPRESSION (1)
+#define TRANSPORT_COMPRESS_MAX_LEN (96)
+
+// Most members a multicast group can have. Acks are tracked in a bitmap.
+#define TRANSPORT_MULTICAST_MAX_MEMBERS (8)
+
+// Stop-and-wait receivers can leave the ack for the segment they expect next
+// with the radio, which sends it back along with its own acknowledgement of
+// that segment. The sender gets its ack without either side switching
+// between TX and RX, and the receiver skips TRANSPORT_TX_ACK_DELAY_MS. Only
+// works when the sender is one hop away, since the ack goes to whoever sent
+// the frame. When the guess is wrong, the ack just has the wrong sequence
+// number, and the usual ack follows.
+#define TRANSPORT_USE_ACK_PAYLOAD (0)
+
+// How many destination ports we keep round trip time estimates for.
+#define TRANSPORT_RTT_TABLE_LEN (4)
+
+// How much of the message fits in one DATA segment.
+#define DATA_SEGMENT_PAYLOAD_LEN (MAX_SEGMENT_LEN - DATA_SEGMENT_HEADER_LEN)
+
+// How long a message can be and still go as a COMPACT segment.
+#define COMPACT_SEGMENT_PAYLOAD_LEN (MAX_SEGMENT_LEN - COMPACT_SEGMENT_HEADER_LEN)
+
+// Selective repeat can acknowledge a whole window with one SACK segment
+// instead of one ACK per DATA segment. The receiver sends a SACK when the
+// sender asks for one, once TRANSPORT_SACK_MAX_PENDING DATA segments have
+// arrived without one, or after TRANSPORT_SACK_DELAY_MS of silence.
+#define TRANSPORT_TX_USE_SACK (1)
+#define TRANSPORT_SACK_MAX_PENDING (TRANSPORT_MAX_WINDOW_SIZE)
+#define TRANSPORT_SACK_DELAY_MS (400)
+
+// START_OF_MESSAGE segment[7] flags
+#define START_FLAG_SELECTIVE_REPEAT (0x01)
+#define START_FLAG_SACK (0x02)
+#define START_FLAG_REPLY_EXPECTED (0x04)    // sent by transport_request
+#define START_FLAG_PIGGYBACK_ACK (0x08)     // segment[8] acks the request's END_OF_MESSAGE
+#define START_FLAG_COMPRESSED (0x10)        // the message is compressed (compress.h)
+#define START_FLAG_LARGE (0x20)             // sent by transport_tx_large; the receiver can resume it
+
+// A START_OF_MESSAGE with START_FLAG_PIGGYBACK_ACK is one byte longer.
+#define START_SEGMENT_PIGGYBACK_LEN (START_SEGMENT_HEADER_LEN + 1)
+
+// DATA segment[7] flags
+#define DATA_FLAG_ACK_REQUEST (0x01)
+
+// The top bit of a COMPACT segment's sequence number says whether the
+// message is compressed. The rest is the sequence number.
+#define COMPACT_FLAG_COMPRESSED (0x80)
+#define COMPACT_SEQ_MASK (0x7F)
+
+
+// segment types: START_OF_MESSAGE, DATA, END_OF_MESSAGE, ACK, SACK, COMPACT
 
 // START_OF_MESSAGE segment:
 // segment[0] = length of segment = 6
@@ -49,6 +165,9 @@
 // segment[3] = source port number
 // segment[4] = segment identifier = 0x07, START_OF_MESSAGE
 // segment[5-6] = total length of message
+// segment[7] = flags (START_FLAG_*)
+// segment[8] = (START_FLAG_PIGGYBACK_ACK only) ack sequence number for the
+//              END_OF_MESSAGE of the request this message answers
 
 // DATA segment:
 // segment[0] = length of segment
@@ -57,6 +176,7 @@
 // segment[3] = source port number
 // segment[4] = segment identifier = 0x0D, DATA
 // segment[5-6] = start address (starting memory address of this segment's data)
+// segment[7] = flags (DATA_FLAG_*)
 // rest is payload
 
 // END_OF_MESSAGE segment:
@@ -73,6 +193,31 @@
 // segment[3] = source port number
 // segment[4] = segment identifier = 0x0A, ACK
 
+// SACK segment:
+// segment[0] = length of segment = 8
+// segment[1] = sequence number of the DATA segment that prompted it
+// segment[2] = destination port number
+// segment[3] = source port number
+// segment[4] = segment identifier = 0x0B, SACK
+// segment[5-6] = cumulative offset (every byte before this was received)
+// segment[7] = bitmap; bit i is set if the DATA segment starting
+//              i segments past the cumulative offset was received
+
+// COMPACT segment:
+// segment[0] = length of segment
+// segment[1] = sequence number
+// segment[2] = destination port number
+// segment[3] = source port number
+// segment[4] = segment identifier = 0x0C, COMPACT
+// rest is the whole message
+
+// With START_FLAG_LARGE, a receiver with a sink answers the START_OF_MESSAGE
+// with a SACK instead of an ack. Its cumulative offset is where the sender
+// should pick up; every DATA segment before that is already in the sink.
+
+// With START_FLAG_COMPRESSED (or COMPACT_FLAG_COMPRESSED), the total length
+// and start addresses are of the compressed message.
+
 
 // Using an enum for a "state machine" to make this a little more easily expandable.
 enum rx_state_t {
@@ -98,6 +243,42 @@ If it does not match... well, somehow my previous ack got lost in transmission,
 so the other guy sent the same thing again. I won't do anything this time.
 Hopefully he got my ack this time and sends the next frame.
 
+=== Selective repeat ===
+The START_OF_MESSAGE and END_OF_MESSAGE segments work the same way, except
+that an ack always carries the sequence number of the segment it acknowledges.
+DATA segment n (counting from 0) gets sequence number n+1, modulo 256.
+
+The transmitter sends a window of up to TRANSPORT_TX_WINDOW_SIZE DATA segments
+back-to-back. The last one it sends has DATA_FLAG_ACK_REQUEST set. Then it
+listens for acks. Anything that did not get acked is sent again, and the
+window slides forward past everything that did.
+
+The receiver uses the start address of each DATA segment to put it in the
+right place, so segments can show up in any order. It remembers which
+segments it has seen and owes an ack for. When a segment with
+DATA_FLAG_ACK_REQUEST arrives, it sends all of those acks at once.
+
+If the START_OF_MESSAGE has START_FLAG_SACK, one SACK segment replaces all of
+those acks. It says how much of the message arrived in order, plus a bitmap of
+what arrived after that, so the transmitter knows exactly which gaps to fill.
+
+================================================================================
+
+Requests and replies
+
+transport_request sends a message with START_FLAG_REPLY_EXPECTED, then waits
+for the answer. The receiver doesn't ack that message's END_OF_MESSAGE right
+away. Instead, when the application calls transport_reply, the reply's
+START_OF_MESSAGE carries the ack (START_FLAG_PIGGYBACK_ACK), which saves a
+frame on the turnaround.
+
+The requester takes that START_OF_MESSAGE as its ack, and keeps the frame for
+the transport_rx that picks up the reply.
+
+If the application takes too long to reply, the requester just sends the
+END_OF_MESSAGE again. That one gets a normal ack, and the reply comes as a
+normal message.
+
 === Transmitter side ===
 We both start at seq number 0. This will be my "current seq num".
 
@@ -123,41 +304,503 @@ typedef enum {
     TRANSPORT_ATTEMPT_RX_ERROR
 } transport_attempt_rx_result;
 
+// Everything the receiver needs to remember about the message one sender is
+// currently putting together. We keep one of these per source port, so
+// several senders can talk to us at the same time.
+typedef struct transport_rx_context {
+    bool used;
+    byte port;                      // source port of the sender
+    byte state;                     // rx_state_t
+    byte mode;                      // TRANSPORT_MODE_* announced by the START_OF_MESSAGE
+    byte seq;                       // stop-and-wait: what we expect the next sequence number to be
+    uint16_t base_index;            // selective repeat: first DATA segment we're still missing
+    byte window_bitmap;             // selective repeat: segments after base_index we already have
+    byte pending_acks[TRANSPORT_MAX_WINDOW_SIZE + 1]; // selective repeat: sequence numbers we owe an ack
+    byte pending_ack_count;
+    bool sack;                      // selective repeat: acknowledge DATA with SACK segments
+    byte sack_seq;                  // selective repeat: sequence number the next SACK answers
+    bool compact_seen;              // compact_seq is valid
+    byte compact_seq;               // sequence number of the last COMPACT segment
+    bool reply_expected;            // the START_OF_MESSAGE had START_FLAG_REPLY_EXPECTED
+    bool reply_owed;                // we held back the END_OF_MESSAGE ack for transport_reply
+    byte reply_ack_seq;             // the ack we held back
+    uint16_t message_len;           // total length from the START_OF_MESSAGE
+    bool compressed;                // the message is compressed
+    compress_state_t decoder;       // transport_rx_stream: where decompressing left off
+    uint16_t decoded_len;           // transport_rx_stream: how much has been decompressed
+    bool to_sink;                   // a START_FLAG_LARGE message going to rx_sink
+    byte last_used;                 // for throwing out the stalest context
+} transport_rx_context_t;
+
+NODE_STATE transport_rx_context_t rx_contexts[TRANSPORT_RX_CONTEXT_COUNT];
+
+#if TRANSPORT_RX_BUFFER_LEN > 0
+// Where each context's message is put together. On the cubes they're the
+// biggest thing in here, so they go in the arena, where avr-size and
+// ARENA_SRAM_BUDGET count them. Every simulated node needs its own.
+#ifndef SIMULATION
+ARENA_REQUIRE(transport_rx, TRANSPORT_RX_CONTEXT_COUNT * TRANSPORT_RX_BUFFER_LEN);
+#define TRANSPORT_RX_BUFFERS ((byte (*)[TRANSPORT_RX_BUFFER_LEN]) ARENA_BUFFER(transport_rx))
+#else
+NODE_STATE byte rx_buffers[TRANSPORT_RX_CONTEXT_COUNT][TRANSPORT_RX_BUFFER_LEN];
+#define TRANSPORT_RX_BUFFERS (rx_buffers)
+#endif
+
+#define TRANSPORT_RX_BUFFER(context) (TRANSPORT_RX_BUFFERS[(context) - rx_contexts])
+#endif
+
+// Set while transport_rx_stream is running. There's no buffer to put
+// out-of-order DATA in, so the receiver only takes segments in order.
+NODE_STATE bool rx_streaming = false;
+
+// Where START_FLAG_LARGE messages go, if anywhere. Like transport_rx_stream,
+// these are only taken in order.
+NODE_STATE const transport_sink_t* rx_sink = NULL;
+
+// A reply's START_OF_MESSAGE that showed up while we were waiting for the ack
+// to our request. transport_attempt_rx takes it before asking the network.
+NODE_STATE frame_buffer_t rx_stashed_frame;
+NODE_STATE bool rx_stash_full = false;
+
+// Bumped every time a context gets used.
+NODE_STATE byte rx_context_clock = 0;
+
+// See transport_get_stats.
+NODE_STATE transport_stats_t stats;
+
+#if TRANSPORT_USE_ACK_PAYLOAD
+// The context whose next ack is waiting in the radio, and what that ack's
+// sequence number is. Only one can be there at a time.
+NODE_STATE transport_rx_context_t* ack_payload_context = NULL;
+NODE_STATE byte ack_payload_seq;
+#endif
+
+// Acks the polling engine owes, and when they're due. While rx_acks.deferring
+// is set, nothing waits TRANSPORT_TX_ACK_DELAY_MS: the acks go in here, and
+// transport_poll sends them once due_at comes around. An entry with a sack
+// context is a SACK for that context, written when it goes out.
+typedef struct {
+    byte seq;
+    byte port;
+    struct transport_rx_context* sack;
+} transport_deferred_ack_t;
+
+typedef struct {
+    bool deferring;
+    byte count;
+    timer_delay_ms_t due_at;
+    transport_deferred_ack_t acks[TRANSPORT_MAX_WINDOW_SIZE + 1];
+} transport_deferred_acks_t;
+
+NODE_STATE transport_deferred_acks_t rx_acks = { .deferring = false, .count = 0 };
+
+// Find the context for a sender. A START_OF_MESSAGE from someone new gets a
+// fresh one, taking over the stalest context if there are none left.
+// Returns NULL if we don't know this sender and it isn't starting a message.
+transport_rx_context_t* transport_rx_context(byte port, bool starting) {
+
+    transport_rx_context_t* context = NULL;
+
+    for (byte i = 0; i < TRANSPORT_RX_CONTEXT_COUNT; i++) {
+        if (rx_contexts[i].used && rx_contexts[i].port == port) {
+            context = &rx_contexts[i];
+            break;
+        }
+    }
+
+    if (context == NULL) {
+        if (!starting) return NULL;
+
+        // Prefer an empty context, then an idle one, then the stalest one.
+        context = &rx_contexts[0];
+        for (byte i = 0; i < TRANSPORT_RX_CONTEXT_COUNT; i++) {
+            transport_rx_context_t* candidate = &rx_contexts[i];
+            if (!candidate->used) {
+                context = candidate;
+                break;
+            }
+            bool candidate_idle = candidate->state == RXST_Idle;
+            bool context_idle = context->state == RXST_Idle;
+            if (candidate_idle != context_idle) {
+                if (candidate_idle) context = candidate;
+            }
+            else if ((byte) (rx_context_clock - candidate->last_used) > (byte) (rx_context_clock - context->last_used)) {
+                context = candidate;
+            }
+        }
+
+        context->used = true;
+        context->port = port;
+        context->state = RXST_Idle;
+        context->mode = TRANSPORT_MODE_STOP_AND_WAIT;
+        context->seq = 0;
+        context->compact_seen = false;
+        context->to_sink = false;
+    }
+
+    context->last_used = ++rx_context_clock;
+    return context;
+}
+
+// Write an ACK segment for the given sequence number.
+void transport_build_ack(byte* ack_seg, byte seq, byte dest_port) {
+    ack_seg[0] = ACK_SEGMENT_HEARDER_LEN;
+    ack_seg[1] = seq;
+    ack_seg[2] = dest_port;  // destination port = port of whoever sent
+    ack_seg[3] = MY_PORT;    // source port = me :)
+    ack_seg[4] = SEGID_ACK;
+    ack_seg[5] = 0;
+}
+
+// Send an ACK segment for the given sequence number.
+void transport_send_ack(byte seq, byte dest_port) {
+    frame_buffer_t frame;
+    transport_build_ack(FRAME_SEGMENT(frame), seq, dest_port);
+    if (LOG_ENABLED(DEBUG, TRANSPORT)) print_trace(TRACE_ACK, seq, dest_port, MY_PORT, 0);
+    // if this errors out, we don't care, the other guy will send me another thing anyways
+    // it's tiny, so it can share a frame
+    network_tx_queued(frame, ACK_SEGMENT_HEARDER_LEN, resolve_network_addr(dest_port), MY_NETWORK_ADDR);
+    stats.acks_sent++;
+}
+
+#if TRANSPORT_USE_ACK_PAYLOAD
+// Leave the ack for the segment this context expects next with the radio.
+void transport_set_ack_payload(transport_rx_context_t* context) {
+    frame_buffer_t frame;
+    byte seq = context->seq == 0 ? 1 : 0;
+    transport_build_ack(FRAME_SEGMENT(frame), seq, context->port);
+    if (network_set_ack_packet(frame, ACK_SEGMENT_HEARDER_LEN, resolve_network_addr(context->port), MY_NETWORK_ADDR)) {
+        ack_payload_context = context;
+        ack_payload_seq = seq;
+    }
+    else if (ack_payload_context != NULL) {
+        network_clear_ack_packet();
+        ack_payload_context = NULL;
+    }
+}
+
+// Whether the radio already sent this ack for us.
+// Either way, the ack payload is used up.
+bool transport_ack_payload_sent(transport_rx_context_t* context, byte seq) {
+    bool sent = ack_payload_context == context && ack_payload_seq == seq && network_ack_packet_sent();
+    if (ack_payload_context != NULL) {
+        network_clear_ack_packet();
+        ack_payload_context = NULL;
+    }
+    return sent;
+}
+#endif
+
+// Remember that we owe the sender an ack for this sequence number.
+void transport_queue_ack(transport_rx_context_t* context, byte seq) {
+    for (byte i = 0; i < context->pending_ack_count; i++) {
+        if (context->pending_acks[i] == seq) return;
+    }
+    if (context->pending_ack_count < sizeof(context->pending_acks)) {
+        context->pending_acks[context->pending_ack_count++] = seq;
+    }
+}
+
+// Leave an ack (or, with a sack context, a SACK) for transport_poll to send
+// once TRANSPORT_TX_ACK_DELAY_MS is up. Returns false if the polling engine
+// isn't running, and the caller has to wait and send it itself.
+bool transport_defer_ack(byte seq, byte port, transport_rx_context_t* sack) {
+
+    if (!rx_acks.deferring) return false;
+
+    for (byte i = 0; i < rx_acks.count; i++) {
+        transport_deferred_ack_t* ack = &rx_acks.acks[i];
+        if (ack->port == port && ack->sack == sack && (sack != NULL || ack->seq == seq)) return true;
+    }
+    if (rx_acks.count == 0) rx_acks.due_at = timer_now_ms() + TRANSPORT_TX_ACK_DELAY_MS;
+
+    // If there's no room, the sender will just send it again.
+    if (rx_acks.count < sizeof(rx_acks.acks) / sizeof(rx_acks.acks[0])) {
+        transport_deferred_ack_t* ack = &rx_acks.acks[rx_acks.count++];
+        ack->seq = seq;
+        ack->port = port;
+        ack->sack = sack;
+    }
+    return true;
+}
+
+// Ack a segment TRANSPORT_TX_ACK_DELAY_MS from now. The sender needs that
+// long to start listening.
+void transport_delayed_ack(byte seq, byte port) {
+    if (transport_defer_ack(seq, port, NULL)) return;
+    timer_wait_ms(TRANSPORT_TX_ACK_DELAY_MS);
+    transport_send_ack(seq, port);
+}
+
+// Send every ack we owe, back-to-back.
+// They're queued, so a few of them share each frame.
+void transport_send_pending_acks(transport_rx_context_t* context) {
+    if (rx_acks.deferring) {
+        for (byte i = 0; i < context->pending_ack_count; i++) {
+            transport_defer_ack(context->pending_acks[i], context->port, NULL);
+        }
+    }
+    else {
+        timer_wait_ms(TRANSPORT_TX_ACK_DELAY_MS);
+        for (byte i = 0; i < context->pending_ack_count; i++) {
+            transport_send_ack(context->pending_acks[i], context->port);
+        }
+    }
+    context->pending_ack_count = 0;
+}
+
+// Send a SACK summarizing everything we have of the current message.
+void transport_send_sack(transport_rx_context_t* context) {
+    uint16_t cumulative_offset = context->base_index * DATA_SEGMENT_PAYLOAD_LEN;
+    frame_buffer_t frame;
+    byte* sack_seg = FRAME_SEGMENT(frame);
+    sack_seg[0] = SACK_SEGMENT_HEADER_LEN;
+    sack_seg[1] = context->sack_seq;
+    sack_seg[2] = context->port;
+    sack_seg[3] = MY_PORT;
+    sack_seg[4] = SEGID_SACK;
+    sack_seg[5] = (cumulative_offset & 0xFF00) >> 8;
+    sack_seg[6] = (cumulative_offset & 0x00FF) >> 0;
+    sack_seg[7] = context->window_bitmap;
+    network_tx_queued(frame, SACK_SEGMENT_HEADER_LEN, resolve_network_addr(context->port), MY_NETWORK_ADDR);
+    stats.acks_sent++;
+    context->pending_ack_count = 0;
+}
+
+// Like transport_delayed_ack, for a SACK. What it says is worked out when it
+// goes out, so it covers anything that arrives in the meantime.
+void transport_delayed_sack(transport_rx_context_t* context) {
+    if (transport_defer_ack(0, context->port, context)) return;
+    timer_wait_ms(TRANSPORT_TX_ACK_DELAY_MS);
+    transport_send_sack(context);
+}
+
+// Has the clock reached the given time yet?
+// Subtracting keeps this right when the clock wraps around.
+bool transport_time_reached(timer_delay_ms_t time) {
+    return (int16_t) (timer_now_ms() - time) >= 0;
+}
+
+// Send the acks transport_defer_ack has been holding on to, if they're due.
+// Returns true if it used the radio.
+bool transport_send_deferred_acks(void) {
+
+    if (rx_acks.count == 0 || !transport_time_reached(rx_acks.due_at)) return false;
+
+    for (byte i = 0; i < rx_acks.count; i++) {
+        transport_deferred_ack_t* ack = &rx_acks.acks[i];
+        if (ack->sack == NULL) {
+            transport_send_ack(ack->seq, ack->port);
+        }
+        // The context might have gone to someone else since.
+        else if (ack->sack->used && ack->sack->port == ack->port) {
+            transport_send_sack(ack->sack);
+        }
+    }
+    rx_acks.count = 0;
+    return true;
+}
+
+// Returns a context that has received DATA it hasn't sent a SACK for yet.
+transport_rx_context_t* transport_rx_sack_owed(void) {
+    for (byte i = 0; i < TRANSPORT_RX_CONTEXT_COUNT; i++) {
+        transport_rx_context_t* context = &rx_contexts[i];
+        if (context->used && context->sack && context->pending_ack_count > 0) return context;
+    }
+    return NULL;
+}
+
+// The selective repeat half of transport_attempt_rx.
+// Acks are only sent once the sender asks for them.
+transport_attempt_rx_result transport_attempt_rx_selective_repeat(transport_rx_context_t* context, byte* segment) {
+
+    transport_attempt_rx_result result = TRANSPORT_ATTEMPT_RX_SUCCESS;
+    bool ack_now = true;
+
+    if (segment[4] == SEGID_DATA) {
+        uint16_t offset = ((uint16_t) segment[5] << 8) + segment[6];
+        uint16_t index = offset / DATA_SEGMENT_PAYLOAD_LEN;
+
+        if (index < context->base_index) {
+            // We already have this one. Our ack must have gotten lost.
+            result = TRANSPORT_ATTEMPT_RX_OUTDATED;
+        }
+        else if (index - context->base_index >= TRANSPORT_MAX_WINDOW_SIZE) {
+            // Too far ahead for us to keep track of. Don't ack it; it'll come again.
+            return TRANSPORT_ATTEMPT_RX_OUTDATED;
+        }
+        else if ((rx_streaming || context->to_sink) && index != context->base_index) {
+            // Streaming has nowhere to keep this until the gap is filled.
+            // Don't ack it, but do answer the sender if it's asking,
+            // so it finds out about the gap.
+            if ((segment[7] & DATA_FLAG_ACK_REQUEST) != 0) {
+                if (context->sack) transport_delayed_sack(context);
+                else transport_send_pending_acks(context);
+            }
+            return TRANSPORT_ATTEMPT_RX_OUTDATED;
+        }
+        else {
+            byte bit = 1 << (index - context->base_index);
+            if ((context->window_bitmap & bit) != 0) {
+                result = TRANSPORT_ATTEMPT_RX_OUTDATED;
+            }
+            else {
+                context->window_bitmap |= bit;
+                // Slide past everything we have in order.
+                while ((context->window_bitmap & 0x01) != 0) {
+                    context->window_bitmap >>= 1;
+                    context->base_index++;
+                }
+            }
+        }
+
+        ack_now = (segment[7] & DATA_FLAG_ACK_REQUEST) != 0;
+
+        if (context->sack) {
+            context->sack_seq = segment[1];
+            context->pending_ack_count++;
+            if (ack_now || context->pending_ack_count >= TRANSPORT_SACK_MAX_PENDING) {
+                transport_delayed_sack(context);
+            }
+            return result;
+        }
+    }
+
+    transport_queue_ack(context, segment[1]);
+    if (ack_now) transport_send_pending_acks(context);
+
+    return result;
+}
+
+transport_attempt_rx_result transport_handle_rx(byte* frame, transport_rx_context_t** context_out);
+
 // Get data from the network layer.
 // Acknowledge it.
 // Verify the data is new by checking the sequence number.
-// Returns true if the reception was successful.
-transport_attempt_rx_result transport_attempt_rx(byte* segment, byte buf_len, uint16_t timeout_ms) {
+// Returns true if the reception was successful, and which sender's context
+// the segment belongs to.
+// The segment is left at FRAME_SEGMENT(frame).
+transport_attempt_rx_result transport_attempt_rx(byte* frame, uint16_t timeout_ms, transport_rx_context_t** context_out) {
 
-    static byte rx_seq = 0; // What we expect the next sequence number to be.
     network_rx_result result;
-    byte ack_seg[ACK_SEGMENT_HEARDER_LEN];
 
     // try to receive some data from the network
-    result = network_rx(segment, MAX_SEGMENT_LEN, timeout_ms);
-    if (result == NETWORK_RX_TIMEOUT) return TRANSPORT_ATTEMPT_RX_TIMEOUT;
-    if (result == NETWORK_RX_ERROR) return TRANSPORT_ATTEMPT_RX_ERROR;
+    if (rx_stash_full) {
+        for (byte i = 0; i < MAX_FRAME_LEN; i++) frame[i] = rx_stashed_frame[i];
+        rx_stash_full = false;
+    }
+    else {
+        result = network_rx(frame, timeout_ms);
+        if (result == NETWORK_RX_TIMEOUT) return TRANSPORT_ATTEMPT_RX_TIMEOUT;
+        if (result == NETWORK_RX_ERROR) return TRANSPORT_ATTEMPT_RX_ERROR;
+    }
+
+    return transport_handle_rx(frame, context_out);
+}
+
+// The part of transport_attempt_rx after something has been received.
+// Acknowledge it, and verify the data is new.
+transport_attempt_rx_result transport_handle_rx(byte* frame, transport_rx_context_t** context_out) {
+
+    transport_rx_context_t* context;
+    byte* segment = FRAME_SEGMENT(frame);
+
+    context = transport_rx_context(segment[3], segment[4] == SEGID_START_OF_MESSAGE || segment[4] == SEGID_COMPACT);
+    *context_out = context;
+
+    // We've never heard of this sender, or its context went to someone else.
+    // There's nowhere to put what it sent, so don't ack it either: an ack
+    // would tell a stop-and-wait sender the data got here. It runs out of
+    // attempts instead, and the message fails rather than vanishing.
+    if (context == NULL) {
+        return TRANSPORT_ATTEMPT_RX_OUTDATED;
+    }
+
+    // A COMPACT segment is a whole message. Ack it with its own sequence
+    // number. If it's the same one as last time, our ack got lost.
+    if (segment[4] == SEGID_COMPACT) {
+        transport_delayed_ack(segment[1], segment[3]);
+        if (context->compact_seen && context->compact_seq == segment[1]) {
+            return TRANSPORT_ATTEMPT_RX_OUTDATED;
+        }
+        context->compact_seen = true;
+        context->compact_seq = segment[1];
+        context->compressed = (segment[1] & COMPACT_FLAG_COMPRESSED) != 0;
+        return TRANSPORT_ATTEMPT_RX_SUCCESS;
+    }
+
+    // If we got a START_OF_MESSAGE, we must synchronize with the sender.
+    if (segment[4] == SEGID_START_OF_MESSAGE) {
+        context->mode = (segment[7] & START_FLAG_SELECTIVE_REPEAT) != 0
+            ? TRANSPORT_MODE_SELECTIVE_REPEAT
+            : TRANSPORT_MODE_STOP_AND_WAIT;
+        context->seq = segment[1];
+        context->compact_seen = false;
+        context->base_index = 0;
+        context->window_bitmap = 0;
+        context->pending_ack_count = 0;
+        context->sack = (segment[7] & START_FLAG_SACK) != 0;
+        context->reply_expected = (segment[7] & START_FLAG_REPLY_EXPECTED) != 0;
+        context->reply_owed = false;
+        context->compressed = (segment[7] & START_FLAG_COMPRESSED) != 0;
+        context->to_sink = rx_sink != NULL
+            && (segment[7] & START_FLAG_LARGE) != 0
+            && context->mode == TRANSPORT_MODE_SELECTIVE_REPEAT;
+    }
+
+    // Tell the sender of a large message how much of it the sink already has,
+    // so it only sends the rest.
+    if (segment[4] == SEGID_START_OF_MESSAGE && context->to_sink) {
+        uint16_t message_len = ((uint16_t) segment[5] << 8) + segment[6];
+        context->base_index = rx_sink->resume(context->port, message_len) / DATA_SEGMENT_PAYLOAD_LEN;
+        context->sack_seq = segment[1];
+        transport_delayed_sack(context);
+        return TRANSPORT_ATTEMPT_RX_SUCCESS;
+    }
+
+    // The sender wants a reply, so hold on to the END_OF_MESSAGE ack.
+    // transport_reply sends it along with the reply.
+    if (segment[4] == SEGID_END_OF_MESSAGE && context->reply_expected && context->state == RXST_Receiving) {
+        if (context->mode == TRANSPORT_MODE_SELECTIVE_REPEAT) {
+            context->reply_ack_seq = segment[1];
+        }
+        else {
+            if (context->seq != segment[1]) return TRANSPORT_ATTEMPT_RX_OUTDATED;
+            context->reply_ack_seq = segment[1] == 0 ? 1 : 0;
+            context->seq = context->reply_ack_seq;
+        }
+        context->reply_expected = false;
+        context->reply_owed = true;
+        return TRANSPORT_ATTEMPT_RX_SUCCESS;
+    }
 
-    // If we got a START_OF_MESSAGE, we must synchronize our sequence numbers.
-    if (segment[4] == SEGID_START_OF_MESSAGE) rx_seq = segment[1];
+    if (context->mode == TRANSPORT_MODE_SELECTIVE_REPEAT) {
+        return transport_attempt_rx_selective_repeat(context, segment);
+    }
 
     // Alright we got something, let me acknowledge it really quick.
-    _delay_ms(TRANSPORT_TX_ACK_DELAY_MS);
-    ack_seg[0] = ACK_SEGMENT_HEARDER_LEN;
-    ack_seg[1] = segment[1] == 0 ? 1 : 0; // advance seq number
-    ack_seg[2] = segment[3]; // destination port = port of whoever sent
-    ack_seg[3] = MY_PORT;    // source port = me :)
-    ack_seg[4] = SEGID_ACK;
-    // if this errors out, we don't care, the other guy will send me another thing anyways
-    network_tx(ack_seg, ACK_SEGMENT_HEARDER_LEN, resolve_network_addr(segment[3]), MY_NETWORK_ADDR);
+    // Unless the radio already did.
+    byte ack_seq = segment[1] == 0 ? 1 : 0; // advance seq number
+#if TRANSPORT_USE_ACK_PAYLOAD
+    if (!transport_ack_payload_sent(context, ack_seq))
+#endif
+    {
+        transport_delayed_ack(ack_seq, segment[3]);
+    }
 
     // Okay. Is this new data?
-    if (rx_seq != segment[1]) {
+    if (context->seq != segment[1]) {
+#if TRANSPORT_USE_ACK_PAYLOAD
+        transport_set_ack_payload(context);
+#endif
         return TRANSPORT_ATTEMPT_RX_OUTDATED;
     }
 
     // Great, new data. Let's advance our expected sequence number.
-    rx_seq = rx_seq == 0 ? 1 : 0;
+    context->seq = context->seq == 0 ? 1 : 0;
+#if TRANSPORT_USE_ACK_PAYLOAD
+    transport_set_ack_payload(context);
+#endif
 
     return TRANSPORT_ATTEMPT_RX_SUCCESS;
 }
@@ -168,9 +811,23 @@ typedef enum {
     TRANSPORT_KEEP_TRYING_TO_RX_ERROR,
 } transport_keep_trying_to_rx_result;
 
-transport_keep_trying_to_rx_result transport_keep_trying_to_rx(byte* segment, byte buf_len, uint16_t timeout_ms) {
+// Keep receiving until we get a new segment.
+// While we owe someone a SACK, we only wait TRANSPORT_SACK_DELAY_MS at a time.
+// If the sender goes quiet for that long, it's waiting on us.
+transport_keep_trying_to_rx_result transport_keep_trying_to_rx(byte* frame, uint16_t timeout_ms, transport_rx_context_t** context) {
     while(true) {
-        transport_attempt_rx_result result = transport_attempt_rx(segment, buf_len, timeout_ms);
+        uint16_t this_timeout_ms = timeout_ms;
+        transport_rx_context_t* sack_owed = transport_rx_sack_owed();
+        if (sack_owed != NULL && this_timeout_ms > TRANSPORT_SACK_DELAY_MS) {
+            this_timeout_ms = TRANSPORT_SACK_DELAY_MS;
+        }
+
+        transport_attempt_rx_result result = transport_attempt_rx(frame, this_timeout_ms, context);
+        if (result == TRANSPORT_ATTEMPT_RX_TIMEOUT && this_timeout_ms != timeout_ms) {
+            transport_send_sack(sack_owed);
+            continue;
+        }
+
         switch (result) {
 
         case TRANSPORT_ATTEMPT_RX_SUCCESS:
@@ -195,119 +852,463 @@ transport_keep_trying_to_rx_result transport_keep_trying_to_rx(byte* segment, by
 }
 
 
+// Hand a segment of a START_FLAG_LARGE message to the sink.
+// Returns false if the segment isn't part of one, so it goes wherever it
+// would have otherwise.
+bool transport_rx_to_sink(transport_rx_context_t* context, byte* segment) {
+
+    if (!context->to_sink) return false;
+
+    byte segment_identifier = segment[4];
+
+    if (segment_identifier == SEGID_COMPACT) {
+        // A small message took its place.
+        context->to_sink = false;
+        return false;
+    }
+    else if (segment_identifier == SEGID_START_OF_MESSAGE) {
+        context->message_len = ((uint16_t) segment[5] << 8) + segment[6];
+        context->state = RXST_Receiving;
+    }
+    else if (context->state != RXST_Receiving) {
+        // We already told the sink this one was done.
+    }
+    else if (segment_identifier == SEGID_DATA) {
+        uint16_t offset = ((uint16_t) segment[5] << 8) + segment[6];
+        byte payload_len = segment[0] - DATA_SEGMENT_HEADER_LEN;
+        rx_sink->write(context->port, offset, &segment[DATA_SEGMENT_HEADER_LEN], payload_len);
+    }
+    else if (segment_identifier == SEGID_END_OF_MESSAGE) {
+        context->state = RXST_Idle;
+        stats.messages_received++;
+        stats.bytes_delivered += context->message_len;
+        rx_sink->done(context->port, context->message_len);
+    }
+
+    return true;
+}
+
+void transport_set_sink(const transport_sink_t* sink) {
+    rx_sink = sink;
+}
+
+#if TRANSPORT_RX_BUFFER_LEN > 0
+// Put a new segment into its sender's buffer.
+// Returns true once the END_OF_MESSAGE shows up and the message is complete.
+bool transport_rx_assemble(transport_rx_context_t* context, byte* segment) {
+
+    byte segment_len = segment[0];
+    byte segment_identifier = segment[4];
+
+    // A COMPACT segment is the whole message, no matter what we were doing.
+    if (segment_identifier == SEGID_COMPACT) {
+        context->message_len = segment_len - COMPACT_SEGMENT_HEADER_LEN;
+        for (uint16_t i = 0; i < TRANSPORT_RX_BUFFER_LEN; i++) {
+            TRANSPORT_RX_BUFFER(context)[i] = i < context->message_len ? segment[i + COMPACT_SEGMENT_HEADER_LEN] : 0;
+        }
+        context->state = RXST_Idle;
+        return true;
+    }
+
+    switch(context->state) {
+
+    case RXST_Idle:
+        if (segment_identifier == SEGID_START_OF_MESSAGE) {
+            context->message_len = ((uint16_t) segment[5] << 8) + segment[6];
+            for (uint16_t i = 0; i < TRANSPORT_RX_BUFFER_LEN; i++) TRANSPORT_RX_BUFFER(context)[i] = 0;
+            context->state = RXST_Receiving;
+        }
+        break;
+
+    case RXST_Receiving:
+        if (segment_identifier == SEGID_DATA) {
+            uint16_t offset = ((uint16_t) segment[5] << 8) + segment[6];
+            byte payload_len = segment_len - DATA_SEGMENT_HEADER_LEN;
+
+            for (uint16_t i = 0; i < payload_len && i + offset < TRANSPORT_RX_BUFFER_LEN; i++) {
+                TRANSPORT_RX_BUFFER(context)[i + offset] = segment[i + DATA_SEGMENT_HEADER_LEN];
+            }
+        }
+        else if (segment_identifier == SEGID_END_OF_MESSAGE) {
+            context->state = RXST_Idle;
+            return true;
+        }
+        // This state is possible if the message fails and the other guy
+        // tries again from the beginning.
+        else if (segment_identifier == SEGID_START_OF_MESSAGE) {
+            context->message_len = ((uint16_t) segment[5] << 8) + segment[6];
+        }
+        break;
+    }
+
+    return false;
+}
+#endif
+
+#if TRANSPORT_RX_BUFFER_LEN > 0
+// Copy a finished message out of its context, decompressing it if it has to
+// be. Whatever's left of the buffer is zeroed.
+// Returns how long the message is. For a compressed message, that's only as
+// much of it as fit.
+uint16_t transport_rx_deliver(transport_rx_context_t* context, byte* buffer, uint16_t buf_len) {
+
+    stats.messages_received++;
+
+    if (context->compressed) {
+        uint16_t len = context->message_len < TRANSPORT_RX_BUFFER_LEN ? context->message_len : TRANSPORT_RX_BUFFER_LEN;
+        uint16_t decoded_len = decompress(TRANSPORT_RX_BUFFER(context), len, buffer, buf_len);
+        for (uint16_t i = decoded_len; i < buf_len; i++) buffer[i] = 0;
+        stats.bytes_delivered += decoded_len;
+        return decoded_len;
+    }
+
+    for (uint16_t i = 0; i < buf_len; i++) {
+        buffer[i] = i < TRANSPORT_RX_BUFFER_LEN ? TRANSPORT_RX_BUFFER(context)[i] : 0;
+    }
+    stats.bytes_delivered += context->message_len;
+    return context->message_len;
+}
+#endif
+
 // The application layer calls this function.
 // Get a complete message.
 // The function returns if a complete message was successfully received.
 // The function will write to message_len to identify the length of the message.
 // The function will write to source_port to identify who sent the message.
 
-// NOTE: this system ONLY works with one transmitter at a time.
+// Every sender gets its own context (see transport_rx_context_t), so messages
+// from up to TRANSPORT_RX_CONTEXT_COUNT senders can be put together at the
+// same time. Whichever one finishes first is copied into the buffer.
+// DATA segments are placed by their start address, so they may arrive in any
+// order.
+#if TRANSPORT_RX_BUFFER_LEN > 0
 transport_rx_result transport_rx(byte* buffer, uint16_t buf_len, uint16_t* message_len, byte* source_port, uint16_t timeout_ms) {
 
     // Start by initializing the recepient's buffer to zero.
     for (int i = 0; i < buf_len; i++) buffer[i] = 0;
 
-    int state = RXST_Idle;
-
-    byte segment_len;
-    byte segment[MAX_SEGMENT_LEN];
+    frame_buffer_t frame;
+    byte* segment = FRAME_SEGMENT(frame);
 
-    byte segment_identifier;
+    transport_rx_context_t* context;
 
     // Continually receive segments until we've put together a whole message.
     while(true) {
 
         // Get the next segment.
         // As a side effect, acknowledge anything we receive.
-        transport_keep_trying_to_rx_result result = transport_keep_trying_to_rx(segment, MAX_SEGMENT_LEN, timeout_ms);
+        transport_keep_trying_to_rx_result result = transport_keep_trying_to_rx(frame, timeout_ms, &context);
         if (result == TRANSPORT_KEEP_TRYING_TO_RX_TIMEOUT) return TRANSPORT_RX_TIMEOUT;
         if (result == TRANSPORT_KEEP_TRYING_TO_RX_ERROR) return TRANSPORT_RX_ERROR;
 
-        segment_len = segment[0];
-        segment_identifier = segment[4];
-
-        switch(state) {
-
-        case RXST_Idle:
-            if (segment_identifier == SEGID_START_OF_MESSAGE) {
-                if (source_port != NULL) {
-                    *source_port = segment[3];
-                }
-                if (message_len != NULL) {
-                    *message_len = segment[5] << 8 + segment[6];
-                }
-                state = RXST_Receiving;
-            }
-            break;
+        if (transport_rx_to_sink(context, segment)) continue;
 
-        case RXST_Receiving:
-            if (segment_identifier == SEGID_DATA) {
-                uint16_t offset = (segment[5] << 8) + segment[6];
-                byte payload_len = segment_len - DATA_SEGMENT_HEADER_LEN;
-
-                for (uint16_t i = 0; i < payload_len && i + offset < buf_len; i++) {
-                    buffer[i + offset] = segment[i + DATA_SEGMENT_HEADER_LEN];
-                }
+        if (transport_rx_assemble(context, segment)) {
+            uint16_t delivered_len = transport_rx_deliver(context, buffer, buf_len);
+            if (source_port != NULL) {
+                *source_port = context->port;
             }
-            else if (segment_identifier == SEGID_END_OF_MESSAGE) {
-                state = RXST_Idle;
-                return TRANSPORT_RX_SUCCESS;
-            }
-            // This state is possible if the message fails and the other guy
-            // tries again from the beginning.
-            else if (segment_identifier == SEGID_START_OF_MESSAGE) {
-                if (message_len != NULL) {
-                    *message_len = segment[5] << 8 + segment[6];
-                }
+            if (message_len != NULL) {
+                *message_len = delivered_len;
             }
-            break;
+            return TRANSPORT_RX_SUCCESS;
         }
     }
 }
+#endif
 
+// Hand part of a message to a transport_rx_stream handler, decompressing it
+// first if it has to be. A compressed segment can turn into more than one
+// call to the handler.
+void transport_stream_data(transport_stream_handler_t handler, transport_rx_context_t* context, uint16_t offset, byte* bytes, byte len) {
 
+    if (!context->compressed) {
+        handler(TRANSPORT_STREAM_DATA, context->port, offset, bytes, len);
+        return;
+    }
 
-// ======================= Transmitter Code ====================================
+    byte decoded[4 * COMPRESS_MAX_TOKEN_LEN];
+    byte decoded_len = 0;
 
-typedef enum {
-    TRANSPORT_ATTEMPT_TX_SUCCESS,
-    TRANSPORT_ATTEMPT_TX_TRANSMIT_FAILED,
-    TRANSPORT_ATTEMPT_TX_NOT_ACKNOWLEDGED,
-    TRANSPORT_ATTEMPT_TX_OLD_ACK,
-    TRANSPORT_ATTEMPT_TX_NOT_AN_ACK,
-    TRANSPORT_ATTEMPT_TX_ERROR
-} transport_attempt_tx_result;
+    for (byte i = 0; i < len; i++) {
+        if (decoded_len > sizeof(decoded) - COMPRESS_MAX_TOKEN_LEN) {
+            handler(TRANSPORT_STREAM_DATA, context->port, context->decoded_len, decoded, decoded_len);
+            context->decoded_len += decoded_len;
+            decoded_len = 0;
+        }
+        decoded_len += decompress_byte(&context->decoder, bytes[i], &decoded[decoded_len]);
+    }
 
-// This function transmits a segment, then waits to receive an acknowledgement.
-// This function can time out.
-// The function returns whether the acknowledgement was received before the timeout.
-transport_attempt_tx_result transport_attempt_tx(byte* segment, byte segment_len, byte dest_port, byte current_seq_num) {
+    if (decoded_len > 0) {
+        handler(TRANSPORT_STREAM_DATA, context->port, context->decoded_len, decoded, decoded_len);
+        context->decoded_len += decoded_len;
+    }
+}
 
-    byte hopefully_an_ack[ACK_SEGMENT_HEARDER_LEN];
-    network_tx_result tx_result;
+// The application layer calls this function.
+// Get a complete message, but hand it to the handler a segment at a time
+// instead of putting it together in a buffer.
+// The handler gets a TRANSPORT_STREAM_START, then every DATA segment in order,
+// then a TRANSPORT_STREAM_END. The bytes are only valid until the handler
+// returns.
+// If the sender starts the message over, the handler gets another
+// TRANSPORT_STREAM_START.
+// Compressed messages are decompressed on the way through, so the handler
+// only ever sees the original.
+// The function returns once a whole message has been delivered.
+transport_rx_result transport_rx_stream(transport_stream_handler_t handler, uint16_t timeout_ms) {
+
+    frame_buffer_t frame;
+    byte* segment = FRAME_SEGMENT(frame);
+
+    transport_rx_context_t* context;
+    transport_rx_result rx_result;
+
+    rx_streaming = true;
 
-    // Let's send this bad boy.
-    tx_result = network_tx(segment, segment_len, resolve_network_addr(dest_port), MY_NETWORK_ADDR);
+    while(true) {
 
-    // Why is this commented out?
-    // For some reason, we sometimes get errors, even when the transmission is successful.
-    // We should just rely on the transport layer acknowledgement. It acts more predictably.
-    //if (tx_result == NETWORK_TX_FAILURE) {
-        //_delay_ms(TRANSPORT_TX_ACK_TIMEOUT_MS);
-        //return TRANSPORT_ATTEMPT_TX_TRANSMIT_FAILED;
-    //}
+        transport_keep_trying_to_rx_result result = transport_keep_trying_to_rx(frame, timeout_ms, &context);
+        if (result == TRANSPORT_KEEP_TRYING_TO_RX_TIMEOUT) {
+            rx_result = TRANSPORT_RX_TIMEOUT;
+            break;
+        }
+        if (result == TRANSPORT_KEEP_TRYING_TO_RX_ERROR) {
+            rx_result = TRANSPORT_RX_ERROR;
+            break;
+        }
 
-    // Now let's try to get an acknowledgement.
-    network_rx_result rx_result = network_rx(hopefully_an_ack, ACK_SEGMENT_HEARDER_LEN, TRANSPORT_TX_ACK_TIMEOUT_MS);
-    if (rx_result == NETWORK_RX_TIMEOUT) return TRANSPORT_ATTEMPT_TX_NOT_ACKNOWLEDGED;
-    if (rx_result == NETWORK_RX_ERROR) return TRANSPORT_ATTEMPT_TX_ERROR;
-    if (hopefully_an_ack[4] != SEGID_ACK) return TRANSPORT_ATTEMPT_TX_NOT_AN_ACK;
-    if (hopefully_an_ack[1] == current_seq_num) return TRANSPORT_ATTEMPT_TX_OLD_ACK;
+        if (transport_rx_to_sink(context, segment)) continue;
+
+        byte segment_identifier = segment[4];
+
+        if (segment_identifier == SEGID_COMPACT) {
+            context->state = RXST_Idle;
+            byte compact_len = segment[0] - COMPACT_SEGMENT_HEADER_LEN;
+            decompress_init(&context->decoder);
+            context->decoded_len = 0;
+            handler(TRANSPORT_STREAM_START, context->port, 0, NULL, 0);
+            transport_stream_data(handler, context, 0, &segment[COMPACT_SEGMENT_HEADER_LEN], compact_len);
+            handler(TRANSPORT_STREAM_END, context->port, context->compressed ? context->decoded_len : compact_len, NULL, 0);
+            stats.messages_received++;
+            stats.bytes_delivered += context->compressed ? context->decoded_len : compact_len;
+            rx_result = TRANSPORT_RX_SUCCESS;
+            break;
+        }
+        else if (segment_identifier == SEGID_START_OF_MESSAGE) {
+            context->message_len = ((uint16_t) segment[5] << 8) + segment[6];
+            context->state = RXST_Receiving;
+            decompress_init(&context->decoder);
+            context->decoded_len = 0;
+            handler(TRANSPORT_STREAM_START, context->port, 0, NULL, 0);
+        }
+        else if (context->state != RXST_Receiving) {
+            // We missed the start of this one. Nothing to do with it.
+        }
+        else if (segment_identifier == SEGID_DATA) {
+            uint16_t offset = ((uint16_t) segment[5] << 8) + segment[6];
+            byte payload_len = segment[0] - DATA_SEGMENT_HEADER_LEN;
+            transport_stream_data(handler, context, offset, &segment[DATA_SEGMENT_HEADER_LEN], payload_len);
+        }
+        else if (segment_identifier == SEGID_END_OF_MESSAGE) {
+            context->state = RXST_Idle;
+            handler(TRANSPORT_STREAM_END, context->port, context->compressed ? context->decoded_len : context->message_len, NULL, 0);
+            stats.messages_received++;
+            stats.bytes_delivered += context->compressed ? context->decoded_len : context->message_len;
+            rx_result = TRANSPORT_RX_SUCCESS;
+            break;
+        }
+    }
 
-    return TRANSPORT_ATTEMPT_TX_SUCCESS;
+    rx_streaming = false;
+    return rx_result;
 }
 
-typedef enum {
+
+
+// ======================= Round Trip Time =====================================
+
+/*
+    Every destination port gets its own ack timeout (RTO), computed the way
+    TCP does it (RFC 6298):
+
+    first sample R:  SRTT = R,  RTTVAR = R/2
+    later samples:   RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|
+                     SRTT   = 7/8 SRTT   + 1/8 R
+    RTO = SRTT + 4 RTTVAR
+
+    Karn's rule: only segments that were acked on their first try count as
+    samples, since we can't tell which copy a retransmitted segment's ack
+    belongs to. Every timeout doubles the RTO until a new sample comes in.
+
+    The same entry keeps the COMPACT sequence numbers we send to the port.
+    A new entry (after a reboot, or after the port's old one got thrown out)
+    has no idea what the receiver last saw from us, so the first message
+    goes the long way, as START_OF_MESSAGE, DATA and END_OF_MESSAGE. The
+    START_OF_MESSAGE makes the receiver forget its last COMPACT sequence
+    number, and every COMPACT segment after that is new to it.
+*/
+
+typedef struct {
+    bool used;
+    byte port;
+    uint16_t srtt_ms;       // smoothed round trip time, 0 until the first sample
+    uint16_t rttvar_ms;     // round trip time variation
+    uint16_t rto_ms;        // what we actually wait for an ack
+    byte compact_seq;       // the last COMPACT sequence number we sent
+    bool compact_synced;    // a START_OF_MESSAGE got through since the entry was made
+} transport_rtt_entry_t;
+
+NODE_STATE transport_rtt_entry_t rtt_table[TRANSPORT_RTT_TABLE_LEN];
+
+// Which entry gets thrown out next when the table is full.
+NODE_STATE byte rtt_table_victim = 0;
+
+// Find the round trip time estimate for a port, making one if we need to.
+transport_rtt_entry_t* transport_rtt_entry(byte port) {
+
+    for (byte i = 0; i < TRANSPORT_RTT_TABLE_LEN; i++) {
+        if (rtt_table[i].used && rtt_table[i].port == port) return &rtt_table[i];
+    }
+
+    transport_rtt_entry_t* entry = &rtt_table[rtt_table_victim];
+    rtt_table_victim = (rtt_table_victim + 1) % TRANSPORT_RTT_TABLE_LEN;
+
+    entry->used = true;
+    entry->port = port;
+    entry->srtt_ms = 0;
+    entry->rttvar_ms = 0;
+    entry->rto_ms = TRANSPORT_TX_ACK_TIMEOUT_MS;
+    entry->compact_seq = 0;
+    entry->compact_synced = false;
+    return entry;
+}
+
+// Fold a new round trip time measurement into the estimate.
+void transport_rtt_sample(transport_rtt_entry_t* entry, uint16_t rtt_ms) {
+
+    if (entry->srtt_ms == 0) {
+        entry->srtt_ms = rtt_ms;
+        entry->rttvar_ms = rtt_ms / 2;
+    }
+    else {
+        uint16_t delta = entry->srtt_ms > rtt_ms ? entry->srtt_ms - rtt_ms : rtt_ms - entry->srtt_ms;
+        entry->rttvar_ms = (uint16_t) (((uint32_t) entry->rttvar_ms * 3 + delta) / 4);
+        entry->srtt_ms = (uint16_t) (((uint32_t) entry->srtt_ms * 7 + rtt_ms) / 8);
+    }
+
+    uint32_t rto = (uint32_t) entry->srtt_ms + 4 * (uint32_t) entry->rttvar_ms;
+    if (rto < TRANSPORT_TX_RTO_MIN_MS) rto = TRANSPORT_TX_RTO_MIN_MS;
+    if (rto > TRANSPORT_TX_RTO_MAX_MS) rto = TRANSPORT_TX_RTO_MAX_MS;
+    entry->rto_ms = (uint16_t) rto;
+}
+
+// We timed out waiting for an ack. Wait twice as long next time.
+void transport_rtt_backoff(transport_rtt_entry_t* entry) {
+    stats.timeouts++;
+    if (LOG_ENABLED(INFO, TRANSPORT)) print_trace(TRACE_TIMEOUT, entry->port, entry->rto_ms >> 8, entry->rto_ms & 0xFF, 0);
+    if (entry->rto_ms > TRANSPORT_TX_RTO_MAX_MS / 2) {
+        entry->rto_ms = TRANSPORT_TX_RTO_MAX_MS;
+    }
+    else {
+        entry->rto_ms = entry->rto_ms * 2;
+    }
+}
+
+
+
+// ======================= Transmitter Code ====================================
+
+typedef enum {
+    TRANSPORT_ATTEMPT_TX_SUCCESS,
+    TRANSPORT_ATTEMPT_TX_PIGGYBACKED,   // acked by the reply, so the wait isn't a round trip time
+    TRANSPORT_ATTEMPT_TX_TRANSMIT_FAILED,
+    TRANSPORT_ATTEMPT_TX_NOT_ACKNOWLEDGED,
+    TRANSPORT_ATTEMPT_TX_OLD_ACK,
+    TRANSPORT_ATTEMPT_TX_NOT_AN_ACK,
+    TRANSPORT_ATTEMPT_TX_ERROR
+} transport_attempt_tx_result;
+
+// Where transport_tx_large reads the message from, and where the receiver
+// told it to pick up.
+NODE_STATE transport_source_t tx_source = NULL;
+NODE_STATE uint16_t tx_resume_offset = 0;
+
+// START and END carry none of the message but hold up all of it, so
+// relays with a backlog send them ahead of DATA, the way they do acks.
+byte transport_segment_priority(byte* segment) {
+    if (segment[4] == SEGID_START_OF_MESSAGE || segment[4] == SEGID_END_OF_MESSAGE) {
+        return PACKET_PRIORITY_CONTROL;
+    }
+    return PACKET_PRIORITY_DATA;
+}
+
+// This function transmits a segment, then waits to receive an acknowledgement.
+// This function can time out.
+// The function returns whether the acknowledgement was received before the timeout.
+// On success, rtt_ms is set to how long the ack took to show up.
+// The segment must already be at FRAME_SEGMENT(frame). It is left untouched,
+// so the same frame can be sent again.
+transport_attempt_tx_result transport_attempt_tx(byte* frame, byte segment_len, byte dest_port, byte expected_ack_seq, uint16_t timeout_ms, uint16_t* rtt_ms) {
+
+    frame_buffer_t ack_frame;
+    byte* hopefully_an_ack = FRAME_SEGMENT(ack_frame);
+    network_tx_result tx_result;
+    byte* segment = FRAME_SEGMENT(frame);
+
+    // Let's send this bad boy.
+    tx_result = network_tx(frame, segment_len, resolve_network_addr(dest_port), MY_NETWORK_ADDR, transport_segment_priority(segment));
+    stats.segments++;
+
+    // Why is this commented out?
+    // For some reason, we sometimes get errors, even when the transmission is successful.
+    // We should just rely on the transport layer acknowledgement. It acts more predictably.
+    //if (tx_result == NETWORK_TX_FAILURE) {
+        //_delay_ms(TRANSPORT_TX_ACK_TIMEOUT_MS);
+        //return TRANSPORT_ATTEMPT_TX_TRANSMIT_FAILED;
+    //}
+
+    // Now let's try to get an acknowledgement.
+    network_rx_result rx_result = network_rx(ack_frame, timeout_ms);
+    if (rx_result == NETWORK_RX_TIMEOUT) return TRANSPORT_ATTEMPT_TX_NOT_ACKNOWLEDGED;
+    if (rx_result == NETWORK_RX_ERROR) return TRANSPORT_ATTEMPT_TX_ERROR;
+
+    // The reply to our request can carry the ack for its END_OF_MESSAGE.
+    // Keep the reply for transport_rx.
+    if (segment[4] == SEGID_END_OF_MESSAGE
+            && hopefully_an_ack[4] == SEGID_START_OF_MESSAGE
+            && (hopefully_an_ack[7] & START_FLAG_PIGGYBACK_ACK) != 0
+            && hopefully_an_ack[3] == dest_port) {
+        if (hopefully_an_ack[8] != expected_ack_seq) return TRANSPORT_ATTEMPT_TX_OLD_ACK;
+        for (byte i = 0; i < MAX_FRAME_LEN; i++) rx_stashed_frame[i] = ack_frame[i];
+        rx_stash_full = true;
+        stats.acks_received++;
+        return TRANSPORT_ATTEMPT_TX_PIGGYBACKED;
+    }
+
+    // A receiver with a sink answers a large message's START_OF_MESSAGE with
+    // how much of it it already has.
+    if (segment[4] == SEGID_START_OF_MESSAGE
+            && (segment[7] & START_FLAG_LARGE) != 0
+            && hopefully_an_ack[4] == SEGID_SACK
+            && hopefully_an_ack[3] == dest_port) {
+        if (hopefully_an_ack[1] != expected_ack_seq) return TRANSPORT_ATTEMPT_TX_OLD_ACK;
+        tx_resume_offset = ((uint16_t) hopefully_an_ack[5] << 8) + hopefully_an_ack[6];
+        *rtt_ms = timer_elapsed_ms();
+        stats.acks_received++;
+        return TRANSPORT_ATTEMPT_TX_SUCCESS;
+    }
+
+    if (hopefully_an_ack[4] != SEGID_ACK) return TRANSPORT_ATTEMPT_TX_NOT_AN_ACK;
+    if (hopefully_an_ack[1] != expected_ack_seq) return TRANSPORT_ATTEMPT_TX_OLD_ACK;
+
+    *rtt_ms = timer_elapsed_ms();
+    stats.acks_received++;
+
+    return TRANSPORT_ATTEMPT_TX_SUCCESS;
+}
+
+typedef enum {
     TRANSPORT_KEEP_TRYING_TO_TX_SUCCESS,
     TRANSPORT_KEEP_TRYING_TO_TX_REACHED_ATTEMPT_LIMIT,
     TRANSPORT_KEEP_TRYING_TO_TX_ERROR
@@ -315,12 +1316,16 @@ typedef enum {
 
 
 // This function continually tries to transmit segments until one is acknowledged.
+// We wait for each ack as long as the destination's RTO says, and back off
+// every time that isn't long enough.
 // This function can fail if the attempted transmissions exceeds TRANSPORT_TX_ATTEMPT_LIMIT.
 // The function returns whether the segment was eventually transmitted and acknowledged.
-transport_keep_trying_to_tx_result transport_keep_trying_to_tx(byte* segment, byte segment_len, byte dest_port, byte current_seq_num) {
+transport_keep_trying_to_tx_result transport_keep_trying_to_tx(byte* frame, byte segment_len, byte dest_port, byte expected_ack_seq) {
 
     uint16_t transmit_attempts = 0;
     transport_attempt_tx_result result;
+    transport_rtt_entry_t* rtt = transport_rtt_entry(dest_port);
+    uint16_t rtt_ms;
 
     while(true) {
 
@@ -328,98 +1333,826 @@ transport_keep_trying_to_tx_result transport_keep_trying_to_tx(byte* segment, by
         if (transmit_attempts > TRANSPORT_TX_ATTEMPT_LIMIT) {
             return TRANSPORT_KEEP_TRYING_TO_TX_REACHED_ATTEMPT_LIMIT;
         }
+        if (transmit_attempts > 1) {
+            stats.retries++;
+            if (LOG_ENABLED(INFO, TRANSPORT)) print_trace(TRACE_RETRY, dest_port, FRAME_SEGMENT(frame)[1], (byte) transmit_attempts, 0);
+        }
 
-        result = transport_attempt_tx(segment, segment_len, dest_port, current_seq_num);
+        result = transport_attempt_tx(frame, segment_len, dest_port, expected_ack_seq, rtt->rto_ms, &rtt_ms);
 
-        if (result == TRANSPORT_ATTEMPT_TX_SUCCESS) return TRANSPORT_KEEP_TRYING_TO_TX_SUCCESS;
+        if (result == TRANSPORT_ATTEMPT_TX_SUCCESS) {
+            // Karn's rule: only trust the measurement if we only sent it once.
+            if (transmit_attempts == 1) transport_rtt_sample(rtt, rtt_ms);
+            return TRANSPORT_KEEP_TRYING_TO_TX_SUCCESS;
+        }
+        if (result == TRANSPORT_ATTEMPT_TX_PIGGYBACKED) return TRANSPORT_KEEP_TRYING_TO_TX_SUCCESS;
         if (result == TRANSPORT_ATTEMPT_TX_ERROR) return TRANSPORT_KEEP_TRYING_TO_TX_ERROR;
+        if (result == TRANSPORT_ATTEMPT_TX_NOT_ACKNOWLEDGED) transport_rtt_backoff(rtt);
 
         // If I get Not an Ack, Old Ack, or Not Acknowledged, let's try again.
 
-        _delay_ms(TRANSPORT_TX_RETRY_DELAY_MS);
+        timer_wait_ms(TRANSPORT_TX_RETRY_DELAY_MS);
 
     }
 }
 
-// The application layer calls this function.
+// Build DATA segment number "index" of the message. If message is NULL, the
+// payload comes from tx_source instead.
+// Returns the length of the segment.
+byte transport_build_data_segment(byte* segment, byte* message, uint16_t message_len, uint16_t index, byte seq, byte dest_port, byte flags) {
+
+    uint16_t start_address = index * DATA_SEGMENT_PAYLOAD_LEN;
+
+    // can't send the whole darn thing at once unless it's small
+    byte this_payload_len;
+    if (message_len - start_address > DATA_SEGMENT_PAYLOAD_LEN) {
+        this_payload_len = DATA_SEGMENT_PAYLOAD_LEN;
+    }
+    else {
+        this_payload_len = (byte) (message_len - start_address);
+    }
+
+    segment[0] = this_payload_len + DATA_SEGMENT_HEADER_LEN;
+    segment[1] = seq;
+    segment[2] = dest_port;
+    segment[3] = MY_PORT;
+    segment[4] = SEGID_DATA;
+    segment[5] = (start_address & 0xFF00) >> 8;
+    segment[6] = (start_address & 0x00FF) >> 0;
+    segment[7] = flags;
+    if (message == NULL) {
+        tx_source(start_address, &segment[DATA_SEGMENT_HEADER_LEN], this_payload_len);
+    }
+    else {
+        for (byte i = 0; i < this_payload_len; i++) {
+            segment[i + DATA_SEGMENT_HEADER_LEN] = message[i + start_address];
+        }
+    }
+
+    return segment[0];
+}
+
+// Send every DATA segment with the alternating-bit protocol.
+// Returns the sequence number to use for the END_OF_MESSAGE segment, or
+// fails like transport_keep_trying_to_tx.
+transport_keep_trying_to_tx_result transport_tx_data_stop_and_wait(byte* message, uint16_t message_len, byte dest_port, byte* current_seq_num) {
+
+    frame_buffer_t frame;
+    byte* segment = FRAME_SEGMENT(frame);
+    uint16_t segment_count = (message_len + DATA_SEGMENT_PAYLOAD_LEN - 1) / DATA_SEGMENT_PAYLOAD_LEN;
+    transport_keep_trying_to_tx_result result;
+
+    for (uint16_t index = 0; index < segment_count; index++) {
+
+        byte this_segment_len = transport_build_data_segment(segment, message, message_len, index, *current_seq_num, dest_port, 0);
+
+        result = transport_keep_trying_to_tx(frame, this_segment_len, dest_port, *current_seq_num == 0 ? 1 : 0);
+        if (result != TRANSPORT_KEEP_TRYING_TO_TX_SUCCESS) return result;
+        *current_seq_num = *current_seq_num == 0 ? 1 : 0;
+
+        timer_wait_ms(TRANSPORT_TX_SEGMENT_SPACING_MS);
+    }
+
+    return TRANSPORT_KEEP_TRYING_TO_TX_SUCCESS;
+}
+
+// Like transport_keep_trying_to_tx, but for a multicast group.
+// The first try goes to the group address. Every member acks on its own, and
+// anyone who didn't gets the segment again as a unicast.
+// The members' acks come back over different numbers of hops, so there's no
+// single round trip time to learn. We wait TRANSPORT_TX_ACK_TIMEOUT_MS for the
+// next ack instead.
+transport_keep_trying_to_tx_result transport_keep_trying_to_tx_multicast(byte* frame, byte segment_len, byte group_port, byte* members, byte member_count, byte expected_ack_seq) {
+
+    frame_buffer_t ack_frame;
+    byte* hopefully_an_ack = FRAME_SEGMENT(ack_frame);
+
+    byte everyone = (byte) ((1 << member_count) - 1);
+    byte acked_bitmap = 0;  // bit i is set if members[i] acked
+
+    for (uint16_t transmit_attempts = 1; transmit_attempts <= TRANSPORT_TX_ATTEMPT_LIMIT; transmit_attempts++) {
+
+        if (transmit_attempts == 1) {
+            network_tx(frame, segment_len, resolve_network_addr(group_port), MY_NETWORK_ADDR, transport_segment_priority(FRAME_SEGMENT(frame)));
+            stats.segments++;
+        }
+        else {
+            // Only bother the members who missed it.
+            for (byte i = 0; i < member_count; i++) {
+                if ((acked_bitmap & (1 << i)) != 0) continue;
+                network_tx(frame, segment_len, resolve_network_addr(members[i]), MY_NETWORK_ADDR, transport_segment_priority(FRAME_SEGMENT(frame)));
+                stats.segments++;
+                stats.retries++;
+                timer_wait_ms(TRANSPORT_TX_WINDOW_SPACING_MS);
+            }
+        }
+
+        while (acked_bitmap != everyone) {
+            network_rx_result rx_result = network_rx(ack_frame, TRANSPORT_TX_ACK_TIMEOUT_MS);
+            if (rx_result == NETWORK_RX_TIMEOUT) break;
+            if (rx_result == NETWORK_RX_ERROR) return TRANSPORT_KEEP_TRYING_TO_TX_ERROR;
+            if (hopefully_an_ack[4] != SEGID_ACK) continue;
+            if (hopefully_an_ack[1] != expected_ack_seq) continue;
+
+            for (byte i = 0; i < member_count; i++) {
+                if (members[i] == hopefully_an_ack[3] && (acked_bitmap & (1 << i)) == 0) {
+                    acked_bitmap |= 1 << i;
+                    stats.acks_received++;
+                }
+            }
+        }
+
+        if (acked_bitmap == everyone) return TRANSPORT_KEEP_TRYING_TO_TX_SUCCESS;
+
+        timer_wait_ms(TRANSPORT_TX_RETRY_DELAY_MS);
+    }
+
+    return TRANSPORT_KEEP_TRYING_TO_TX_REACHED_ATTEMPT_LIMIT;
+}
+
+// Mark everything a SACK says was received.
+// Returns the new acked bitmap for the window starting at base_index.
+byte transport_apply_sack(byte* sack, uint16_t base_index, byte window_len, byte acked_bitmap) {
+    uint16_t cumulative_index = (((uint16_t) sack[5] << 8) + sack[6]) / DATA_SEGMENT_PAYLOAD_LEN;
+    for (byte i = 0; i < window_len; i++) {
+        uint16_t index = base_index + i;
+        if (index < cumulative_index) {
+            acked_bitmap |= 1 << i;
+        }
+        else if (index - cumulative_index < 8 && (sack[7] & (1 << (index - cumulative_index))) != 0) {
+            acked_bitmap |= 1 << i;
+        }
+    }
+    return acked_bitmap;
+}
+
+// Send every DATA segment with selective repeat, from segment first_index on.
+// A window of segments goes out back-to-back, then we collect acks for them.
+// Only the segments that were not acked are sent again.
+transport_keep_trying_to_tx_result transport_tx_data_selective_repeat(byte* message, uint16_t message_len, byte dest_port, uint16_t first_index) {
+
+#if TRANSPORT_TX_USE_BURST
+    frame_buffer_t window_frames[TRANSPORT_TX_WINDOW_SIZE];
+    byte* burst_frames[TRANSPORT_TX_WINDOW_SIZE];
+    byte burst_lens[TRANSPORT_TX_WINDOW_SIZE];
+#else
+    frame_buffer_t frame;
+    byte* segment = FRAME_SEGMENT(frame);
+#endif
+    frame_buffer_t ack_frame;
+    byte* hopefully_an_ack = FRAME_SEGMENT(ack_frame);
+
+    uint16_t segment_count = (message_len + DATA_SEGMENT_PAYLOAD_LEN - 1) / DATA_SEGMENT_PAYLOAD_LEN;
+    uint16_t base_index = first_index; // oldest segment that hasn't been acked
+    byte acked_bitmap = 0;      // bit i is set if segment base_index + i has been acked
+    byte sent_bitmap = 0;       // bit i is set if segment base_index + i has been sent before
+    uint16_t transmit_attempts = 0;
+    transport_rtt_entry_t* rtt = transport_rtt_entry(dest_port);
+
+    while (base_index < segment_count) {
+
+        transmit_attempts++;
+        if (transmit_attempts > TRANSPORT_TX_ATTEMPT_LIMIT) {
+            return TRANSPORT_KEEP_TRYING_TO_TX_REACHED_ATTEMPT_LIMIT;
+        }
+
+        byte window_len = TRANSPORT_TX_WINDOW_SIZE;
+        if (segment_count - base_index < window_len) {
+            window_len = (byte) (segment_count - base_index);
+        }
+        byte window_mask = (byte) ((1 << window_len) - 1);
+
+        // Find the last segment we're about to send so it can request the acks.
+        byte last = 0;
+        for (byte i = 0; i < window_len; i++) {
+            if ((acked_bitmap & (1 << i)) == 0) last = i;
+        }
+
+        // Karn's rule: the ack for the last segment only counts as a round trip
+        // time sample if the segment is going out for the first time.
+        bool sample_rtt = (sent_bitmap & (1 << last)) == 0;
+
+        // Send everything in the window that hasn't been acked yet.
+#if TRANSPORT_TX_USE_BURST
+        byte burst_count = 0;
+        for (byte i = 0; i < window_len; i++) {
+            if ((acked_bitmap & (1 << i)) != 0) continue;
+
+            uint16_t index = base_index + i;
+            byte flags = (i == last) ? DATA_FLAG_ACK_REQUEST : 0;
+            burst_frames[burst_count] = window_frames[burst_count];
+            burst_lens[burst_count] = transport_build_data_segment(FRAME_SEGMENT(window_frames[burst_count]), message, message_len, index, (byte) (index + 1), dest_port, flags);
+            burst_count++;
+            if ((sent_bitmap & (1 << i)) != 0) stats.retries++;
+            sent_bitmap |= 1 << i;
+        }
+        network_tx_burst(burst_frames, burst_lens, burst_count, resolve_network_addr(dest_port), MY_NETWORK_ADDR);
+        stats.segments += burst_count;
+#else
+        for (byte i = 0; i < window_len; i++) {
+            if ((acked_bitmap & (1 << i)) != 0) continue;
+
+            uint16_t index = base_index + i;
+            byte flags = (i == last) ? DATA_FLAG_ACK_REQUEST : 0;
+            byte this_segment_len = transport_build_data_segment(segment, message, message_len, index, (byte) (index + 1), dest_port, flags);
+
+            network_tx(frame, this_segment_len, resolve_network_addr(dest_port), MY_NETWORK_ADDR, PACKET_PRIORITY_DATA);
+            stats.segments++;
+            if ((sent_bitmap & (1 << i)) != 0) stats.retries++;
+            sent_bitmap |= 1 << i;
+            if (i != last) timer_wait_ms(TRANSPORT_TX_WINDOW_SPACING_MS);
+        }
+#endif
+
+        // Now collect as many acks as we can.
+        byte acked_before = acked_bitmap;
+        while ((acked_bitmap & window_mask) != window_mask) {
+            network_rx_result rx_result = network_rx(ack_frame, rtt->rto_ms);
+            if (rx_result == NETWORK_RX_TIMEOUT) break;
+            if (rx_result == NETWORK_RX_ERROR) return TRANSPORT_KEEP_TRYING_TO_TX_ERROR;
+            if (hopefully_an_ack[4] != SEGID_ACK && hopefully_an_ack[4] != SEGID_SACK) continue;
+
+            // Ignore stragglers from the previous window.
+            byte offset_in_window = (byte) (hopefully_an_ack[1] - (byte) (base_index + 1));
+            if (offset_in_window >= window_len) continue;
+            stats.acks_received++;
+
+            // The acks come back-to-back once the receiver starts sending them,
+            // so the wait for the first one is the round trip time.
+            if (sample_rtt) {
+                transport_rtt_sample(rtt, timer_elapsed_ms());
+                sample_rtt = false;
+            }
+
+            // A SACK tells us everything the receiver has, so there's nothing
+            // else to wait for. Go fill in the gaps.
+            if (hopefully_an_ack[4] == SEGID_SACK) {
+                acked_bitmap = transport_apply_sack(hopefully_an_ack, base_index, window_len, acked_bitmap);
+                break;
+            }
+
+            acked_bitmap |= 1 << offset_in_window;
+        }
+
+        // Anything new acked? Then we're making progress.
+        if (acked_bitmap != acked_before) {
+            transmit_attempts = 0;
+        }
+        else {
+            transport_rtt_backoff(rtt);
+            timer_wait_ms(TRANSPORT_TX_RETRY_DELAY_MS);
+        }
+
+        // Slide the window past everything that got acked in order.
+        while ((acked_bitmap & 0x01) != 0 && base_index < segment_count) {
+            acked_bitmap >>= 1;
+            sent_bitmap >>= 1;
+            base_index++;
+        }
+
+        timer_wait_ms(TRANSPORT_TX_WINDOW_SPACING_MS);
+    }
+
+    return TRANSPORT_KEEP_TRYING_TO_TX_SUCCESS;
+}
+
+// Send a message that fits in one segment as a single COMPACT segment.
+// That's one acked frame instead of three.
+// The sequence number only has to differ from the last one we sent to the
+// same receiver, so each destination counts on its own.
+transport_tx_result transport_tx_compact(byte* message, byte message_len, byte dest_port, bool compressed) {
+
+    frame_buffer_t frame;
+    byte* segment = FRAME_SEGMENT(frame);
+    transport_rtt_entry_t* entry = transport_rtt_entry(dest_port);
+
+    entry->compact_seq = (entry->compact_seq + 1) & COMPACT_SEQ_MASK;
+
+    segment[0] = message_len + COMPACT_SEGMENT_HEADER_LEN;
+    segment[1] = entry->compact_seq | (compressed ? COMPACT_FLAG_COMPRESSED : 0);
+    segment[2] = dest_port;
+    segment[3] = MY_PORT;
+    segment[4] = SEGID_COMPACT;
+    for (byte i = 0; i < message_len; i++) {
+        segment[i + COMPACT_SEGMENT_HEADER_LEN] = message[i];
+    }
+
+    transport_keep_trying_to_tx_result result = transport_keep_trying_to_tx(frame, segment[0], dest_port, segment[1]);
+    if (result == TRANSPORT_KEEP_TRYING_TO_TX_REACHED_ATTEMPT_LIMIT) return TRANSPORT_TX_REACHED_ATTEMPT_LIMIT;
+    if (result == TRANSPORT_KEEP_TRYING_TO_TX_ERROR) return TRANSPORT_TX_ERROR;
+
+    return TRANSPORT_TX_SUCCESS;
+}
+
+#if TRANSPORT_TX_USE_COMPRESSION
+// Compress a message into buffer, which holds TRANSPORT_COMPRESS_MAX_LEN
+// bytes. Returns how long it came out, or 0 if it isn't worth sending that
+// way.
+uint16_t transport_compress(byte* message, uint16_t message_len, byte* buffer) {
+    if (message_len < 2 || message_len > TRANSPORT_COMPRESS_MAX_LEN) return 0;
+    return compress(message, message_len, buffer, message_len - 1);
+}
+#endif
+
 // The function takes the message, splits it up into segments,
-// and sends each segment one-by-one.
-// Every segment must be acknowledged before the next one is sent.
+// and sends them.
+// Messages are compressed first if that makes them shorter.
+// Short messages without start_flags go as one COMPACT segment instead.
+// In stop-and-wait mode, every segment must be acknowledged before the next
+// one is sent. In selective repeat mode, a window of segments is in flight at
+// once.
+// start_flags are added to the START_OF_MESSAGE. With START_FLAG_PIGGYBACK_ACK,
+// piggyback_ack_seq goes along with it.
 // The function can fail if one of the segments is not acknowledged in time.
 // The function returns whether the message was sent successfully.
-transport_tx_result transport_tx(byte* message, uint16_t message_len, byte dest_port) {
+transport_tx_result transport_tx_with_flags(byte* message, uint16_t message_len, byte dest_port, byte start_flags, byte piggyback_ack_seq) {
 
     byte current_seq_num = 0;
 
-    byte segment[MAX_SEGMENT_LEN];
-    uint16_t bytes_remaining = message_len;
+    frame_buffer_t frame;
+    byte* segment = FRAME_SEGMENT(frame);
+    byte start_segment_len = START_SEGMENT_HEADER_LEN;
 
     transport_keep_trying_to_tx_result result;
 
+#if TRANSPORT_TX_USE_COMPRESSION
+    byte compressed[TRANSPORT_COMPRESS_MAX_LEN];
+    uint16_t compressed_len = message == NULL ? 0 : transport_compress(message, message_len, compressed);
+    if (compressed_len > 0) {
+        message = compressed;
+        message_len = compressed_len;
+        start_flags |= START_FLAG_COMPRESSED;
+    }
+#endif
+
+#if TRANSPORT_TX_USE_COMPACT
+    // The other flags only fit in a START_OF_MESSAGE. Until one has gone to
+    // this receiver, it might take a COMPACT segment for an old one.
+    if ((start_flags & ~START_FLAG_COMPRESSED) == 0 && message_len <= COMPACT_SEGMENT_PAYLOAD_LEN
+            && transport_rtt_entry(dest_port)->compact_synced) {
+        return transport_tx_compact(message, (byte) message_len, dest_port, (start_flags & START_FLAG_COMPRESSED) != 0);
+    }
+#endif
+
     // ------ send START_OF_MESSAGE -----
-    segment[0] = START_SEGMENT_HEADER_LEN;
+    if ((start_flags & START_FLAG_PIGGYBACK_ACK) != 0) {
+        start_segment_len = START_SEGMENT_PIGGYBACK_LEN;
+        segment[8] = piggyback_ack_seq;
+    }
+    segment[0] = start_segment_len;
     segment[1] = current_seq_num;
     segment[2] = dest_port;
     segment[3] = MY_PORT;
     segment[4] = SEGID_START_OF_MESSAGE;
     segment[5] = (message_len & 0xFF00) >> 8;
     segment[6] = (message_len & 0x00FF) >> 0;
-
-    result = transport_keep_trying_to_tx(segment, START_SEGMENT_HEADER_LEN, dest_port, current_seq_num);
+#if TRANSPORT_TX_MODE == TRANSPORT_MODE_SELECTIVE_REPEAT
+    segment[7] = start_flags | START_FLAG_SELECTIVE_REPEAT | (TRANSPORT_TX_USE_SACK ? START_FLAG_SACK : 0);
+    tx_resume_offset = 0;
+    result = transport_keep_trying_to_tx(frame, start_segment_len, dest_port, current_seq_num);
+#else
+    segment[7] = start_flags;
+    result = transport_keep_trying_to_tx(frame, start_segment_len, dest_port, current_seq_num == 0 ? 1 : 0);
+#endif
     if (result == TRANSPORT_KEEP_TRYING_TO_TX_REACHED_ATTEMPT_LIMIT) return TRANSPORT_TX_REACHED_ATTEMPT_LIMIT;
     if (result == TRANSPORT_KEEP_TRYING_TO_TX_ERROR) return TRANSPORT_TX_ERROR;
-    current_seq_num = current_seq_num == 0 ? 1 : 0;
+    transport_rtt_entry(dest_port)->compact_synced = true;
 
-    _delay_ms(TRANSPORT_TX_SEGMENT_SPACING_MS);
+    timer_wait_ms(TRANSPORT_TX_SEGMENT_SPACING_MS);
 
     // ------ send data segments -----
-    while (bytes_remaining > 0) {
+#if TRANSPORT_TX_MODE == TRANSPORT_MODE_SELECTIVE_REPEAT
+    result = transport_tx_data_selective_repeat(message, message_len, dest_port, tx_resume_offset / DATA_SEGMENT_PAYLOAD_LEN);
+    current_seq_num = (byte) ((message_len + DATA_SEGMENT_PAYLOAD_LEN - 1) / DATA_SEGMENT_PAYLOAD_LEN + 1);
+#else
+    current_seq_num = 1;
+    result = transport_tx_data_stop_and_wait(message, message_len, dest_port, &current_seq_num);
+#endif
+    if (result == TRANSPORT_KEEP_TRYING_TO_TX_REACHED_ATTEMPT_LIMIT) return TRANSPORT_TX_REACHED_ATTEMPT_LIMIT;
+    if (result == TRANSPORT_KEEP_TRYING_TO_TX_ERROR) return TRANSPORT_TX_ERROR;
 
-        // can't send the whole darn thing at once unless it's small
-        byte this_payload_len;
-        if (bytes_remaining > MAX_SEGMENT_LEN - DATA_SEGMENT_HEADER_LEN) {
-            this_payload_len = MAX_SEGMENT_LEN - DATA_SEGMENT_HEADER_LEN;
-        }
-        else {
-            this_payload_len = (byte) bytes_remaining;
-        }
+    timer_wait_ms(TRANSPORT_TX_SEGMENT_SPACING_MS);
+
+    // ------ send END_OF_MESSAGE -----
+    segment[0] = END_SEGMENT_HEADER_LEN;
+    segment[1] = current_seq_num;
+    segment[2] = dest_port;
+    segment[3] = MY_PORT;
+    segment[4] = SEGID_END_OF_MESSAGE;
+    segment[5] = 0;
+
+#if TRANSPORT_TX_MODE == TRANSPORT_MODE_SELECTIVE_REPEAT
+    result = transport_keep_trying_to_tx(frame, END_SEGMENT_HEADER_LEN, dest_port, current_seq_num);
+#else
+    result = transport_keep_trying_to_tx(frame, END_SEGMENT_HEADER_LEN, dest_port, current_seq_num == 0 ? 1 : 0);
+#endif
+    if (result == TRANSPORT_KEEP_TRYING_TO_TX_REACHED_ATTEMPT_LIMIT) return TRANSPORT_TX_REACHED_ATTEMPT_LIMIT;
+    if (result == TRANSPORT_KEEP_TRYING_TO_TX_ERROR) return TRANSPORT_TX_ERROR;
 
-        byte this_segment_len = this_payload_len + DATA_SEGMENT_HEADER_LEN;
-        uint16_t start_address = message_len - (uint16_t) bytes_remaining;
+    return TRANSPORT_TX_SUCCESS;
 
-        segment[0] = this_segment_len;
-        segment[1] = current_seq_num;
-        segment[2] = dest_port;
-        segment[3] = MY_PORT;
-        segment[4] = SEGID_DATA;
-        segment[5] = (start_address & 0xFF00) >> 8;
-        segment[6] = (start_address & 0x00FF) >> 0;
-        for (byte i = 0; i < this_payload_len; i++) {
-            segment[i + DATA_SEGMENT_HEADER_LEN] = message[i + start_address];
+}
+
+// Count how a message went, and pass the result along.
+transport_tx_result transport_count_tx(transport_tx_result result) {
+    if (result == TRANSPORT_TX_SUCCESS) stats.messages_sent++;
+    else stats.messages_failed++;
+    return result;
+}
+
+// The application layer calls this function.
+// Send a message. See transport_tx_with_flags.
+transport_tx_result transport_tx(byte* message, uint16_t message_len, byte dest_port) {
+    return transport_count_tx(transport_tx_with_flags(message, message_len, dest_port, 0, 0));
+}
+
+// The application layer calls this function.
+// Send a message that's too big to keep in RAM. source is asked for each
+// DATA segment's bytes as it's built, possibly more than once. If the
+// receiver has a sink (see transport_set_sink), a message that broke off
+// partway picks up where the sink left off when it's sent again.
+transport_tx_result transport_tx_large(transport_source_t source, uint16_t message_len, byte dest_port) {
+    tx_source = source;
+    transport_tx_result result = transport_tx_with_flags(NULL, message_len, dest_port, START_FLAG_LARGE, 0);
+    tx_source = NULL;
+    return transport_count_tx(result);
+}
+
+// The application layer calls this function.
+// Answer the message that was just received from dest_port.
+// If that message came from transport_request, the ack for its
+// END_OF_MESSAGE rides along with this message's START_OF_MESSAGE.
+// Otherwise, this is the same as transport_tx.
+transport_tx_result transport_reply(byte* message, uint16_t message_len, byte dest_port) {
+
+    for (byte i = 0; i < TRANSPORT_RX_CONTEXT_COUNT; i++) {
+        transport_rx_context_t* context = &rx_contexts[i];
+        if (context->used && context->port == dest_port && context->reply_owed) {
+            context->reply_owed = false;
+            return transport_count_tx(transport_tx_with_flags(message, message_len, dest_port, START_FLAG_PIGGYBACK_ACK, context->reply_ack_seq));
         }
+    }
+
+    return transport_tx(message, message_len, dest_port);
+}
+
+#if TRANSPORT_RX_BUFFER_LEN > 0
+// The application layer calls this function.
+// Send a message to dest_port and wait for its transport_reply.
+// Messages from anyone else that finish in the meantime are thrown away.
+// The function will write to reply_len to identify the length of the reply.
+transport_rx_result transport_request(byte* message, uint16_t message_len, byte dest_port, byte* reply, uint16_t reply_buf_len, uint16_t* reply_len, uint16_t timeout_ms) {
+
+    transport_tx_result tx_result = transport_tx_with_flags(message, message_len, dest_port, START_FLAG_REPLY_EXPECTED, 0);
+    if (tx_result != TRANSPORT_TX_SUCCESS) return TRANSPORT_RX_ERROR;
+
+    while(true) {
+        byte source_port;
+        transport_rx_result rx_result = transport_rx(reply, reply_buf_len, reply_len, &source_port, timeout_ms);
+        if (rx_result != TRANSPORT_RX_SUCCESS) return rx_result;
+        if (source_port == dest_port) return TRANSPORT_RX_SUCCESS;
+    }
+}
+#endif
+
+// The application layer calls this function.
+// Send one message to every member of a multicast group.
+// group_port must resolve to a group address (see NETWORK_GROUP_ALL_CUBES),
+// and members lists the port of everyone in the group.
+// This always uses stop-and-wait. Each segment is sent to the group once,
+// then only to the members that didn't ack it.
+// The function returns whether every member got the whole message.
+transport_tx_result transport_tx_multicast(byte* message, uint16_t message_len, byte group_port, byte* members, byte member_count) {
+
+    if (member_count == 0 || member_count > TRANSPORT_MULTICAST_MAX_MEMBERS) return TRANSPORT_TX_ERROR;
+
+    byte current_seq_num = 0;
+    byte start_flags = 0;
+
+#if TRANSPORT_TX_USE_COMPRESSION
+    byte compressed[TRANSPORT_COMPRESS_MAX_LEN];
+    uint16_t compressed_len = transport_compress(message, message_len, compressed);
+    if (compressed_len > 0) {
+        message = compressed;
+        message_len = compressed_len;
+        start_flags = START_FLAG_COMPRESSED;
+    }
+#endif
 
-        bytes_remaining -= (uint16_t) this_payload_len;
+    frame_buffer_t frame;
+    byte* segment = FRAME_SEGMENT(frame);
+    uint16_t segment_count = (message_len + DATA_SEGMENT_PAYLOAD_LEN - 1) / DATA_SEGMENT_PAYLOAD_LEN;
 
-        result = transport_keep_trying_to_tx(segment, this_segment_len, dest_port, current_seq_num);
+    transport_keep_trying_to_tx_result result;
+
+    // ------ send START_OF_MESSAGE -----
+    segment[0] = START_SEGMENT_HEADER_LEN;
+    segment[1] = current_seq_num;
+    segment[2] = group_port;
+    segment[3] = MY_PORT;
+    segment[4] = SEGID_START_OF_MESSAGE;
+    segment[5] = (message_len & 0xFF00) >> 8;
+    segment[6] = (message_len & 0x00FF) >> 0;
+    segment[7] = start_flags;
+    result = transport_keep_trying_to_tx_multicast(frame, START_SEGMENT_HEADER_LEN, group_port, members, member_count, 1);
+    if (result == TRANSPORT_KEEP_TRYING_TO_TX_REACHED_ATTEMPT_LIMIT) return TRANSPORT_TX_REACHED_ATTEMPT_LIMIT;
+    if (result == TRANSPORT_KEEP_TRYING_TO_TX_ERROR) return TRANSPORT_TX_ERROR;
+    current_seq_num = 1;
+
+    timer_wait_ms(TRANSPORT_TX_SEGMENT_SPACING_MS);
+
+    // ------ send data segments -----
+    for (uint16_t index = 0; index < segment_count; index++) {
+
+        byte this_segment_len = transport_build_data_segment(segment, message, message_len, index, current_seq_num, group_port, 0);
+
+        result = transport_keep_trying_to_tx_multicast(frame, this_segment_len, group_port, members, member_count, current_seq_num == 0 ? 1 : 0);
         if (result == TRANSPORT_KEEP_TRYING_TO_TX_REACHED_ATTEMPT_LIMIT) return TRANSPORT_TX_REACHED_ATTEMPT_LIMIT;
         if (result == TRANSPORT_KEEP_TRYING_TO_TX_ERROR) return TRANSPORT_TX_ERROR;
         current_seq_num = current_seq_num == 0 ? 1 : 0;
 
-        _delay_ms(TRANSPORT_TX_SEGMENT_SPACING_MS);
+        timer_wait_ms(TRANSPORT_TX_SEGMENT_SPACING_MS);
     }
 
     // ------ send END_OF_MESSAGE -----
     segment[0] = END_SEGMENT_HEADER_LEN;
     segment[1] = current_seq_num;
-    segment[2] = dest_port;
+    segment[2] = group_port;
     segment[3] = MY_PORT;
     segment[4] = SEGID_END_OF_MESSAGE;
-
-    result = transport_keep_trying_to_tx(segment, END_SEGMENT_HEADER_LEN, dest_port, current_seq_num);
+    segment[5] = 0;
+    result = transport_keep_trying_to_tx_multicast(frame, END_SEGMENT_HEADER_LEN, group_port, members, member_count, current_seq_num == 0 ? 1 : 0);
     if (result == TRANSPORT_KEEP_TRYING_TO_TX_REACHED_ATTEMPT_LIMIT) return TRANSPORT_TX_REACHED_ATTEMPT_LIMIT;
     if (result == TRANSPORT_KEEP_TRYING_TO_TX_ERROR) return TRANSPORT_TX_ERROR;
-    current_seq_num = current_seq_num == 0 ? 1 : 0;
 
     return TRANSPORT_TX_SUCCESS;
+}
+
+
+
+// ======================= Polling Engine ======================================
+
+/*
+    Everything above blocks until it's done. The polling engine does the same
+    work a little bit at a time, so the application can do other things while
+    messages go in and out.
+
+    transport_send_async starts sending a message, and transport_receive_async
+    gives the engine somewhere to put a message that comes in. After that, call
+    transport_poll as often as possible. Each call handles whatever the radio
+    has picked up, and sends the next segment or gives up on an ack when it's
+    time. Nothing in here waits on a timeout. Times come from timer_now_ms, so
+    timer_clock_initialize has to be called first.
+
+    The sender here always uses stop-and-wait. Anyone can still send to us with
+    selective repeat.
+
+    Acks still go out TRANSPORT_TX_ACK_DELAY_MS after the segment, because the
+    sender needs that long to start listening for one. Instead of waiting that
+    out, transport_poll leaves them in rx_acks and sends them from whichever
+    call comes along once they're due.
+*/
+
+typedef enum {
+    ASYNC_TXST_Idle,
+    ASYNC_TXST_Send,            // waiting until ready_at to send the next segment
+    ASYNC_TXST_WaitForAck       // waiting for the ack, or for the RTO to run out
+} async_tx_state_t;
+
+typedef struct {
+    byte state;                 // async_tx_state_t
+    transport_async_status_t status;
+    byte* message;
+    uint16_t message_len;
+    byte dest_port;
+    uint16_t index;             // 0 = START_OF_MESSAGE, then the DATA segments, then END_OF_MESSAGE
+    uint16_t segment_count;     // how many DATA segments there are
+    byte seq;
+    uint16_t transmit_attempts;
+    timer_delay_ms_t ready_at;
+    timer_delay_ms_t sent_at;
+    frame_buffer_t frame;
+} transport_async_tx_t;
+
+typedef struct {
+    transport_async_status_t status;
+    byte* buffer;
+    uint16_t buf_len;
+    uint16_t message_len;
+    byte source_port;
+} transport_async_rx_t;
+
+NODE_STATE transport_async_tx_t async_tx = { .state = ASYNC_TXST_Idle, .status = TRANSPORT_ASYNC_IDLE };
+NODE_STATE transport_async_rx_t async_rx = { .status = TRANSPORT_ASYNC_IDLE };
+
+// Put segment number async_tx.index in the frame.
+// Returns its length.
+byte transport_async_build_segment(void) {
+
+    byte* segment = FRAME_SEGMENT(async_tx.frame);
+
+    if (async_tx.index > 0 && async_tx.index <= async_tx.segment_count) {
+        return transport_build_data_segment(segment, async_tx.message, async_tx.message_len, async_tx.index - 1, async_tx.seq, async_tx.dest_port, 0);
+    }
+
+    segment[1] = async_tx.seq;
+    segment[2] = async_tx.dest_port;
+    segment[3] = MY_PORT;
+
+    if (async_tx.index == 0) {
+        segment[0] = START_SEGMENT_HEADER_LEN;
+        segment[4] = SEGID_START_OF_MESSAGE;
+        segment[5] = (async_tx.message_len & 0xFF00) >> 8;
+        segment[6] = (async_tx.message_len & 0x00FF) >> 0;
+        segment[7] = 0;
+    }
+    else {
+        segment[0] = END_SEGMENT_HEADER_LEN;
+        segment[4] = SEGID_END_OF_MESSAGE;
+        segment[5] = 0;
+    }
+
+    return segment[0];
+}
+
+// Send the next segment, or give up on an ack, if it's time.
+// Returns true if it used the radio.
+bool transport_async_tx_step(void) {
+
+    transport_rtt_entry_t* rtt;
+
+    switch (async_tx.state) {
+
+    case ASYNC_TXST_Send:
+        if (!transport_time_reached(async_tx.ready_at)) return false;
+
+        async_tx.transmit_attempts++;
+        if (async_tx.transmit_attempts > TRANSPORT_TX_ATTEMPT_LIMIT) {
+            async_tx.state = ASYNC_TXST_Idle;
+            async_tx.status = TRANSPORT_ASYNC_FAILED;
+            stats.messages_failed++;
+            return false;
+        }
+
+        byte segment_len = transport_async_build_segment();
+        if (async_tx.transmit_attempts > 1) {
+            stats.retries++;
+            if (LOG_ENABLED(INFO, TRANSPORT)) print_trace(TRACE_RETRY, async_tx.dest_port, FRAME_SEGMENT(async_tx.frame)[1], (byte) async_tx.transmit_attempts, 0);
+        }
+        network_tx(async_tx.frame, segment_len, resolve_network_addr(async_tx.dest_port), MY_NETWORK_ADDR, transport_segment_priority(FRAME_SEGMENT(async_tx.frame)));
+        stats.segments++;
+        async_tx.sent_at = timer_now_ms();
+        async_tx.state = ASYNC_TXST_WaitForAck;
+        return true;
+
+    case ASYNC_TXST_WaitForAck:
+        rtt = transport_rtt_entry(async_tx.dest_port);
+        if (!transport_time_reached(async_tx.sent_at + rtt->rto_ms)) return false;
+
+        // Nobody acked. Try again in a bit.
+        transport_rtt_backoff(rtt);
+        async_tx.ready_at = timer_now_ms() + TRANSPORT_TX_RETRY_DELAY_MS;
+        async_tx.state = ASYNC_TXST_Send;
+        return false;
+
+    default:
+        return false;
+    }
+}
+
+// An ack arrived. Is it the one we're waiting for?
+void transport_async_tx_ack(byte* segment) {
+
+    if (async_tx.state != ASYNC_TXST_WaitForAck) return;
+    if (segment[3] != async_tx.dest_port) return;
+    if (segment[1] != (async_tx.seq == 0 ? 1 : 0)) return;
+    stats.acks_received++;
+
+    // Karn's rule: only trust the measurement if we only sent it once.
+    if (async_tx.transmit_attempts == 1) {
+        transport_rtt_sample(transport_rtt_entry(async_tx.dest_port), timer_now_ms() - async_tx.sent_at);
+    }
+
+    // That was the END_OF_MESSAGE. We're done.
+    if (async_tx.index > async_tx.segment_count) {
+        async_tx.state = ASYNC_TXST_Idle;
+        async_tx.status = TRANSPORT_ASYNC_DONE;
+        stats.messages_sent++;
+        return;
+    }
+
+    async_tx.index++;
+    async_tx.seq = async_tx.index == 1 ? 1 : (async_tx.seq == 0 ? 1 : 0);
+    async_tx.transmit_attempts = 0;
+    async_tx.ready_at = timer_now_ms() + TRANSPORT_TX_SEGMENT_SPACING_MS;
+    async_tx.state = ASYNC_TXST_Send;
+}
+
+// Start sending a message in the background.
+// The message must stay put until transport_send_status stops saying
+// TRANSPORT_ASYNC_BUSY.
+// Returns false if a message is already being sent.
+bool transport_send_async(byte* message, uint16_t message_len, byte dest_port) {
+
+    if (async_tx.state != ASYNC_TXST_Idle) return false;
+
+    async_tx.message = message;
+    async_tx.message_len = message_len;
+    async_tx.dest_port = dest_port;
+    async_tx.index = 0;
+    async_tx.segment_count = (message_len + DATA_SEGMENT_PAYLOAD_LEN - 1) / DATA_SEGMENT_PAYLOAD_LEN;
+    async_tx.seq = 0;
+    async_tx.transmit_attempts = 0;
+    async_tx.ready_at = timer_now_ms();
+    async_tx.state = ASYNC_TXST_Send;
+    async_tx.status = TRANSPORT_ASYNC_BUSY;
+    network_listen();
+
+    return true;
+}
+
+transport_async_status_t transport_send_status(void) {
+    return async_tx.status;
+}
+
+#if TRANSPORT_RX_BUFFER_LEN > 0
+// Give the engine somewhere to put the next message that comes in.
+void transport_receive_async(byte* buffer, uint16_t buf_len) {
+    async_rx.buffer = buffer;
+    async_rx.buf_len = buf_len;
+    async_rx.status = TRANSPORT_ASYNC_BUSY;
+    network_listen();
+}
+
+// Once this says TRANSPORT_ASYNC_DONE, the message is in the buffer, and
+// message_len and source_port say how long it is and who sent it.
+transport_async_status_t transport_receive_status(uint16_t* message_len, byte* source_port) {
+    if (async_rx.status == TRANSPORT_ASYNC_DONE) {
+        if (message_len != NULL) *message_len = async_rx.message_len;
+        if (source_port != NULL) *source_port = async_rx.source_port;
+    }
+    return async_rx.status;
+}
+
+// A message was put together. Hand it over, if anyone's asking for one.
+// It's been acked by now, so if nobody is, at least count it.
+void transport_async_rx_done(transport_rx_context_t* context) {
+
+    if (async_rx.status != TRANSPORT_ASYNC_BUSY) {
+        stats.messages_dropped++;
+        return;
+    }
+
+    async_rx.message_len = transport_rx_deliver(context, async_rx.buffer, async_rx.buf_len);
+    async_rx.source_port = context->port;
+    async_rx.status = TRANSPORT_ASYNC_DONE;
+}
+#endif
+
+// Do whatever transport work is ready to be done, without waiting.
+void transport_poll(void) {
+
+    frame_buffer_t frame;
+    byte* segment = FRAME_SEGMENT(frame);
+    transport_rx_context_t* context;
+
+    // Handle everything the radio picked up since last time. Once a message
+    // is waiting in the receive buffer, the rest waits in the radio until the
+    // application takes it, or a second one would be acked and thrown away.
+    while (async_rx.status != TRANSPORT_ASYNC_DONE && network_poll(frame) == NETWORK_RX_SUCCESS) {
+
+        if (segment[4] == SEGID_ACK) {
+            transport_async_tx_ack(segment);
+            continue;
+        }
+
+        // With no buffer posted and no sink, nothing could take a message,
+        // so nothing gets acked either. The sender keeps trying until
+        // there's somewhere for it to go.
+        if (async_rx.status != TRANSPORT_ASYNC_BUSY && rx_sink == NULL) continue;
+
+        // The acks for anything else wait in rx_acks.
+        rx_acks.deferring = true;
+        transport_attempt_rx_result result = transport_handle_rx(frame, &context);
+        rx_acks.deferring = false;
+        network_listen();
+        if (result != TRANSPORT_ATTEMPT_RX_SUCCESS) continue;
+
+        if (transport_rx_to_sink(context, segment)) continue;
+#if TRANSPORT_RX_BUFFER_LEN > 0
+        if (transport_rx_assemble(context, segment)) transport_async_rx_done(context);
+#endif
+    }
+
+    if (transport_send_deferred_acks()) network_listen();
+    if (transport_async_tx_step()) network_listen();
+}
+
+transport_stats_t transport_get_stats(void) {
+    return stats;
+}
 
+void transport_reset_stats(void) {
+    transport_stats_t none = { 0 };
+    stats = none;
 }
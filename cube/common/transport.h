@@ -9,7 +9,9 @@ enum segment_identifier_t {
     SEGID_START_OF_MESSAGE = 0x07,
     SEGID_DATA = 0x0D,
     SEGID_END_OF_MESSAGE = 0x09,
-    SEGID_ACK = 0x0A
+    SEGID_ACK = 0x0A,
+    SEGID_SACK = 0x0B,
+    SEGID_COMPACT = 0x0C
 };
 
 typedef enum {
@@ -24,8 +26,95 @@ typedef enum {
     TRANSPORT_TX_ERROR
 } transport_tx_result;
 
+// What transport_rx_stream is telling the handler about.
+// START: a message is starting. offset and len are 0.
+// DATA:  bytes[0 .. len) are bytes [offset .. offset + len) of the message.
+// END:   the message is done. offset is the length of the message.
+typedef enum {
+    TRANSPORT_STREAM_START,
+    TRANSPORT_STREAM_DATA,
+    TRANSPORT_STREAM_END
+} transport_stream_event_t;
+
+typedef void (*transport_stream_handler_t)(transport_stream_event_t event, byte source_port, uint16_t offset, byte* bytes, byte len);
+
 transport_rx_result transport_rx(byte* buffer, uint16_t buf_len, uint16_t* message_len, byte* source_port, uint16_t timeout_ms);
 
+// Large messages, longer than anyone has RAM for. transport_tx_large reads
+// the message from a source a segment at a time. On the receiving end,
+// whatever receive call is running writes it to the sink at its offset as it
+// arrives, instead of putting it together in a buffer, as long as a sink was
+// set with transport_set_sink.
+//
+// resume: how much of a message this long from source_port the sink already
+//         has, in order, so the sender can pick up from there. 0 to start
+//         over. This is where a new message starts.
+// write:  bytes[0 .. len) are bytes [offset .. offset + len) of the message.
+//         They come in order.
+// done:   the whole message is in the sink.
+//
+// Large messages are never compressed.
+typedef struct {
+    uint16_t (*resume)(byte source_port, uint16_t message_len);
+    void (*write)(byte source_port, uint16_t offset, byte* bytes, byte len);
+    void (*done)(byte source_port, uint16_t message_len);
+} transport_sink_t;
+
+typedef void (*transport_source_t)(uint16_t offset, byte* bytes, byte len);
+
+void transport_set_sink(const transport_sink_t* sink);
+
+transport_tx_result transport_tx_large(transport_source_t source, uint16_t message_len, byte dest_port);
+
+transport_rx_result transport_rx_stream(transport_stream_handler_t handler, uint16_t timeout_ms);
+
 transport_tx_result transport_tx(byte* message, uint16_t message_len, byte dest_port);
 
+// Send one message to every member of a multicast group.
+transport_tx_result transport_tx_multicast(byte* message, uint16_t message_len, byte group_port, byte* members, byte member_count);
+
+// The polling engine. Start work with transport_send_async and
+// transport_receive_async, then call transport_poll until the status says
+// it's done. See transport.c for details.
+typedef enum {
+    TRANSPORT_ASYNC_IDLE,
+    TRANSPORT_ASYNC_BUSY,
+    TRANSPORT_ASYNC_DONE,
+    TRANSPORT_ASYNC_FAILED
+} transport_async_status_t;
+
+void transport_poll(void);
+
+bool transport_send_async(byte* message, uint16_t message_len, byte dest_port);
+
+transport_async_status_t transport_send_status(void);
+
+void transport_receive_async(byte* buffer, uint16_t buf_len);
+
+transport_async_status_t transport_receive_status(uint16_t* message_len, byte* source_port);
+
+// Request/response pairs. The reply carries the ack for the end of the
+// request, which saves a frame on the turnaround.
+transport_tx_result transport_reply(byte* message, uint16_t message_len, byte dest_port);
+
+transport_rx_result transport_request(byte* message, uint16_t message_len, byte dest_port, byte* reply, uint16_t reply_buf_len, uint16_t* reply_len, uint16_t timeout_ms);
+
+// What the transport layer has done since transport_reset_stats. The counts
+// wrap around.
+typedef struct {
+    uint16_t segments;          // segments sent, retries included
+    uint16_t retries;           // segments sent again because no ack came
+    uint16_t timeouts;          // times an ack took longer than the RTO
+    uint16_t acks_sent;         // ACKs and SACKs
+    uint16_t acks_received;     // ones we were waiting for
+    uint16_t messages_sent;     // unicast messages that were acked all the way through
+    uint16_t messages_failed;   // unicast messages that were given up on
+    uint16_t messages_received; // handed to the application or a sink
+    uint16_t messages_dropped;  // acked, but nobody was waiting for them
+    uint32_t bytes_delivered;   // how long those messages were, in total
+} transport_stats_t;
+
+transport_stats_t transport_get_stats(void);
+void transport_reset_stats(void);
+
 #endif
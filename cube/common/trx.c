@@ -16,10 +16,14 @@
 
 #include "trx.h"
 
+#include "cpu_clock.h"
+#include "idle.h"
 #include "spi.h"
 #include "uart.h"
+#include "log_level.h"
+#include "profile.h"
 
-#define F_CPU 1000000
+#include "clock.h"
 #include <util/delay.h>
 
 /////////////////// Private Defines ////////////////////////////////////////////
@@ -27,6 +31,16 @@
 #define TRX_EICRA (0)
 // Both interrupts are low-level (Interrupt 1 isn't used).
 
+#if (TRX_RX_RING_LENGTH & (TRX_RX_RING_LENGTH - 1)) != 0
+#error "TRX_RX_RING_LENGTH must be a power of two."
+#endif
+
+// Turn the receive interrupt on and off. Anything that talks to the
+// transceiver outside of the interrupt has to turn it off first, or the
+// handler could start its own SPI transaction in the middle of ours.
+#define TRX_IRQ_ENABLE()  (EIMSK |= _BV(TRX_IRQ_INT))
+#define TRX_IRQ_DISABLE() (EIMSK &= ~_BV(TRX_IRQ_INT))
+
 #define TRX_TRANSACTION_MAX_LENGTH  (33)
 // 1 for the instruction, up to 32 for the data.
 
@@ -50,12 +64,22 @@
 
 // Writes a payload from the TX buffer.
 #define TRX_WRITE_TX_PAYLOAD_INSTRUCTION        (0xA0)
+
+// Same, but the receiver won't acknowledge it.
+#define TRX_WRITE_TX_PAYLOAD_NOACK_INSTRUCTION  (0xB0)
 #define TRX_WRITE_TX_PAYLOAD_TRANSACTION_LENGTH (TRX_PAYLOAD_LENGTH + 1)
 
 // Reads a payload from the RX buffer.
 #define TRX_READ_RX_PAYLOAD_INSTRUCTION         (0x61)
 #define TRX_READ_RX_PAYLOAD_TRANSACTION_LENGTH  (TRX_PAYLOAD_LENGTH + 1)
 
+// Reads the length of the payload at the front of the RX buffer.
+#define TRX_READ_RX_PAYLOAD_WIDTH_INSTRUCTION   (0x60)
+
+// Writes a payload to go out with the next acknowledgement on a pipe.
+// The pipe number goes in the low three bits.
+#define TRX_WRITE_ACK_PAYLOAD_INSTRUCTION       (0xA8)
+
 // Register Addresses
 
 // Configuration register
@@ -82,13 +106,23 @@
 // Status register
 #define TRX_REGISTER_ADDRESS_STATUS     (0x07)
 
+// Transmit observe register
+#define TRX_REGISTER_ADDRESS_OBSERVE_TX (0x08)
+
+// Received power detector
+#define TRX_REGISTER_ADDRESS_RPD        (0x09)
+
 // Receive address for Data Pipe 0.
 #define TRX_REGISTER_ADDRESS_RX_ADDR_P0 (0x0A)
 
+// Receive address for Data Pipe 1. Pipes 2 through 5 follow it, but only
+// have their lowest byte. The rest is the same as pipe 1's.
+#define TRX_REGISTER_ADDRESS_RX_ADDR_P1 (0x0B)
+
 // Transmit address.
 #define TRX_REGISTER_ADDRESS_TX_ADDR    (0x10)
 
-// RX data pipe 0
+// RX data pipe 0. Pipes 1 through 5 follow it.
 #define TRX_REGISTER_ADDRESS_RX_PW_P0   (0x11)
 
 // Enable dynaic payload length.
@@ -97,6 +131,9 @@
 // Feature Register
 #define TRX_REGISTER_ADDRESS_FEATURE    (0x1D)
 
+// FIFO Status Register
+#define TRX_REGISTER_ADDRESS_FIFO_STATUS (0x17)
+
 // Registers and fields
 
 #define PWR_UP      (1)
@@ -111,23 +148,35 @@
 // Same as above, but in PRX mode.
 #define TRX_CONFIG_RX (TRX_CONFIG_TX | _BV(PRIM_RX))
 
-// Only Pipe 0 is used.
+// Pipe 0 is acknowledged. trx_add_rx_address turns it on for the others
+// too, because dynamic payload length needs it, but broadcasts to them are
+// sent without asking for an acknowledgement.
 #define TRX_EN_AA (0x01)
 
-// Only Pipe 0 is used.
+// Pipe 0 is always used. trx_add_rx_address turns on the others.
 #define TRX_EN_RXADDR (0x01)
 
+// Which bits of the status register say what pipe a payload came in on.
+// All ones means the RX FIFO is empty.
+#define RX_P_NO_MASK  (0x07)
+#define RX_P_NO_EMPTY (0x07)
+
 // This design uses only four-byte addresses.
 #define TRX_SETUP_AW  (0x02) // 10 -> 4 bytes
 
-// Maximum retransmission delay and tries.
-#define TRX_SETUP_RETR (0xFF)
+// For trx_start_sniffing: an illegal address width, which makes it 2 bytes,
+// and an address that goes over the air as 0x00 0x55. Addresses are written
+// low byte first and sent high byte first.
+#define TRX_SNIFF_SETUP_AW  (0x00)
+#define TRX_SNIFF_ADDRESS   (0x0055)
+
+// Power on and in PRX mode, with the CRC off so nothing is thrown out.
+#define TRX_CONFIG_SNIFF    (_BV(PWR_UP) | _BV(PRIM_RX))
 
-// Leaves the frequency channel at default.
+// The frequency channel until trx_set_channel says otherwise.
 #define TRX_RF_CH (0x02)
 
-// No continuous carrier, 250kbps, no PLL lock, 0dBm output power.
-#define TRX_RF_SETUP (0x26) // binary 0010 0110
+// RF_SETUP and SETUP_RETR come from the link profile. See link_profiles.
 
 // Status register
 #define RX_DR     (6)
@@ -141,28 +190,57 @@
 
 #define IRQ_FLAGS (_BV(RX_DR) | _BV(TX_DS) | _BV(MAX_RT))
 
+// Setup of automatic retransmission
+#define ARD_SHIFT (4)
+#define ARC_MASK  (0x0F)
+#define TRX_ARD_STEP_US (250)
+
 // Transmitter observation register
-// Not used for this project.
+#define PLOS_CNT_SHIFT (4)
+#define ARC_CNT_MASK   (0x0F)
 
 // Received power detector
-// Not used for this project.
+// RPD is only right once the receiver has been on for 130us to settle and
+// 40us for its gain control.
+#define RPD           (0)
+#define TRX_RPD_SETTLE_US (170)
 
 // RX address is determined in trx.h.
 
 // TX address is determined during code body.
 
-// Number of bytes is data pipes is not relevant for this project, except for
-// data pipe 0.
+// Every pipe takes full-length payloads.
 #define TRX_RX_PW_P0  TRX_PAYLOAD_LENGTH
 
-// FIFO status register are not relevant to this project.
+// FIFO status register
+#define RX_EMPTY  (0)
+#define TX_EMPTY  (4)
+
+// Feature register
+#define EN_DPL      (2)
+#define EN_ACK_PAY  (1)
+#define EN_DYN_ACK  (0)
+
+#if TRX_DYNAMIC_PAYLOAD_LENGTH
+
+// Dynamic payload length on every data pipe.
+#define TRX_DYNPD (0x3F)
+
+// Dynamic payload length enabled, payloads with acknowledgements enabled, and
+// payloads with no acknowledgement enabled. Acknowledgements only carry a
+// payload if trx_set_ack_payload has loaded one.
+#define TRX_FEATURE (_BV(EN_DPL) | _BV(EN_ACK_PAY) | _BV(EN_DYN_ACK))
+
+#else
 
 // Dynamic payload length is not used.
 #define TRX_DYNPD (0x00)
 
-// Dynamic payload length not used, no payload with acknowledgement, and no
-// payloads with no acknowledgement.
-#define TRX_FEATURE (0x00)
+// Dynamic payload length not used, no payload with acknowledgement, and
+// payloads with no acknowledgement enabled.
+#define TRX_FEATURE (_BV(EN_DYN_ACK))
+
+#endif
 
 /////////////////// Private type definitions ///////////////////////////////////
 
@@ -172,8 +250,33 @@ typedef uint8_t trx_interrupt_request_t;
 #define TRX_INTERRUPT_REQUEST_MAX_RETRANSMISSIONS (2)
 #define TRX_INTERRUPT_REQUEST_DATA_RECEIVED       (3)
 
+// What each link profile writes to RF_SETUP and SETUP_RETR.
+typedef struct {
+  spi_message_element_t rf_setup;
+  spi_message_element_t setup_retr;
+} trx_link_profile_registers_t;
+
 /////////////////// Static Variable Definitions ////////////////////////////////
 
+// Indexed by trx_link_profile_t.
+// RF_SETUP: no continuous carrier, no PLL lock, then the data rate and power.
+// SETUP_RETR: retransmit delay in the high nibble (250us steps, plus 250us),
+// retransmit count in the low nibble.
+static const trx_link_profile_registers_t link_profiles[TRX_LINK_PROFILE_COUNT] = {
+  { 0x26, 0xFF }, // ROBUST:    250kbps, 0dBm,   4000us, 15 tries
+  { 0x06, 0x5A }, // BALANCED:  1Mbps,   0dBm,   1500us, 10 tries
+  { 0x0E, 0x15 }, // FAST:      2Mbps,   0dBm,    500us,  5 tries
+  { 0x22, 0x5F }, // LOW_POWER: 250kbps, -12dBm, 1500us, 15 tries
+};
+
+static trx_link_profile_t current_link_profile = TRX_LINK_PROFILE_DEFAULT;
+
+// What's in RF_CH, other than in the middle of trx_channel_activity.
+static uint8_t current_channel = TRX_RF_CH;
+
+// Counts from OBSERVE_TX, since the last trx_reset_link_stats.
+static trx_link_stats_t link_stats;
+
 trx_status_buffer_t trx_status_buffer;
 
 // The RX address of this data cube.
@@ -182,6 +285,62 @@ trx_address_t       trx_this_rx_address;
 // The buffer that the rx payload will be read to.
 spi_message_element_t *rx_payload_buffer;
 
+// Payloads the interrupt handler has read out of the transceiver.
+// The handler only moves rx_ring_head and everyone else only moves
+// rx_ring_tail, so neither needs a lock. They count up forever and wrap
+// around; head - tail is how many payloads are waiting.
+static trx_payload_element_t rx_ring[TRX_RX_RING_LENGTH][TRX_PAYLOAD_LENGTH];
+static uint8_t rx_ring_pipe[TRX_RX_RING_LENGTH];
+static volatile uint8_t rx_ring_head = 0;
+static volatile uint8_t rx_ring_tail = 0;
+
+// Whether the transceiver is in RX mode with the interrupt armed.
+static volatile uint8_t trx_listening = 0;
+
+// The pipe the last payload trx_try_dequeue handed out came in on.
+static uint8_t rx_last_pipe = 0;
+
+// Which pipes are listening, and what pipe 1 is listening for. Pipes 2
+// through 5 have to share all but the lowest byte with it.
+static spi_message_element_t rx_pipes_enabled = TRX_EN_RXADDR;
+static trx_address_t         rx_pipe1_address;
+
+// What we last wrote to the registers that change on every turnaround, so
+// we only spend SPI transactions on the ones that actually change. The
+// transceiver keeps its registers for as long as it has power, and we're the
+// only ones writing them.
+static spi_message_element_t shadow_config;
+static trx_address_t         shadow_tx_addr;
+static trx_address_t         shadow_rx_addr_p0;
+static uint8_t               shadow_addresses_valid = 0;
+#define SHADOW_TX_ADDR_VALID    (0x01)
+#define SHADOW_RX_ADDR_P0_VALID (0x02)
+
+// The payload to send back with the next acknowledgement. Switching to TX
+// mode flushes it out of the transceiver, so we keep a copy and load it
+// again every time we start listening. The W_ACK_PAYLOAD instruction goes
+// in front of it, so the whole thing can go out in one background transaction.
+static trx_payload_element_t ack_payload_message[TRX_PAYLOAD_LENGTH + 1];
+static trx_payload_element_t * const ack_payload = ack_payload_message + 1;
+static uint8_t               ack_payload_length = 0;
+static volatile uint8_t      ack_payload_loaded = 0;
+static volatile uint8_t      ack_payload_sent = 0;
+
+// The duty cycle from trx_set_duty_cycle. A duty_sleep_ms of 0 means it's
+// off. While awake, the transceiver powers down at duty_sleep_at; while
+// asleep, it wakes up again at duty_wake_at.
+static timer_delay_ms_t duty_listen_ms = 0;
+static timer_delay_ms_t duty_sleep_ms = 0;
+static timer_delay_ms_t duty_sleep_at;
+static timer_delay_ms_t duty_wake_at;
+static uint8_t          duty_asleep = 0;
+
+// How long trx_transmit_payload keeps trying, from trx_set_wakeup.
+static timer_delay_ms_t wakeup_ms = 0;
+
+// Whether trx_ready has seen the registers take, since trx_initialize.
+static uint8_t registers_ready = 0;
+
 /////////////////// Private Function Prototypes ////////////////////////////////
 
 void write_register(
@@ -203,16 +362,88 @@ void write_address(
 );
 
 void write_tx_payload(
-  const spi_message_element_t *payload
+  spi_message_element_t        instruction,
+  const spi_message_element_t *payload,
+  uint8_t                      length
 );
 
 void read_rx_payload(
   spi_message_element_t *buffer
 );
 
+// Writes every register trx_initialize sets up.
+void configure_registers(void);
+
+// Whether the registers hold what configure_registers wrote.
+uint8_t registers_match(void);
+
+// Puts the transceiver in TX mode, pointed at the given address.
+void configure_tx(
+  trx_address_t address
+);
+
+// Writes CONFIG, unless it already holds this value.
+void set_config(
+  spi_message_element_t value
+);
+
+// Write TX_ADDR and RX_ADDR_P0, unless they already hold these addresses.
+void set_tx_addr(
+  trx_address_t address
+);
+void set_rx_addr_p0(
+  trx_address_t address
+);
+
 // Returns which interrupt was requested by the transceiver.
 trx_interrupt_request_t get_interrupt_request();
 
+// Moves payloads out of the transceiver's RX FIFO and into the ring buffer
+// until one of them runs out.
+void drain_rx_fifo();
+
+// Puts ack_payload in the transceiver's TX FIFO, for pipe 0.
+void write_ack_payload();
+
+// Sleeps until the transceiver pulls its IRQ pin low, with INT0 to wake us
+// up. Only for while we're not listening.
+void wait_for_irq(void);
+
+// Whether duty_cycle_update has something to do yet.
+uint8_t duty_cycle_due(void);
+
+// Reads OBSERVE_TX into link_stats, after some payloads are done.
+void observe_tx(
+  uint8_t payloads_done
+);
+
+// Sends one payload with the given W_TX_PAYLOAD instruction and waits for
+// the transceiver to say how it went.
+trx_transmission_outcome_t transmit_one(
+  trx_address_t                address,
+  spi_message_element_t        instruction,
+  trx_payload_element_t       *payload,
+  int                          payload_length
+);
+
+// Sends one payload with an acknowledgement, over and over until it's
+// acknowledged or wakeup_ms is up.
+trx_transmission_outcome_t transmit_waking(
+  trx_address_t                address,
+  trx_payload_element_t       *payload,
+  int                          payload_length
+);
+
+// Powers the transceiver down, keeping whatever it has received.
+void power_down(void);
+
+// Powers down at the end of a listen window, and lets trx_start_listening
+// power back up at the end of a sleep.
+void duty_cycle_update(void);
+
+// Puts off the next sleep, because something is going on.
+void duty_cycle_stay_awake(void);
+
 /////////////////// Public Function Bodies /////////////////////////////////////
 
 // Initializes the TRX, including initializing the SPI and any other peripherals
@@ -232,19 +463,35 @@ void trx_initialize(
   // Set the IRQ pin's pull-up.
   TRX_IRQ_PORT |= _BV(TRX_IRQ_INDEX);
 
+  // The IRQ pin triggers INT0, but only once we start listening.
+  TRX_IRQ_DISABLE();
+  EICRA = TRX_EICRA;
+
   spi_initialize();
 
-  write_register(TRX_REGISTER_ADDRESS_CONFIG,     TRX_CONFIG_RX       );
-  write_register(TRX_REGISTER_ADDRESS_EN_AA,      TRX_EN_AA           );
-  write_register(TRX_REGISTER_ADDRESS_EN_RXADDR,  TRX_EN_RXADDR       );
-  write_register(TRX_REGISTER_ADDRESS_SETUP_AW,   TRX_SETUP_AW        );
-  write_register(TRX_REGISTER_ADDRESS_SETUP_RETR, TRX_SETUP_RETR      );
-  write_register(TRX_REGISTER_ADDRESS_RF_CH,      TRX_RF_CH           );
-  write_register(TRX_REGISTER_ADDRESS_RF_SETUP,   TRX_RF_SETUP        );
-  write_register(TRX_REGISTER_ADDRESS_RX_PW_P0,   TRX_RX_PW_P0        );
-  write_register(TRX_REGISTER_ADDRESS_DYNPD,      TRX_DYNPD           );
-  write_register(TRX_REGISTER_ADDRESS_FEATURE,    TRX_FEATURE         );
-  
+  configure_registers();
+  registers_ready = 0;
+
+}
+
+uint8_t trx_ready(void) {
+
+  if (registers_ready) return 1;
+
+  // Until it's out of its power on reset, the transceiver ignores whatever
+  // we write, and reads back as all zeros or all ones. Write it all again
+  // and look next time.
+  if (!registers_match()) {
+    configure_registers();
+    return 0;
+  }
+
+  // CONFIG has had PWR_UP since it was written, so all that's left is the
+  // crystal.
+  _delay_us(TRX_POWER_UP_US);
+  registers_ready = 1;
+  return 1;
+
 }
 
 trx_transmission_outcome_t trx_transmit_payload(
@@ -252,21 +499,181 @@ trx_transmission_outcome_t trx_transmit_payload(
   trx_payload_element_t *payload,
   int payload_length
 ) {
+  PROFILE_BEGIN(PROFILE_TRX_TRANSMIT);
+  trx_transmission_outcome_t outcome = transmit_waking(address, payload, payload_length);
+  PROFILE_END(PROFILE_TRX_TRANSMIT);
+  if (outcome == TRX_TRANSMISSION_FAILURE) {
+    LOG_WARN(TRX, "[WARNING] Transceiver reached max retransmissions\r\n");
+  }
+  return outcome;
+}
 
-  flush_tx();
+// Nobody acknowledges it, so all TX_DS tells us is that it went out.
+trx_transmission_outcome_t trx_broadcast_payload(
+  trx_address_t address,
+  trx_payload_element_t *payload,
+  int payload_length
+) {
+  return transmit_one(address, TRX_WRITE_TX_PAYLOAD_NOACK_INSTRUCTION, payload, payload_length);
+}
 
-  // Configure the transceiver as a primary transmitter.
+uint8_t trx_add_rx_address(
+  trx_address_t address
+) {
+
+  // Find the first pipe that isn't listening yet.
+  uint8_t pipe = 1;
+  while (pipe < TRX_PIPE_COUNT && (rx_pipes_enabled & _BV(pipe)) != 0) pipe++;
+  if (pipe == TRX_PIPE_COUNT) return TRX_PIPE_NONE;
+
+  // Pipes 2 through 5 only get to pick their lowest byte.
+  if (pipe > 1 && (address & ~(trx_address_t) 0xFF) != (rx_pipe1_address & ~(trx_address_t) 0xFF)) {
+    return TRX_PIPE_NONE;
+  }
+
+  TRX_IRQ_DISABLE();
+
+  if (pipe == 1) {
+    write_address(TRX_REGISTER_ADDRESS_RX_ADDR_P1, address);
+    rx_pipe1_address = address;
+  }
+  else {
+    write_register(TRX_REGISTER_ADDRESS_RX_ADDR_P1 + pipe - 1, (spi_message_element_t) (address & 0xFF));
+  }
+  write_register(TRX_REGISTER_ADDRESS_RX_PW_P0 + pipe, TRX_RX_PW_P0);
+
+  rx_pipes_enabled |= _BV(pipe);
+  write_register(TRX_REGISTER_ADDRESS_EN_AA,     rx_pipes_enabled);
+  write_register(TRX_REGISTER_ADDRESS_EN_RXADDR, rx_pipes_enabled);
+
+  if (trx_listening) TRX_IRQ_ENABLE();
+
+  return pipe;
+}
+
+uint8_t trx_last_rx_pipe(void) {
+  return rx_last_pipe;
+}
+
+void trx_set_link_profile(
+  trx_link_profile_t profile
+) {
+
+  if (profile >= TRX_LINK_PROFILE_COUNT || profile == current_link_profile) return;
+
+  // CE has to be low while the data rate changes.
+  TRX_IRQ_DISABLE();
   TRX_CE_PORT &= ~_BV(TRX_CE_INDEX);
-  write_register(TRX_REGISTER_ADDRESS_CONFIG, TRX_CONFIG_TX);
 
-  // Set the TX address.
-  write_address(TRX_REGISTER_ADDRESS_TX_ADDR, address);
+  write_register(TRX_REGISTER_ADDRESS_RF_SETUP,   link_profiles[profile].rf_setup);
+  write_register(TRX_REGISTER_ADDRESS_SETUP_RETR, link_profiles[profile].setup_retr);
+  current_link_profile = profile;
+
+  if (trx_listening) {
+    TRX_CE_PORT |= _BV(TRX_CE_INDEX);
+    TRX_IRQ_ENABLE();
+  }
+
+}
+
+trx_link_profile_t trx_get_link_profile(void) {
+  return current_link_profile;
+}
+
+void trx_set_channel(
+  uint8_t channel
+) {
+
+  if (channel > TRX_CHANNEL_MAX) return;
+
+  TRX_IRQ_DISABLE();
+  TRX_CE_PORT &= ~_BV(TRX_CE_INDEX);
+
+  write_register(TRX_REGISTER_ADDRESS_RF_CH, channel);
+  current_channel = channel;
+
+  if (trx_listening) {
+    TRX_CE_PORT |= _BV(TRX_CE_INDEX);
+    TRX_IRQ_ENABLE();
+  }
+
+}
+
+uint8_t trx_get_channel(void) {
+  return current_channel;
+}
+
+uint8_t trx_channel_activity(
+  uint8_t channel,
+  uint8_t samples
+) {
+
+  uint8_t busy = 0;
+
+  // The settling time has to be right, or RPD is wrong.
+  cpu_clock_full_speed();
 
-  // Set the RX address of Pipe 0.
-  write_address(TRX_REGISTER_ADDRESS_RX_ADDR_P0,address);
+  TRX_IRQ_DISABLE();
+  TRX_CE_PORT &= ~_BV(TRX_CE_INDEX);
+
+  // Hang on to what already came in before we flush.
+  if (trx_listening) drain_rx_fifo();
+
+  set_config(TRX_CONFIG_RX);
+  write_register(TRX_REGISTER_ADDRESS_RF_CH, channel);
+
+  // RPD latches until CE goes low, so every sample needs a fresh start.
+  for (uint8_t i = 0; i < samples; i++) {
+    TRX_CE_PORT |= _BV(TRX_CE_INDEX);
+    _delay_us(TRX_RPD_SETTLE_US);
+    if ((read_register(TRX_REGISTER_ADDRESS_RPD) & _BV(RPD)) != 0) busy++;
+    TRX_CE_PORT &= ~_BV(TRX_CE_INDEX);
+  }
+
+  // Anything that happened to match our address on that channel isn't real.
+  flush_rx();
+  write_register(TRX_REGISTER_ADDRESS_STATUS, _BV(RX_DR));
+
+  write_register(TRX_REGISTER_ADDRESS_RF_CH, current_channel);
+
+  if (trx_listening) {
+    TRX_CE_PORT |= _BV(TRX_CE_INDEX);
+    TRX_IRQ_ENABLE();
+  }
+
+  return busy;
+}
+
+trx_link_stats_t trx_get_link_stats(void) {
+  return link_stats;
+}
+
+void trx_reset_link_stats(void) {
+  link_stats.transmissions = 0;
+  link_stats.retransmissions = 0;
+  link_stats.lost = 0;
+  link_stats.last_retransmissions = 0;
+}
+
+trx_transmission_outcome_t transmit_one(
+  trx_address_t                address,
+  spi_message_element_t        instruction,
+  trx_payload_element_t       *payload,
+  int                          payload_length
+) {
+
+  // Whatever we're sending, there's protocol work to do around it.
+  cpu_clock_full_speed();
+
+  // The IRQ means "sent" from here on, not "received".
+  TRX_IRQ_DISABLE();
+  trx_listening = 0;
+
+  configure_tx(address);
 
   // Send the data to the transceiver.
-  write_tx_payload(payload);
+  if (payload_length > TRX_PAYLOAD_LENGTH) payload_length = TRX_PAYLOAD_LENGTH;
+  write_tx_payload(instruction, payload, payload_length);
 
   // Set the CE pin high to begin the transmission.
   TRX_CE_PORT |= _BV(TRX_CE_INDEX);
@@ -274,9 +681,18 @@ trx_transmission_outcome_t trx_transmit_payload(
   TRX_CE_PORT &= ~_BV(TRX_CE_INDEX);
 
   // Wait until the transceiver raises the IRQ flag (active low).
-  TRX_WAIT_FOR_IRQ();
+  wait_for_irq();
+
+  // If the acknowledgement had a payload, it's in the RX FIFO. Queue it up
+  // like anything else we receive.
+  if ((read_register(TRX_REGISTER_ADDRESS_STATUS) & _BV(RX_DR)) != 0) {
+    drain_rx_fifo();
+  }
+
   trx_interrupt_request_t interrupt_request;
   interrupt_request = get_interrupt_request();
+  observe_tx(1);
+  duty_cycle_stay_awake();
 
   trx_transmission_outcome_t outcome;
   switch (interrupt_request)
@@ -286,73 +702,362 @@ trx_transmission_outcome_t trx_transmit_payload(
     break;
 
   case TRX_INTERRUPT_REQUEST_MAX_RETRANSMISSIONS:
-    uart_transmit_formatted_message("[WARNING] Transceiver reached max retransmissions\r\n");
-    UART_WAIT_UNTIL_DONE();
+    // The caller decides whether that's worth a warning.
     return TRX_TRANSMISSION_FAILURE;
   
   default:
-    uart_transmit_formatted_message("[WARNING] Unknown error in trx_transmit_payload()\r\n");
-    UART_WAIT_UNTIL_DONE();
+    LOG_WARN(TRX, "[WARNING] Unknown error in transmit_one()\r\n");
     return TRX_TRANSMISSION_FAILURE;
   }
 
 }
 
-// Receives a payload using polling.
+uint8_t trx_transmit_burst(
+  trx_address_t address,
+  trx_payload_element_t * const *payloads,
+  const uint8_t *payload_lengths,
+  uint8_t count,
+  trx_transmission_outcome_t *outcomes
+) {
+
+  // loaded is how many payloads have gone into the FIFO, done is how many
+  // have come back out with an outcome. The ones in between are in the FIFO,
+  // and there are never more than TRX_TX_BURST_DEPTH of them.
+  uint8_t loaded = 0;
+  uint8_t done = 0;
+  uint8_t sent = 0;
+
+  cpu_clock_full_speed();
+
+  // If the receiver might be asleep, wake it up with the first one. The rest
+  // follow while it's listening.
+  if (wakeup_ms > 0 && count > 0) {
+    outcomes[0] = transmit_waking(address, payloads[0], payload_lengths[0]);
+    if (outcomes[0] == TRX_TRANSMISSION_SUCCESS) sent++;
+    loaded = done = 1;
+  }
+
+  TRX_IRQ_DISABLE();
+  trx_listening = 0;
+
+  configure_tx(address);
+
+  while (done < count) {
+
+    // Top the FIFO back up.
+    while (loaded < count && (uint8_t) (loaded - done) < TRX_TX_BURST_DEPTH) {
+      uint8_t length = payload_lengths[loaded];
+      if (length > TRX_PAYLOAD_LENGTH) length = TRX_PAYLOAD_LENGTH;
+      write_tx_payload(TRX_WRITE_TX_PAYLOAD_INSTRUCTION, payloads[loaded], length);
+      loaded++;
+    }
+
+    // CE stays high, so the transceiver keeps going as long as there's
+    // something in the FIFO.
+    TRX_CE_PORT |= _BV(TRX_CE_INDEX);
+
+    wait_for_irq();
+    uint8_t done_before = done;
+    uint8_t waiting = loaded - done;
+    spi_message_element_t status_register = read_register(TRX_REGISTER_ADDRESS_STATUS);
+
+    // Stop before MAX_RT is cleared, or the transceiver starts on the one
+    // that failed all over again.
+    if ((status_register & _BV(MAX_RT)) != 0) TRX_CE_PORT &= ~_BV(TRX_CE_INDEX);
+
+    // Only the flags we saw, so one that comes up after the read isn't lost.
+    if ((status_register & _BV(RX_DR)) != 0) drain_rx_fifo();
+    write_register(TRX_REGISTER_ADDRESS_STATUS, status_register & IRQ_FLAGS);
+
+    // TX_DS is a flag, not a count, and FIFO_STATUS can only say empty or
+    // full. With no more than two waiting, that's enough to tell how many
+    // finished.
+    if ((status_register & _BV(MAX_RT)) != 0) {
+      // The one at the front of the FIFO gave up, and it's still there, so
+      // the transceiver stopped. If there's one ahead of it, TX_DS says
+      // whether it made it. There's no way to drop just the one that failed,
+      // so flush them all and load the rest again.
+      if (waiting > 1 && (status_register & _BV(TX_DS)) != 0) {
+        outcomes[done++] = TRX_TRANSMISSION_SUCCESS;
+        sent++;
+      }
+      outcomes[done++] = TRX_TRANSMISSION_FAILURE;
+      flush_tx();
+      loaded = done;
+    }
+    else if ((status_register & _BV(TX_DS)) != 0) {
+      if ((read_register(TRX_REGISTER_ADDRESS_FIFO_STATUS) & _BV(TX_EMPTY)) != 0) {
+        // Everything made it. One that finished after the flags were
+        // cleared has just been counted, so its TX_DS mustn't be counted
+        // again. Nothing else can go out until we load more.
+        while (done < loaded) {
+          outcomes[done++] = TRX_TRANSMISSION_SUCCESS;
+          sent++;
+        }
+        write_register(TRX_REGISTER_ADDRESS_STATUS, _BV(TX_DS));
+      }
+      else if (waiting > 1) {
+        // One left, so the first one made it.
+        outcomes[done++] = TRX_TRANSMISSION_SUCCESS;
+        sent++;
+      }
+      // Otherwise the only one waiting is still there, and the flag was from
+      // one we've already counted.
+    }
+
+    // ARC_CNT only covers the most recent payload, so payloads that finished
+    // together share one count.
+    observe_tx(done - done_before);
+
+  }
+
+  TRX_CE_PORT &= ~_BV(TRX_CE_INDEX);
+  duty_cycle_stay_awake();
+
+  if (sent < count) {
+    LOG_WARN(TRX, "[WARNING] Transceiver reached max retransmissions on %d of %d payloads\r\n", count - sent, count);
+  }
+
+  return sent;
+}
+
+// Receives a payload, waiting for one to arrive if none has been queued yet.
 trx_reception_outcome_t trx_receive_payload(
   trx_payload_element_t *payload_buffer,
   timer_delay_ms_t timeout_ms
 ) {
 
-  flush_rx();
+  // Maybe it's already here.
+  trx_start_listening();
+  if (trx_try_dequeue(payload_buffer) == TRX_RECEPTION_SUCCESS) {
+    // We didn't wait at all, so make timer_elapsed_ms say so.
+    timer_start(0);
+    timer_stop();
+    return TRX_RECEPTION_SUCCESS;
+  }
+
+  // Start Timer 1 if required.
+  if (timeout_ms < TRX_TIMEOUT_INDEFINITE) {
+    timer_start(timeout_ms);
+  }
+  // Not starting the timer means the timer flag will never go high.
+
+  // Wait either for the interrupt handler to queue something or to time out.
+  // Going around trx_start_listening keeps the duty cycle going, if there is
+  // one. In between, sleep until INT0, Timer 1, or Timer 0's tick says it's
+  // time for the duty cycle.
+  while(!TIMER_DONE && rx_ring_head == rx_ring_tail) {
+    trx_start_listening();
+    IDLE_UNTIL(TIMER_DONE || rx_ring_head != rx_ring_tail || duty_cycle_due());
+  }
+
+  // The transceiver stays in RX mode, so anything else that shows up gets
+  // queued for next time.
+
+  if (rx_ring_head == rx_ring_tail) {
+
+    timer_stop();
+
+    // The reception timed out.
+    return TRX_RECEPTION_TIMEOUT;
+
+  }
+
+  timer_stop();
+  return trx_try_dequeue(payload_buffer);
+}
+
+// Puts the transceiver in receive mode and arms the receive interrupt.
+// Anything already in the RX FIFO is kept.
+void trx_start_listening(void) {
+
+  duty_cycle_update();
+  if (duty_asleep || trx_listening) return;
 
   // Move back into receive mode.
-  write_register(TRX_REGISTER_ADDRESS_CONFIG, TRX_CONFIG_RX);
+  set_config(TRX_CONFIG_RX);
 
   // Restore the rx address
-  write_address(TRX_REGISTER_ADDRESS_RX_ADDR_P0, trx_this_rx_address);
+  set_rx_addr_p0(trx_this_rx_address);
+
+  // Going into TX mode threw out the ack payload, if there was one.
+  if (ack_payload_length > 0 && !ack_payload_sent) write_ack_payload();
 
   // Enable active RX mode.
   TRX_CE_PORT |= _BV(TRX_CE_INDEX);
 
-  // Start Timer 0 if required.
-  if (timeout_ms < TRX_TIMEOUT_INDEFINITE) {
-    timer_start(timeout_ms);
-  }
-  // Not starting the timer means the timer flag will never go high.
+  // If something came in while we weren't looking, the IRQ is already low
+  // and the handler runs right away.
+  trx_listening = 1;
+  TRX_IRQ_ENABLE();
+
+}
 
-  // Wait either for the transceiver to finish or to time out.
-  while(!TIMER_DONE && !TRX_IRQ);
-  // While loop exits either when the timer times out or an interrupt is requested.
+void trx_start_sniffing(void) {
 
-  // Set the CE pin low.
+  TRX_IRQ_DISABLE();
   TRX_CE_PORT &= ~_BV(TRX_CE_INDEX);
+  trx_listening = 0;
 
-  if (TIMER_DONE) {
+  write_register(TRX_REGISTER_ADDRESS_EN_AA,      0x00                );
+  write_register(TRX_REGISTER_ADDRESS_EN_RXADDR,  TRX_EN_RXADDR       );
+  rx_pipes_enabled = TRX_EN_RXADDR;
+  write_register(TRX_REGISTER_ADDRESS_SETUP_AW,   TRX_SNIFF_SETUP_AW  );
+  write_register(TRX_REGISTER_ADDRESS_RX_PW_P0,   TRX_PAYLOAD_LENGTH  );
+  write_register(TRX_REGISTER_ADDRESS_DYNPD,      0x00                );
+  write_register(TRX_REGISTER_ADDRESS_FEATURE,    0x00                );
+
+  // Nothing else uses the address registers while sniffing, and
+  // trx_initialize starts the shadows over.
+  write_address(TRX_REGISTER_ADDRESS_RX_ADDR_P0, TRX_SNIFF_ADDRESS);
+  shadow_addresses_valid = 0;
+  set_config(TRX_CONFIG_SNIFF);
 
-    timer_stop();
+  flush_rx();
+  write_register(TRX_REGISTER_ADDRESS_STATUS, IRQ_FLAGS);
 
-    // The reception timed out.
-    return TRX_RECEPTION_TIMEOUT;
+  TRX_CE_PORT |= _BV(TRX_CE_INDEX);
 
-  } else {
+}
 
-    timer_stop();
+trx_reception_outcome_t trx_sniff(
+  trx_payload_element_t *capture_buffer
+) {
 
-    // The reception succeeded.
-    trx_interrupt_request_t interrupt_request;
-    interrupt_request = get_interrupt_request();
-
-    if (interrupt_request == TRX_INTERRUPT_REQUEST_DATA_RECEIVED) {
-      read_rx_payload(payload_buffer);
-      return TRX_RECEPTION_SUCCESS;
-    } else {
-      // This should be an unreachable state.
-      uart_transmit_formatted_message("[WARNING] Unknown error in trx_receive_payload()\r\n");
-      UART_WAIT_UNTIL_DONE();
-      return TRX_RECEPTION_ERROR;
-    }
+  if (!TRX_IRQ) return TRX_RECEPTION_TIMEOUT;
+
+  uint8_t pipe = (read_register(TRX_REGISTER_ADDRESS_STATUS) >> RX_P_NO0) & RX_P_NO_MASK;
+  if (pipe != RX_P_NO_EMPTY) {
+    // Always the full 32 bytes, whatever TRX_DYNAMIC_PAYLOAD_LENGTH says.
+    spi_message_element_t instruction = TRX_READ_RX_PAYLOAD_INSTRUCTION;
+    const spi_section_t sections[] = {
+      { &instruction, &trx_status_buffer, 1                  },
+      { NULL,         capture_buffer,     TRX_PAYLOAD_LENGTH },
+    };
+    spi_transfer(sections, 2);
+  }
+
+  // Leave the IRQ low until the FIFO is empty, so the next call gets the
+  // rest.
+  if (pipe == RX_P_NO_EMPTY ||
+      ((read_register(TRX_REGISTER_ADDRESS_STATUS) >> RX_P_NO0) & RX_P_NO_MASK) == RX_P_NO_EMPTY) {
+    write_register(TRX_REGISTER_ADDRESS_STATUS, _BV(RX_DR));
   }
+
+  return pipe == RX_P_NO_EMPTY ? TRX_RECEPTION_TIMEOUT : TRX_RECEPTION_SUCCESS;
+}
+
+void trx_set_ack_payload(
+  const trx_payload_element_t *payload,
+  uint8_t length
+) {
+
+#if TRX_DYNAMIC_PAYLOAD_LENGTH
+  if (length > TRX_PAYLOAD_LENGTH) length = TRX_PAYLOAD_LENGTH;
+
+  TRX_IRQ_DISABLE();
+
+  // The last one might still be shifting out of ack_payload_message.
+  SPI_WAIT_UNTIL_DONE();
+
+  for (uint8_t i = 0; i < length; i++) ack_payload[i] = payload[i];
+  ack_payload_length = length;
+  ack_payload_sent = 0;
+
+  // Replace whatever is loaded now. Outside of RX mode, trx_start_listening
+  // takes care of it.
+  if (trx_listening) {
+    flush_tx();
+    write_ack_payload();
+  }
+
+  if (trx_listening) TRX_IRQ_ENABLE();
+#else
+  // Acknowledgement payloads need dynamic payload lengths.
+  (void) payload;
+  (void) length;
+#endif
+
+}
+
+void trx_clear_ack_payload(void) {
+
+  TRX_IRQ_DISABLE();
+
+  ack_payload_length = 0;
+  ack_payload_sent = 0;
+  if (ack_payload_loaded) {
+    flush_tx();
+    ack_payload_loaded = 0;
+  }
+
+  if (trx_listening) TRX_IRQ_ENABLE();
+
+}
+
+uint8_t trx_ack_payload_sent(void) {
+  return ack_payload_sent;
+}
+
+void trx_set_duty_cycle(
+  timer_delay_ms_t listen_ms,
+  timer_delay_ms_t sleep_ms
+) {
+
+  if (listen_ms < TRX_DUTY_CYCLE_MIN_LISTEN_MS) listen_ms = TRX_DUTY_CYCLE_MIN_LISTEN_MS;
+  if (sleep_ms > TRX_DUTY_CYCLE_MAX_SLEEP_MS) sleep_ms = TRX_DUTY_CYCLE_MAX_SLEEP_MS;
+
+  duty_listen_ms = listen_ms;
+  duty_sleep_ms = sleep_ms;
+
+  // Start out awake. trx_start_listening powers back up if we were asleep.
+  duty_asleep = 0;
+  duty_sleep_at = timer_now_ms() + listen_ms;
+
+}
+
+uint8_t trx_asleep(void) {
+  return duty_asleep;
+}
+
+void trx_set_wakeup(
+  timer_delay_ms_t ms
+) {
+  wakeup_ms = ms;
+}
+
+// Takes the oldest payload out of the ring buffer.
+trx_reception_outcome_t trx_try_dequeue(
+  trx_payload_element_t *payload_buffer
+) {
+
+  // If the ring filled up, the handler left the rest in the transceiver's
+  // FIFO. Go get them now that there might be room.
+  if (rx_ring_head == rx_ring_tail && trx_listening) {
+    TRX_IRQ_DISABLE();
+    drain_rx_fifo();
+    TRX_IRQ_ENABLE();
+  }
+
+  if (rx_ring_head == rx_ring_tail) {
+    return TRX_RECEPTION_TIMEOUT;
+  }
+
+  trx_payload_element_t *slot = rx_ring[rx_ring_tail & (TRX_RX_RING_LENGTH - 1)];
+  for (int i = 0; i < TRX_PAYLOAD_LENGTH; i++) {
+    payload_buffer[i] = slot[i];
+  }
+  rx_last_pipe = rx_ring_pipe[rx_ring_tail & (TRX_RX_RING_LENGTH - 1)];
+  rx_ring_tail++;
+
+  // There's probably more where that came from.
+  duty_cycle_stay_awake();
+
+  return TRX_RECEPTION_SUCCESS;
+}
+
+uint8_t trx_rx_pending(void) {
+  return rx_ring_head - rx_ring_tail;
 }
 
 // Gets the value currently in the status buffer. This is equivalent to what was
@@ -364,12 +1069,43 @@ trx_status_buffer_t trx_get_status() {
 
 /////////////////// Private function bodies ////////////////////////////////////
 
+void configure_registers(void) {
+
+  // Nothing in the shadow registers can be trusted until we've written them.
+  shadow_addresses_valid = 0;
+
+  write_register(TRX_REGISTER_ADDRESS_CONFIG,     TRX_CONFIG_RX       );
+  shadow_config = TRX_CONFIG_RX;
+  write_register(TRX_REGISTER_ADDRESS_EN_AA,      TRX_EN_AA           );
+  write_register(TRX_REGISTER_ADDRESS_EN_RXADDR,  TRX_EN_RXADDR       );
+  rx_pipes_enabled = TRX_EN_RXADDR;
+  write_register(TRX_REGISTER_ADDRESS_SETUP_AW,   TRX_SETUP_AW        );
+  write_register(TRX_REGISTER_ADDRESS_SETUP_RETR, link_profiles[current_link_profile].setup_retr);
+  write_register(TRX_REGISTER_ADDRESS_RF_CH,      current_channel     );
+  write_register(TRX_REGISTER_ADDRESS_RF_SETUP,   link_profiles[current_link_profile].rf_setup);
+  write_register(TRX_REGISTER_ADDRESS_RX_PW_P0,   TRX_RX_PW_P0        );
+  write_register(TRX_REGISTER_ADDRESS_DYNPD,      TRX_DYNPD           );
+  write_register(TRX_REGISTER_ADDRESS_FEATURE,    TRX_FEATURE         );
+  
+}
+
+uint8_t registers_match(void) {
+  return read_register(TRX_REGISTER_ADDRESS_CONFIG)   == shadow_config
+      && read_register(TRX_REGISTER_ADDRESS_SETUP_AW) == TRX_SETUP_AW
+      && read_register(TRX_REGISTER_ADDRESS_RF_CH)    == current_channel
+      && read_register(TRX_REGISTER_ADDRESS_RF_SETUP) == link_profiles[current_link_profile].rf_setup;
+}
+
 void write_register(
   spi_message_element_t address,
   spi_message_element_t value
 ) {
   spi_message_element_t instruction = TRX_WRITE_REGISTER_INSTRUCTION | (address & TRX_WRITE_REGISTER_ADDRESS_MASK);
-  spi_execute_transaction(NULL, 0, 2, &instruction, 1, &value, 1);
+  const spi_section_t sections[] = {
+    { &instruction, &trx_status_buffer, 1 },
+    { &value,       NULL,               1 },
+  };
+  spi_transfer(sections, 2);
 }
 
 spi_message_element_t read_register(
@@ -377,21 +1113,25 @@ spi_message_element_t read_register(
 ) {
   spi_message_element_t response;
   spi_message_element_t instruction = TRX_READ_REGISTER_INSTRUCTION | (address & TRX_READ_REGISTER_ADDRESS_MASK);
-  spi_execute_transaction(&response, 1, 2, &instruction, 1, NULL, 1);
+  const spi_section_t sections[] = {
+    { &instruction, &trx_status_buffer, 1 },
+    { NULL,         &response,          1 },
+  };
+  spi_transfer(sections, 2);
   return response;
 }
 
 void flush_rx() {
-  spi_message_element_t response;
   spi_message_element_t instruction = 0b11100010;
-  spi_execute_transaction(&response, 0, 1, &instruction, 1);
+  const spi_section_t section = { &instruction, &trx_status_buffer, 1 };
+  spi_transfer(&section, 1);
   return;
 }
 
 void flush_tx() {
-  spi_message_element_t response;
   spi_message_element_t instruction = 0b11100001;
-  spi_execute_transaction(&response, 0, 1, &instruction, 1);
+  const spi_section_t section = { &instruction, &trx_status_buffer, 1 };
+  spi_transfer(&section, 1);
   return;
 }
 
@@ -400,21 +1140,279 @@ void write_address(
   trx_address_t         address
 ) {
   spi_message_element_t instruction = TRX_WRITE_REGISTER_INSTRUCTION | (register_address & TRX_WRITE_REGISTER_ADDRESS_MASK);
-  spi_execute_transaction(NULL, 0, 2, &instruction, 1, &address, 4);
+  const spi_section_t sections[] = {
+    { &instruction,                            &trx_status_buffer, 1                     },
+    { (const spi_message_element_t*) &address, NULL,               sizeof(trx_address_t) },
+  };
+  spi_transfer(sections, 2);
 }
 
 void write_tx_payload(
-  const spi_message_element_t *payload
+  spi_message_element_t        instruction,
+  const spi_message_element_t *payload,
+  uint8_t                      length
 ) {
-  spi_message_element_t instruction = TRX_WRITE_TX_PAYLOAD_INSTRUCTION;
-  spi_execute_transaction(NULL, 0, 2, &instruction, 1, payload, TRX_PAYLOAD_LENGTH);
+#if TRX_DYNAMIC_PAYLOAD_LENGTH
+  const spi_section_t sections[] = {
+    { &instruction, &trx_status_buffer, 1      },
+    { payload,      NULL,               length },
+  };
+  spi_transfer(sections, 2);
+#else
+  // The NULL section clocks out zeros for the rest of the fixed length.
+  if (length > TRX_PAYLOAD_LENGTH) length = TRX_PAYLOAD_LENGTH;
+  const spi_section_t sections[] = {
+    { &instruction, &trx_status_buffer, 1                           },
+    { payload,      NULL,               length                      },
+    { NULL,         NULL,               TRX_PAYLOAD_LENGTH - length },
+  };
+  spi_transfer(sections, 3);
+#endif
 }
 
 void read_rx_payload(
   spi_message_element_t *buffer
 ) {
   spi_message_element_t instruction = TRX_READ_RX_PAYLOAD_INSTRUCTION;
-  spi_execute_transaction(buffer, 1, 2, &instruction, 1, NULL, TRX_PAYLOAD_LENGTH);
+#if TRX_DYNAMIC_PAYLOAD_LENGTH
+  spi_message_element_t width;
+  spi_message_element_t width_instruction = TRX_READ_RX_PAYLOAD_WIDTH_INSTRUCTION;
+  const spi_section_t width_sections[] = {
+    { &width_instruction, &trx_status_buffer, 1 },
+    { NULL,               &width,             1 },
+  };
+  spi_transfer(width_sections, 2);
+
+  // The datasheet says a width over 32 means the payload is garbage and the
+  // only way to get rid of it is to flush.
+  if (width > TRX_PAYLOAD_LENGTH) {
+    flush_rx();
+    width = 0;
+  } else {
+    const spi_section_t sections[] = {
+      { &instruction, &trx_status_buffer, 1     },
+      { NULL,         buffer,             width },
+    };
+    spi_transfer(sections, 2);
+  }
+
+  for (uint8_t i = width; i < TRX_PAYLOAD_LENGTH; i++) {
+    buffer[i] = TRX_PAYLOAD_PADDING;
+  }
+#else
+  const spi_section_t sections[] = {
+    { &instruction, &trx_status_buffer, 1                  },
+    { NULL,         buffer,             TRX_PAYLOAD_LENGTH },
+  };
+  spi_transfer(sections, 2);
+#endif
+}
+
+void drain_rx_fifo() {
+
+  while ((uint8_t) (rx_ring_head - rx_ring_tail) < TRX_RX_RING_LENGTH) {
+
+    // The status register says which pipe the next payload came in on, or
+    // that there isn't one.
+    uint8_t pipe = (read_register(TRX_REGISTER_ADDRESS_STATUS) >> RX_P_NO0) & RX_P_NO_MASK;
+    if (pipe == RX_P_NO_EMPTY) break;
+
+    read_rx_payload(rx_ring[rx_ring_head & (TRX_RX_RING_LENGTH - 1)]);
+    rx_ring_pipe[rx_ring_head & (TRX_RX_RING_LENGTH - 1)] = pipe;
+    rx_ring_head++;
+
+  }
+
+  // In RX mode, TX_DS means an acknowledgement just took our ack payload
+  // with it.
+  spi_message_element_t flags = _BV(RX_DR);
+  if (trx_listening && (read_register(TRX_REGISTER_ADDRESS_STATUS) & _BV(TX_DS)) != 0) {
+    flags |= _BV(TX_DS);
+    ack_payload_loaded = 0;
+    ack_payload_sent = 1;
+  }
+
+  // Clearing the flag lets the IRQ pin go high again. Anything we didn't have
+  // room for stays in the FIFO until trx_try_dequeue comes back for it.
+  write_register(TRX_REGISTER_ADDRESS_STATUS, flags);
+
+}
+
+void observe_tx(
+  uint8_t payloads_done
+) {
+
+  if (payloads_done == 0) return;
+
+  spi_message_element_t observe = read_register(TRX_REGISTER_ADDRESS_OBSERVE_TX);
+  uint8_t lost = observe >> PLOS_CNT_SHIFT;
+
+  link_stats.transmissions += payloads_done;
+  link_stats.last_retransmissions = observe & ARC_CNT_MASK;
+  link_stats.retransmissions += link_stats.last_retransmissions;
+
+  // PLOS_CNT stops at 15, so move it into link_stats and start it over.
+  // Writing RF_CH is the only way to clear it.
+  if (lost > 0) {
+    link_stats.lost += lost;
+    write_register(TRX_REGISTER_ADDRESS_RF_CH, current_channel);
+  }
+
+}
+
+void write_ack_payload() {
+
+  // Nothing needs to wait on this, so it shifts out in the background while
+  // we get on with listening. Whatever talks to the transceiver next waits
+  // for it to finish first.
+  ack_payload_message[0] = TRX_WRITE_ACK_PAYLOAD_INSTRUCTION | 0;
+  if (!spi_start_transaction(ack_payload_message, NULL, ack_payload_length + 1, NULL)) {
+    const spi_section_t section = { ack_payload_message, NULL, ack_payload_length + 1 };
+    spi_transfer(&section, 1);
+  }
+  ack_payload_loaded = 1;
+}
+
+void configure_tx(
+  trx_address_t address
+) {
+
+  flush_tx();
+  ack_payload_loaded = 0;
+
+  // Configure the transceiver as a primary transmitter.
+  TRX_CE_PORT &= ~_BV(TRX_CE_INDEX);
+  set_config(TRX_CONFIG_TX);
+
+  // Set the TX address.
+  set_tx_addr(address);
+
+  // Set the RX address of Pipe 0 so the acknowledgement comes back to us.
+  set_rx_addr_p0(address);
+
+}
+
+void set_config(
+  spi_message_element_t value
+) {
+  if (value == shadow_config) return;
+  write_register(TRX_REGISTER_ADDRESS_CONFIG, value);
+
+  // Coming out of power down, the oscillator has to start before anything
+  // else works.
+  if ((shadow_config & _BV(PWR_UP)) == 0 && (value & _BV(PWR_UP)) != 0) {
+    _delay_us(TRX_POWER_UP_US);
+  }
+
+  shadow_config = value;
+}
+
+trx_transmission_outcome_t transmit_waking(
+  trx_address_t                address,
+  trx_payload_element_t       *payload,
+  int                          payload_length
+) {
+
+  // Each try is ARC + 1 transmissions, ARD apart. Time spent on the air
+  // isn't counted, so this errs on the side of trying for too long.
+  spi_message_element_t setup_retr = link_profiles[current_link_profile].setup_retr;
+  uint16_t try_us = (((setup_retr >> ARD_SHIFT) + 1) * TRX_ARD_STEP_US) * ((setup_retr & ARC_MASK) + 1);
+  uint16_t tries = (uint16_t) (((uint32_t) wakeup_ms * 1000) / try_us) + 1;
+
+  trx_transmission_outcome_t outcome;
+  do {
+    outcome = transmit_one(address, TRX_WRITE_TX_PAYLOAD_INSTRUCTION, payload, payload_length);
+  } while (outcome == TRX_TRANSMISSION_FAILURE && --tries > 0);
+
+  return outcome;
+}
+
+void power_down(void) {
+
+  TRX_IRQ_DISABLE();
+
+  // Don't leave anything in the RX FIFO to be lost.
+  if (trx_listening) drain_rx_fifo();
+  trx_listening = 0;
+
+  TRX_CE_PORT &= ~_BV(TRX_CE_INDEX);
+
+  // trx_start_listening loads the ack payload again when we wake up.
+  if (ack_payload_loaded) {
+    flush_tx();
+    ack_payload_loaded = 0;
+  }
+
+  set_config(TRX_CONFIG_OFF);
+
+}
+
+void duty_cycle_update(void) {
+
+  if (duty_sleep_ms == 0) return;
+
+  timer_delay_ms_t now = timer_now_ms();
+
+  if (duty_asleep) {
+    if ((int16_t) (now - duty_wake_at) < 0) return;
+    duty_asleep = 0;
+    duty_sleep_at = now + duty_listen_ms;
+  }
+  else if ((int16_t) (now - duty_sleep_at) >= 0) {
+    power_down();
+    duty_asleep = 1;
+    duty_wake_at = now + duty_sleep_ms;
+  }
+
+}
+
+uint8_t duty_cycle_due(void) {
+
+  if (duty_sleep_ms == 0) return 0;
+
+  timer_delay_ms_t now = timer_now_ms();
+  return (int16_t) (now - (duty_asleep ? duty_wake_at : duty_sleep_at)) >= 0;
+
+}
+
+void wait_for_irq(void) {
+
+  // INT0 is level triggered, so its handler turns it off again (see below).
+  TRX_IRQ_ENABLE();
+  IDLE_UNTIL(TRX_IRQ);
+  TRX_IRQ_DISABLE();
+
+}
+
+void duty_cycle_stay_awake(void) {
+
+  if (duty_sleep_ms == 0) return;
+
+  // Whatever powered us up, we're awake now.
+  duty_asleep = 0;
+
+  timer_delay_ms_t linger_ms = TRX_DUTY_CYCLE_LINGER_MS;
+  if (duty_listen_ms > linger_ms) linger_ms = duty_listen_ms;
+  duty_sleep_at = timer_now_ms() + linger_ms;
+
+}
+
+void set_tx_addr(
+  trx_address_t address
+) {
+  if ((shadow_addresses_valid & SHADOW_TX_ADDR_VALID) != 0 && address == shadow_tx_addr) return;
+  write_address(TRX_REGISTER_ADDRESS_TX_ADDR, address);
+  shadow_tx_addr = address;
+  shadow_addresses_valid |= SHADOW_TX_ADDR_VALID;
+}
+
+void set_rx_addr_p0(
+  trx_address_t address
+) {
+  if ((shadow_addresses_valid & SHADOW_RX_ADDR_P0_VALID) != 0 && address == shadow_rx_addr_p0) return;
+  write_address(TRX_REGISTER_ADDRESS_RX_ADDR_P0, address);
+  shadow_rx_addr_p0 = address;
+  shadow_addresses_valid |= SHADOW_RX_ADDR_P0_VALID;
 }
 
 trx_interrupt_request_t get_interrupt_request() {
@@ -438,4 +1436,20 @@ trx_interrupt_request_t get_interrupt_request() {
 
   return 0;
 
-}
\ No newline at end of file
+}
+
+///////////// Interrupt Service Routines ///////////////////////////////////////
+
+// The transceiver received something. Get it out of the transceiver before
+// its FIFO overflows.
+ISR(TRX_IRQ_INT_vect) {
+
+  // wait_for_irq only needed waking up. The IRQ stays low until whoever was
+  // waiting clears it, so stop interrupting.
+  if (!trx_listening) {
+    TRX_IRQ_DISABLE();
+    return;
+  }
+
+  drain_rx_fifo();
+}
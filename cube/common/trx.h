@@ -19,11 +19,47 @@
 
 /////////////////// TRX Settings ///////////////////////////////////////////////
 
-// The length of payloads transmitted and received by this transceiver.
+// The longest payload transmitted and received by this transceiver.
 #define TRX_PAYLOAD_LENGTH (32)
 
+// If this is 1, payloads go over the air at their actual length, and the
+// receiver finds out how long each one is from the transceiver. If it's 0,
+// every payload is padded to TRX_PAYLOAD_LENGTH. Every node has to agree.
+#define TRX_DYNAMIC_PAYLOAD_LENGTH (1)
+
+// The transceiver listens on up to this many addresses at once, one per data
+// pipe. Pipe 0 is this node's own address; trx_add_rx_address hands out the
+// rest.
+#define TRX_PIPE_COUNT (6)
+#define TRX_PIPE_UNICAST (0)
+#define TRX_PIPE_NONE (0xFF)
+
+// How the link trades speed for range. Every node on a link has to be using
+// a profile with the same data rate, or they can't hear each other.
+typedef enum {
+    TRX_LINK_PROFILE_ROBUST,      // 250kbps, full power, 15 slow retries
+    TRX_LINK_PROFILE_BALANCED,    // 1Mbps, full power, 10 retries
+    TRX_LINK_PROFILE_FAST,        // 2Mbps, full power, 5 quick retries
+    TRX_LINK_PROFILE_LOW_POWER,   // 250kbps, -12dBm, 15 retries
+    TRX_LINK_PROFILE_COUNT
+} trx_link_profile_t;
+
+// The highest channel. Channel n is at 2400 + n MHz.
+#define TRX_CHANNEL_MAX (125)
+
+// The profile trx_initialize starts with.
+#define TRX_LINK_PROFILE_DEFAULT TRX_LINK_PROFILE_ROBUST
+
+// How many payloads the transceiver's TX FIFO holds.
+#define TRX_TX_FIFO_DEPTH (3)
+
+// How many of those trx_transmit_burst keeps in it. TX_DS doesn't say how
+// many payloads went out, and FIFO_STATUS only says empty or full, so with
+// any more it couldn't always tell which one hit MAX_RT.
+#define TRX_TX_BURST_DEPTH (2)
+
 // Payloads shorter than TRX_PAYLOAD_LENGTH are padded with this before being
-// transmitted.
+// transmitted, or after being received.
 #define TRX_PAYLOAD_PADDING (0x00)
 
 // The ports and pins used to drive the chip-enable pin of the transceiver.
@@ -40,18 +76,35 @@
 #define TRX_IRQ_INT       INT0
 #define TRX_IRQ_INT_vect  INT0_vect
 
+// How many received payloads the INT0 handler can hold on to until someone
+// asks for them. Must be a power of two. Each one costs TRX_PAYLOAD_LENGTH
+// bytes of SRAM.
+#define TRX_RX_RING_LENGTH (4)
+
 // Passing this to trx_receive_payload will cause the function to wait for a
 // reception indefinitely.
 #define TRX_TIMEOUT_INDEFINITE (15001)
 
+// Duty-cycled listening. Between listen windows the transceiver is powered
+// down, which draws under 1uA instead of about 12mA. Nobody sleeps longer
+// than TRX_DUTY_CYCLE_MAX_SLEEP_MS, so a sender that keeps retransmitting
+// for TRX_WAKEUP_MS always lands one in a listen window.
+#define TRX_DUTY_CYCLE_MIN_LISTEN_MS (10)
+#define TRX_DUTY_CYCLE_MAX_SLEEP_MS  (2000)
+#define TRX_WAKEUP_MS (TRX_DUTY_CYCLE_MAX_SLEEP_MS + TRX_DUTY_CYCLE_MIN_LISTEN_MS)
+
+// After hearing or sending something, a duty-cycled transceiver stays awake
+// at least this long for whatever comes next.
+#define TRX_DUTY_CYCLE_LINGER_MS (500)
+
+// How long the transceiver takes to come back from being powered down.
+#define TRX_POWER_UP_US (1500)
+
 /////////////////// TRX Macros /////////////////////////////////////////////////
 
 // Whether the transceiver has requested an interrupt
 #define TRX_IRQ ((TRX_IRQ_PIN & _BV(TRX_IRQ_INDEX)) == 0)
 
-// Waits until the TRX_IRQ pin goes low.
-#define TRX_WAIT_FOR_IRQ() while(!TRX_IRQ)
-
 /////////////////// TRX type definitions ///////////////////////////////////////
 
 // Addresses are 32 bits wide, or 4 bytes.
@@ -76,6 +129,15 @@ typedef enum {
     TRX_RECEPTION_TIMEOUT
 } trx_reception_outcome_t;
 
+// What the transceiver's OBSERVE_TX register has told us about our
+// transmissions. The counts wrap around.
+typedef struct {
+    uint16_t transmissions;         // payloads sent, or given up on
+    uint16_t retransmissions;       // automatic retransmissions, in total
+    uint16_t lost;                  // payloads that ran out of retransmissions
+    uint8_t  last_retransmissions;  // retransmissions the last payload took
+} trx_link_stats_t;
+
 /////////////////// Public function prototypes /////////////////////////////////
 
 // Initializes the TRX, including initializing the SPI and any other peripherals
@@ -84,6 +146,14 @@ void trx_initialize(
   trx_address_t rx_address
 );
 
+// Whether the transceiver is ready to use since trx_initialize: it's out of
+// its power on reset, its registers hold what trx_initialize wrote, and it has
+// had the 1.5 ms it needs to power up. If the registers didn't take, it writes
+// them again. Call it until it says yes; that's usually within 2 ms of power
+// coming up, or up to 100 ms if the supply is slow. Do it before setting up
+// anything else, like trx_add_rx_address.
+uint8_t trx_ready(void);
+
 // Transmits a payload to the given address.
 trx_transmission_outcome_t trx_transmit_payload(
   trx_address_t address,
@@ -91,12 +161,146 @@ trx_transmission_outcome_t trx_transmit_payload(
   int payload_length
 );
 
-// Receives a payload using polling.
+// Transmits a payload that nobody acknowledges, so any number of
+// transceivers can listen for it on a pipe from trx_add_rx_address.
+// Success only means it went out.
+trx_transmission_outcome_t trx_broadcast_payload(
+  trx_address_t address,
+  trx_payload_element_t *payload,
+  int payload_length
+);
+
+// Listens on another address, for broadcasts and groups, as well as our own.
+// Send to it with trx_broadcast_payload, or every listener will try to
+// acknowledge. Pipe 1 takes any address, but pipes 2
+// through 5 only differ from it in their lowest byte. Returns the pipe, or
+// TRX_PIPE_NONE if there's no pipe that can take this address.
+uint8_t trx_add_rx_address(
+  trx_address_t address
+);
+
+// The pipe the last payload from trx_try_dequeue or trx_receive_payload came
+// in on. TRX_PIPE_UNICAST means it was sent to us in particular.
+uint8_t trx_last_rx_pipe(void);
+
+// Switches to another link profile. The other end of the link has to switch
+// too.
+void trx_set_link_profile(
+  trx_link_profile_t profile
+);
+
+trx_link_profile_t trx_get_link_profile(void);
+
+// Moves to another frequency channel. Everyone we talk to has to be on it.
+void trx_set_channel(
+  uint8_t channel
+);
+
+uint8_t trx_get_channel(void);
+
+// Listens to a channel for a moment, samples times, and returns how many of
+// those times the received power detector saw something stronger than
+// -64dBm. Comes back to the current channel afterward, but anything that
+// arrives in the meantime is lost.
+uint8_t trx_channel_activity(
+  uint8_t channel,
+  uint8_t samples
+);
+
+// How our transmissions have gone since trx_reset_link_stats.
+trx_link_stats_t trx_get_link_stats(void);
+void trx_reset_link_stats(void);
+
+// Transmits up to count payloads to the same address back-to-back. Up to
+// TRX_TX_BURST_DEPTH of them sit in the transceiver at once, so the next one
+// starts the moment the last one is acknowledged. outcomes[i] says what
+// happened to payloads[i]. Returns how many were sent successfully.
+uint8_t trx_transmit_burst(
+  trx_address_t address,
+  trx_payload_element_t * const *payloads,
+  const uint8_t *payload_lengths,
+  uint8_t count,
+  trx_transmission_outcome_t *outcomes
+);
+
+// Receives a payload, waiting for one to arrive if none has been queued yet.
 trx_reception_outcome_t trx_receive_payload(
   trx_payload_element_t *payload_buffer,
   timer_delay_ms_t timeout_ms
 );
 
+// Puts the transceiver in receive mode and leaves it there. While it listens,
+// the INT0 handler moves every payload that arrives into a ring buffer, where
+// trx_try_dequeue and trx_receive_payload find it. Transmitting stops the
+// listening until this is called again. With a duty cycle, this is also what
+// keeps the schedule, so keep calling it.
+void trx_start_listening(void);
+
+// Listens for listen_ms, then powers the transceiver down for sleep_ms, over
+// and over, instead of listening all the time. A sleep_ms of 0 listens all
+// the time again. Anything sent to us has to come from someone using
+// trx_set_wakeup. The schedule runs off of timer_now_ms, so
+// timer_clock_initialize has to have been called.
+void trx_set_duty_cycle(
+  timer_delay_ms_t listen_ms,
+  timer_delay_ms_t sleep_ms
+);
+
+// Whether the duty cycle has the transceiver powered down right now.
+uint8_t trx_asleep(void);
+
+// Makes trx_transmit_payload and trx_transmit_burst keep retransmitting for
+// up to wakeup_ms before giving up, so a duty-cycled receiver wakes up in
+// time to hear it. Use TRX_WAKEUP_MS when anyone we send to might be asleep.
+// Broadcasts aren't acknowledged, so they only reach whoever is awake.
+void trx_set_wakeup(
+  timer_delay_ms_t wakeup_ms
+);
+
+// Loads a payload for the transceiver to send back with the acknowledgement
+// of the next payload it receives, so the sender gets it without either side
+// changing modes. It stays loaded through transmissions until it is sent or
+// replaced. On the other end, it's queued like any other received payload.
+// Needs TRX_DYNAMIC_PAYLOAD_LENGTH.
+void trx_set_ack_payload(
+  const trx_payload_element_t *payload,
+  uint8_t length
+);
+
+// Stops sending the ack payload, if it hasn't gone out yet.
+void trx_clear_ack_payload(void);
+
+// Whether the ack payload has gone out with an acknowledgement since
+// trx_set_ack_payload loaded it.
+uint8_t trx_ack_payload_sent(void);
+
+// Turns the transceiver into a listen-only sniffer for cube/sniffer. The
+// nRF24L01+ can only receive payloads sent to an address it's listening for,
+// so it's set up to listen for a 2-byte address (an undocumented width) that
+// is a 0x00 followed by the 0x55 preamble. Noise that happens to end in a
+// zero byte right before a real preamble lines it up, and then it takes
+// everything after, the sender's address, packet control field, payload and
+// CRC, as a 32-byte payload, without checking the CRC. Only addresses whose
+// first bit is 0 have a 0x55 preamble, which is all of ours. Nothing is
+// acknowledged, and the INT0 handler stays off; poll with trx_sniff.
+// trx_initialize puts everything back.
+void trx_start_sniffing(void);
+
+// Reads out the next raw 32-byte capture, without waiting. Returns
+// TRX_RECEPTION_TIMEOUT if there isn't one yet.
+trx_reception_outcome_t trx_sniff(
+  trx_payload_element_t *capture_buffer
+);
+
+// Takes the oldest queued payload, without waiting.
+// Returns TRX_RECEPTION_TIMEOUT if there's nothing yet.
+trx_reception_outcome_t trx_try_dequeue(
+  trx_payload_element_t *payload_buffer
+);
+
+// How many received payloads are waiting for trx_try_dequeue.
+uint8_t trx_rx_pending(void);
+
 // Gets the value currently in the status buffer. This is equivalent to what was
 // in the transceiver's status register at the beginning of the last SPI
 // transaction.
@@ -4,5 +4,6 @@
 #define MY_DATA_LINK_ADDR (0x3A3A3A3A)
 #define MY_NETWORK_ADDR (0x3A)
 #define MY_PORT (0x3A)
+#define MY_GROUP_ADDR (NETWORK_GROUP_ALL_CUBES)
 
 #endif
@@ -1,8 +0,0 @@
-#ifndef _ROUTING_TABLE_H
-#define _ROUTING_TABLE_H
-
-#include "networking_constants.h"
-
-byte routing_table(byte final_addr);
-
-#endif
@@ -0,0 +1,72 @@
+#ifndef _HIL_BRIDGE_H
+#define _HIL_BRIDGE_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// HIL Bridge
+//
+// A cube that puts simulated nodes on the air. build/hil_bridge
+// (cube/sim/hil_bridge.c) runs on the host, takes whatever the simulated
+// nodes send to an address that isn't another simulated node, and hands it
+// to this cube over the UART. The cube transmits it for real and says how it
+// went. Everything the cube receives goes back up to the host, which passes
+// each packet in it to the simulated node it's for.
+//
+// On the air, the cube is one node at HIL_BRIDGE_DATA_LINK_ADDR, and every
+// simulated node is behind it: real cubes need routes to the simulated
+// nodes' addresses with it as the next hop (topology.h, or route discovery).
+// It also listens for route discovery beacons.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+
+// Where the bridge is on the air.
+#define HIL_BRIDGE_NETWORK_ADDR     (0x7E)
+#define HIL_BRIDGE_DATA_LINK_ADDR   (0x7E7E7E7EUL)
+
+/*
+    Messages
+
+    Both ways, every message starts with HIL_SYNC_0, HIL_SYNC_1 and its type.
+    Anything between messages is text, and is skipped over.
+
+    HIL_TRANSMIT (host to cube)
+    [3..6]          = the address to send it to, low byte first
+    [7]             = HIL_FLAG_BROADCAST to send it without an
+                      acknowledgement, like trx_broadcast_payload
+    [8]             = payload length, up to 32
+    [9..]           = the payload
+
+    HIL_RESULT (cube to host), after every HIL_TRANSMIT
+    [3]             = HIL_RESULT_SENT or HIL_RESULT_FAILED
+    [4..7]          = how long the transmission took, in us, low byte first
+    [8]             = automatic retransmissions it took
+
+    HIL_RECEIVED (cube to host)
+    [3..34]         = the payload, padded to 32 bytes
+*/
+
+#define HIL_SYNC_0                  (0xA5)
+#define HIL_SYNC_1                  (0x5A)
+
+#define HIL_TRANSMIT                ('T')
+#define HIL_RESULT                  ('R')
+#define HIL_RECEIVED                ('F')
+
+#define HIL_HEADER_LEN              (3)
+#define HIL_TRANSMIT_HEADER_LEN     (HIL_HEADER_LEN + 6)
+#define HIL_RESULT_LEN              (HIL_HEADER_LEN + 6)
+#define HIL_RECEIVED_LEN            (HIL_HEADER_LEN + HIL_PAYLOAD_LEN)
+
+#define HIL_PAYLOAD_LEN             (32)
+
+#define HIL_FLAG_BROADCAST          (0x01)
+
+#define HIL_RESULT_SENT             (0)
+#define HIL_RESULT_FAILED           (1)
+
+// The cube runs at 8 MHz to keep the UART at this speed.
+#define HIL_BAUD                    (250000UL)
+
+#endif // _HIL_BRIDGE_H
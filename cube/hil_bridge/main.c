@@ -0,0 +1,114 @@
+/* * * * * * * * * * * * * * *
+      HIL Bridge Software
+ * * * * * * * * * * * * * * */
+
+#include "hil_bridge.h"
+#include "digital_io.h"
+#include "trx.h"
+#include "timer.h"
+#include "uart.h"
+#include "networking_constants.h"
+
+#include "cube_parameters.h"
+
+// A HIL_TRANSMIT on its way in from the host.
+static uint8_t request[HIL_TRANSMIT_HEADER_LEN + HIL_PAYLOAD_LEN];
+static uint8_t request_len = 0;
+
+// Takes whatever the host has sent. Returns 1 once there's a whole
+// HIL_TRANSMIT in request.
+static uint8_t take_request(void) {
+
+    uart_message_element_t c;
+
+    while (uart_try_receive(&c)) {
+
+        // Resynchronize on anything that isn't what comes next.
+        if ((request_len == 0 && c != HIL_SYNC_0)
+            || (request_len == 1 && c != HIL_SYNC_1)
+            || (request_len == 2 && c != HIL_TRANSMIT)) {
+            request_len = c == HIL_SYNC_0 ? 1 : 0;
+            continue;
+        }
+
+        request[request_len++] = c;
+
+        if (request_len == HIL_TRANSMIT_HEADER_LEN && request[HIL_TRANSMIT_HEADER_LEN - 1] > HIL_PAYLOAD_LEN) {
+            request_len = 0;
+            continue;
+        }
+
+        if (request_len >= HIL_TRANSMIT_HEADER_LEN
+            && request_len == HIL_TRANSMIT_HEADER_LEN + request[HIL_TRANSMIT_HEADER_LEN - 1]) {
+            request_len = 0;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Transmits the request, and tells the host how it went.
+static void transmit(void) {
+
+    trx_address_t address = 0;
+    for (uint8_t i = 0; i < 4; i++) {
+        address |= (trx_address_t) request[HIL_HEADER_LEN + i] << (8 * i);
+    }
+    uint8_t flags = request[HIL_HEADER_LEN + 4];
+    uint8_t length = request[HIL_HEADER_LEN + 5];
+    trx_payload_element_t *payload = &request[HIL_TRANSMIT_HEADER_LEN];
+
+    LED_set(LED_GREEN);
+    uint32_t started_us = timer_now_us();
+    trx_transmission_outcome_t outcome = (flags & HIL_FLAG_BROADCAST) != 0
+        ? trx_broadcast_payload(address, payload, length)
+        : trx_transmit_payload(address, payload, length);
+    uint32_t took_us = timer_now_us() - started_us;
+    trx_start_listening();
+    LED_set(LED_BLUE);
+
+    uint8_t result[HIL_RESULT_LEN];
+    result[0] = HIL_SYNC_0;
+    result[1] = HIL_SYNC_1;
+    result[2] = HIL_RESULT;
+    result[3] = outcome == TRX_TRANSMISSION_SUCCESS ? HIL_RESULT_SENT : HIL_RESULT_FAILED;
+    for (uint8_t i = 0; i < 4; i++) {
+        result[4 + i] = (uint8_t) (took_us >> (8 * i));
+    }
+    result[8] = trx_get_link_stats().last_retransmissions;
+    uart_transmit_bytes(result, HIL_RESULT_LEN);
+
+}
+
+int main() {
+
+    digital_io_initialize();
+    uart_initialize();
+    timer_clock_initialize();
+
+    LED_set(LED_OFF);
+    uart_transmit_formatted_message_P(PSTR("\r\n::: HIL Bridge %02x :::\r\n"), HIL_BRIDGE_NETWORK_ADDR);
+
+    trx_initialize(HIL_BRIDGE_DATA_LINK_ADDR);
+    trx_add_rx_address(0x01010101UL * NETWORK_ADDR_BEACON);
+    trx_start_listening();
+    LED_set(LED_BLUE);
+
+    uint8_t received[HIL_RECEIVED_LEN];
+    received[0] = HIL_SYNC_0;
+    received[1] = HIL_SYNC_1;
+    received[2] = HIL_RECEIVED;
+
+    while (1) {
+
+        if (take_request()) transmit();
+
+        while (trx_try_dequeue(&received[HIL_HEADER_LEN]) == TRX_RECEPTION_SUCCESS) {
+            uart_transmit_bytes(received, HIL_RECEIVED_LEN);
+        }
+
+        // Keeps timer_now_us counting past 65 seconds.
+        timer_now_us();
+
+    }
+}
@@ -7,103 +7,428 @@
 #include "log.h"
 #include "trx.h"
 #include "network.h"
+#include "channel.h"
+#include "command.h"
+#include "telemetry.h"
+#include "arena.h"
+#include "route_discovery.h"
+#include "address_resolution.h"
+#include "stats.h"
 
 #include <stdio.h>
 #include <string.h>
 
 #include "cube_parameters.h"
+#include "timer.h"
 #include <util/delay.h>
 
-// read message and adjust the LED accordingly
-void parse_message(char* message) {
+// If this is 1, the transceiver doesn't spin the color wheel. Instead it
+// relays whatever messages come in over the UART, from a host or the rover
+// board (rover/trx_link.h). Build with -DAPPLICATION_BRIDGE_MODE=0 for the
+// color wheel. Each one is framed like this:
+//
+// BRIDGE_SYNC, destination port, length (high byte first), the message,
+// then the sum of everything after BRIDGE_SYNC, modulo 256.
+//
+// Every frame gets a line back saying what happened to it. Only one message
+// is in flight at a time, so wait for that line before sending the one after
+// next, or the UART's receive buffer fills up.
+//
+// Between frames, BRIDGE_STATS prints the transceiver's own counts
+// (stats.h), and BRIDGE_STATS_RESET starts them over.
+#ifndef APPLICATION_BRIDGE_MODE
+#define APPLICATION_BRIDGE_MODE (1)
+#endif
+#define BRIDGE_SYNC (0x7E)
+#define BRIDGE_STATS ('?')
+#define BRIDGE_STATS_RESET ('!')
 
-    char search[12];
+// Commands for the same destination wait this long for company before they
+// go out together in one envelope (see command.h).
+#define APPLICATION_COMMAND_DEADLINE_MS (500)
 
-    snprintf(search, sizeof(search), "LED:OFF");
-    if (strstr(message, search) != NULL) {
-        LED_set(LED_OFF);
-        return;
+// The cubes the scheduler keeps a queue for.
+#define APPLICATION_DESTINATIONS (4)
+
+// After a failed send, a destination sits out this long before its queue is
+// tried again, doubling with each failure in a row up to the max. The max has
+// to stay under 32 s for the timer_now_ms comparisons.
+#define APPLICATION_BACKOFF_MIN_MS (1000)
+#define APPLICATION_BACKOFF_MAX_MS (16000)
+
+ARENA_REQUIRE(message, MAX_MESSAGE_LEN);
+ARENA_REQUIRE(incoming, MAX_MESSAGE_LEN);
+
+typedef enum {
+    BRIDGE_ST_Sync,
+    BRIDGE_ST_Port,
+    BRIDGE_ST_LengthHigh,
+    BRIDGE_ST_LengthLow,
+    BRIDGE_ST_Message,
+    BRIDGE_ST_Checksum
+} bridge_state_t;
+
+typedef struct {
+    bridge_state_t state;
+    byte port;
+    uint16_t length;
+    uint16_t received;
+    byte checksum;
+} bridge_parser_t;
+
+/*
+ * The send scheduler. Every destination has its own envelope of commands
+ * waiting to go out, so a cube that's out of range only holds up its own
+ * commands. Sends go out one at a time with transport_send_async, taking
+ * turns between the destinations that have something due. A destination
+ * whose last send failed is skipped until its backoff runs out, and the
+ * backoff doubles each time it fails again, so the reachable cubes get
+ * nearly all of the air time.
+ *
+ * Each destination also keeps its last eight results and a smoothed send
+ * time, which application_print_links shows.
+ */
+typedef struct {
+    byte port;                      // 0 if this entry isn't used yet
+    command_envelope_t envelope;    // commands waiting to go out
+    timer_delay_ms_t deadline;      // when the envelope has to go
+    timer_delay_ms_t ready_ms;      // backed off until then
+    uint16_t backoff_ms;            // 0 while the destination is reachable
+    byte history;                   // bit 0 is the last send, 1 if it worked
+    uint16_t srtt_ms;               // smoothed time a send takes, 0 if none yet
+} application_destination_t;
+
+static application_destination_t destinations[APPLICATION_DESTINATIONS];
+
+// The one send in flight. The envelope is copied out so that commands can
+// keep piling up for that destination in the meantime.
+static application_destination_t* sending = NULL;
+static command_envelope_t sending_envelope;
+static timer_delay_ms_t sending_since;
+
+// Where the next turn starts.
+static byte next_destination = 0;
+
+// call transport_tx and handle the error messages.
+void application_tx(byte* message, uint16_t message_len, byte dest_port) {
+    transport_tx_result result;
+    result = transport_tx(message, message_len, dest_port);
+    if (result == TRANSPORT_TX_REACHED_ATTEMPT_LIMIT) {
+        uart_transmit_formatted_message_P(PSTR("[WARNING] Transport layer reached attempt limit\r\n"));
+        UART_WAIT_UNTIL_DONE();
     }
+    if (result == TRANSPORT_TX_ERROR) {
+        uart_transmit_formatted_message_P(PSTR("[WARNING] Transport layer encountered an error\r\n"));
+        UART_WAIT_UNTIL_DONE();
+    }
+    return;
+}
 
-    snprintf(search, sizeof(search), "LED:BLUE");
-    if (strstr(message, search) != NULL) {
-        LED_set(LED_BLUE);
-        return;
+// call transport_tx_multicast and handle the error messages.
+void application_tx_multicast(byte* message, uint16_t message_len, byte group_port, byte* members, byte member_count) {
+    transport_tx_result result;
+    result = transport_tx_multicast(message, message_len, group_port, members, member_count);
+    if (result == TRANSPORT_TX_REACHED_ATTEMPT_LIMIT) {
+        uart_transmit_formatted_message_P(PSTR("[WARNING] Transport layer reached attempt limit on multicast\r\n"));
+        UART_WAIT_UNTIL_DONE();
+    }
+    if (result == TRANSPORT_TX_ERROR) {
+        uart_transmit_formatted_message_P(PSTR("[WARNING] Transport layer encountered an error on multicast\r\n"));
+        UART_WAIT_UNTIL_DONE();
     }
+    return;
+}
 
-    snprintf(search, sizeof(search), "LED:GREEN");
-    if (strstr(message, search) != NULL) {
-        LED_set(LED_GREEN);
-        return;
+// The scheduler's entry for port, made if it doesn't have one yet. NULL if
+// the table is full.
+static application_destination_t* application_destination(byte port) {
+    for (byte i = 0; i < APPLICATION_DESTINATIONS; i++) {
+        if (destinations[i].port == port) return &destinations[i];
     }
+    for (byte i = 0; i < APPLICATION_DESTINATIONS; i++) {
+        if (destinations[i].port == 0) {
+            memset(&destinations[i], 0, sizeof(destinations[i]));
+            destinations[i].port = port;
+            return &destinations[i];
+        }
+    }
+    return NULL;
+}
 
-    snprintf(search, sizeof(search), "LED:CYAN");
-    if (strstr(message, search) != NULL) {
-        LED_set(LED_CYAN);
-        return;
+// Put a command in dest_port's envelope. It goes out after
+// APPLICATION_COMMAND_DEADLINE_MS, or as soon as the envelope fills up, once
+// the destination's turn comes and it isn't backed off. Returns false if
+// there's no room for it.
+bool application_queue_command(byte dest_port, byte opcode, byte arg) {
+    application_destination_t* destination = application_destination(dest_port);
+    if (destination == NULL) return false;
+    if (destination->envelope.len == 0) {
+        destination->deadline = timer_now_ms() + APPLICATION_COMMAND_DEADLINE_MS;
+    }
+    if (!command_envelope_add(&destination->envelope, opcode, arg)) return false;
+    if (destination->envelope.len + 2 > COMMAND_ENVELOPE_LEN) {
+        destination->deadline = timer_now_ms();
     }
+    return true;
+}
 
-    snprintf(search, sizeof(search), "LED:RED");
-    if (strstr(message, search) != NULL) {
-        LED_set(LED_RED);
+// Fold the result of the send in flight into its destination's record.
+static void application_send_finished(bool delivered) {
+    application_destination_t* destination = sending;
+    sending = NULL;
+
+    destination->history = (destination->history << 1) | (delivered ? 1 : 0);
+
+    if (delivered) {
+        uint16_t rtt_ms = timer_now_ms() - sending_since;
+        if (destination->srtt_ms == 0) destination->srtt_ms = rtt_ms;
+        else destination->srtt_ms = destination->srtt_ms - (destination->srtt_ms >> 3) + (rtt_ms >> 3);
+        destination->backoff_ms = 0;
         return;
     }
 
-    snprintf(search, sizeof(search), "LED:MAGENTA");
-    if (strstr(message, search) != NULL) {
-        LED_set(LED_MAGENTA);
-        return;
+    if (destination->backoff_ms == 0) destination->backoff_ms = APPLICATION_BACKOFF_MIN_MS;
+    else if (destination->backoff_ms < APPLICATION_BACKOFF_MAX_MS) destination->backoff_ms <<= 1;
+    destination->ready_ms = timer_now_ms() + destination->backoff_ms;
+    uart_transmit_formatted_message_P(PSTR("[WARNING] %02x unreachable, backing off for %u ms\r\n"), destination->port, destination->backoff_ms);
+
+    // The failed commands go back in front of anything queued since, as far
+    // as there's room for them.
+    command_envelope_t newer = destination->envelope;
+    destination->envelope = sending_envelope;
+    for (byte i = 1; i + 1 < newer.len; i += 2) {
+        if (!command_envelope_add(&destination->envelope, newer.message[i], newer.message[i + 1])) break;
     }
+}
 
-    snprintf(search, sizeof(search), "LED:YELLOW");
-    if (strstr(message, search) != NULL) {
-        LED_set(LED_YELLOW);
-        return;
+// Run the scheduler: finish off the send in flight, then start the next one
+// that's due. Call this along with transport_poll.
+void application_poll_commands(void) {
+    if (sending != NULL) {
+        transport_async_status_t status = transport_send_status();
+        if (status == TRANSPORT_ASYNC_BUSY) return;
+        application_send_finished(status == TRANSPORT_ASYNC_DONE);
     }
 
-    snprintf(search, sizeof(search), "LED:WHITE");
-    if (strstr(message, search) != NULL) {
-        LED_set(LED_WHITE);
+    timer_delay_ms_t now = timer_now_ms();
+    for (byte turn = 0; turn < APPLICATION_DESTINATIONS; turn++) {
+        application_destination_t* destination = &destinations[next_destination];
+        next_destination = (next_destination + 1) % APPLICATION_DESTINATIONS;
+
+        if (destination->port == 0 || destination->envelope.len == 0) continue;
+        if ((int16_t) (now - destination->deadline) < 0) continue;
+        if (destination->backoff_ms != 0 && (int16_t) (now - destination->ready_ms) < 0) continue;
+
+        sending_envelope = destination->envelope;
+        command_envelope_clear(&destination->envelope);
+        if (!transport_send_async(sending_envelope.message, sending_envelope.len, destination->port)) {
+            // The engine is busy with something else. Try again next time.
+            destination->envelope = sending_envelope;
+            return;
+        }
+        sending = destination;
+        sending_since = now;
         return;
     }
+}
 
-    return;
+// One line per destination: how many of its last eight sends worked, how
+// long they take, and how long it's backed off for.
+void application_print_links(void) {
+    for (byte i = 0; i < APPLICATION_DESTINATIONS; i++) {
+        application_destination_t* destination = &destinations[i];
+        if (destination->port == 0) continue;
+        byte delivered = 0;
+        for (byte bit = 0; bit < 8; bit++) {
+            if (destination->history & (1 << bit)) delivered++;
+        }
+        uart_transmit_formatted_message_P(PSTR("[LINK] %02x: %d/8 delivered, %u ms per send, backoff %u ms\r\n"),
+            destination->port, delivered, destination->srtt_ms, destination->backoff_ms);
+        UART_WAIT_UNTIL_DONE();
+    }
 }
 
+// Find the quietest channel and bring everyone over to it.
+// If anyone didn't hear about it, call the whole thing off,
+// or they'd be stuck on the old channel by themselves.
+void application_agree_on_channel(byte* members, byte member_count) {
+    byte command[COMMAND_MAX_LEN];
+    byte old_channel = trx_get_channel();
+    byte best_channel;
 
-// call transport_tx and handle the error messages.
-void application_tx(byte* message, uint16_t message_len, byte dest_port) {
-    transport_tx_result result;
-    result = transport_tx(message, 79, dest_port);
-    if (result == TRANSPORT_TX_REACHED_ATTEMPT_LIMIT) {
-        uart_transmit_formatted_message("[WARNING] Transport layer reached attempt limit\r\n");
+    byte busy = channel_scan(&best_channel, 1);
+    uart_transmit_formatted_message_P(PSTR("Quietest channel is %d (busy %d/%d), we're on %d\r\n"), best_channel, busy, CHANNEL_SCAN_SAMPLES, old_channel);
+    UART_WAIT_UNTIL_DONE();
+    if (best_channel == old_channel) return;
+
+    byte command_len = command_build(command, COMMAND_CHANNEL, best_channel);
+    transport_tx_result result = transport_tx_multicast(command, command_len, NETWORK_GROUP_ALL_CUBES, members, member_count);
+    if (result != TRANSPORT_TX_SUCCESS) {
+        uart_transmit_formatted_message_P(PSTR("[WARNING] Not everyone heard about channel %d, staying on %d\r\n"), best_channel, old_channel);
         UART_WAIT_UNTIL_DONE();
+        command_len = command_build(command, COMMAND_CHANNEL, old_channel);
+        application_tx_multicast(command, command_len, NETWORK_GROUP_ALL_CUBES, members, member_count);
+        return;
     }
-    if (result == TRANSPORT_TX_ERROR) {
-        uart_transmit_formatted_message("[WARNING] Transport layer encountered an error\r\n");
-        UART_WAIT_UNTIL_DONE();
+
+    // Everyone else moves CHANNEL_SWITCH_DELAY_MS after they heard about it.
+    _delay_ms(CHANNEL_SWITCH_DELAY_MS);
+    channel_switch(best_channel);
+}
+
+// Feed the parser one character from the UART. Returns true once a whole
+// frame with a good checksum has been put in message.
+bool bridge_parse(bridge_parser_t* parser, byte c, byte* message) {
+
+    switch (parser->state) {
+
+    case BRIDGE_ST_Sync:
+        if (c == BRIDGE_SYNC) {
+            parser->checksum = 0;
+            parser->state = BRIDGE_ST_Port;
+        }
+        else if (c == BRIDGE_STATS) {
+            stats_print();
+        }
+        else if (c == BRIDGE_STATS_RESET) {
+            stats_reset();
+        }
+        return false;
+
+    case BRIDGE_ST_Port:
+        parser->port = c;
+        parser->checksum += c;
+        parser->state = BRIDGE_ST_LengthHigh;
+        return false;
+
+    case BRIDGE_ST_LengthHigh:
+        parser->length = (uint16_t) c << 8;
+        parser->checksum += c;
+        parser->state = BRIDGE_ST_LengthLow;
+        return false;
+
+    case BRIDGE_ST_LengthLow:
+        parser->length |= c;
+        parser->checksum += c;
+        parser->received = 0;
+        if (parser->length == 0 || parser->length > MAX_MESSAGE_LEN) {
+            uart_transmit_formatted_message_P(PSTR("[BRIDGE] Bad length %u\r\n"), parser->length);
+            parser->state = BRIDGE_ST_Sync;
+            return false;
+        }
+        parser->state = BRIDGE_ST_Message;
+        return false;
+
+    case BRIDGE_ST_Message:
+        message[parser->received++] = c;
+        parser->checksum += c;
+        if (parser->received == parser->length) parser->state = BRIDGE_ST_Checksum;
+        return false;
+
+    case BRIDGE_ST_Checksum:
+        parser->state = BRIDGE_ST_Sync;
+        if (c != parser->checksum) {
+            uart_transmit_formatted_message_P(PSTR("[BRIDGE] Bad checksum for port %02x\r\n"), parser->port);
+            return false;
+        }
+        return true;
+
+    default:
+        parser->state = BRIDGE_ST_Sync;
+        return false;
+    }
+}
+
+// Relay messages from the UART into the network until the power goes out.
+// The next frame comes in while the last one is still being sent out of
+// outgoing, which has to hold MAX_MESSAGE_LEN.
+void application_bridge(byte* outgoing, byte* members, byte member_count) {
+
+    byte* incoming = ARENA_BUFFER(incoming);
+    bridge_parser_t parser = { BRIDGE_ST_Sync };
+    bool frame_ready = false;
+    bool sending = false;
+    byte sending_port = 0;
+
+    uart_transmit_formatted_message_P(PSTR("::: Bridge mode. Send framed messages over the UART. :::\r\n"));
+
+    address_resolution_initialize();
+#if ROUTE_DISCOVERY
+    route_discovery_initialize();
+#endif
+
+    while (true) {
+
+        transport_poll();
+        address_resolution_poll();
+#if ROUTE_DISCOVERY
+        route_discovery_poll();
+#endif
+
+        if (sending) {
+            transport_async_status_t status = transport_send_status();
+            if (status == TRANSPORT_ASYNC_DONE || status == TRANSPORT_ASYNC_FAILED) {
+                uart_transmit_formatted_message_P(PSTR("[BRIDGE] %02x %s\r\n"), sending_port, status == TRANSPORT_ASYNC_DONE ? "OK" : "FAIL");
+                sending = false;
+            }
+        }
+
+        // Hand the finished frame over to the transport layer as soon as it's
+        // free. Until then, whatever comes in waits in the UART's buffer.
+        if (frame_ready && !sending) {
+            uint16_t length = parser.length;
+            memcpy(outgoing, incoming, length);
+            frame_ready = false;
+
+            if (parser.port == NETWORK_GROUP_ALL_CUBES) {
+                // There's no background multicast, so this one holds things up.
+                transport_tx_result result = transport_tx_multicast(outgoing, length, NETWORK_GROUP_ALL_CUBES, members, member_count);
+                uart_transmit_formatted_message_P(PSTR("[BRIDGE] %02x %s\r\n"), parser.port, result == TRANSPORT_TX_SUCCESS ? "OK" : "FAIL");
+            }
+            else if (transport_send_async(outgoing, length, parser.port)) {
+                sending = true;
+                sending_port = parser.port;
+            }
+            else {
+                uart_transmit_formatted_message_P(PSTR("[BRIDGE] %02x FAIL\r\n"), parser.port);
+            }
+        }
+
+        byte c;
+        while (!frame_ready && uart_try_receive(&c)) {
+            frame_ready = bridge_parse(&parser, c, incoming);
+        }
     }
-    return;
 }
 
+// What the transceiver says about each color on the wheel. They're in flash,
+// table and all, so they don't take up SRAM.
+static const char color_wheel_green[] PROGMEM = "Go touch some grass. LED:GREEN\r\n";
+static const char color_wheel_cyan[] PROGMEM = "This color reminds me of the ocean. LED:CYAN\r\n";
+static const char color_wheel_red[] PROGMEM = "Is it pronounced \"tomato\" or \"tomato\"? LED:RED\r\n";
+static const char color_wheel_magenta[] PROGMEM = "This color is pretty. LED:MAGENTA\r\n";
+static const char color_wheel_yellow[] PROGMEM = "This is yellow? Are you sure? LED:YELLOW\r\n";
+static const char color_wheel_white[] PROGMEM = "White chocolate is over-rated. Except when used in cookies. LED:WHITE\r\n";
+static const char color_wheel_blue[] PROGMEM = "Do you like blue? LED:BLUE\r\n";
+
+static PGM_P const color_wheel_str[7] PROGMEM = {
+    color_wheel_green,
+    color_wheel_cyan,
+    color_wheel_red,
+    color_wheel_magenta,
+    color_wheel_yellow,
+    color_wheel_white,
+    color_wheel_blue,
+};
+
 void application() {
 
     // To save on memory, the same buffer is used to store a received message
     // and to prepare a message to transmit.
-    char message[MAX_MESSAGE_LEN];
+    char* message = (char*) ARENA_BUFFER(message);
     uint16_t message_len;
     byte who_sent_me_this;
 
-    char *color_wheel_str[7] = {
-        "Go touch some grass. LED:GREEN\r\n",
-        "This color reminds me of the ocean. LED:CYAN\r\n",
-        "Is it pronounced \"tomato\" or \"tomato\"? LED:RED\r\n",
-        "This color is pretty. LED:MAGENTA\r\n",
-        "This is yellow? Are you sure? LED:YELLOW\r\n",
-        "White chocolate is over-rated. Except when used in cookies. LED:WHITE\r\n",
-        "Do you like blue? LED:BLUE\r\n",
-    };
-
     char color_wheel_raw[7] = {
         LED_GREEN,
         LED_CYAN,
@@ -120,18 +445,28 @@ void application() {
         0x3c
     };
 
-    uart_transmit_formatted_message("::: Rover's transceiver activated. Entering network mode. :::\r\n");
+    uart_transmit_formatted_message_P(PSTR("::: Rover's transceiver activated. Entering network mode. :::\r\n"));
     UART_WAIT_UNTIL_DONE();
 
     LED_set(LED_BLUE);
 
-    _delay_ms(1000);
+    // The async transport engine and the command deadlines run off of this.
+    timer_clock_initialize();
+
+    application_agree_on_channel(everyone, 3);
+
+#if APPLICATION_BRIDGE_MODE
+    application_bridge((byte*) message, everyone, 3);
+#endif
+
+    // The cubes' telemetry reports come in here between colors.
+    transport_receive_async((byte*) message, MAX_MESSAGE_LEN);
 
     while(true) {
 
         // Step right up and spin the wheel!
         for (int i = 0; i < 7; i++) {
-            char* this_color_str = color_wheel_str[i];
+            PGM_P this_color_str = (PGM_P) pgm_read_word(&color_wheel_str[i]);
             char this_color_raw = color_wheel_raw[i];
 
             // Show off the color we chose.
@@ -142,11 +477,23 @@ void application() {
             _delay_ms(1000);
 
             // Alright, now everybody has to wear it.
-            for (int j = 0; j < 3; j++) {
-                snprintf(message, MAX_MESSAGE_LEN, this_color_str);
-                application_tx(message, strlen(message), everyone[j]);
-                _delay_ms(5000);
+            uart_transmit_formatted_message_P(PSTR("%S"), this_color_str);
+            UART_WAIT_UNTIL_DONE();
+            for (byte j = 0; j < 3; j++) {
+                application_queue_command(everyone[j], COMMAND_LED, this_color_raw);
+            }
+            timer_delay_ms_t next_color = timer_now_ms() + 5000;
+            while ((int16_t) (timer_now_ms() - next_color) < 0) {
+                transport_poll();
+                application_poll_commands();
+                if (transport_receive_status(&message_len, &who_sent_me_this) == TRANSPORT_ASYNC_DONE) {
+                    telemetry_print((byte*) message, message_len);
+                    transport_receive_async((byte*) message, MAX_MESSAGE_LEN);
+                }
             }
         }
+
+        // How everyone's links held up over that turn of the wheel.
+        application_print_links();
     }
 }
@@ -0,0 +1,13 @@
+#ifndef _ARENA_SLOTS_H
+#define _ARENA_SLOTS_H
+
+// The transceiver's buffers. See arena.h. Bridge mode needs a second
+// message buffer on top of the cubes', so this gets a bigger budget.
+#define ARENA_SRAM_BUDGET (1024)
+
+#define ARENA_SLOTS(ARENA_SLOT) \
+    ARENA_SLOT(message, MAX_MESSAGE_LEN)    /* received into, or sent from in bridge mode */ \
+    ARENA_SLOT(incoming, MAX_MESSAGE_LEN)   /* bridge mode: the next frame from the UART */ \
+    ARENA_SLOT(transport_rx, 2 * MAX_MESSAGE_LEN) /* transport.c: each rx context's message */
+
+#endif
@@ -7,10 +7,11 @@
 #include "trx.h"
 #include "application.h"
 #include "log.h"
+#include "channel.h"
 #include "uart.h"
+#include "arena.h"
 
 #include "cube_parameters.h"
-#include <util/delay.h>
 
 int main() {
 
@@ -20,16 +21,23 @@ int main() {
     uart_initialize();
 
     LED_set(LED_OFF);
-    uart_transmit_formatted_message("\r\n::: Wombat %02x :::\r\n", MY_NETWORK_ADDR);
+    uart_transmit_formatted_message_P(PSTR("\r\n::: Wombat %02x :::\r\n"), MY_NETWORK_ADDR);
+    arena_report();
     //print_log();
 
     // Wait until the rover instructs the cube to start transmitting.
     while(SW_read(SW1));
 
     LED_set(LED_WHITE);
-    _delay_ms(2000);
 
+    // Ready as soon as the transceiver says so, rather than after a guess.
     trx_initialize(MY_DATA_LINK_ADDR);
+    while (!trx_ready());
+
+    // The rover's transceiver is always listening, but the cubes sleep most
+    // of the time, so keep trying until they wake up.
+    trx_set_wakeup(TRX_WAKEUP_MS);
+    channel_load();
 
     application();
 
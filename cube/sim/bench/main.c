@@ -0,0 +1,482 @@
+/*
+        WARNING
+
+        This is a SIMULATION FILE.
+        Do not compile this code for hardware.
+*/
+
+// Transport benchmarks. Each workload below builds a little network on the
+// multi-node simulator (cube/sim/multi), has some senders push messages
+// through it to a sink, and reports how it went as one CSV line:
+//
+// goodput_bps        message bytes delivered (once each) per second, from
+//                    the first send to the last delivery
+// latency_p*_ms      from the start of transport_tx to the sink having the
+//                    whole message, for the messages that made it
+// segments           segments the senders put on the air, not counting
+//                    transport retransmissions
+// retx_per_segment   transport retransmissions (the same segment again,
+//                    after no ack) per segment
+// link_retx          the same packet sent again by data link on a failure
+// frames             every frame any node put on the air, acks included
+// poll_max_ms        the longest any transport_poll call took, for the
+//                    workloads on the polling engine
+// acked_lost         messages transport_tx said were sent that the sink
+//                    never got. Anything but 0 is a bug, and makes
+//                    build/sim_bench exit with 1
+//
+// Everything runs on the virtual clock, so the numbers are the protocol's
+// and not the host's, and every node's losses come from BENCH_SEED, so two
+// runs of the same code see the same air and can be compared before and
+// after a change. Set SIM_SEED to try other air, and SIM_RADIO_LINKS to a
+// links file with traces (sim_trx.c) to run the workloads on a recorded
+// field link instead of the workload's loss. The results go to stdout and
+// everything the nodes print goes to stderr, so
+//
+//   build/sim_bench > before.csv
+//
+// gives a clean file. build/sim_bench <name> runs just the workloads whose
+// names start with name.
+//
+// The network: the sink, a chain of hops - 1 relays, and the senders, who
+// all hang off the end of the chain, hops away from the sink.
+//
+// A sender that reboots is two threads, since everything a node remembers
+// is thread-local (node_state.h). The second one is on the clock from the
+// start, and picks up where the first one left off once it's gone.
+
+#include "sim_trx.h"
+#include "sim_delay.h"
+#include "transport.h"
+#include "routing_table.h"
+#include "address_resolution.h"
+#include "address.h"
+#include "networking_constants.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_MAX_NODES (32)
+#define BENCH_MAX_MESSAGES (512)
+
+// How long idle nodes wait around at a time.
+#define BENCH_LISTEN_MS (100)
+
+// Where every node's random numbers start, unless SIM_SEED says otherwise.
+#define BENCH_SEED (1)
+
+// A workload gives up after this much simulated time.
+#define BENCH_TIME_LIMIT_MS (600000LL)
+
+// The first bytes of every message: who sent it, which one it is, and when
+// transport_tx started on it.
+#define BENCH_HEADER_LEN (7)
+
+typedef struct {
+    const char* name;
+    uint8_t hops;
+    uint8_t senders;
+    uint16_t message_len;
+    uint16_t messages;          // per sender
+    uint8_t loss_percent;
+    uint8_t async;              // everyone uses the polling engine
+    uint16_t restart_after;     // senders reboot after this many messages, if not 0
+} bench_workload_t;
+
+static const bench_workload_t workloads[] = {
+    // name                   hops senders len  count loss  async  restart
+    { "small_1hop",             1,   1,    16,   50,   0,   0,     0 },
+    { "small_1hop_loss10",      1,   1,    16,   50,  10,   0,     0 },
+    { "small_1hop_loss30",      1,   1,    16,   50,  30,   0,     0 },
+    { "large_1hop",             1,   1,   250,   20,   0,   0,     0 },
+    { "large_1hop_loss10",      1,   1,   250,   20,  10,   0,     0 },
+    { "large_3hop",             3,   1,   250,   20,   0,   0,     0 },
+    { "large_3hop_loss10",      3,   1,   250,   20,  10,   0,     0 },
+    { "small_6hop_loss10",      6,   1,    16,   30,  10,   0,     0 },
+    // More senders than the sink has TRANSPORT_RX_CONTEXT_COUNT contexts for.
+    { "senders4_1hop",          1,   4,   100,   20,   0,   0,     0 },
+    { "senders4_1hop_loss10",   1,   4,   100,   20,  10,   0,     0 },
+    { "senders4_3hop_loss10",   3,   4,   100,   20,  10,   0,     0 },
+    { "senders8_1hop_loss10",   1,   8,    50,   20,  10,   0,     0 },
+    // Stop-and-wait senders, through the polling engine, that take any ack
+    // as delivery.
+    { "senders4_1hop_async",    1,   4,   100,   20,   0,   1,     0 },
+    // The sender reboots after its first message, and starts counting its
+    // COMPACT sequence numbers over.
+    { "small_1hop_restart",     1,   1,    16,   10,   0,   0,     1 },
+};
+
+#define BENCH_WORKLOAD_COUNT (sizeof(workloads) / sizeof(workloads[0]))
+
+_Thread_local sim_node_t sim_node;
+
+// The workload that's running, and what's been seen so far. Everything
+// below is shared by the nodes, under results_mutex.
+static const bench_workload_t* workload;
+static int node_count;
+
+static pthread_mutex_t results_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int senders_done;
+static volatile int stop;
+
+static int delivered;
+static int duplicates;
+static uint32_t delivered_bytes;
+static int64_t first_send_ms;
+static int64_t last_delivery_ms;
+static uint32_t latencies_ms[BENCH_MAX_MESSAGES];
+static uint8_t seen[BENCH_MAX_NODES][BENCH_MAX_MESSAGES / 8];
+static uint8_t reported_sent[BENCH_MAX_NODES][BENCH_MAX_MESSAGES / 8];
+static int acked_lost_total;
+
+static uint32_t segments;
+static uint32_t transport_retx;
+static uint32_t link_retx;
+static uint32_t frames;
+static uint32_t collisions;
+static uint32_t poll_max_ms;
+
+// Set once a rebooting sender's first thread is gone.
+static volatile int rebooted[BENCH_MAX_NODES];
+
+// The last segment and packet each node sent, to spot it being sent again.
+typedef struct {
+    uint8_t valid;
+    uint8_t dest_port;
+    uint8_t segid;
+    uint8_t seq;
+    uint8_t packet_id;
+} bench_last_t;
+static bench_last_t last_sent[BENCH_MAX_NODES];
+
+static int64_t now_ms(void) {
+    return sim_now_us() / 1000;
+}
+
+// Node 0 is the sink, 1 to hops - 1 are the relays, and the rest are senders.
+static byte node_address(int index) {
+    return index + 1;
+}
+
+static int node_index(byte addr) {
+    return addr - 1;
+}
+
+static int is_sender(int index) {
+    return index >= workload->hops;
+}
+
+static void set_routes(int index) {
+    int hops = workload->hops;
+    for (int to = 0; to < node_count; to++) {
+        int next;
+        if (to == index) next = to;
+        else if (index < hops && (to < index || !is_sender(to))) next = to < index ? index - 1 : index + 1;
+        else if (index < hops) next = index == hops - 1 ? to : index + 1;     // toward the senders
+        else next = hops - 1;                                                   // senders go through the last relay
+        routing_table_set(node_address(to), node_address(next));
+    }
+}
+
+static int is_data_segment(byte segid) {
+    return segid == SEGID_START_OF_MESSAGE || segid == SEGID_DATA
+        || segid == SEGID_END_OF_MESSAGE || segid == SEGID_COMPACT;
+}
+
+// Sorts out everything that goes on the air. Runs on the sending node.
+static void tap(trx_address_t from, trx_address_t to, const trx_payload_element_t* frame, trx_transmission_outcome_t outcome) {
+
+    int index = node_index(from & 0xFF);
+    if (index < 0 || index >= node_count) return;
+
+    pthread_mutex_lock(&results_mutex);
+    frames++;
+
+    // There might be a few packets in the frame.
+    for (byte offset = 0; offset + PACKET_HEADER_LEN <= MAX_FRAME_LEN; offset += frame[offset]) {
+        const byte* packet = &frame[offset];
+        if (packet[0] < PACKET_HEADER_LEN || offset + packet[0] > MAX_FRAME_LEN) break;
+
+        // Only the packets this node started count, not the ones it's relaying.
+        if (packet[2] != (from & 0xFF) || packet[0] < PACKET_HEADER_LEN + 5) continue;
+
+        const byte* segment = &packet[PACKET_HEADER_LEN];
+        if (!is_data_segment(segment[4])) continue;
+
+        bench_last_t* last = &last_sent[index];
+        int same_segment = last->valid && last->dest_port == segment[2]
+            && last->segid == segment[4] && last->seq == segment[1];
+        if (same_segment && last->packet_id == packet[3]) link_retx++;
+        else if (same_segment) transport_retx++;
+        else segments++;
+
+        last->valid = 1;
+        last->dest_port = segment[2];
+        last->segid = segment[4];
+        last->seq = segment[1];
+        last->packet_id = packet[3];
+    }
+    pthread_mutex_unlock(&results_mutex);
+}
+
+// transport_poll, keeping track of how long it takes.
+static void poll_once(void) {
+    int64_t started = now_ms();
+    transport_poll();
+    address_resolution_poll();
+    uint32_t took = now_ms() - started;
+    _delay_ms(1);
+
+    pthread_mutex_lock(&results_mutex);
+    if (took > poll_max_ms) poll_max_ms = took;
+    pthread_mutex_unlock(&results_mutex);
+}
+
+// Like transport_rx, on the polling engine.
+static transport_rx_result poll_rx(byte* message, uint16_t* message_len, byte* source_port, uint16_t timeout_ms) {
+    if (transport_receive_status(NULL, NULL) != TRANSPORT_ASYNC_BUSY) transport_receive_async(message, MAX_MESSAGE_LEN);
+    int64_t until = now_ms() + timeout_ms;
+    while (now_ms() < until) {
+        poll_once();
+        if (transport_receive_status(message_len, source_port) == TRANSPORT_ASYNC_DONE) {
+            transport_receive_async(message, MAX_MESSAGE_LEN);
+            return TRANSPORT_RX_SUCCESS;
+        }
+    }
+    return TRANSPORT_RX_TIMEOUT;
+}
+
+static void listen_until_stopped(void) {
+    byte message[MAX_MESSAGE_LEN];
+    uint16_t message_len;
+    byte source_port;
+    while (!stop) {
+        address_resolution_poll();
+        if (workload->async) poll_rx(message, &message_len, &source_port, BENCH_LISTEN_MS);
+        else transport_rx(message, sizeof(message), &message_len, &source_port, BENCH_LISTEN_MS);
+    }
+}
+
+static void sink(void) {
+
+    byte message[MAX_MESSAGE_LEN];
+    uint16_t message_len;
+    byte source_port;
+    int senders = workload->senders;
+
+    while (1) {
+        address_resolution_poll();
+        transport_rx_result result = workload->async
+            ? poll_rx(message, &message_len, &source_port, BENCH_LISTEN_MS)
+            : transport_rx(message, sizeof(message), &message_len, &source_port, BENCH_LISTEN_MS);
+
+        pthread_mutex_lock(&results_mutex);
+        if (result == TRANSPORT_RX_SUCCESS && message_len >= BENCH_HEADER_LEN) {
+            int sender = message[0] - workload->hops;
+            uint16_t number = message[1] | (message[2] << 8);
+            uint32_t sent_ms = message[3] | (message[4] << 8) | ((uint32_t) message[5] << 16) | ((uint32_t) message[6] << 24);
+            if (sender >= 0 && sender < senders && number < workload->messages) {
+                uint8_t* bits = &seen[sender][number / 8];
+                if (*bits & (1 << (number % 8))) {
+                    duplicates++;
+                }
+                else {
+                    *bits |= 1 << (number % 8);
+                    if (delivered < BENCH_MAX_MESSAGES) latencies_ms[delivered] = now_ms() - sent_ms;
+                    delivered++;
+                    delivered_bytes += message_len;
+                    last_delivery_ms = now_ms();
+                }
+            }
+        }
+        int done = senders_done == senders;
+        pthread_mutex_unlock(&results_mutex);
+
+        if (done || now_ms() > BENCH_TIME_LIMIT_MS) break;
+    }
+    stop = 1;
+}
+
+// Sends messages first to last - 1.
+static void sender(int index, uint16_t first, uint16_t last) {
+
+    byte message[MAX_MESSAGE_LEN];
+
+    // Spread out the start a little.
+    if (first == 0) _delay_ms(13 * (index - workload->hops));
+
+    for (uint16_t i = first; i < last && !stop; i++) {
+        int64_t start = now_ms();
+
+        pthread_mutex_lock(&results_mutex);
+        if (first_send_ms < 0 || start < first_send_ms) first_send_ms = start;
+        pthread_mutex_unlock(&results_mutex);
+
+        message[0] = index;
+        message[1] = i & 0xFF;
+        message[2] = i >> 8;
+        for (int b = 0; b < 4; b++) message[3 + b] = (byte) ((uint32_t) start >> (8 * b));
+        // Something that doesn't compress to nothing.
+        for (int b = BENCH_HEADER_LEN; b < workload->message_len; b++) message[b] = 'A' + (b * 7 + i) % 26;
+
+        address_resolution_poll();
+
+        int sent;
+        if (workload->async) {
+            transport_send_async(message, workload->message_len, node_address(0));
+            while (transport_send_status() == TRANSPORT_ASYNC_BUSY && !stop) poll_once();
+            sent = transport_send_status() == TRANSPORT_ASYNC_DONE;
+        }
+        else {
+            sent = transport_tx(message, workload->message_len, node_address(0)) == TRANSPORT_TX_SUCCESS;
+        }
+        if (sent) {
+            pthread_mutex_lock(&results_mutex);
+            reported_sent[index - workload->hops][i / 8] |= 1 << (i % 8);
+            pthread_mutex_unlock(&results_mutex);
+        }
+    }
+}
+
+static void* node(void* arg) {
+
+    int index = (int) (intptr_t) arg % BENCH_MAX_NODES;
+    int second_life = (int) (intptr_t) arg >= BENCH_MAX_NODES;
+    uint16_t restart_after = workload->restart_after;
+    sim_node.network_addr = node_address(index);
+    sim_node.data_link_addr = 0x01010101UL * sim_node.network_addr;
+
+    // Not on the air until the first thread is off it.
+    while (second_life && !rebooted[index] && !stop) _delay_ms(BENCH_LISTEN_MS);
+
+    trx_initialize(MY_DATA_LINK_ADDR);
+    timer_clock_initialize();
+    set_routes(index);
+    address_resolution_initialize();
+
+    if (index == 0) sink();
+    else if (is_sender(index)) {
+        if (restart_after > 0 && !second_life) {
+            sender(index, 0, restart_after);
+            sim_trx_shutdown();
+            rebooted[index] = 1;
+            sim_leave();
+            return NULL;
+        }
+        sender(index, second_life ? restart_after : 0, workload->messages);
+
+        pthread_mutex_lock(&results_mutex);
+        senders_done++;
+        pthread_mutex_unlock(&results_mutex);
+
+        // Stick around to ack and relay until everyone's done.
+        listen_until_stopped();
+    }
+    else listen_until_stopped();
+
+    pthread_mutex_lock(&results_mutex);
+    collisions += sim_trx_collisions();
+    pthread_mutex_unlock(&results_mutex);
+
+    sim_trx_shutdown();
+    sim_leave();
+    return NULL;
+}
+
+static int compare_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*) a, y = *(const uint32_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t percentile(int percent) {
+    if (delivered == 0) return 0;
+    int count = delivered < BENCH_MAX_MESSAGES ? delivered : BENCH_MAX_MESSAGES;
+    int i = (count * percent + 99) / 100 - 1;
+    return latencies_ms[i < 0 ? 0 : i];
+}
+
+static void run(const bench_workload_t* w, FILE* results, int run_number) {
+
+    workload = w;
+    node_count = w->hops + w->senders;
+    senders_done = 0;
+    stop = 0;
+    delivered = duplicates = 0;
+    delivered_bytes = 0;
+    first_send_ms = -1;
+    last_delivery_ms = 0;
+    segments = transport_retx = link_retx = frames = collisions = poll_max_ms = 0;
+    memset(seen, 0, sizeof(seen));
+    memset(reported_sent, 0, sizeof(reported_sent));
+    memset(last_sent, 0, sizeof(last_sent));
+    memset((void*) rebooted, 0, sizeof(rebooted));
+    int thread_count = node_count + (w->restart_after > 0 ? w->senders : 0);
+
+    // A fresh clock for every workload.
+    char clock_file[64], nodes[16];
+    snprintf(clock_file, sizeof(clock_file), "/tmp/rocket_rover_bench_clock_%d_%d", (int) getpid(), run_number);
+    snprintf(nodes, sizeof(nodes), "%d", thread_count);
+    unlink(clock_file);
+    setenv("SIM_CLOCK_FILE", clock_file, 1);
+    setenv("SIM_VIRTUAL_NODES", nodes, 1);
+
+    sim_trx_set_default_link(w->loss_percent, 1, 1000);
+
+    pthread_t threads[2 * BENCH_MAX_NODES];
+    for (int i = 0; i < thread_count; i++) {
+        // The second lives come after everyone, counting from the first sender.
+        int arg = i < node_count ? i : BENCH_MAX_NODES + w->hops + (i - node_count);
+        pthread_create(&threads[i], NULL, node, (void*) (intptr_t) arg);
+    }
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    unlink(clock_file);
+
+    int count = delivered < BENCH_MAX_MESSAGES ? delivered : BENCH_MAX_MESSAGES;
+    qsort(latencies_ms, count, sizeof(latencies_ms[0]), compare_u32);
+
+    int acked_lost = 0;
+    for (int sender_index = 0; sender_index < w->senders; sender_index++) {
+        for (int i = 0; i < w->messages; i++) {
+            uint8_t bit = 1 << (i % 8);
+            if ((reported_sent[sender_index][i / 8] & bit) != 0 && (seen[sender_index][i / 8] & bit) == 0) acked_lost++;
+        }
+    }
+    if (acked_lost > 0) fprintf(stderr, "%s: %d messages reported sent were never delivered\n", w->name, acked_lost);
+    acked_lost_total += acked_lost;
+
+    int64_t elapsed_ms = last_delivery_ms - first_send_ms;
+    uint32_t goodput = elapsed_ms > 0 ? (uint32_t) (delivered_bytes * 8000LL / elapsed_ms) : 0;
+
+    fprintf(results, "%s,%d,%d,%d,%d,%d,%d,%d,%d,%u,%u,%u,%u,%u,%u,%u,%.3f,%u,%u,%u,%u,%lld\n",
+        w->name, w->hops, w->senders, w->message_len, w->messages, w->loss_percent,
+        delivered, duplicates, acked_lost, goodput,
+        percentile(50), percentile(90), percentile(99), count > 0 ? latencies_ms[count - 1] : 0,
+        segments, transport_retx, segments > 0 ? (double) transport_retx / segments : 0.0,
+        link_retx, frames, collisions, poll_max_ms, (long long) elapsed_ms);
+    fflush(results);
+}
+
+int main(int argc, char** argv) {
+
+    // Results on stdout, everything else on stderr.
+    FILE* results = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    sim_trx_set_tap(tap);
+    sim_trx_set_seed(BENCH_SEED);
+
+    fprintf(results, "workload,hops,senders,message_len,messages,loss_percent,"
+        "delivered,duplicates,acked_lost,goodput_bps,latency_p50_ms,latency_p90_ms,latency_p99_ms,latency_max_ms,"
+        "segments,transport_retx,retx_per_segment,link_retx,frames,collisions,poll_max_ms,elapsed_ms\n");
+
+    for (unsigned i = 0; i < BENCH_WORKLOAD_COUNT; i++) {
+        if (argc > 1 && strncmp(workloads[i].name, argv[1], strlen(argv[1])) != 0) continue;
+        run(&workloads[i], results, i);
+    }
+    return acked_lost_total > 0 ? 1 : 0;
+}
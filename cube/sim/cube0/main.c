@@ -24,7 +24,7 @@ int main() {
     printf("::: Simulating cube 0    :::\n\n");
 
 	trx_initialize(MY_DATA_LINK_ADDR);
-	_delay_ms(300);
+	while (!trx_ready());
 
     while(1) {
         printf("Attempting to receive message... ");
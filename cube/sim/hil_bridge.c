@@ -0,0 +1,348 @@
+/*
+
+        WARNING
+
+        This is a SIMULATION FILE.
+        Do not compile this code for hardware.
+
+*/
+
+// Connects simulated nodes to the air, through a cube running the HIL
+// bridge firmware (cube/hil_bridge). Simulated nodes started with
+// SIM_HIL_SOCKET set connect here (sim_hil.h); whatever they send to an
+// address with no simulated node goes to the cube, which transmits it for
+// real. Packets the cube hears go to the simulated node they're addressed
+// to, one packet per frame, or to every node for beacons and groups.
+//
+// Usage: SIM_HIL_SOCKET=/tmp/rocket_rover_hil build/hil_bridge /dev/ttyUSB0
+//        SIM_HIL_SOCKET=/tmp/rocket_rover_hil build/sim_multi ...
+//
+// The serial port is set to raw 8N1 at HIL_BAUD. Ctrl-C prints how the
+// transmissions went: how long the cube said each one took on the air, and
+// how long the whole round trip over the UART took, which is what the
+// simulated nodes see.
+
+#include "sim_hil.h"
+#include "hil_bridge.h"
+#include "networking_constants.h"
+
+#include <asm/ioctls.h>
+#include <asm/termbits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// <sys/ioctl.h> and <asm/termbits.h> don't get along.
+int ioctl(int fd, unsigned long request, ...);
+
+#define HIL_SOCKET_DEFAULT "/tmp/rocket_rover_hil"
+#define HIL_MAX_NODES (64)
+
+// How long to wait for the cube to say how a transmission went.
+#define HIL_RESULT_TIMEOUT_MS (1000)
+
+typedef struct {
+    int fd;
+    trx_address_t address;      // 0 until the node says hello
+} hil_node_t;
+
+static hil_node_t nodes[HIL_MAX_NODES];
+static int node_count = 0;
+
+static int serial = -1;
+
+// The message coming in from the cube.
+static uint8_t message[HIL_RECEIVED_LEN];
+static int message_len = 0;
+
+static uint32_t sent, failed, timeouts;
+static uint64_t air_us_total, air_us_max;
+static uint64_t round_trip_us_total, round_trip_us_max;
+static uint32_t frames_received, packets_delivered, packets_dropped;
+
+static volatile sig_atomic_t stop = 0;
+
+static int64_t now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int open_serial(const char* device) {
+    int fd = open(device, O_RDWR | O_NOCTTY);
+    if (fd == -1) return -1;
+
+    struct termios2 tio;
+    if (ioctl(fd, TCGETS2, &tio) == -1) {
+        close(fd);
+        return -1;
+    }
+    tio.c_iflag = 0;
+    tio.c_oflag = 0;
+    tio.c_lflag = 0;
+    tio.c_cflag = CS8 | CREAD | CLOCAL | BOTHER;
+    tio.c_ispeed = HIL_BAUD;
+    tio.c_ospeed = HIL_BAUD;
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    if (ioctl(fd, TCSETS2, &tio) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void write_all(int fd, const uint8_t* bytes, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, bytes, len);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) continue;
+            return;
+        }
+        bytes += n;
+        len -= n;
+    }
+}
+
+// Hands each packet in a frame from the air to whoever it's for.
+static void deliver(const uint8_t* frame) {
+
+    frames_received++;
+
+    int offset = 0;
+    while (offset + PACKET_HEADER_LEN <= HIL_PAYLOAD_LEN) {
+        uint8_t len = frame[offset];
+        if (len == 0) break;             // the rest is padding
+        if (len < PACKET_HEADER_LEN || offset + len > HIL_PAYLOAD_LEN) break;
+
+        uint8_t dest = frame[offset + 1];
+        int everyone = dest == NETWORK_ADDR_BEACON || dest == NETWORK_ADDR_RESOLVE
+            || dest == NETWORK_GROUP_ALL_CUBES;
+
+        sim_hil_message_t packet;
+        memset(&packet, 0, sizeof(packet));
+        packet.type = SIM_HIL_FRAME;
+        packet.length = len;
+        packet.address = 0x01010101UL * frame[offset + 2];
+        memcpy(packet.payload, &frame[offset], len);
+
+        int delivered = 0;
+        for (int i = 0; i < node_count; i++) {
+            if (everyone ? nodes[i].address != 0 : nodes[i].address == 0x01010101UL * dest) {
+                send(nodes[i].fd, &packet, sizeof(packet), MSG_DONTWAIT);
+                delivered = 1;
+            }
+        }
+        if (delivered) packets_delivered++;
+        else packets_dropped++;
+
+        offset += len;
+    }
+}
+
+// Reads what the cube has sent. Returns 1 and fills in result when a
+// HIL_RESULT comes in; frames from the air are delivered as they come.
+static int read_serial(uint8_t* result) {
+
+    uint8_t bytes[256];
+    ssize_t n = read(serial, bytes, sizeof(bytes));
+    if (n <= 0) return 0;
+
+    int got_result = 0;
+    for (ssize_t i = 0; i < n; i++) {
+        uint8_t c = bytes[i];
+
+        if ((message_len == 0 && c != HIL_SYNC_0)
+            || (message_len == 1 && c != HIL_SYNC_1)
+            || (message_len == 2 && c != HIL_RESULT && c != HIL_RECEIVED)) {
+            // Text from the cube.
+            if (message_len == 0) fputc(c, stderr);
+            message_len = c == HIL_SYNC_0 ? 1 : 0;
+            continue;
+        }
+
+        message[message_len++] = c;
+
+        if (message[2] == HIL_RESULT && message_len == HIL_RESULT_LEN) {
+            memcpy(result, message, HIL_RESULT_LEN);
+            got_result = 1;
+            message_len = 0;
+        }
+        else if (message[2] == HIL_RECEIVED && message_len == HIL_RECEIVED_LEN) {
+            deliver(&message[HIL_HEADER_LEN]);
+            message_len = 0;
+        }
+    }
+    return got_result;
+}
+
+// Sends one payload out through the cube, and tells the node how it went.
+static void transmit(hil_node_t* node, const sim_hil_message_t* request) {
+
+    uint8_t out[HIL_TRANSMIT_HEADER_LEN + HIL_PAYLOAD_LEN];
+    uint8_t length = request->length > HIL_PAYLOAD_LEN ? HIL_PAYLOAD_LEN : request->length;
+    out[0] = HIL_SYNC_0;
+    out[1] = HIL_SYNC_1;
+    out[2] = HIL_TRANSMIT;
+    for (int i = 0; i < 4; i++) out[HIL_HEADER_LEN + i] = (uint8_t) (request->address >> (8 * i));
+    out[HIL_HEADER_LEN + 4] = request->broadcast ? HIL_FLAG_BROADCAST : 0;
+    out[HIL_HEADER_LEN + 5] = length;
+    memcpy(&out[HIL_TRANSMIT_HEADER_LEN], request->payload, length);
+
+    int64_t started_us = now_us();
+    write_all(serial, out, HIL_TRANSMIT_HEADER_LEN + length);
+
+    sim_hil_message_t reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.type = SIM_HIL_RESULT;
+    reply.address = request->address;
+    reply.outcome = TRX_TRANSMISSION_FAILURE;
+
+    uint8_t result[HIL_RESULT_LEN];
+    int64_t deadline_us = started_us + HIL_RESULT_TIMEOUT_MS * 1000LL;
+    int got_result = 0;
+    while (!got_result) {
+        int64_t left_us = deadline_us - now_us();
+        if (left_us <= 0) break;
+        struct pollfd fds = { serial, POLLIN, 0 };
+        if (poll(&fds, 1, (int) ((left_us + 999) / 1000)) > 0) got_result = read_serial(result);
+    }
+
+    uint64_t round_trip_us = now_us() - started_us;
+    sent++;
+
+    if (!got_result) {
+        timeouts++;
+        failed++;
+        fprintf(stderr, "No answer from the cube for a frame to %08x\n", request->address);
+    }
+    else {
+        uint32_t air_us = result[4] | (result[5] << 8) | (result[6] << 16) | ((uint32_t) result[7] << 24);
+        reply.outcome = result[3] == HIL_RESULT_SENT ? TRX_TRANSMISSION_SUCCESS : TRX_TRANSMISSION_FAILURE;
+        reply.air_us = air_us;
+        reply.retransmissions = result[8];
+        if (reply.outcome == TRX_TRANSMISSION_FAILURE) failed++;
+
+        air_us_total += air_us;
+        if (air_us > air_us_max) air_us_max = air_us;
+        round_trip_us_total += round_trip_us;
+        if (round_trip_us > round_trip_us_max) round_trip_us_max = round_trip_us;
+    }
+
+    send(node->fd, &reply, sizeof(reply), MSG_DONTWAIT);
+}
+
+static void remove_node(int i) {
+    close(nodes[i].fd);
+    nodes[i] = nodes[--node_count];
+}
+
+static void print_stats(void) {
+    uint32_t answered = sent - timeouts;
+    fprintf(stderr, "\n::: HIL bridge :::\n");
+    fprintf(stderr, "frames sent %u, failed %u, no answer %u\n", sent, failed, timeouts);
+    if (answered > 0) {
+        fprintf(stderr, "air us: avg %llu, max %llu\n",
+            (unsigned long long) (air_us_total / answered), (unsigned long long) air_us_max);
+        fprintf(stderr, "round trip us: avg %llu, max %llu\n",
+            (unsigned long long) (round_trip_us_total / answered), (unsigned long long) round_trip_us_max);
+    }
+    fprintf(stderr, "frames received %u, packets delivered %u, for nobody %u\n",
+        frames_received, packets_delivered, packets_dropped);
+}
+
+static void on_signal(int signal) {
+    stop = 1;
+}
+
+int main(int argc, char** argv) {
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <serial port>\n", argv[0]);
+        return 1;
+    }
+
+    serial = open_serial(argv[1]);
+    if (serial == -1) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    const char* path = getenv(SIM_HIL_SOCKET_ENV);
+    if (path == NULL) path = HIL_SOCKET_DEFAULT;
+
+    int listener = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if (listener == -1 || bind(listener, (struct sockaddr*) &addr, sizeof(addr)) == -1 || listen(listener, 16) == -1) {
+        fprintf(stderr, "Could not listen on %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    fprintf(stderr, "Bridging %s to %s\n", path, argv[1]);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    while (!stop) {
+
+        struct pollfd fds[HIL_MAX_NODES + 2];
+        fds[0] = (struct pollfd) { listener, POLLIN, 0 };
+        fds[1] = (struct pollfd) { serial, POLLIN, 0 };
+        for (int i = 0; i < node_count; i++) fds[2 + i] = (struct pollfd) { nodes[i].fd, POLLIN, 0 };
+        int watching = node_count;
+
+        if (poll(fds, 2 + watching, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd != -1 && node_count < HIL_MAX_NODES) {
+                nodes[node_count].fd = fd;
+                nodes[node_count].address = 0;
+                node_count++;
+            }
+            else if (fd != -1) {
+                close(fd);
+            }
+        }
+
+        if (fds[1].revents & POLLIN) {
+            uint8_t ignored[HIL_RESULT_LEN];
+            read_serial(ignored);
+        }
+
+        // Backwards, so a node that leaves doesn't make us skip one.
+        for (int i = watching - 1; i >= 0; i--) {
+            if ((fds[2 + i].revents & (POLLIN | POLLHUP)) == 0) continue;
+
+            sim_hil_message_t request;
+            ssize_t n = recv(nodes[i].fd, &request, sizeof(request), 0);
+            if (n != sizeof(request)) {
+                remove_node(i);
+                continue;
+            }
+            if (request.type == SIM_HIL_HELLO) nodes[i].address = request.address;
+            if (request.type == SIM_HIL_TX) transmit(&nodes[i], &request);
+        }
+    }
+
+    print_stats();
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,192 @@
+// Makes a link trace for the simulator (see SIM_RADIO_LINKS in sim_trx.c)
+// from a real link, so the simulation can lose what the field lost, when it
+// lost it.
+//
+// From the sniffer cube, by way of build/sniffer_pcap: one step per frame
+// sent to the address. A frame is every attempt with the same packet ID. If
+// the sniffer heard it acknowledged, the step has 0% loss and the latency is
+// from the first attempt to the acknowledgement, retransmissions and all;
+// otherwise it has 100% loss.
+//
+// From the telemetry the rover's transceiver printed (telemetry.h): one step
+// per report from the cube at the address, with the frames that ran out of
+// retransmissions out of the frames it sent, and the retransmissions those
+// took, each worth the link profile's retransmit delay. Reports are assumed
+// to be TELEMETRY_INTERVAL_MS apart, since the log doesn't say when they
+// came in.
+//
+// The address is a network address, in hex. A link trace is about one
+// direction, so pick the receiver's address for a sniffer capture, or the
+// sender's for telemetry.
+//
+// Usage: build/link_trace pcap 3c capture.pcap > to_3c.trace
+//        build/link_trace telemetry 3c trx_log.txt > from_3c.trace
+
+#include "sniffer.h"
+#include "telemetry.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The ROBUST link profile waits 4 ms between retransmissions (trx.c).
+#define LINK_TRACE_RETRANSMIT_MS (4)
+
+static uint32_t get32(const uint8_t* bytes) {
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+}
+
+// The frame being put together from the attempts heard so far.
+typedef struct {
+    int valid;
+    unsigned int pid;
+    uint64_t first_us;
+    uint64_t acked_us;
+    int acked;
+} link_trace_frame_t;
+
+static uint64_t start_us;
+static int started = 0;
+
+static void finish_frame(const link_trace_frame_t* frame) {
+    if (!frame->valid) return;
+    if (!started) {
+        start_us = frame->first_us;
+        started = 1;
+    }
+    long long at_ms = (long long) ((frame->first_us - start_us) / 1000);
+    if (frame->acked) {
+        printf("%lld 0 %llu\n", at_ms, (unsigned long long) ((frame->acked_us - frame->first_us) / 1000));
+    }
+    else {
+        printf("%lld 100 0\n", at_ms);
+    }
+}
+
+static int from_pcap(FILE* in, uint8_t address) {
+
+    uint8_t header[24];
+    if (fread(header, 1, sizeof(header), in) != sizeof(header) || get32(header) != 0xa1b2c3d4) {
+        fprintf(stderr, "not a pcap file from sniffer_pcap\n");
+        return 1;
+    }
+    if (get32(&header[20]) != SNIFFER_PCAP_LINKTYPE) {
+        fprintf(stderr, "link type %u isn't the sniffer's\n", get32(&header[20]));
+        return 1;
+    }
+
+    printf("# frames to %02x, from a sniffer capture\n", address);
+
+    link_trace_frame_t frame = { 0 };
+    uint8_t record[16];
+    static uint8_t packet[65536];
+
+    while (fread(record, 1, sizeof(record), in) == sizeof(record)) {
+        uint64_t when_us = (uint64_t) get32(record) * 1000000 + get32(&record[4]);
+        uint32_t captured = get32(&record[8]);
+        if (captured > sizeof(packet) || fread(packet, 1, captured, in) != captured) break;
+        if (captured < SNIFFER_PCAP_HEADER_LEN) continue;
+
+        const uint8_t* to = &packet[SNIFFER_PCAP_ADDRESS_INDEX];
+        if (to[0] != address || to[1] != address || to[2] != address || to[3] != address) continue;
+        if (packet[SNIFFER_PCAP_FLAGS_INDEX] == SNIFFER_PCAP_CRC_BAD) continue;
+
+        unsigned int pid = packet[SNIFFER_PCAP_PID_INDEX] >> 1;
+        unsigned int no_ack = packet[SNIFFER_PCAP_PID_INDEX] & 1;
+
+        // An acknowledgement is sent back on the same address, with nothing
+        // in it.
+        if (packet[SNIFFER_PCAP_LENGTH_INDEX] == 0) {
+            if (frame.valid && !frame.acked) {
+                frame.acked = 1;
+                frame.acked_us = when_us;
+            }
+            continue;
+        }
+
+        // Broadcasts aren't acknowledged, so there's no telling whether they
+        // got there.
+        if (no_ack) continue;
+
+        // The same packet ID again is a retransmission. After an
+        // acknowledgement, it means the sender didn't hear it.
+        if (frame.valid && pid == frame.pid) {
+            frame.acked = 0;
+            continue;
+        }
+
+        finish_frame(&frame);
+        frame.valid = 1;
+        frame.pid = pid;
+        frame.first_us = when_us;
+        frame.acked = 0;
+    }
+
+    finish_frame(&frame);
+    return 0;
+}
+
+static int from_telemetry(FILE* in, uint8_t address) {
+
+    printf("# frames from %02x, from telemetry every %d ms\n", address, TELEMETRY_INTERVAL_MS);
+
+    char line[256];
+    long long at_ms = 0;
+    unsigned int last_tx = 0, last_retx = 0, last_lost = 0;
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        unsigned int from, rx, tx, retx, lost;
+        if (sscanf(line, "%x: rx %u, tx %u, retx %u, lost %u", &from, &rx, &tx, &retx, &lost) != 5) continue;
+        if (from != address) continue;
+
+        // The counts are 16 bits, and wrap around.
+        uint16_t frames = (uint16_t) (tx - last_tx);
+        uint16_t retransmissions = (uint16_t) (retx - last_retx);
+        uint16_t failures = (uint16_t) (lost - last_lost);
+        last_tx = tx;
+        last_retx = retx;
+        last_lost = lost;
+
+        if (frames > 0) {
+            printf("%lld %u %u\n", at_ms,
+                failures * 100u / frames,
+                1 + retransmissions * LINK_TRACE_RETRANSMIT_MS / frames);
+        }
+        at_ms += TELEMETRY_INTERVAL_MS;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s pcap|telemetry <network address> [file]\n", argv[0]);
+        return 1;
+    }
+
+    uint8_t address = (uint8_t) strtoul(argv[2], NULL, 16);
+
+    FILE* in = stdin;
+    if (argc > 3) {
+        in = fopen(argv[3], "rb");
+        if (in == NULL) {
+            perror(argv[3]);
+            return 1;
+        }
+    }
+
+    int result;
+    if (strcmp(argv[1], "pcap") == 0) {
+        result = from_pcap(in, address);
+    }
+    else if (strcmp(argv[1], "telemetry") == 0) {
+        result = from_telemetry(in, address);
+    }
+    else {
+        fprintf(stderr, "%s isn't pcap or telemetry\n", argv[1]);
+        result = 1;
+    }
+
+    if (in != stdin) fclose(in);
+    return result;
+}
@@ -0,0 +1,28 @@
+/*
+        WARNING
+
+        This is a SIMULATION FILE.
+        Do not compile this code for hardware.
+*/
+
+#ifndef _ADDRESS_H
+#define _ADDRESS_H
+
+#include <stdint.h>
+
+// In the multi-node simulator every thread is a node, so "my address" is
+// whichever node this thread is. main.c fills this in before the node
+// touches the stack.
+typedef struct {
+    uint32_t data_link_addr;
+    uint8_t network_addr;
+} sim_node_t;
+
+extern _Thread_local sim_node_t sim_node;
+
+#define MY_DATA_LINK_ADDR (sim_node.data_link_addr)
+#define MY_NETWORK_ADDR (sim_node.network_addr)
+#define MY_PORT (sim_node.network_addr)
+#define MY_GROUP_ADDR (NETWORK_GROUP_ALL_CUBES)
+
+#endif
@@ -0,0 +1,208 @@
+/*
+        WARNING
+
+        This is a SIMULATION FILE.
+        Do not compile this code for hardware.
+*/
+
+// Dozens of nodes in one process. Every node is a thread with its own copy
+// of the networking stack (see node_state.h), talking over the same
+// simulated radio as the single-node simulators (sim_trx.c), so the stack
+// can be tried at sizes there will never be enough hardware for.
+//
+// Node 0 is the sink. Every other node sends it a few messages, relaying
+// whatever comes through in between, and the sink prints how many made it
+// once everyone's done, and its own counts from every layer (stats.h).
+//
+// Usage: build/sim_multi [nodes] [chain|star] [messages per node]
+//
+// chain: each node only routes through its neighbors, so messages from the
+//        far end take nodes - 1 hops.
+// star:  everyone sends straight to the sink.
+//
+// It runs on the virtual clock (sim_delay.h) unless SIM_VIRTUAL_NODES says
+// otherwise, so a long run over many hops takes seconds, not minutes.
+
+#include "sim_trx.h"
+#include "sim_delay.h"
+#include "transport.h"
+#include "routing_table.h"
+#include "stats.h"
+#include "address.h"
+#include "networking_constants.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Addresses go from 0x01 up, skipping the group addresses.
+#define SIM_MULTI_MAX_NODES (ROUTING_TABLE_COLUMNS - 4)
+#define SIM_MULTI_SINK (0)
+
+// How long a node waits for something to relay between its messages.
+#define SIM_MULTI_LISTEN_MS (500)
+
+// Gives up on the run after this much simulated time.
+#define SIM_MULTI_TIME_LIMIT_S (600)
+
+typedef enum {
+    SIM_MULTI_CHAIN,
+    SIM_MULTI_STAR
+} sim_multi_topology_t;
+
+_Thread_local sim_node_t sim_node;
+
+static int node_count = 20;
+static sim_multi_topology_t topology = SIM_MULTI_CHAIN;
+static int messages_per_node = 3;
+
+// Shared by every node, under results_mutex.
+static pthread_mutex_t results_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int senders_done = 0;
+static int sent_ok = 0;
+static int received = 0;
+static int duplicates = 0;
+static uint32_t received_from[SIM_MULTI_MAX_NODES];     // bit n: message n made it
+
+static byte node_address(int index) {
+    byte addr = index + 1;
+    if (addr >= NETWORK_GROUP_ALL_CUBES) addr += 3;
+    return addr;
+}
+
+static int node_index(byte addr) {
+    if (addr > NETWORK_ADDR_RESOLVE) addr -= 3;
+    return addr - 1;
+}
+
+// The routes node index uses to get everywhere else.
+static void set_routes(int index) {
+    for (int to = 0; to < node_count; to++) {
+        int next = to;
+        if (topology == SIM_MULTI_CHAIN && to != index) {
+            next = to < index ? index - 1 : index + 1;
+        }
+        routing_table_set(node_address(to), node_address(next));
+    }
+    routing_table_set(NETWORK_GROUP_ALL_CUBES, NETWORK_ADDR_NONE);
+}
+
+static void sink(void) {
+
+    byte message[MAX_MESSAGE_LEN];
+    uint16_t message_len;
+    byte source_port;
+
+    while (1) {
+        transport_rx_result result = transport_rx(message, sizeof(message), &message_len, &source_port, SIM_MULTI_LISTEN_MS);
+
+        pthread_mutex_lock(&results_mutex);
+        int number;
+        if (result == TRANSPORT_RX_SUCCESS && sscanf((char*) message, "Hello from %*x, number %d", &number) == 1) {
+            uint32_t bit = 1UL << (number & 31);
+            uint32_t* from = &received_from[node_index(source_port)];
+            if (*from & bit) duplicates++;
+            else received++;
+            *from |= bit;
+        }
+        int done = senders_done == node_count - 1;
+        pthread_mutex_unlock(&results_mutex);
+
+        if (done || timer_now_ms() / 1000 > SIM_MULTI_TIME_LIMIT_S) break;
+    }
+
+    printf("\n::: %d nodes, %s, %d messages each :::\n", node_count,
+        topology == SIM_MULTI_CHAIN ? "chain" : "star", messages_per_node);
+    for (int i = 1; i < node_count; i++) {
+        printf("%02x: %d of %d\n", node_address(i), __builtin_popcount(received_from[i]), messages_per_node);
+    }
+    printf("Sent %d, received %d of %d (and %d twice) in %u ms\n", sent_ok, received,
+        (node_count - 1) * messages_per_node, duplicates, (unsigned) (sim_now_us() / 1000));
+    printf("\n");
+    stats_print();
+    exit(received == (node_count - 1) * messages_per_node ? 0 : 1);
+}
+
+static void sender(int index) {
+
+    byte message[MAX_MESSAGE_LEN];
+    uint16_t message_len;
+    byte source_port;
+
+    // Everybody starting at once would just be a pile of collisions.
+    _delay_ms(37 * index % 1000);
+
+    for (int i = 0; i < messages_per_node; i++) {
+        int len = snprintf((char*) message, sizeof(message), "Hello from %02x, number %d", MY_NETWORK_ADDR, i);
+        if (transport_tx(message, len + 1, node_address(SIM_MULTI_SINK)) == TRANSPORT_TX_SUCCESS) {
+            pthread_mutex_lock(&results_mutex);
+            sent_ok++;
+            pthread_mutex_unlock(&results_mutex);
+        }
+        transport_rx(message, sizeof(message), &message_len, &source_port, SIM_MULTI_LISTEN_MS);
+    }
+
+    pthread_mutex_lock(&results_mutex);
+    senders_done++;
+    pthread_mutex_unlock(&results_mutex);
+
+    // Keep relaying for everyone further out.
+    while (1) {
+        transport_rx(message, sizeof(message), &message_len, &source_port, SIM_MULTI_LISTEN_MS);
+    }
+}
+
+static void* node(void* arg) {
+
+    int index = (int) (intptr_t) arg;
+    sim_node.network_addr = node_address(index);
+    sim_node.data_link_addr = 0x01010101UL * sim_node.network_addr;
+
+    trx_initialize(MY_DATA_LINK_ADDR);
+    timer_clock_initialize();
+    set_routes(index);
+
+    if (index == SIM_MULTI_SINK) sink();
+    else sender(index);
+    return NULL;
+}
+
+static char clock_file[64];
+
+static void remove_clock_file(void) {
+    unlink(clock_file);
+}
+
+int main(int argc, char** argv) {
+
+    if (argc > 1) node_count = atoi(argv[1]);
+    if (argc > 2) topology = strcmp(argv[2], "star") == 0 ? SIM_MULTI_STAR : SIM_MULTI_CHAIN;
+    if (argc > 3) messages_per_node = atoi(argv[3]);
+    if (messages_per_node > 32) messages_per_node = 32;
+
+    if (node_count < 2 || node_count > SIM_MULTI_MAX_NODES) {
+        printf("Between 2 and %d nodes, please.\n", SIM_MULTI_MAX_NODES);
+        return 1;
+    }
+
+    // Every node is in this process, so the clock can be this process's too.
+    if (getenv("SIM_VIRTUAL_NODES") == NULL) {
+        char nodes[16];
+        snprintf(nodes, sizeof(nodes), "%d", node_count);
+        snprintf(clock_file, sizeof(clock_file), "/tmp/rocket_rover_sim_clock_%d", (int) getpid());
+        setenv("SIM_VIRTUAL_NODES", nodes, 1);
+        setenv("SIM_CLOCK_FILE", clock_file, 1);
+        atexit(remove_clock_file);
+    }
+
+    printf("::: Simulating %d nodes :::\n\n", node_count);
+
+    pthread_t threads[SIM_MULTI_MAX_NODES];
+    for (int i = 0; i < node_count; i++) {
+        pthread_create(&threads[i], NULL, node, (void*) (intptr_t) i);
+    }
+    pthread_join(threads[SIM_MULTI_SINK], NULL);
+    return 0;
+}
@@ -23,7 +23,7 @@ int main() {
     printf("::: Simulating rover     :::\n\n");
 
 	trx_initialize(MY_DATA_LINK_ADDR);
-	_delay_ms(300);
+	while (!trx_ready());
 
     printf("Attempting to transmit payload... ");
     fflush(stdout);
@@ -1,8 +1,238 @@
 #include "sim_delay.h"
+#include "node_state.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
+// The virtual clock is a discrete-event scheduler spread over the nodes'
+// processes. They share this in a memory-mapped file. Each node is either
+// running or waiting for some time. When the last one to be running starts
+// to wait, it moves the clock to the soonest time anyone's waiting for and
+// wakes everyone up; the ones whose time has come run, and the rest go back
+// to waiting.
+//
+// A node sending a payload moves the receiver's time up to when the payload
+// is due (sim_notify_us), so a node waiting on its radio wakes up for it.
+// Nothing else can happen while a node is running, so virtual time stands
+// still during it: only waiting moves the clock.
+//
+// A node that exits stops counting. One that's killed leaves the others
+// waiting for it forever.
+//
+// In the multi-node simulator (cube/sim/multi) the nodes are threads instead
+// of processes, and each one joins on its own, the same way.
+
+#define SIM_CLOCK_FILE_ENV "SIM_CLOCK_FILE"
+#define SIM_CLOCK_FILE_DEFAULT "/tmp/rocket_rover_sim_clock"
+#define SIM_VIRTUAL_NODES_ENV "SIM_VIRTUAL_NODES"
+
+#define SIM_CLOCK_MAGIC (0x52565443)
+#define SIM_CLOCK_MAX_NODES (64)
+
+typedef struct {
+    int used;
+    int waiting;
+    uint32_t address;
+    int64_t wait_until_us;      // while waiting
+    int64_t notify_us;          // the soonest a sender needs it awake
+} sim_clock_node_t;
+
+typedef struct {
+    volatile uint32_t magic;    // set once everything else is ready
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    int expected_nodes;
+    int joined_nodes;           // how many have ever joined, to know when to start
+    int64_t now_us;
+    sim_clock_node_t nodes[SIM_CLOCK_MAX_NODES];
+} sim_clock_t;
+
+NODE_STATE int mode = -1;           // -1 until the first call, then 0 for real, 1 for virtual
+NODE_STATE sim_clock_t* shared = NULL;
+NODE_STATE int my_node = -1;
+
+static int64_t host_now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void leave(void) {
+    if (my_node == -1) return;     // atexit runs this on the main thread, which may not be a node
+
+    pthread_mutex_lock(&shared->mutex);
+    shared->nodes[my_node].used = 0;
+    pthread_cond_broadcast(&shared->changed);
+    pthread_mutex_unlock(&shared->mutex);
+    my_node = -1;
+}
+
+// Opens the shared clock, making it if this is the first node.
+static void join(int expected) {
+    const char* file_name = getenv(SIM_CLOCK_FILE_ENV);
+    if (file_name == NULL) file_name = SIM_CLOCK_FILE_DEFAULT;
+
+    int fd = open(file_name, O_RDWR | O_CREAT | O_EXCL, 0666);
+    int creator = fd != -1;
+    if (!creator) fd = open(file_name, O_RDWR);
+    if (fd == -1 || (creator && ftruncate(fd, sizeof(sim_clock_t)) == -1)) {
+        printf("ERROR: Could not open the virtual clock %s: %s\n", file_name, strerror(errno));
+        exit(1);
+    }
+
+    // Someone else may still be setting it up.
+    while (!creator && lseek(fd, 0, SEEK_END) < (off_t) sizeof(sim_clock_t)) usleep(1000);
+
+    shared = mmap(NULL, sizeof(sim_clock_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shared == MAP_FAILED) {
+        printf("ERROR: Could not map the virtual clock: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    if (creator) {
+        pthread_mutexattr_t mutex_attr;
+        pthread_condattr_t cond_attr;
+        pthread_mutexattr_init(&mutex_attr);
+        pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+        pthread_condattr_init(&cond_attr);
+        pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutex_init(&shared->mutex, &mutex_attr);
+        pthread_cond_init(&shared->changed, &cond_attr);
+        shared->expected_nodes = expected;
+        shared->joined_nodes = 0;
+        shared->now_us = 0;
+        __sync_synchronize();
+        shared->magic = SIM_CLOCK_MAGIC;
+    }
+    while (shared->magic != SIM_CLOCK_MAGIC) usleep(1000);
+
+    pthread_mutex_lock(&shared->mutex);
+    if (shared->joined_nodes >= shared->expected_nodes) {
+        pthread_mutex_unlock(&shared->mutex);
+        printf("ERROR: The virtual clock in %s is from a run that's already started. Delete it first.\n", file_name);
+        exit(1);
+    }
+    for (int i = 0; i < SIM_CLOCK_MAX_NODES; i++) {
+        if (!shared->nodes[i].used) {
+            my_node = i;
+            break;
+        }
+    }
+    if (my_node == -1) {
+        pthread_mutex_unlock(&shared->mutex);
+        printf("ERROR: The virtual clock only has room for %d nodes.\n", SIM_CLOCK_MAX_NODES);
+        exit(1);
+    }
+    shared->nodes[my_node].used = 1;
+    shared->nodes[my_node].waiting = 0;
+    shared->nodes[my_node].address = 0;
+    shared->nodes[my_node].notify_us = SIM_TIME_FOREVER;
+    shared->joined_nodes++;
+    pthread_cond_broadcast(&shared->changed);
+    pthread_mutex_unlock(&shared->mutex);
+
+    atexit(leave);
+}
+
+static int virtual_time(void) {
+    if (mode == -1) {
+        const char* nodes = getenv(SIM_VIRTUAL_NODES_ENV);
+        mode = nodes != NULL && atoi(nodes) > 0;
+        if (mode) join(atoi(nodes));
+    }
+    return mode;
+}
+
+// If everyone's waiting, moves the clock up to the soonest of them. The
+// mutex has to be held.
+static void advance(void) {
+    if (shared->joined_nodes < shared->expected_nodes) return;
+
+    int64_t soonest = SIM_TIME_FOREVER;
+    for (int i = 0; i < SIM_CLOCK_MAX_NODES; i++) {
+        sim_clock_node_t* node = &shared->nodes[i];
+        if (!node->used) continue;
+        if (!node->waiting) return;
+        int64_t when = node->wait_until_us < node->notify_us ? node->wait_until_us : node->notify_us;
+        if (when < soonest) soonest = when;
+    }
+    if (soonest == SIM_TIME_FOREVER) return;       // Everybody's stuck
+
+    if (soonest > shared->now_us) shared->now_us = soonest;
+    pthread_cond_broadcast(&shared->changed);
+}
+
+int sim_virtual_time(void) {
+    return virtual_time();
+}
+
+int64_t sim_now_us(void) {
+    if (!virtual_time()) return host_now_us();
+
+    pthread_mutex_lock(&shared->mutex);
+    int64_t now = shared->now_us;
+    pthread_mutex_unlock(&shared->mutex);
+    return now;
+}
+
+int64_t sim_wait_until_us(int64_t when) {
+    if (!virtual_time()) {
+        int64_t now = host_now_us();
+        if (when > now) usleep(when - now);
+        return host_now_us();
+    }
+
+    pthread_mutex_lock(&shared->mutex);
+    sim_clock_node_t* me = &shared->nodes[my_node];
+    me->waiting = 1;
+    me->wait_until_us = when;
+    while (1) {
+        int64_t until = when < me->notify_us ? when : me->notify_us;
+        if (shared->now_us >= until && shared->joined_nodes >= shared->expected_nodes) break;
+        advance();
+        if (shared->now_us >= until && shared->joined_nodes >= shared->expected_nodes) break;
+        pthread_cond_wait(&shared->changed, &shared->mutex);
+    }
+    me->waiting = 0;
+    int64_t now = shared->now_us;
+    if (me->notify_us <= now) me->notify_us = SIM_TIME_FOREVER;
+    pthread_mutex_unlock(&shared->mutex);
+    return now;
+}
+
+void sim_leave(void) {
+    if (mode == 1) leave();
+}
+
+void sim_name_node(uint32_t address) {
+    if (!virtual_time()) return;
+
+    pthread_mutex_lock(&shared->mutex);
+    shared->nodes[my_node].address = address;
+    pthread_mutex_unlock(&shared->mutex);
+}
+
+void sim_notify_us(uint32_t address, int64_t when) {
+    if (!virtual_time()) return;
+
+    pthread_mutex_lock(&shared->mutex);
+    for (int i = 0; i < SIM_CLOCK_MAX_NODES; i++) {
+        sim_clock_node_t* node = &shared->nodes[i];
+        if (node->used && node->address == address && when < node->notify_us) {
+            node->notify_us = when;
+        }
+    }
+    pthread_mutex_unlock(&shared->mutex);
+}
+
 void _delay_ms(int ms) {
-    usleep(ms*1000);
+    sim_wait_until_us(sim_now_us() + (int64_t) ms * 1000);
 }
@@ -1,6 +1,42 @@
 #ifndef _SIM_DELAY_H
 #define _SIM_DELAY_H
 
+#include <stdint.h>
+
+// The simulation's clock. Normally it's the host's clock, and waiting means
+// sleeping.
+//
+// With SIM_VIRTUAL_NODES set to how many nodes are in the simulation, the
+// nodes share a virtual clock instead (in the file SIM_CLOCK_FILE, or
+// /tmp/rocket_rover_sim_clock). It only moves when every node is waiting,
+// and then it jumps straight to the soonest time one of them is waiting
+// for, so a 1500 ms timeout costs no real time at all. It doesn't start
+// until all of them have joined. See sim_delay.c.
+
+#define SIM_TIME_FOREVER (INT64_MAX)
+
 void _delay_ms(int ms);
 
-#endif
\ No newline at end of file
+// Whether the clock is virtual.
+int sim_virtual_time(void);
+
+// Microseconds since some point that every node agrees on.
+int64_t sim_now_us(void);
+
+// Waits until sim_now_us() is at least when, or until sim_notify_us wakes
+// this node up. Returns the time it woke up at.
+int64_t sim_wait_until_us(int64_t when);
+
+// Takes this node off the virtual clock, for a node that's done before the
+// process is. Exiting does it too.
+void sim_leave(void);
+
+// Says which radio address this node receives at, for sim_notify_us.
+void sim_name_node(uint32_t address);
+
+// Makes sure the node at this address wakes up by when (a payload for it is
+// due then). Only does anything with the virtual clock; with the host's
+// clock, the socket wakes it up.
+void sim_notify_us(uint32_t address, int64_t when);
+
+#endif
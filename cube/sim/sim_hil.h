@@ -0,0 +1,52 @@
+/*
+
+        WARNING
+
+        This is a SIMULATION FILE.
+        Do not compile this code for hardware.
+
+*/
+
+#ifndef _SIM_HIL_H
+#define _SIM_HIL_H
+
+// What simulated nodes and build/hil_bridge (cube/sim/hil_bridge.c) say to
+// each other. Each node that finds SIM_HIL_SOCKET set connects to the bridge
+// there with a SOCK_SEQPACKET socket, so every message arrives whole and in
+// order, and the bridge knows when a node goes away.
+//
+// SIM_HIL_HELLO    node to bridge, once. address is the node's.
+// SIM_HIL_TX       node to bridge. Put payload on the air to address. The
+//                  node waits for the SIM_HIL_RESULT.
+// SIM_HIL_RESULT   bridge to node. outcome is what the real transceiver
+//                  said, air_us how long it took, and retransmissions how
+//                  many automatic retransmissions that was.
+// SIM_HIL_FRAME    bridge to node. One packet from the air for this node,
+//                  as a frame of its own.
+//
+// A transmission only goes to the bridge if there's no simulated node at
+// its address, and the bridge only works on the host's clock, not the
+// virtual one.
+
+#include <stdint.h>
+#include "sim_trx.h"
+
+#define SIM_HIL_SOCKET_ENV "SIM_HIL_SOCKET"
+
+#define SIM_HIL_HELLO   (0)
+#define SIM_HIL_TX      (1)
+#define SIM_HIL_RESULT  (2)
+#define SIM_HIL_FRAME   (3)
+
+typedef struct {
+    uint8_t type;
+    uint8_t broadcast;          // SIM_HIL_TX: no acknowledgement
+    uint8_t length;             // SIM_HIL_TX and SIM_HIL_FRAME
+    trx_transmission_outcome_t outcome;
+    uint8_t retransmissions;
+    trx_address_t address;
+    uint32_t air_us;
+    trx_payload_element_t payload[TRX_PAYLOAD_LENGTH];
+} sim_hil_message_t;
+
+#endif
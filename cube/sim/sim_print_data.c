@@ -92,6 +92,51 @@ void print_segment(byte* segment) {
         printf("\t\t=================================================\n");
         break;
 
+    // SACK segment:
+    // segment[0] = length of segment = 8
+    // segment[1] = sequence number
+    // segment[2] = destination port number
+    // segment[3] = source port number
+    // segment[4] = segment identifier = 0x0B, SACK
+    // segment[5-6] = cumulative offset (everything before this was received)
+    // segment[7] = bitmap of DATA segments received after the cumulative offset
+
+    case SEGID_SACK:
+        printf("\t\t========== Segment (Selective Acknowledgement) ===========\n");
+        printf("\t\tLength of segment:          %d\n", segment[0]);
+        printf("\t\tSequence number:            %d\n", segment[1]);
+        printf("\t\tDestination port number:    %02x\n", segment[2]);
+        printf("\t\tSource port number:         %02x\n", segment[3]);
+        printf("\t\tSegment identifier:         %02x (SACK)\n", segment[4]);
+        printf("\t\tCumulative offset:          %d\n", (segment[5] << 8) + segment[6]);
+        printf("\t\tReceived bitmap:            %02x\n", segment[7]);
+        printf("\t\t=================================================\n");
+        break;
+
+    // COMPACT segment:
+    // segment[0] = length of segment
+    // segment[1] = sequence number
+    // segment[2] = destination port number
+    // segment[3] = source port number
+    // segment[4] = segment identifier = 0x0C, COMPACT
+    // rest is the whole message
+
+    case SEGID_COMPACT: {
+        int compact_length = segment[0] - COMPACT_SEGMENT_HEADER_LEN;
+        for (int i = 0; i < compact_length; i++) {
+            payload[i] = segment[i + COMPACT_SEGMENT_HEADER_LEN];
+        }
+        printf("\t\t========== Segment (Compact Message) ===========\n");
+        printf("\t\tLength of segment:          %d\n", segment[0]);
+        printf("\t\tSequence number:            %d\n", segment[1]);
+        printf("\t\tDestination port number:    %02x\n", segment[2]);
+        printf("\t\tSource port number:         %02x\n", segment[3]);
+        printf("\t\tSegment identifier:         %02x (COMPACT)\n", segment[4]);
+        printf("\t\tThe message:                %s\n", payload);
+        printf("\t\t=================================================\n");
+        break;
+    }
+
     default:
         printf("\t\t========== Segment (Invalid) ===========\n");
         printf("\t\tLength of segment:          %d\n", segment[0]);
@@ -109,14 +154,40 @@ void print_packet(byte* packet) {
     // packet[0] = length of packet
     // packet[1] = final destination network address
     // packet[2] = original source network address
+    // packet[3] = packet ID
+    // packet[4] = hop limit and flags
     // rest is payload
 
     printf("\t========== Packet ==========\n");
     printf("\tPacket length:    %d\n", packet[0]);
     printf("\tDestination addr: %02x\n", packet[1]);
     printf("\tSource addr:      %02x\n", packet[2]);
+    printf("\tPacket ID:        %d\n", packet[3]);
+    printf("\tHops left:        %d\n", packet[4] & PACKET_TTL_MASK);
     printf("\tPayload:\n");
     print_segment(&packet[PACKET_HEADER_LEN]);
     printf("\t============================\n");
 
-}
\ No newline at end of file
+}
+
+static const char* trace_event_name(trace_event_t event) {
+    switch (event) {
+    case TRACE_FRAME_TX:  return "TX";
+    case TRACE_FRAME_RX:  return "RX";
+    case TRACE_FORWARD:   return "FWD";
+    case TRACE_ACK:       return "ACK";
+    case TRACE_RETRY:     return "RETRY";
+    case TRACE_TIMEOUT:   return "TIMEOUT";
+    case TRACE_HOP:       return "HOP";
+    default:              return "?";
+    }
+}
+
+void print_trace(trace_event_t event, byte a, byte b, byte c, byte d) {
+    printf("%s %02x %02x %02x %02x\n", trace_event_name(event), a, b, c, d);
+}
+
+void print_trace_packet(trace_event_t event, byte* packet) {
+    printf("%s %02x->%02x\n", trace_event_name(event), packet[2], packet[1]);
+    print_packet(packet);
+}
@@ -4,8 +4,23 @@
 #include "networking_constants.h"
 #include <stdio.h>
 
+// Protocol events that get traced as they happen.
+typedef enum {
+    TRACE_FRAME_TX  = 0x01, // a: dest, b: src, c: segment id, d: seq
+    TRACE_FRAME_RX  = 0x02, // same
+    TRACE_FORWARD   = 0x03, // same
+    TRACE_ACK       = 0x04, // a: seq, b: dest port, c: source port
+    TRACE_RETRY     = 0x05, // a: dest port, b: seq, c: attempt
+    TRACE_TIMEOUT   = 0x06, // a: port, b-c: the RTO that ran out, high byte first
+    TRACE_HOP       = 0x07  // a: source, b: dest, c: a node on the way, d: ms it held the packet
+} trace_event_t;
+
 void print_segment(byte* segment);
 
 void print_packet(byte* packet);
 
+// The simulation always prints events as text.
+void print_trace(trace_event_t event, byte a, byte b, byte c, byte d);
+void print_trace_packet(trace_event_t event, byte* packet);
+
 #endif
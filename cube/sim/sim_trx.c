@@ -8,41 +8,503 @@
 */
 
 #include "sim_trx.h"
-
-// This file simulates the behavior of the transceiver.
-// It requires Linux-style FIFOs because Windows makes
-// things hard. This code will only compile and run on Linux.
-// WSL might work?
+#include "profile.h"
+
+// This file simulates the behavior of the transceiver, and the air between
+// them. Every simulated node has a UNIX datagram socket named after its
+// address, and sending a payload is one non-blocking sendto, so a node that
+// isn't reading (or isn't running at all) never holds up the sender. This
+// code will only compile and run on Linux. WSL might work?
+//
+// The air is modeled per link (SIM_RADIO_LINKS, below), either with fixed
+// numbers or by replaying a trace of a real link:
+//
+// - loss: a payload doesn't get there, and the sender doesn't get an ack.
+// - ack loss: it gets there, but the ack doesn't make it back, so the
+//   sender thinks it failed and tries again. This uses the loss of the link
+//   going the other way.
+// - bandwidth: a payload takes 8 * TRX_PAYLOAD_LENGTH / bandwidth seconds on
+//   the air. The sender waits that long, like the radio would.
+// - latency: the receiver holds on to a payload until this long after it
+//   finished coming in.
+// - collisions: two payloads from different senders that are on the air at
+//   the same time at a receiver both get lost there. The senders still get
+//   their acks, since nothing goes back to tell them; the transport layer's
+//   acks are what notice.
+//
+// With SIM_HIL_SOCKET set, anything sent to an address that has no
+// simulated node goes to build/hil_bridge instead, and out over the air from
+// a real transceiver (sim_hil.h). Whatever the air sends back comes in from
+// the bridge as well as the socket.
+//
+// The sender stamps each payload with when it went out, by sim_now_us(),
+// which every node agrees on. That's the host's clock, or with
+// SIM_VIRTUAL_NODES set, a virtual clock that skips over the time everyone
+// spends waiting (sim_delay.h). On the virtual clock, a node waiting to
+// receive is woken up by the sender when the payload is due, instead of by
+// its socket.
 
 // If you get red squigglies here, you're probably on Windows
 
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
-#include <sys/stat.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <poll.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <time.h>
+#include <sys/stat.h>
 #include "sim_delay.h"
+#include "sim_hil.h"
+#include "node_state.h"
+
+// Where each node's socket goes.
+#define SIM_RADIO_SOCKET_FORMAT "/tmp/rocket_rover_radio_%08x"
+
+// The link models come from the file named by this environment variable, one
+// link per line:
+//
+//   <source> <destination> <loss %> <latency ms> <bandwidth kbps>
+//
+// Addresses are in hex, or * for any. The first line that matches a link is
+// the one it gets; links that match no line get the defaults. Lines starting
+// with # are skipped. For example:
+//
+//   # cube 2 can barely hear the rover
+//   3f3f3f3f 3c3c3c3c 60 5 250
+//   * * 10 1 1000
+//
+// Instead of the loss and latency, a link can follow a trace:
+//
+//   <source> <destination> trace <trace file> <bandwidth kbps>
+//
+// A trace file has one step per line, in order:
+//
+//   <ms since the node started> <loss %> <latency ms>
+//
+// and each step holds until the next one; the first holds from the start and
+// the last holds forever. build/link_trace (cube/sim/link_trace.c) makes them
+// from what the sniffer cube heard, with a step per frame (0 or 100% loss),
+// or from the telemetry the cubes send, with a step per report.
+#define SIM_RADIO_LINKS_ENV "SIM_RADIO_LINKS"
+
+// With this set, every node's random numbers start from it (mixed with the
+// node's address) instead of from the time, so a run can be repeated.
+// It takes the place of anything sim_trx_set_seed was given.
+#define SIM_SEED_ENV "SIM_SEED"
+
+// The defaults. 10% loss is the 90% reliability the simulation always had.
+#define SIM_RADIO_DEFAULT_LOSS_PERCENT (10)
+#define SIM_RADIO_DEFAULT_LATENCY_MS (1)
+#define SIM_RADIO_DEFAULT_KBPS (1000)
+
+#define SIM_RADIO_MAX_LINKS (32)
+#define SIM_RADIO_ANY (0)
+
+// Payloads that have come in but haven't been handed out yet.
+#define SIM_RADIO_PENDING (16)
+
+typedef struct {
+    int64_t at_us;              // since the node started
+    uint8_t loss_percent;
+    uint16_t latency_ms;
+} sim_trace_step_t;
+
+typedef struct {
+    trx_address_t source;       // SIM_RADIO_ANY matches every address
+    trx_address_t destination;
+    uint8_t loss_percent;       // the trace's current step, if it has one
+    uint16_t latency_ms;
+    uint16_t kbps;
+    sim_trace_step_t* trace;    // NULL for a fixed link
+    int trace_len;
+    int trace_next;             // the first step that hasn't started yet
+} sim_link_t;
+
+// What goes over the socket.
+typedef struct {
+    trx_address_t source;
+    int64_t air_start_us;       // when it started going out
+    int64_t air_end_us;         // when it was all out
+    int64_t deliver_us;         // when the receiver gets to see it
+    trx_payload_element_t payload[TRX_PAYLOAD_LENGTH];
+} sim_datagram_t;
+
+typedef struct {
+    sim_datagram_t datagram;
+    uint8_t collided;
+} sim_pending_t;
+
+NODE_STATE trx_address_t my_addr;
+NODE_STATE int my_socket = -1;
+NODE_STATE char my_socket_path[108];
+
+// The connection to build/hil_bridge, if there is one.
+NODE_STATE int hil_socket = -1;
+
+NODE_STATE sim_link_t links[SIM_RADIO_MAX_LINKS];
+NODE_STATE int link_count = 0;
+
+// Where trace time starts.
+NODE_STATE int64_t links_started_us;
+
+NODE_STATE sim_pending_t pending[SIM_RADIO_PENDING];
+NODE_STATE int pending_count = 0;
+
+// The last payload that came in, to check the next one against for
+// collisions even after it's been handed out.
+NODE_STATE sim_datagram_t last_arrival;
+NODE_STATE uint8_t have_last_arrival = 0;
+
+NODE_STATE uint32_t collisions = 0;
+
+// Every node gets its own random numbers, even on threads.
+NODE_STATE unsigned int rand_seed;
+
+// These are the same for every node in the process.
+static sim_link_t default_link = {
+    SIM_RADIO_ANY, SIM_RADIO_ANY,
+    SIM_RADIO_DEFAULT_LOSS_PERCENT, SIM_RADIO_DEFAULT_LATENCY_MS, SIM_RADIO_DEFAULT_KBPS, NULL, 0, 0
+};
+static sim_trx_tap_t tap = NULL;
+static unsigned int seed;
+static int have_seed = 0;
+
+// When the last reception started and finished, for timer_elapsed_ms().
+NODE_STATE int64_t rx_started_us;
+NODE_STATE int64_t rx_finished_us;
+
+NODE_STATE trx_link_profile_t current_link_profile = TRX_LINK_PROFILE_DEFAULT;
+NODE_STATE trx_link_stats_t link_stats;
+
+
+static void socket_path(char* path, trx_address_t address) {
+    snprintf(path, 108, SIM_RADIO_SOCKET_FORMAT, address);
+}
 
+static int parse_address(const char* text, trx_address_t* address) {
+    if (strcmp(text, "*") == 0) {
+        *address = SIM_RADIO_ANY;
+        return 1;
+    }
+    char* end;
+    *address = (trx_address_t) strtoul(text, &end, 16);
+    return *end == '\0';
+}
 
-static trx_address_t my_addr;
-char my_fifo[256];
+// Reads a trace file into link. Returns 0 if there's nothing usable in it.
+static int load_trace(sim_link_t* link, const char* file_name) {
+    FILE* file = fopen(file_name, "r");
+    if (file == NULL) {
+        printf("Couldn't open the trace %s\n", file_name);
+        return 0;
+    }
 
-// As a percent
-#define NETWORK_RELIABILITY (90)
+    int capacity = 0;
+    char line[128];
+    link->trace = NULL;
+    link->trace_len = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        long long at_ms;
+        unsigned loss, latency;
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%lld %u %u", &at_ms, &loss, &latency) != 3) continue;
+
+        if (link->trace_len > 0 && at_ms * 1000 < link->trace[link->trace_len - 1].at_us) {
+            printf("Trace %s goes back in time: %s", file_name, line);
+            continue;
+        }
+        if (link->trace_len == capacity) {
+            capacity = capacity == 0 ? 256 : capacity * 2;
+            link->trace = realloc(link->trace, capacity * sizeof(sim_trace_step_t));
+        }
+        sim_trace_step_t* step = &link->trace[link->trace_len++];
+        step->at_us = at_ms * 1000;
+        step->loss_percent = loss > 100 ? 100 : loss;
+        step->latency_ms = latency;
+    }
+    fclose(file);
+
+    if (link->trace_len == 0) {
+        printf("Nothing in the trace %s\n", file_name);
+        free(link->trace);
+        link->trace = NULL;
+        return 0;
+    }
+    link->trace_next = 0;
+    link->loss_percent = link->trace[0].loss_percent;
+    link->latency_ms = link->trace[0].latency_ms;
+    return 1;
+}
+
+// Moves a traced link up to the step it's on now.
+static void follow_trace(sim_link_t* link) {
+    int64_t now = sim_now_us() - links_started_us;
+    while (link->trace_next < link->trace_len && link->trace[link->trace_next].at_us <= now) {
+        link->loss_percent = link->trace[link->trace_next].loss_percent;
+        link->latency_ms = link->trace[link->trace_next].latency_ms;
+        link->trace_next++;
+    }
+}
+
+static void load_links(void) {
+    links_started_us = sim_now_us();
+
+    const char* file_name = getenv(SIM_RADIO_LINKS_ENV);
+    if (file_name == NULL) return;
+
+    FILE* file = fopen(file_name, "r");
+    if (file == NULL) {
+        printf("Couldn't open %s, using the default link\n", file_name);
+        return;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL && link_count < SIM_RADIO_MAX_LINKS) {
+        char source[32], destination[32], trace[200];
+        unsigned loss, latency, kbps;
+        int traced = 0;
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%31s %31s trace %199s %u", source, destination, trace, &kbps) == 4) {
+            traced = 1;
+        }
+        else if (sscanf(line, "%31s %31s %u %u %u", source, destination, &loss, &latency, &kbps) != 5) {
+            continue;
+        }
+
+        sim_link_t* link = &links[link_count];
+        if (!parse_address(source, &link->source) || !parse_address(destination, &link->destination)) {
+            printf("Bad address in %s: %s", file_name, line);
+            continue;
+        }
+        if (traced) {
+            if (!load_trace(link, trace)) continue;
+        }
+        else {
+            link->loss_percent = loss > 100 ? 100 : loss;
+            link->latency_ms = latency;
+            link->trace = NULL;
+        }
+        link->kbps = kbps == 0 ? 1 : kbps;
+        link_count++;
+    }
+    fclose(file);
+    printf("Loaded %d radio links from %s\n", link_count, file_name);
+}
+
+static sim_link_t find_link(trx_address_t source, trx_address_t destination) {
+    for (int i = 0; i < link_count; i++) {
+        if ((links[i].source == SIM_RADIO_ANY || links[i].source == source)
+            && (links[i].destination == SIM_RADIO_ANY || links[i].destination == destination)) {
+            if (links[i].trace != NULL) follow_trace(&links[i]);
+            return links[i];
+        }
+    }
+    return default_link;
+}
+
+static int chance(uint8_t percent) {
+    return rand_r(&rand_seed) % 100 < percent;
+}
+
+// Queues a packet from the bridge, due right away. The bridge only works on
+// the host's clock, where collisions are the air's business.
+static void take_hil_frame(const sim_hil_message_t* message) {
+    if (pending_count == SIM_RADIO_PENDING) return;
+    sim_pending_t* slot = &pending[pending_count++];
+    memset(slot, 0, sizeof(*slot));
+    slot->datagram.source = message->address;
+    slot->datagram.air_start_us = slot->datagram.air_end_us = slot->datagram.deliver_us = sim_now_us();
+    memcpy(slot->datagram.payload, message->payload, TRX_PAYLOAD_LENGTH);
+}
+
+// Reads whatever has come in into pending, checking each one for a
+// collision with the last.
+static void drain_socket(void) {
+    sim_datagram_t datagram;
+
+    if (hil_socket != -1) {
+        sim_hil_message_t message;
+        while (recv(hil_socket, &message, sizeof(message), MSG_DONTWAIT) == sizeof(message)) {
+            if (message.type == SIM_HIL_FRAME) take_hil_frame(&message);
+        }
+    }
+
+    while (recv(my_socket, &datagram, sizeof(datagram), MSG_DONTWAIT) == sizeof(datagram)) {
+
+        uint8_t collided = 0;
+        if (have_last_arrival && last_arrival.source != datagram.source
+            && datagram.air_start_us < last_arrival.air_end_us
+            && last_arrival.air_start_us < datagram.air_end_us) {
+            collided = 1;
+            collisions++;
+            // The other one's gone too, if it hasn't been handed out yet.
+            for (int i = 0; i < pending_count; i++) {
+                if (pending[i].datagram.source == last_arrival.source
+                    && pending[i].datagram.air_start_us == last_arrival.air_start_us) {
+                    pending[i].collided = 1;
+                }
+            }
+        }
+        last_arrival = datagram;
+        have_last_arrival = 1;
+
+        if (pending_count == SIM_RADIO_PENDING) {
+            continue;           // The RX FIFO's full, the radio drops it
+        }
+        pending[pending_count].datagram = datagram;
+        pending[pending_count].collided = collided;
+        pending_count++;
+    }
+}
+
+// Hands out the oldest payload that's due, skipping the ones that collided.
+// Returns 1 if there was one.
+static int take_pending(trx_payload_element_t* payload_buffer, int64_t now) {
+    while (pending_count > 0 && pending[0].datagram.deliver_us <= now) {
+        sim_pending_t first = pending[0];
+        memmove(&pending[0], &pending[1], (pending_count - 1) * sizeof(pending[0]));
+        pending_count--;
+        if (first.collided) continue;
+        memcpy(payload_buffer, first.datagram.payload, TRX_PAYLOAD_LENGTH);
+        return 1;
+    }
+    return 0;
+}
 
 
 // Initializes the TRX, including initializing the SPI and any other peripherals
 // required.
 void trx_initialize(trx_address_t rx_address) {
-    srand(time(NULL));
+    const char* seed_text = getenv(SIM_SEED_ENV);
+    if (seed_text != NULL) sim_trx_set_seed((unsigned int) strtoul(seed_text, NULL, 0));
+    rand_seed = (have_seed ? seed : (unsigned int) time(NULL)) ^ rx_address;
     my_addr = rx_address;
-    sprintf(my_fifo, "/tmp/rocket_rover_fifo_test_%#010x", rx_address);
-    printf("Creating a FIFO: %s\n", my_fifo);
-    mkfifo(my_fifo, 0666);
+    sim_name_node(rx_address);
+    load_links();
+
+    socket_path(my_socket_path, rx_address);
+    unlink(my_socket_path);         // Left over from a run that didn't clean up
+
+    my_socket = socket(AF_UNIX, SOCK_DGRAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, my_socket_path, sizeof(addr.sun_path) - 1);
+    if (my_socket == -1 || bind(my_socket, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+        printf("ERROR: Could not open the radio socket %s: %s\n", my_socket_path, strerror(errno));
+        return;
+    }
+    printf("Listening on %s\n", my_socket_path);
+
+    const char* hil_path = getenv(SIM_HIL_SOCKET_ENV);
+    if (hil_path == NULL) return;
+
+    struct sockaddr_un hil_addr;
+    memset(&hil_addr, 0, sizeof(hil_addr));
+    hil_addr.sun_family = AF_UNIX;
+    strncpy(hil_addr.sun_path, hil_path, sizeof(hil_addr.sun_path) - 1);
+    hil_socket = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (hil_socket == -1 || connect(hil_socket, (struct sockaddr*) &hil_addr, sizeof(hil_addr)) == -1) {
+        printf("ERROR: Could not reach the HIL bridge at %s: %s\n", hil_path, strerror(errno));
+        if (hil_socket != -1) close(hil_socket);
+        hil_socket = -1;
+        return;
+    }
+
+    sim_hil_message_t hello;
+    memset(&hello, 0, sizeof(hello));
+    hello.type = SIM_HIL_HELLO;
+    hello.address = rx_address;
+    send(hil_socket, &hello, sizeof(hello), 0);
+    printf("Bridged to the air through %s\n", hil_path);
+}
+
+// There's nothing to power up. If the socket didn't open, trx_initialize
+// has already said so.
+uint8_t trx_ready(void) {
+    return 1;
+}
+
+// Whether a simulated node is listening at the address.
+static int simulated(trx_address_t address) {
+    char path[108];
+    struct stat info;
+    socket_path(path, address);
+    return stat(path, &info) == 0;
+}
+
+// Puts a payload on the real air, through the bridge, and waits to hear how
+// it went.
+static trx_transmission_outcome_t transmit_hil(trx_address_t address, trx_payload_element_t* payload, int payload_length, int broadcast) {
+
+    sim_hil_message_t message;
+    memset(&message, 0, sizeof(message));
+    message.type = SIM_HIL_TX;
+    message.broadcast = broadcast;
+    message.length = payload_length;
+    message.address = address;
+    memcpy(message.payload, payload, payload_length);
+
+    if (send(hil_socket, &message, sizeof(message), 0) != sizeof(message)) {
+        link_stats.lost++;
+        return TRX_TRANSMISSION_FAILURE;
+    }
+
+    // Packets for us can come in ahead of the result.
+    while (recv(hil_socket, &message, sizeof(message), 0) == sizeof(message)) {
+        if (message.type == SIM_HIL_FRAME) {
+            take_hil_frame(&message);
+            continue;
+        }
+        if (message.type != SIM_HIL_RESULT) continue;
+
+        link_stats.last_retransmissions = message.retransmissions;
+        link_stats.retransmissions += message.retransmissions;
+        if (message.outcome == TRX_TRANSMISSION_FAILURE) link_stats.lost++;
+        return message.outcome;
+    }
+
+    // The bridge went away.
+    printf("ERROR: Lost the HIL bridge\n");
+    close(hil_socket);
+    hil_socket = -1;
+    link_stats.lost++;
+    return TRX_TRANSMISSION_FAILURE;
+}
+
+// Puts a payload on the air, or doesn't.
+static trx_transmission_outcome_t send_datagram(trx_address_t address, sim_datagram_t* datagram, sim_link_t link) {
+
+    // Randomly fail to transmit.
+    if (chance(link.loss_percent)) {
+        link_stats.lost++;
+        return TRX_TRANSMISSION_FAILURE;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    socket_path(addr.sun_path, address);
+
+    // Nobody listening at that address (or their socket is full) is the same
+    // as nobody hearing it.
+    if (sendto(my_socket, datagram, sizeof(*datagram), MSG_DONTWAIT, (struct sockaddr*) &addr, sizeof(addr)) != sizeof(*datagram)) {
+        link_stats.lost++;
+        return TRX_TRANSMISSION_FAILURE;
+    }
+    sim_notify_us(address, datagram->deliver_us);
+
+    // Randomly lose the acknowledgement on the way back.
+    if (chance(find_link(address, my_addr).loss_percent)) {
+        return TRX_TRANSMISSION_FAILURE;
+    }
+    return TRX_TRANSMISSION_SUCCESS;
 }
 
 // Transmits a payload to the given address.
@@ -50,56 +512,137 @@ void trx_initialize(trx_address_t rx_address) {
 // Sometimes, the payload will not send.
 // Sometimes, the payload will send, but we will
 // not get our acknowledgement back.
-trx_transmission_outcome_t trx_transmit_payload(
+static trx_transmission_outcome_t transmit(
     trx_address_t address,
     trx_payload_element_t *payload,
-    int payload_length
+    int payload_length,
+    int broadcast
 ) {
+    sim_link_t link = find_link(my_addr, address);
+    sim_datagram_t datagram;
 
-    _delay_ms(1);
-
-    // Randomly fail to transmit.
-    if (!(rand() % 100 < NETWORK_RELIABILITY)) {
-        return TRX_TRANSMISSION_FAILURE;
-    }
-
-    // prepare FIFO name
-    char destination_fifo[256];
-    sprintf(destination_fifo, "/tmp/rocket_rover_fifo_test_%#010x", address);
+    PROFILE_BEGIN(PROFILE_TRX_TRANSMIT);
+    link_stats.transmissions++;
 
     // prepare payload
-    char final_payload[TRX_PAYLOAD_LENGTH];
-    for (int i = 0; i < TRX_PAYLOAD_LENGTH; i++) {
-        final_payload[i] = '\0';
-    }
+    memset(&datagram, 0, sizeof(datagram));
     if (!(payload_length < TRX_PAYLOAD_LENGTH)) {
         payload_length = TRX_PAYLOAD_LENGTH;
     }
-    for (int i = 0; i < payload_length; i++) {
-        final_payload[i] = payload[i];
+    memcpy(datagram.payload, payload, payload_length);
+
+    if (hil_socket != -1 && !simulated(address)) {
+        trx_transmission_outcome_t outcome = transmit_hil(address, datagram.payload, payload_length, broadcast);
+        if (tap != NULL) tap(my_addr, address, datagram.payload, outcome);
+        PROFILE_END(PROFILE_TRX_TRANSMIT);
+        return outcome;
     }
 
+    int64_t air_us = (int64_t) TRX_PAYLOAD_LENGTH * 8 * 1000 / link.kbps;
+    datagram.source = my_addr;
+    datagram.air_start_us = sim_now_us();
+    datagram.air_end_us = datagram.air_start_us + air_us;
+    datagram.deliver_us = datagram.air_end_us + (int64_t) link.latency_ms * 1000;
 
+    // It's on the air for this long either way.
+    sim_wait_until_us(datagram.air_end_us);
 
-    // Open FIFO
-    int fd = open(destination_fifo, O_WRONLY);
+    trx_transmission_outcome_t outcome = send_datagram(address, &datagram, link);
+    if (tap != NULL) tap(my_addr, address, datagram.payload, outcome);
+    PROFILE_END(PROFILE_TRX_TRANSMIT);
+    return outcome;
+}
 
-    // Write to FIFO
-    write(fd, final_payload, TRX_PAYLOAD_LENGTH);
+trx_transmission_outcome_t trx_transmit_payload(
+    trx_address_t address,
+    trx_payload_element_t *payload,
+    int payload_length
+) {
+    return transmit(address, payload, payload_length, 0);
+}
 
-    // Close FIFO
-    close(fd);
+// There's no FIFO to keep full, so a burst is just one transmission after
+// another.
+uint8_t trx_transmit_burst(
+  trx_address_t address,
+  trx_payload_element_t * const *payloads,
+  const uint8_t *payload_lengths,
+  uint8_t count,
+  trx_transmission_outcome_t *outcomes
+) {
+    uint8_t sent = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        outcomes[i] = trx_transmit_payload(address, payloads[i], payload_lengths[i]);
+        if (outcomes[i] == TRX_TRANSMISSION_SUCCESS) sent++;
+    }
+    return sent;
+}
 
+void trx_set_link_profile(
+  trx_link_profile_t profile
+) {
+    if (profile < TRX_LINK_PROFILE_COUNT) current_link_profile = profile;
+}
 
-    _delay_ms(1);
+trx_link_profile_t trx_get_link_profile(void) {
+    return current_link_profile;
+}
 
-    // Randomly report a failure. Perhaps our data link acknowledgement was lost.
-    // ...nevermind. My Linux FIFOs lock up when I do this, for some reason...
-    //if (!(rand() % 100 < NETWORK_RELIABILITY)) {
-        //return TRX_TRANSMISSION_FAILURE;
-    //}
-    return TRX_TRANSMISSION_SUCCESS;
+trx_link_stats_t trx_get_link_stats(void) {
+    return link_stats;
+}
 
+void trx_reset_link_stats(void) {
+    link_stats.transmissions = 0;
+    link_stats.retransmissions = 0;
+    link_stats.lost = 0;
+    link_stats.last_retransmissions = 0;
+}
+
+trx_transmission_outcome_t trx_broadcast_payload(
+  trx_address_t address,
+  trx_payload_element_t *payload,
+  int payload_length
+) {
+    return transmit(address, payload, payload_length, 1);
+}
+
+uint8_t trx_add_rx_address(
+  trx_address_t address
+) {
+    return TRX_PIPE_NONE;
+}
+
+uint8_t trx_last_rx_pipe(void) {
+    return TRX_PIPE_UNICAST;
+}
+
+void trx_set_ack_payload(
+  const trx_payload_element_t *payload,
+  uint8_t length
+) {
+}
+
+void trx_clear_ack_payload(void) {
+}
+
+uint8_t trx_ack_payload_sent(void) {
+    return 0;
+}
+
+void trx_set_duty_cycle(
+  timer_delay_ms_t listen_ms,
+  timer_delay_ms_t sleep_ms
+) {
+}
+
+uint8_t trx_asleep(void) {
+    return 0;
+}
+
+void trx_set_wakeup(
+  timer_delay_ms_t wakeup_ms
+) {
 }
 
 // Receives a payload using polling.
@@ -107,50 +650,117 @@ trx_reception_outcome_t trx_receive_payload(
   trx_payload_element_t *payload_buffer,
   uint16_t timer_delay_ms
 ) {
-    // https://man7.org/linux/man-pages/man2/poll.2.html
-    int ready;
-    ssize_t s;
-    struct pollfd fds;
+    if (my_socket == -1) {
+        printf("ERROR: The radio socket isn't open.\n");
+        return TRX_RECEPTION_ERROR;
+    }
 
-    // Open FIFO
-    fds.fd = open(my_fifo, O_RDONLY | O_NONBLOCK);
-    if (fds.fd == -1) {
-        printf("ERROR: Could not open FIFO.\n");
-        return TRX_RECEPTION_FAILURE;
+    rx_started_us = sim_now_us();
+    rx_finished_us = rx_started_us;
+
+    int64_t deadline = sim_now_us() + (int64_t) timer_delay_ms * 1000;
+    int forever = timer_delay_ms >= TRX_TIMEOUT_INDEFINITE;
+
+    while (1) {
+        drain_socket();
+
+        int64_t now = sim_now_us();
+        if (take_pending(payload_buffer, now)) {
+            rx_finished_us = now;
+            return TRX_RECEPTION_SUCCESS;
+        }
+        if (!forever && now >= deadline) {
+            return TRX_RECEPTION_TIMEOUT;
+        }
+
+        // Sleep until something comes in, the next one is due, or time's up.
+        int64_t wake = forever ? -1 : deadline;
+        if (pending_count > 0 && (wake == -1 || pending[0].datagram.deliver_us < wake)) {
+            wake = pending[0].datagram.deliver_us;
+        }
+        if (sim_virtual_time()) {
+            sim_wait_until_us(wake == -1 ? SIM_TIME_FOREVER : wake);
+            continue;
+        }
+        int wait_ms = wake == -1 ? -1 : (int) ((wake - now + 999) / 1000);
+
+        struct pollfd fds[2] = { { my_socket, POLLIN, 0 }, { hil_socket, POLLIN, 0 } };
+        if (poll(fds, hil_socket == -1 ? 1 : 2, wait_ms) == -1 && errno != EINTR) {
+            return TRX_RECEPTION_ERROR;
+        }
     }
+}
 
-    int my_delay = timer_delay_ms;
-    if (my_delay >= TRX_TIMEOUT_INDEFINITE)
-        my_delay = -1;
+uint32_t sim_trx_collisions(void) {
+    return collisions;
+}
 
-    // Wait for data
-    ready = poll(&fds, 1, my_delay);
-    if (ready == -1) {
-        return TRX_RECEPTION_FAILURE;
-    }
-    if (fds.revents == 0) {
-        return TRX_RECEPTION_FAILURE;
-    }
+void sim_trx_set_default_link(uint8_t loss_percent, uint16_t latency_ms, uint16_t kbps) {
+    default_link.loss_percent = loss_percent > 100 ? 100 : loss_percent;
+    default_link.latency_ms = latency_ms;
+    default_link.kbps = kbps == 0 ? 1 : kbps;
+}
 
-    // Read from FIFO
-    s = read(fds.fd, payload_buffer, TRX_PAYLOAD_LENGTH);
-    if (s == -1) {
-        printf("reading failed, s == -1\n");
-        return TRX_RECEPTION_FAILURE;
-    }
+void sim_trx_set_tap(sim_trx_tap_t new_tap) {
+    tap = new_tap;
+}
 
-    // Close the FIFO
-    if (close(fds.fd) == -1) {
-        printf("closing the file failed\n");
-        _delay_ms(1);
-        return TRX_RECEPTION_FAILURE;
-    }
+void sim_trx_set_seed(unsigned int new_seed) {
+    seed = new_seed;
+    have_seed = 1;
+}
+
+void sim_trx_shutdown(void) {
+    if (my_socket == -1) return;
+    close(my_socket);
+    unlink(my_socket_path);
+    my_socket = -1;
+    pending_count = 0;
 
-    return TRX_RECEPTION_SUCCESS;
+    if (hil_socket != -1) close(hil_socket);
+    hil_socket = -1;
 
+    for (int i = 0; i < link_count; i++) free(links[i].trace);
+    link_count = 0;
 }
 
 // You silly goose
 trx_status_buffer_t trx_get_status() {
     return 0;
 }
+
+timer_delay_ms_t timer_elapsed_ms(void) {
+    return (timer_delay_ms_t) ((rx_finished_us - rx_started_us) / 1000);
+}
+
+void trx_start_listening(void) {
+}
+
+trx_reception_outcome_t trx_try_dequeue(
+  trx_payload_element_t *payload_buffer
+) {
+    return trx_receive_payload(payload_buffer, 0);
+}
+
+uint8_t trx_rx_pending(void) {
+    drain_socket();
+    int64_t now = sim_now_us();
+    for (int i = 0; i < pending_count; i++) {
+        if (!pending[i].collided && pending[i].datagram.deliver_us <= now) return 1;
+    }
+    return 0;
+}
+
+NODE_STATE int64_t clock_started_us;
+
+void timer_clock_initialize(void) {
+    clock_started_us = sim_now_us();
+}
+
+timer_delay_ms_t timer_now_ms(void) {
+    return (timer_delay_ms_t) ((sim_now_us() - clock_started_us) / 1000);
+}
+
+void timer_wait_ms(timer_delay_ms_t delay_ms) {
+    _delay_ms(delay_ms);
+}
@@ -39,7 +39,9 @@ typedef uint8_t trx_transmission_outcome_t;
 // Whether a given attempt to receive a transmission succeeded or failed.
 typedef uint8_t trx_reception_outcome_t;
 #define TRX_RECEPTION_FAILURE (0)
-#define TRX_RECEPTION_SUCCESS (1) 
+#define TRX_RECEPTION_SUCCESS (1)
+#define TRX_RECEPTION_ERROR TRX_RECEPTION_FAILURE
+#define TRX_RECEPTION_TIMEOUT (2)
 
 #define TRX_TIMEOUT_INDEFINITE (15001)
 
@@ -50,6 +52,7 @@ typedef uint8_t trx_reception_outcome_t;
 void trx_initialize(
   trx_address_t rx_address
 );
+uint8_t trx_ready(void);
 
 // Transmits a payload to the given address.
 trx_transmission_outcome_t trx_transmit_payload(
@@ -58,15 +61,141 @@ trx_transmission_outcome_t trx_transmit_payload(
   int payload_length
 );
 
+// Link profiles don't change anything in the simulation, but the stack can
+// still pick them.
+typedef enum {
+    TRX_LINK_PROFILE_ROBUST,
+    TRX_LINK_PROFILE_BALANCED,
+    TRX_LINK_PROFILE_FAST,
+    TRX_LINK_PROFILE_LOW_POWER,
+    TRX_LINK_PROFILE_COUNT
+} trx_link_profile_t;
+
+#define TRX_LINK_PROFILE_DEFAULT TRX_LINK_PROFILE_ROBUST
+
+// There are no retransmissions in the simulation, but transmissions and
+// losses are counted.
+typedef struct {
+    uint16_t transmissions;
+    uint16_t retransmissions;
+    uint16_t lost;
+    uint8_t  last_retransmissions;
+} trx_link_stats_t;
+
+void trx_set_link_profile(
+  trx_link_profile_t profile
+);
+trx_link_profile_t trx_get_link_profile(void);
+trx_link_stats_t trx_get_link_stats(void);
+void trx_reset_link_stats(void);
+
+// How many payloads the transceiver's TX FIFO holds.
+#define TRX_TX_FIFO_DEPTH (3)
+
+// Transmits payloads to the same address one after another.
+// outcomes[i] says what happened to payloads[i].
+// Returns how many were sent successfully.
+uint8_t trx_transmit_burst(
+  trx_address_t address,
+  trx_payload_element_t * const *payloads,
+  const uint8_t *payload_lengths,
+  uint8_t count,
+  trx_transmission_outcome_t *outcomes
+);
+
 // Receives a payload using polling.
 trx_reception_outcome_t trx_receive_payload(
   trx_payload_element_t *payload_buffer,
   uint16_t timer_delay_ms
 );
 
+// The socket is always there to read, so this does nothing.
+void trx_start_listening(void);
+
+// Reads a payload if one is waiting, without blocking.
+trx_reception_outcome_t trx_try_dequeue(
+  trx_payload_element_t *payload_buffer
+);
+
+// Whether a payload is ready for trx_try_dequeue.
+uint8_t trx_rx_pending(void);
+
+// How many payloads have been lost to collisions at this node (see
+// sim_trx.c).
+uint32_t sim_trx_collisions(void);
+
+// The link model for every link SIM_RADIO_LINKS doesn't mention, for every
+// node in the process.
+void sim_trx_set_default_link(uint8_t loss_percent, uint16_t latency_ms, uint16_t kbps);
+
+// Gets called for every payload any node in the process puts on the air,
+// lost or not, on the sending node's thread. outcome is what the sender was
+// told. NULL turns it off.
+typedef void (*sim_trx_tap_t)(trx_address_t from, trx_address_t to, const trx_payload_element_t* payload, trx_transmission_outcome_t outcome);
+void sim_trx_set_tap(sim_trx_tap_t tap);
+
+// Starts every node's random numbers from seed (mixed with its address)
+// instead of from the time, for nodes initialized after this. The same seed,
+// links and workload on the virtual clock give the same run. SIM_SEED in the
+// environment takes its place.
+void sim_trx_set_seed(unsigned int seed);
+
+// Closes this node's socket, for a node that's done.
+void sim_trx_shutdown(void);
+
+// The simulation only has one socket per node, so there's nowhere to listen
+// for other addresses. trx_add_rx_address always fails, and everything
+// comes in on TRX_PIPE_UNICAST.
+#define TRX_PIPE_COUNT (6)
+#define TRX_PIPE_UNICAST (0)
+#define TRX_PIPE_NONE (0xFF)
+
+trx_transmission_outcome_t trx_broadcast_payload(
+  trx_address_t address,
+  trx_payload_element_t *payload,
+  int payload_length
+);
+uint8_t trx_add_rx_address(
+  trx_address_t address
+);
+uint8_t trx_last_rx_pipe(void);
+
+// There are no hardware acknowledgements in the simulation, so there's
+// nothing to carry an ack payload. trx_ack_payload_sent always says no.
+void trx_set_ack_payload(
+  const trx_payload_element_t *payload,
+  uint8_t length
+);
+void trx_clear_ack_payload(void);
+uint8_t trx_ack_payload_sent(void);
+
+// Simulated nodes never sleep, so the duty cycle and the wake-up
+// retransmission do nothing.
+#define TRX_DUTY_CYCLE_MAX_SLEEP_MS (2000)
+#define TRX_WAKEUP_MS (2010)
+void trx_set_duty_cycle(
+  timer_delay_ms_t listen_ms,
+  timer_delay_ms_t sleep_ms
+);
+uint8_t trx_asleep(void);
+void trx_set_wakeup(
+  timer_delay_ms_t wakeup_ms
+);
+
 // Gets the value currently in the status buffer. This is equivalent to what was
 // in the transceiver's status register at the beginning of the last SPI
 // transaction.
 trx_status_buffer_t trx_get_status();
 
+// Returns how many milliseconds the last call to trx_receive_payload waited.
+// Stands in for the hardware timer_elapsed_ms().
+timer_delay_ms_t timer_elapsed_ms(void);
+
+// Stand in for the hardware millisecond clock, using the host's clock.
+void timer_clock_initialize(void);
+timer_delay_ms_t timer_now_ms(void);
+
+// Stand in for the hardware's sleeping wait, which is just _delay_ms here.
+void timer_wait_ms(timer_delay_ms_t delay_ms);
+
 #endif
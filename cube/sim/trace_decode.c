@@ -0,0 +1,97 @@
+// Turns what a data cube printed with PRINT_DATA_BINARY_TRACE back into
+// something readable. Text passes straight through; binary records are
+// decoded one per line.
+//
+// Usage: build/trace_decode < capture.bin
+//        build/trace_decode capture.bin
+
+#include "print_data.h"
+#include "transport.h"
+
+#include <stdio.h>
+
+static const char* segment_name(byte segid) {
+    switch (segid) {
+    case SEGID_START_OF_MESSAGE:  return "START_OF_MESSAGE";
+    case SEGID_DATA:              return "DATA";
+    case SEGID_END_OF_MESSAGE:    return "END_OF_MESSAGE";
+    case SEGID_ACK:               return "ACK";
+    case SEGID_SACK:              return "SACK";
+    case SEGID_COMPACT:           return "COMPACT";
+    default:                      return "INVALID";
+    }
+}
+
+static void print_record(const byte* record) {
+
+    uint16_t time_ms = record[2] | (record[3] << 8);
+    byte a = record[4];
+    byte b = record[5];
+    byte c = record[6];
+    byte d = record[7];
+
+    printf("[%5u ms] ", time_ms);
+
+    switch (record[1]) {
+    case TRACE_FRAME_TX:
+    case TRACE_FRAME_RX:
+    case TRACE_FORWARD:
+        printf("%-7s %02x->%02x SegID %02x (%s) seq %d\n",
+            record[1] == TRACE_FRAME_TX ? "TX" : record[1] == TRACE_FRAME_RX ? "RX" : "FWD",
+            b, a, c, segment_name(c), d);
+        break;
+    case TRACE_ACK:
+        printf("ACK     seq %d to port %02x from port %02x\n", a, b, c);
+        break;
+    case TRACE_RETRY:
+        printf("RETRY   port %02x seq %d attempt %d\n", a, b, c);
+        break;
+    case TRACE_TIMEOUT:
+        printf("TIMEOUT port %02x after %d ms\n", a, (b << 8) | c);
+        break;
+    case TRACE_HOP:
+        printf("HOP     %02x->%02x via %02x, held %d ms\n", a, b, c, d);
+        break;
+    default:
+        printf("?? %02x %02x %02x %02x %02x\n", record[1], a, b, c, d);
+        break;
+    }
+}
+
+int main(int argc, char** argv) {
+
+    FILE* in = stdin;
+    if (argc > 1) {
+        in = fopen(argv[1], "rb");
+        if (in == NULL) {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    int c;
+    while ((c = fgetc(in)) != EOF) {
+
+        if (c != TRACE_SYNC) {
+            putchar(c);
+            continue;
+        }
+
+        byte record[TRACE_RECORD_LEN];
+        record[0] = TRACE_SYNC;
+        int i;
+        for (i = 1; i < TRACE_RECORD_LEN; i++) {
+            c = fgetc(in);
+            if (c == EOF) break;
+            record[i] = (byte) c;
+        }
+        if (i < TRACE_RECORD_LEN) {
+            printf("[truncated record]\n");
+            break;
+        }
+        print_record(record);
+    }
+
+    if (in != stdin) fclose(in);
+    return 0;
+}
@@ -0,0 +1,103 @@
+/* * * * * * * * * * * * * * *
+       Sniffer Software
+ * * * * * * * * * * * * * * */
+
+#include "sniffer.h"
+#include "digital_io.h"
+#include "trx.h"
+#include "timer.h"
+#include "uart.h"
+
+#include "cube_parameters.h"
+
+// Only pass on captures sent to a byte repeated four times, which is what
+// every data link address in this design is (address.h). Nearly everything
+// else is noise that happened to look like a preamble. Build with
+// -DSNIFFER_ONLY_OURS=0 to see it all.
+#ifndef SNIFFER_ONLY_OURS
+#define SNIFFER_ONLY_OURS (1)
+#endif
+
+static uint8_t ours(const trx_payload_element_t *capture) {
+    return capture[0] == capture[1] && capture[1] == capture[2] && capture[2] == capture[3];
+}
+
+// Channel and profile changes come in over the UART as a line of text: a
+// channel number, or p and a profile number.
+static void take_command(void) {
+
+    static uint8_t typed = 0;
+    static uint8_t profile = 0;
+    static uint16_t number = 0;
+    uart_message_element_t c;
+
+    while (uart_try_receive(&c)) {
+        if (c >= '0' && c <= '9') {
+            number = number * 10 + (c - '0');
+            typed = 1;
+        }
+        else if (c == 'p' || c == 'P') {
+            profile = 1;
+        }
+        else if ((c == '\r' || c == '\n') && typed) {
+            if (profile && number < TRX_LINK_PROFILE_COUNT) {
+                trx_set_link_profile((trx_link_profile_t) number);
+            }
+            else if (!profile && number <= TRX_CHANNEL_MAX) {
+                trx_set_channel((uint8_t) number);
+            }
+            // Both of them leave the receiver off.
+            trx_start_sniffing();
+            uart_transmit_formatted_message_P(PSTR("\r\n::: Channel %u, profile %u :::\r\n"),
+                trx_get_channel(), trx_get_link_profile());
+            typed = 0;
+            profile = 0;
+            number = 0;
+        }
+    }
+
+}
+
+int main() {
+
+    digital_io_initialize();
+    uart_initialize();
+    timer_clock_initialize();
+
+    LED_set(LED_OFF);
+    uart_transmit_formatted_message_P(PSTR("\r\n::: Sniffer :::\r\n"));
+
+    trx_initialize(0);
+    trx_start_sniffing();
+
+    uart_transmit_formatted_message_P(PSTR("::: Channel %u, profile %u :::\r\n"),
+        trx_get_channel(), trx_get_link_profile());
+    LED_set(LED_BLUE);
+
+    uint8_t record[SNIFFER_RECORD_LEN];
+    record[0] = SNIFFER_SYNC_0;
+    record[1] = SNIFFER_SYNC_1;
+
+    while (1) {
+
+        // Take the time first, so it's as close as it can be to the capture
+        // finishing. It's late by however long the loop takes to come back
+        // around, which is a few hundred microseconds while the UART is busy.
+        uint32_t time_us = timer_now_us();
+
+        if (trx_sniff(&record[SNIFFER_CAPTURE_INDEX]) != TRX_RECEPTION_SUCCESS) {
+            take_command();
+            continue;
+        }
+
+        if (SNIFFER_ONLY_OURS && !ours(&record[SNIFFER_CAPTURE_INDEX])) continue;
+
+        for (uint8_t i = 0; i < 4; i++) {
+            record[SNIFFER_TIME_INDEX + i] = (uint8_t) (time_us >> (8 * i));
+        }
+        record[SNIFFER_CHANNEL_INDEX] = trx_get_channel();
+
+        uart_transmit_bytes(record, SNIFFER_RECORD_LEN);
+
+    }
+}
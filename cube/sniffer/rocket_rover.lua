@@ -0,0 +1,169 @@
+-- Wireshark dissector for the sniffer cube's captures, by way of
+-- build/sniffer_pcap (cube/sniffer/sniffer_pcap.c).
+--
+-- Copy it into Wireshark's personal plugins folder (Help > About > Folders),
+-- or run wireshark -X lua_script:cube/sniffer/rocket_rover.lua capture.pcap
+--
+-- Each pcap packet is the 8-byte header sniffer_pcap.c writes, then the
+-- Enhanced ShockBurst payload. The payload is a data link frame: one or more
+-- packets (networking_constants.h), each with a segment (transport.c) inside.
+-- A payload with an unchecked CRC was cut off by the capture, so the last
+-- packet in it can be short.
+
+local esb = Proto("rocket_rover_esb", "Rocket Rover ESB")
+local packet = Proto("rocket_rover_packet", "Rocket Rover Packet")
+local segment = Proto("rocket_rover_segment", "Rocket Rover Segment")
+
+local crc_names = {
+    [0x01] = "good",
+    [0x02] = "bad",
+    [0x04] = "not captured",
+}
+
+local segid_names = {
+    [0x07] = "START_OF_MESSAGE",
+    [0x0D] = "DATA",
+    [0x09] = "END_OF_MESSAGE",
+    [0x0A] = "ACK",
+    [0x0B] = "SACK",
+    [0x0C] = "COMPACT",
+}
+
+local priority_names = {
+    [0] = "data",
+    [1] = "ack",
+    [2] = "control",
+}
+
+local esb_fields = {
+    crc = ProtoField.uint8("rocket_rover_esb.crc", "CRC", base.HEX, crc_names),
+    channel = ProtoField.uint8("rocket_rover_esb.channel", "Channel"),
+    address = ProtoField.uint32("rocket_rover_esb.address", "Address", base.HEX),
+    length = ProtoField.uint8("rocket_rover_esb.length", "Payload length"),
+    pid = ProtoField.uint8("rocket_rover_esb.pid", "Packet ID", base.DEC, nil, 0x06),
+    no_ack = ProtoField.bool("rocket_rover_esb.no_ack", "No acknowledgement", 8, nil, 0x01),
+}
+esb.fields = esb_fields
+
+local packet_fields = {
+    length = ProtoField.uint8("rocket_rover_packet.length", "Length"),
+    dest = ProtoField.uint8("rocket_rover_packet.dest", "Destination", base.HEX),
+    src = ProtoField.uint8("rocket_rover_packet.src", "Source", base.HEX),
+    id = ProtoField.uint8("rocket_rover_packet.id", "Packet ID"),
+    ttl = ProtoField.uint8("rocket_rover_packet.ttl", "Hop limit", base.DEC, nil, 0x0F),
+    hop_trace = ProtoField.bool("rocket_rover_packet.hop_trace", "Hop trace", 8, nil, 0x10),
+    priority = ProtoField.uint8("rocket_rover_packet.priority", "Priority", base.DEC, priority_names, 0x60),
+}
+packet.fields = packet_fields
+
+local segment_fields = {
+    length = ProtoField.uint8("rocket_rover_segment.length", "Length"),
+    seq = ProtoField.uint8("rocket_rover_segment.seq", "Sequence number"),
+    dest_port = ProtoField.uint8("rocket_rover_segment.dest_port", "Destination port", base.HEX),
+    src_port = ProtoField.uint8("rocket_rover_segment.src_port", "Source port", base.HEX),
+    segid = ProtoField.uint8("rocket_rover_segment.segid", "Type", base.HEX, segid_names),
+    message_len = ProtoField.uint16("rocket_rover_segment.message_len", "Message length"),
+    offset = ProtoField.uint16("rocket_rover_segment.offset", "Offset"),
+    cumulative = ProtoField.uint16("rocket_rover_segment.cumulative", "Cumulative offset"),
+    flags = ProtoField.uint8("rocket_rover_segment.flags", "Flags", base.HEX),
+    bitmap = ProtoField.uint8("rocket_rover_segment.bitmap", "Bitmap", base.HEX),
+    data = ProtoField.bytes("rocket_rover_segment.data", "Data"),
+}
+segment.fields = segment_fields
+
+local function dissect_segment(tvb, tree)
+    local len = tvb:len()
+    if len < 5 then return nil end
+
+    local segid = tvb(4, 1):uint()
+    local subtree = tree:add(segment, tvb())
+    subtree:add(segment_fields.length, tvb(0, 1))
+    subtree:add(segment_fields.seq, tvb(1, 1))
+    subtree:add(segment_fields.dest_port, tvb(2, 1))
+    subtree:add(segment_fields.src_port, tvb(3, 1))
+    subtree:add(segment_fields.segid, tvb(4, 1))
+
+    local name = segid_names[segid] or string.format("0x%02x", segid)
+    local data_start = 5
+    if len >= 8 then
+        if segid == 0x07 then
+            subtree:add(segment_fields.message_len, tvb(5, 2))
+            subtree:add(segment_fields.flags, tvb(7, 1))
+            data_start = len
+        elseif segid == 0x0D then
+            subtree:add(segment_fields.offset, tvb(5, 2))
+            subtree:add(segment_fields.flags, tvb(7, 1))
+            data_start = 8
+        elseif segid == 0x0B then
+            subtree:add(segment_fields.cumulative, tvb(5, 2))
+            subtree:add(segment_fields.bitmap, tvb(7, 1))
+            data_start = len
+        end
+    end
+    if (segid == 0x0D or segid == 0x0C) and data_start < len then
+        subtree:add(segment_fields.data, tvb(data_start))
+    end
+
+    subtree:append_text(string.format(", %s, seq %d", name, tvb(1, 1):uint()))
+    return name
+end
+
+local function dissect_frame(tvb, pinfo, tree)
+    local offset = 0
+    local summary = {}
+
+    while offset + 5 <= tvb:len() do
+        local len = tvb(offset, 1):uint()
+        if len == 0 then break end         -- the rest is padding
+
+        local available = math.min(len, tvb:len() - offset)
+        local p = tvb(offset, available)
+        local subtree = tree:add(packet, p)
+        subtree:add(packet_fields.length, p(0, 1))
+        subtree:add(packet_fields.dest, p(1, 1))
+        subtree:add(packet_fields.src, p(2, 1))
+        subtree:add(packet_fields.id, p(3, 1))
+        subtree:add(packet_fields.ttl, p(4, 1))
+        subtree:add(packet_fields.hop_trace, p(4, 1))
+        subtree:add(packet_fields.priority, p(4, 1))
+        subtree:append_text(string.format(", %02x -> %02x", p(2, 1):uint(), p(1, 1):uint()))
+        if available < len then subtree:append_text(" [cut off]") end
+
+        local name
+        if available > 5 then
+            name = dissect_segment(p(5):tvb(), subtree)
+        end
+        table.insert(summary, string.format("%02x->%02x %s", p(2, 1):uint(), p(1, 1):uint(), name or ""))
+
+        offset = offset + len
+    end
+
+    if #summary > 0 then pinfo.cols.info:set(table.concat(summary, "; ")) end
+end
+
+function esb.dissector(tvb, pinfo, tree)
+    if tvb:len() < 8 then return 0 end
+
+    pinfo.cols.protocol:set("ROCKET")
+
+    local subtree = tree:add(esb, tvb(0, 8))
+    subtree:add(esb_fields.crc, tvb(0, 1))
+    subtree:add(esb_fields.channel, tvb(1, 1))
+    subtree:add(esb_fields.address, tvb(2, 4))
+    subtree:add(esb_fields.length, tvb(6, 1))
+    subtree:add(esb_fields.pid, tvb(7, 1))
+    subtree:add(esb_fields.no_ack, tvb(7, 1))
+
+    local length = tvb(6, 1):uint()
+    pinfo.cols.src:set(string.format("ch %d", tvb(1, 1):uint()))
+    pinfo.cols.dst:set(string.format("%08x", tvb(2, 4):uint()))
+
+    if length == 0 then
+        pinfo.cols.info:set("acknowledgement")
+    elseif tvb:len() > 8 then
+        dissect_frame(tvb(8):tvb(), pinfo, tree)
+    end
+    return tvb:len()
+end
+
+DissectorTable.get("wtap_encap"):add(wtap.USER0, esb)
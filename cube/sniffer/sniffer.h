@@ -0,0 +1,93 @@
+#ifndef _SNIFFER_H
+#define _SNIFFER_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Sniffer
+//
+// A cube that only listens (trx_start_sniffing), and sends everything it hears
+// out of the UART, as binary records, with the time it heard it. Nothing it
+// does goes over the air, so it can sit next to a flight without changing it.
+// build/sniffer_pcap (cube/sniffer/sniffer_pcap.c) turns the records into a
+// pcap file, and cube/sniffer/rocket_rover.lua shows them in Wireshark.
+//
+// Type a channel number and return into the serial port to move to another
+// channel, or p and a link profile number (trx.h) to change the data rate.
+// It starts on TRX's default channel and profile.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+
+/*
+    Record Layout
+
+    record[0..1]    = SNIFFER_SYNC_0, SNIFFER_SYNC_1
+    record[2..5]    = microseconds since power up, low byte first. Wraps
+                      around about every 71 minutes.
+    record[6]       = the channel it was heard on
+    record[7..38]   = the raw capture: everything the transceiver heard after
+                      the preamble, starting with the sender's address
+
+    Anything between records (the startup banner, answers to commands) is
+    text, and is skipped over.
+
+    The capture is an Enhanced ShockBurst packet, high bit first:
+
+    4 bytes         the address it was sent to
+    9 bits          packet control field: 6 bits of payload length, 2 bits
+                    of packet ID, and a no acknowledgement bit
+    length bytes    the payload
+    8 bits          CRC
+
+    so everything after the address is shifted by a bit. Only 32 bytes are
+    captured, so a payload over 25 bytes is cut off, along with its CRC.
+*/
+
+#define SNIFFER_SYNC_0              (0xA5)
+#define SNIFFER_SYNC_1              (0x5A)
+
+#define SNIFFER_TIME_INDEX          (2)
+#define SNIFFER_CHANNEL_INDEX       (6)
+#define SNIFFER_CAPTURE_INDEX       (7)
+#define SNIFFER_CAPTURE_LEN         (32)
+#define SNIFFER_RECORD_LEN          (SNIFFER_CAPTURE_INDEX + SNIFFER_CAPTURE_LEN)
+
+// Where the pieces of a capture are, in bits from its start.
+#define SNIFFER_ADDRESS_LEN         (4)
+#define SNIFFER_PCF_BIT             (SNIFFER_ADDRESS_LEN * 8)
+#define SNIFFER_PCF_BITS            (9)
+#define SNIFFER_PAYLOAD_BIT         (SNIFFER_PCF_BIT + SNIFFER_PCF_BITS)
+
+// The longest payload that fits in a capture with its CRC.
+#define SNIFFER_CHECKED_PAYLOAD_MAX ((SNIFFER_CAPTURE_LEN * 8 - SNIFFER_PAYLOAD_BIT - 8) / 8)
+
+/*
+    pcap Layout
+
+    build/sniffer_pcap writes packets with link type USER0. Each starts with
+    a SNIFFER_PCAP_HEADER_LEN header, then as much of the payload as was
+    captured:
+
+    packet[0]       = SNIFFER_PCAP_CRC_GOOD, _CRC_BAD or _CUT_OFF
+    packet[1]       = the channel
+    packet[2..5]    = the address it was sent to, as it went over the air
+    packet[6]       = payload length, from the packet control field; 0 is an
+                      acknowledgement
+    packet[7]       = packet ID << 1 | no acknowledgement bit
+*/
+
+#define SNIFFER_PCAP_LINKTYPE       (147)
+
+#define SNIFFER_PCAP_CRC_GOOD       (0x01)
+#define SNIFFER_PCAP_CRC_BAD        (0x02)
+#define SNIFFER_PCAP_CUT_OFF        (0x04)
+
+#define SNIFFER_PCAP_FLAGS_INDEX    (0)
+#define SNIFFER_PCAP_CHANNEL_INDEX  (1)
+#define SNIFFER_PCAP_ADDRESS_INDEX  (2)
+#define SNIFFER_PCAP_LENGTH_INDEX   (6)
+#define SNIFFER_PCAP_PID_INDEX      (7)
+#define SNIFFER_PCAP_HEADER_LEN     (8)
+
+#endif // _SNIFFER_H
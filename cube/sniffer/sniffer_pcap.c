@@ -0,0 +1,182 @@
+// Turns the sniffer cube's records (cube/sniffer/sniffer.h) into a pcap file
+// that Wireshark can open, one packet per Enhanced ShockBurst payload heard.
+// Reads a saved capture, or the serial port itself, and flushes after every
+// packet so it can be watched live.
+//
+// Usage: build/sniffer_pcap capture.bin capture.pcap
+//        stty -F /dev/ttyUSB0 250000 raw && build/sniffer_pcap /dev/ttyUSB0 - | wireshark -k -i -
+//
+// Captures whose CRC doesn't check out are noise, and are dropped unless -a
+// is given. Payloads too long to have their CRC captured are kept, marked as
+// unchecked.
+//
+// The packets are laid out as sniffer.h says. cube/sniffer/rocket_rover.lua
+// decodes them, and the frames inside.
+
+#include "sniffer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// The most payload any one capture can hold after the address and packet
+// control field, CRC or not.
+#define SNIFFER_PAYLOAD_MAX_CAPTURED ((SNIFFER_CAPTURE_LEN * 8 - SNIFFER_PAYLOAD_BIT) / 8)
+
+// Enhanced ShockBurst payloads are never longer than this.
+#define SNIFFER_PAYLOAD_MAX     (32)
+
+static void put_u16(FILE* out, uint16_t value) {
+    fputc(value & 0xFF, out);
+    fputc(value >> 8, out);
+}
+
+static void put_u32(FILE* out, uint32_t value) {
+    put_u16(out, value & 0xFFFF);
+    put_u16(out, value >> 16);
+}
+
+// n bits of capture starting at bit, high bit first.
+static unsigned int get_bits(const uint8_t* capture, int bit, int n) {
+    unsigned int value = 0;
+    for (int i = bit; i < bit + n; i++) {
+        value = (value << 1) | ((capture[i / 8] >> (7 - i % 8)) & 1);
+    }
+    return value;
+}
+
+// The transceiver's 1-byte CRC: x^8 + x^2 + x + 1, starting from 0xFF, over
+// the first bits of the capture.
+static uint8_t crc8(const uint8_t* capture, int bits) {
+    uint8_t crc = 0xFF;
+    for (int i = 0; i < bits; i++) {
+        uint8_t in = (capture[i / 8] >> (7 - i % 8)) & 1;
+        uint8_t top = crc >> 7;
+        crc <<= 1;
+        if (top ^ in) crc ^= 0x07;
+    }
+    return crc;
+}
+
+// Reads the rest of a record after its sync bytes. Returns 0 at the end.
+static int read_record(FILE* in, uint8_t* record) {
+    size_t want = SNIFFER_RECORD_LEN - 2;
+    return fread(&record[2], 1, want, in) == want;
+}
+
+int main(int argc, char** argv) {
+
+    int keep_all = 0;
+    if (argc > 1 && strcmp(argv[1], "-a") == 0) {
+        keep_all = 1;
+        argc--;
+        argv++;
+    }
+
+    FILE* in = stdin;
+    FILE* out = stdout;
+    if (argc > 1 && strcmp(argv[1], "-") != 0) {
+        in = fopen(argv[1], "rb");
+        if (in == NULL) {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+    if (argc > 2 && strcmp(argv[2], "-") != 0) {
+        out = fopen(argv[2], "wb");
+        if (out == NULL) {
+            perror(argv[2]);
+            return 1;
+        }
+    }
+
+    // The pcap global header: microsecond timestamps, nothing cut short by
+    // the snapshot length.
+    put_u32(out, 0xa1b2c3d4);
+    put_u16(out, 2);
+    put_u16(out, 4);
+    put_u32(out, 0);
+    put_u32(out, 0);
+    put_u32(out, 65535);
+    put_u32(out, SNIFFER_PCAP_LINKTYPE);
+    fflush(out);
+
+    uint8_t record[SNIFFER_RECORD_LEN];
+    uint64_t time_high_us = 0;
+    uint32_t last_time_us = 0;
+    long kept = 0, dropped = 0;
+    int c;
+
+    while ((c = fgetc(in)) != EOF) {
+
+        // Text between records goes to stderr, so the banner and command
+        // answers still show up.
+        if (c != SNIFFER_SYNC_0) {
+            fputc(c, stderr);
+            continue;
+        }
+        c = fgetc(in);
+        if (c != SNIFFER_SYNC_1) {
+            if (c != EOF) ungetc(c, in);
+            continue;
+        }
+        if (!read_record(in, record)) break;
+
+        uint32_t time_us = 0;
+        for (int i = 0; i < 4; i++) time_us |= (uint32_t) record[SNIFFER_TIME_INDEX + i] << (8 * i);
+        if (time_us < last_time_us) time_high_us += 1ULL << 32;
+        last_time_us = time_us;
+        uint64_t when_us = time_high_us + time_us;
+
+        const uint8_t* capture = &record[SNIFFER_CAPTURE_INDEX];
+        unsigned int length = get_bits(capture, SNIFFER_PCF_BIT, 6);
+        unsigned int pid = get_bits(capture, SNIFFER_PCF_BIT + 6, 2);
+        unsigned int no_ack = get_bits(capture, SNIFFER_PCF_BIT + 8, 1);
+
+        uint8_t flags;
+        if (length > SNIFFER_PAYLOAD_MAX) {
+            flags = SNIFFER_PCAP_CRC_BAD;
+        }
+        else if (length > SNIFFER_CHECKED_PAYLOAD_MAX) {
+            flags = SNIFFER_PCAP_CUT_OFF;
+        }
+        else {
+            int crc_bit = SNIFFER_PAYLOAD_BIT + 8 * length;
+            flags = crc8(capture, crc_bit) == get_bits(capture, crc_bit, 8)
+                ? SNIFFER_PCAP_CRC_GOOD
+                : SNIFFER_PCAP_CRC_BAD;
+        }
+
+        if (flags == SNIFFER_PCAP_CRC_BAD && !keep_all) {
+            dropped++;
+            continue;
+        }
+        kept++;
+
+        unsigned int captured = length;
+        if (captured > SNIFFER_PAYLOAD_MAX_CAPTURED) captured = SNIFFER_PAYLOAD_MAX_CAPTURED;
+
+        uint8_t packet[SNIFFER_PCAP_HEADER_LEN + SNIFFER_PAYLOAD_MAX_CAPTURED];
+        packet[SNIFFER_PCAP_FLAGS_INDEX] = flags;
+        packet[SNIFFER_PCAP_CHANNEL_INDEX] = record[SNIFFER_CHANNEL_INDEX];
+        memcpy(&packet[SNIFFER_PCAP_ADDRESS_INDEX], capture, SNIFFER_ADDRESS_LEN);
+        packet[SNIFFER_PCAP_LENGTH_INDEX] = length;
+        packet[SNIFFER_PCAP_PID_INDEX] = (pid << 1) | no_ack;
+        for (unsigned int i = 0; i < captured; i++) {
+            packet[SNIFFER_PCAP_HEADER_LEN + i] = get_bits(capture, SNIFFER_PAYLOAD_BIT + 8 * i, 8);
+        }
+
+        uint32_t packet_len = SNIFFER_PCAP_HEADER_LEN + captured;
+        put_u32(out, (uint32_t) (when_us / 1000000));
+        put_u32(out, (uint32_t) (when_us % 1000000));
+        put_u32(out, packet_len);
+        put_u32(out, SNIFFER_PCAP_HEADER_LEN + (length > captured ? length : captured));
+        fwrite(packet, 1, packet_len, out);
+        fflush(out);
+    }
+
+    fprintf(stderr, "\n%ld packets, %ld dropped for a bad CRC\n", kept, dropped);
+
+    if (in != stdin) fclose(in);
+    if (out != stdout) fclose(out);
+    return 0;
+}
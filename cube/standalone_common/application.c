@@ -7,6 +7,14 @@
 #include "log.h"
 #include "trx.h"
 #include "network.h"
+#include "channel.h"
+#include "command.h"
+#include "telemetry.h"
+#include "stream_store.h"
+#include "arena.h"
+#include "route_discovery.h"
+#include "address_resolution.h"
+#include "cpu_clock.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -14,99 +22,99 @@
 #include "cube_parameters.h"
 #include <util/delay.h>
 
-// read message and adjust the LED accordingly
-void parse_message(char* message) {
+// While nothing is going on, the radio listens for APPLICATION_LISTEN_MS out
+// of every APPLICATION_LISTEN_MS + APPLICATION_SLEEP_MS. Longer sleeps make
+// the battery last longer, but messages can take that long to get through.
+#define APPLICATION_LISTEN_MS (20)
+#define APPLICATION_SLEEP_MS  (980)
 
-    char search[12];
+// The CPU only slows down once there's been nothing to do for this long, so
+// it isn't switching back and forth on every pass through the loop.
+#define APPLICATION_IDLE_AFTER_MS (50)
 
-    snprintf(search, sizeof(search), "LED:OFF");
-    if (strstr(message, search) != NULL) {
-        LED_set(LED_OFF);
-        return;
-    }
-
-    snprintf(search, sizeof(search), "LED:BLUE");
-    if (strstr(message, search) != NULL) {
-        LED_set(LED_BLUE);
-        return;
-    }
-
-    snprintf(search, sizeof(search), "LED:GREEN");
-    if (strstr(message, search) != NULL) {
-        LED_set(LED_GREEN);
-        return;
-    }
-
-    snprintf(search, sizeof(search), "LED:CYAN");
-    if (strstr(message, search) != NULL) {
-        LED_set(LED_CYAN);
-        return;
-    }
-
-    snprintf(search, sizeof(search), "LED:RED");
-    if (strstr(message, search) != NULL) {
-        LED_set(LED_RED);
-        return;
-    }
-
-    snprintf(search, sizeof(search), "LED:MAGENTA");
-    if (strstr(message, search) != NULL) {
-        LED_set(LED_MAGENTA);
-        return;
-    }
-
-    snprintf(search, sizeof(search), "LED:YELLOW");
-    if (strstr(message, search) != NULL) {
-        LED_set(LED_YELLOW);
-        return;
-    }
-
-    snprintf(search, sizeof(search), "LED:WHITE");
-    if (strstr(message, search) != NULL) {
-        LED_set(LED_WHITE);
-        return;
-    }
-
-    return;
-}
+ARENA_REQUIRE(message, MAX_MESSAGE_LEN);
 
 void application() {
 
     // To save on memory, the same buffer is used to store a received message
     // and to prepare a message to transmit.
-    char message[MAX_MESSAGE_LEN];
+    char* message = (char*) ARENA_BUFFER(message);
     uint16_t message_len;
     byte who_sent_me_this;
 
-    transport_rx_result result;
-
     uint16_t num_messages_this_session = 0;
 
-    uart_transmit_formatted_message("::: Data cube %02x activated. Entering network mode. :::\r\n", MY_NETWORK_ADDR);
+    uart_transmit_formatted_message_P(PSTR("::: Data cube %02x activated. Entering network mode. :::\r\n"), MY_NETWORK_ADDR);
     UART_WAIT_UNTIL_DONE();
 
     LED_set(LED_BLUE);
 
-    while(true) {
+    // The transport layer runs in the background off of transport_poll,
+    // so this loop is free to do other work between polls.
+    timer_clock_initialize();
 
-        /*
-        network_rx(message, MAX_SEGMENT_LEN, TRX_TIMEOUT_INDEFINITE);
-        */
+    // The other cubes sleep too, so wake them up when forwarding.
+    trx_set_duty_cycle(APPLICATION_LISTEN_MS, APPLICATION_SLEEP_MS);
+    trx_set_wakeup(TRX_WAKEUP_MS);
 
-        result = transport_rx(message, MAX_MESSAGE_LEN, &message_len, &who_sent_me_this, TRX_TIMEOUT_INDEFINITE);
-        if (result == TRANSPORT_RX_SUCCESS) {
-            message[MAX_MESSAGE_LEN - 1] = 0;
-            parse_message(message);
-            uart_transmit_formatted_message("=== Got a message ===\r\n%s\r\n=====================\r\n", message);
-            UART_WAIT_UNTIL_DONE();
+    address_resolution_initialize();
+#if ROUTE_DISCOVERY
+    route_discovery_initialize();
+#endif
+    telemetry_initialize();
+
+    // Large messages go straight to the EEPROM.
+    transport_set_sink(&stream_store_sink);
+
+    transport_receive_async((byte*) message, MAX_MESSAGE_LEN);
+
+    timer_delay_ms_t busy_ms = timer_now_ms();
+
+    while(true) {
+
+        // While the radio sleeps and nothing is on its way out, nothing needs
+        // the CPU at full speed either. Sending goes back to it (trx.c), and
+        // so does the radio waking up.
+        if (trx_asleep() && !trx_rx_pending() && transport_send_status() != TRANSPORT_ASYNC_BUSY) {
+            if ((timer_delay_ms_t) (timer_now_ms() - busy_ms) >= APPLICATION_IDLE_AFTER_MS) {
+                cpu_clock_idle();
+            }
         }
-        if (result == TRANSPORT_RX_TIMEOUT) {
-            uart_transmit_formatted_message("[WARNING] Transport layer RX timed out %s\r\n", message);
-            UART_WAIT_UNTIL_DONE();
+        else {
+            busy_ms = timer_now_ms();
+            cpu_clock_full_speed();
         }
-        if (result == TRANSPORT_RX_ERROR) {
-            uart_transmit_formatted_message("[WARNING] Transport layer RX encountered an error %s\r\n", message);
-            UART_WAIT_UNTIL_DONE();
+
+        transport_poll();
+        channel_poll();
+        address_resolution_poll();
+#if ROUTE_DISCOVERY
+        route_discovery_poll();
+#endif
+        telemetry_poll(num_messages_this_session);
+
+        if (transport_receive_status(&message_len, &who_sent_me_this) == TRANSPORT_ASYNC_DONE) {
+            message[MAX_MESSAGE_LEN - 1] = 0;
+            if (telemetry_receive((byte*) message, message_len)) {
+                // It goes out with our next report.
+            }
+            else {
+                command_handle((byte*) message, message_len);
+                if (COMMAND_IS_BINARY(message, message_len)) {
+                    uart_transmit_formatted_message_P(PSTR("=== Got command %02x from %02x ===\r\n"), message[1], who_sent_me_this);
+                }
+                else {
+                    uart_transmit_formatted_message_P(PSTR("=== Got a message ===\r\n%s\r\n=====================\r\n"), message);
+                }
+                UART_WAIT_UNTIL_DONE();
+            }
+            num_messages_this_session++;
+
+            // Handling a message goes about as deep as the stack gets.
+            arena_report();
+
+            // Ready for the next one.
+            transport_receive_async((byte*) message, MAX_MESSAGE_LEN);
         }
     }
 }
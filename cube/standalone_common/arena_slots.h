@@ -0,0 +1,9 @@
+#ifndef _ARENA_SLOTS_H
+#define _ARENA_SLOTS_H
+
+// The data cubes' buffers. See arena.h.
+#define ARENA_SLOTS(ARENA_SLOT) \
+    ARENA_SLOT(message, MAX_MESSAGE_LEN)    /* what application() receives into */ \
+    ARENA_SLOT(transport_rx, 2 * MAX_MESSAGE_LEN) /* transport.c: each rx context's message */
+
+#endif
@@ -15,6 +15,8 @@
 #include "networking_constants.h"
 #include "timer.h"
 #include "log.h"
+#include "channel.h"
+#include "arena.h"
 
 // Specific to this cube includes
 #include "address.h"
@@ -30,13 +32,11 @@
 
 /////////////////// Private Defines ///////////////////////////////////////////
 
-// If this macro is defined, UART functionality will be included.
-// #define DEBUG_MODE
+// How much the networking code prints is set in log_level.h.
 
-// The number of milliseconds to wait after the cube is turned on to enter the 
-// LOADING state.
-#define STARTUP_DURATION_MS 1000
-// Wait one full second.
+// The number of milliseconds the limit switch has to read the same before
+// we believe it. The cube leaves STARTUP as soon as it has.
+#define SWITCH_DEBOUNCE_MS 20
 
 // The number of milliseconds that the data cube's limit switch must be
 // depressed for before the cube enters the LOADED state.
@@ -47,11 +47,6 @@
 // The number of seconds the data cube waits until it turns off its LED.
 #define LOADED_1_DURATION_S 10
 
-// The number of milliseconds that the data cube waits after it is dispensed
-// from the rover (its limit switch is released) before beginning its RF
-// operations. During this time, the data cube's RF hardware is brough online.
-#define DISPENSING_DURATION_MS 1000
-// Wait 1/10 seconds for the trx to start up.
 
 // These colors are for the state machine leading up to network operation.
 // Go to application.c to see how colors are handled during network operation.
@@ -67,8 +62,8 @@
 // The states that the data cube state machine can be in
 enum data_cube_state_enum {
 
-    // The cube waits in this state for a certain amount of time before moving to
-    // the READY_TO_LOAD state.
+    // The cube waits in this state for the limit switch to settle before
+    // moving to the READY_TO_LOAD state.
     STARTUP,
 
     // In this state, the data cube watches for the limit switch be be depressed,
@@ -87,8 +82,8 @@ enum data_cube_state_enum {
     // by the limit switch being released.
     LOADED,
 
-    // The data cube has been dispensed onto the ground and waits there while the
-    // mission hardware (the transceiver) powers up.
+    // The data cube has been dispensed onto the ground and waits there until
+    // the mission hardware (the transceiver) says it's ready.
     DISPENSING,
 
     // The data cube performs its mission functions. Once the data cube enters
@@ -103,6 +98,12 @@ typedef enum data_cube_state_enum data_cube_state_t;
 // The current state of this data cube.
 volatile static data_cube_state_t current_state = STARTUP;
 
+// The limit switch, as switch_update last saw it: what it reads, when it
+// last changed, and what it settled on.
+static char switch_reading;
+static timer_delay_ms_t switch_changed_ms;
+static char switch_pressed;
+
 /////////////////// Private Function Prototypes ///////////////////////////////
 
 // The code that's run each time around the state machine loop, depending on
@@ -115,6 +116,10 @@ void state_code_loaded(void);
 void state_code_dispensing(void);
 void state_code_operational(void);
 
+// Reads the limit switch. Returns whether it has read the same for
+// SWITCH_DEBOUNCE_MS, and keeps switch_pressed to what it settled on.
+uint8_t switch_update(void);
+
 /////////////////// Public Function Bodies ////////////////////////////////////
 
 int main() {
@@ -125,10 +130,15 @@ int main() {
     uart_initialize();
 
     LED_set(LED_WHITE);
-    uart_transmit_formatted_message("\r\n::: Data Cube %02x :::\r\n", MY_NETWORK_ADDR);
+    uart_transmit_formatted_message_P(PSTR("\r\n::: Data Cube %02x :::\r\n"), MY_NETWORK_ADDR);
+    arena_report();
     //print_log();
 
-    timer_start(STARTUP_DURATION_MS);
+    // The Timer 0 clock debounces the limit switch, so Timer 1 is still free
+    // for the state machine.
+    timer_clock_initialize();
+    switch_reading = SW_read(SW1);
+    switch_changed_ms = timer_now_ms();
 
     // DEBUG
     //application();
@@ -179,9 +189,8 @@ int main() {
 
 void state_code_startup(void) {
 
-    if ((TIFR1 & _BV(OCF1A)) != 0) {
+    if (switch_update()) {
 
-        timer_stop();
         current_state = READY_TO_LOAD;
         LED_set(LED_COLOR_READY_TO_LOAD);
 
@@ -191,7 +200,8 @@ void state_code_startup(void) {
 
 void state_code_ready_to_load(void) {
 
-    if (SW_read(SW1)) {
+    switch_update();
+    if (switch_pressed) {
 
         timer_start(LOADING_DURATION_MS);
         current_state = LOADING;
@@ -203,7 +213,8 @@ void state_code_ready_to_load(void) {
 
 void state_code_loading(void) {
 
-    if (!SW_read(SW1)) {
+    switch_update();
+    if (!switch_pressed) {
 
         timer_stop();
         current_state = READY_TO_LOAD;
@@ -211,7 +222,7 @@ void state_code_loading(void) {
 
     }
 
-    else if ((TIFR1 & _BV(OCF1A)) != 0) {
+    else if (TIMER_DONE) {
 
         timer_stop();
         timer_start(1000);
@@ -226,7 +237,7 @@ void state_code_loaded(void) {
 
     static int seconds_passed;
 
-    if ((TIFR1 & _BV(OCF1A)) != 0) {
+    if (TIMER_DONE) {
         timer_stop();
         seconds_passed = seconds_passed + 1;
         if (seconds_passed >= LOADED_1_DURATION_S) {
@@ -236,10 +247,12 @@ void state_code_loaded(void) {
         }
     }
 
-    if (!SW_read(SW1)) {
-        timer_start(DISPENSING_DURATION_MS);
+    switch_update();
+    if (!switch_pressed) {
+        timer_stop();
         current_state = DISPENSING;
         trx_initialize(MY_DATA_LINK_ADDR);
+        channel_load();
         LED_set(LED_COLOR_DISPENSING);
     }
 
@@ -247,8 +260,8 @@ void state_code_loaded(void) {
 
 void state_code_dispensing(void) {
 
-    if ((TIFR1 & _BV(OCF1A)) != 0) {
-        timer_stop();
+    // Usually a couple of milliseconds after trx_initialize.
+    if (trx_ready()) {
         current_state = OPERATIONAL;
     }
 
@@ -259,3 +272,21 @@ void state_code_operational(void) {
     application();
 
 }
+
+uint8_t switch_update(void) {
+
+    char reading = SW_read(SW1);
+    timer_delay_ms_t now = timer_now_ms();
+
+    if (reading != switch_reading) {
+        switch_reading = reading;
+        switch_changed_ms = now;
+        return 0;
+    }
+
+    if ((timer_delay_ms_t) (now - switch_changed_ms) < SWITCH_DEBOUNCE_MS) return 0;
+
+    switch_pressed = reading;
+    return 1;
+
+}
@@ -10,17 +10,24 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 
-#include <math.h>
-
 #include "config.h"
 #include "accelerometer.h"
 #include "adc.h"
 #include "timer.h"
+#include "events.h"
+#include "window_detector.h"
+#include "vector.h"
 
 
 ///////////////////// Global Variables /////////////////////////////////////////
 static volatile bool launch_is_a_go = false;
 static volatile bool no_motion = false;
+static volatile bool impact_seen = false;
+
+// The last LAUNCH_WINDOW_LENGTH and NO_MOTION_WINDOW_LENGTH samples
+static window_detector_t launch_window = WINDOW_DETECTOR_INIT(LAUNCH_WINDOW_LENGTH, LAUNCH_FORCE_CNT_THRESHOLD);
+static window_detector_t no_motion_window = WINDOW_DETECTOR_INIT(NO_MOTION_WINDOW_LENGTH, NO_MOTION_CNT_THRESHOLD);
+static window_detector_t free_fall_window = WINDOW_DETECTOR_INIT(FREE_FALL_WINDOW_LENGTH, FREE_FALL_CNT_THRESHOLD);
 
 void reset_launch_is_a_go() {
     launch_is_a_go = false;
@@ -31,6 +38,7 @@ bool get_launch_is_a_go() {
 }
 
 void reset_no_motion() {
+    window_detector_initialize(&no_motion_window, NO_MOTION_WINDOW_LENGTH, NO_MOTION_CNT_THRESHOLD);
     no_motion = false;
 }
 
@@ -38,6 +46,15 @@ bool get_no_motion() {
     return no_motion;
 }
 
+void reset_impact_seen() {
+    window_detector_initialize(&free_fall_window, FREE_FALL_WINDOW_LENGTH, FREE_FALL_CNT_THRESHOLD);
+    impact_seen = false;
+}
+
+bool get_impact_seen() {
+    return impact_seen;
+}
+
 
 ///////////////////// Public Function Prototypes ///////////////////////////////
 
@@ -65,28 +82,44 @@ int16_t accelerometer_read(char axis) {
     return accel_returned;
 }
 
+// Fills in all three axes from the same ADC round, in (1/2)*m/(s^2). Returns the snapshot's sequence number,
+// which changes every time there's a new one
+uint8_t accelerometer_snapshot(vector_t* acceleration) {
+    adc_triplet_t triplet = adc_get_triplet();   // X, Y and Z in that order (see adc.h)
+
+    acceleration->x = triplet.value[0] - 512 + X_AXIS_ERROR;
+    acceleration->y = triplet.value[1] - 512 + Y_AXIS_ERROR;
+    acceleration->z = triplet.value[2] - 512 + Z_AXIS_ERROR;
+
+    return triplet.sequence;
+}
+
 // Returns magnitude of aggregate vector in (1/2)*m/(s^2)
+// Only worked out once per snapshot, no matter how many checks ask for it. Called from the launch and no motion check timers
 uint32_t acceleration_agg_mag(void) {
-    int32_t x_comp, y_comp, z_comp;
-    uint32_t mag_returned;
+    static bool cached = false;
+    static uint8_t cached_sequence;
+    static uint32_t cached_mag;
 
-    x_comp = accelerometer_read(X_AXIS);
-    y_comp = accelerometer_read(Y_AXIS);
-    z_comp = accelerometer_read(Z_AXIS);
+    vector_t acceleration;
+    uint8_t sequence = accelerometer_snapshot(&acceleration);
 
-    // mag_returned = sqrt(pow(x_comp, 2) + pow(y_comp, 2) + pow(z_comp, 2));  // Good old Pythagoreas
-    mag_returned = (x_comp * x_comp) + (y_comp * y_comp) + (z_comp * z_comp);
+    if (!cached || sequence != cached_sequence) {
+        cached_mag = vector_magnitude_squared(&acceleration);   // Good old Pythagoreas, minus the square root
+        cached_sequence = sequence;
+        cached = true;
+    }
 
-    return mag_returned;
+    return cached_mag;
 }
 
 // Determines whether the rover is right-side-up (true) or upside-down (false).
 bool is_up(void) {
-    int16_t acceleration_z;
+    vector_t acceleration;
     bool return_val;
 
-    acceleration_z = accelerometer_read(Z_AXIS);
-    if (acceleration_z > 0) {
+    accelerometer_snapshot(&acceleration);
+    if (acceleration.z > 0) {
         return_val = true;
     } else {
         return_val = false;
@@ -95,38 +128,30 @@ bool is_up(void) {
     return return_val;
 }
 
-// Called by timer2 channel A interrupt. Changes launch_is_a_go global variable
-void is_launched(logic_vector samples) {
-    logic_vector check_vector = 0x1;
-    uint8_t high_G_cnt = 0;
-    
-    for (int i = 0; i < 64; i++) {
-        if (samples & check_vector) {
-            high_G_cnt++;
+// Called by the launch check timer (timer.c) with whether this sample was >= LAUNCH_FORCE. Changes launch_is_a_go global variable
+void is_launched(bool high_G) {
+    if (window_detector_update(&launch_window, high_G)) {
+        if (!launch_is_a_go) {
+            event_post(EVENT_LAUNCH);
         }
-
-        check_vector = check_vector << 1;
-    }
-
-    if (high_G_cnt >= LAUNCH_FORCE_CNT_THRESHOLD) {
         launch_is_a_go = true;
     }
 }
 
-// Called by timer2 channel B interrupt. Changes no_motion global variable
-void is_no_motion(uint64_t samples) {
-    logic_vector check_vector = 0x1;
-    uint8_t no_motion_cnt = 0;
-    
-    for (int i = 0; i < 64; i++) {
-        if (samples & check_vector) {
-            no_motion_cnt++;
-        }
+// Called by the no motion check timer (timer.c) with whether this sample was about 1 G. Changes no_motion global variable
+void is_no_motion(bool still) {
+    bool now_still = window_detector_update(&no_motion_window, still);
 
-        check_vector = check_vector << 1;
+    if (now_still && !no_motion) {
+        event_post(EVENT_NO_MOTION);
     }
+    no_motion = now_still;
+}
 
-    if (no_motion_cnt >= LAUNCH_FORCE_CNT_THRESHOLD) {
-        no_motion = true;
+// Called by the no motion check timer (timer.c) with whether this sample was an impact, and whether it was falling.
+// Changes impact_seen global variable
+void is_impact(bool high_G, bool falling) {
+    if (window_detector_update(&free_fall_window, falling) || high_G) {
+        impact_seen = true;
     }
 }
\ No newline at end of file
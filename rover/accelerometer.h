@@ -17,6 +17,7 @@
 #include <stdbool.h>
 
 #include "config.h"
+#include "vector.h"
 
 
 ///////////////////// Macro Definitions /////////////////////////////////////////
@@ -32,6 +33,9 @@
 
 #define NO_MOVEMENT_TOLERANCE_SQUARED   NO_MOVEMENT_TOLERANCE * NO_MOVEMENT_TOLERANCE
 
+#define LANDING_IMPACT_FORCE_SQUARED    LANDING_IMPACT_FORCE * LANDING_IMPACT_FORCE * ONE_G_SQUARED         // LANDING_IMPACT_FORCE defined in config.h
+#define FREE_FALL_FORCE_SQUARED         (FREE_FALL_FORCE_TENTHS * FREE_FALL_FORCE_TENTHS * ONE_G_SQUARED / 100)
+
 
 ///////////////////// Type Definitions /////////////////////////////////////////
 
@@ -48,20 +52,33 @@ void reset_launch_is_a_go();
 bool get_launch_is_a_go();
 void reset_no_motion();
 bool get_no_motion();
+void reset_impact_seen();
+bool get_impact_seen();
 
 // Requests and returns acceleration of axis in (1/2)*m/(s^2)
 int16_t accelerometer_read(char axis);
 
+// Fills in all three axes from the same ADC round, in (1/2)*m/(s^2). Returns the snapshot's sequence number,
+// which changes every time there's a new one
+uint8_t accelerometer_snapshot(vector_t* acceleration);
+
 // Returns magnitude of aggregate vector in [(1/2)*m/(s^2)]^2 (to avoid square rooting)
 uint32_t acceleration_agg_mag(void);
 
 // Determines whether the rover is right-side-up (true) or upside-down (false).
 bool is_up(void);
 
-// Called by timer2 channel A interrupt. Changes launch_is_a_go global variable
-void is_launched(uint64_t samples);
+// Called by the launch check timer (timer.c) with whether this sample was >= LAUNCH_FORCE. Changes launch_is_a_go global variable
+// once LAUNCH_FORCE_CNT_THRESHOLD of the last LAUNCH_WINDOW_LENGTH samples were
+void is_launched(bool high_G);
+
+// Called by the no motion check timer (timer.c) with whether this sample was about 1 G. no_motion global variable is true
+// while NO_MOTION_CNT_THRESHOLD of the last NO_MOTION_WINDOW_LENGTH samples are, and false otherwise
+void is_no_motion(bool still);
 
-// Called by timer2 channel B interrupt. Changes no_motion global variable
-void is_no_motion(uint64_t samples);
+// Called by the no motion check timer (timer.c) with whether this sample was >= LANDING_IMPACT_FORCE, and whether it was
+// under FREE_FALL_FORCE_TENTHS. Sets impact_seen global variable on an impact, or once FREE_FALL_CNT_THRESHOLD of the last
+// FREE_FALL_WINDOW_LENGTH samples were falling
+void is_impact(bool high_G, bool falling);
 
 #endif  // _ACCELEROMETER_H
\ No newline at end of file
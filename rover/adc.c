@@ -8,8 +8,11 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 
 #include "adc.h"
+#include "timer.h"
+#include "profile.h"
 
 //////////////// Private Defines ///////////////////////////////////////////////
 
@@ -53,7 +56,6 @@
   #define ADC_ADPS (ADC_ADPS_128 & ADC_ADPS_MASK)
 #endif
 
-#define ADC_CHANNEL_COUNT (11)
 #define ADC_MUX_ADC0 (0)
 #define ADC_MUX_ADC1 (  _BV(MUX0)                                     )
 #define ADC_MUX_ADC2 (              _BV(MUX1)                         )
@@ -67,120 +69,108 @@
 #define ADC_MUX_GND  (  _BV(MUX0) | _BV(MUX1) | _BV(MUX2) | _BV(MUX3) )
 #define ADC_MUX_MASK (  _BV(MUX0) | _BV(MUX1) | _BV(MUX2) | _BV(MUX3) )
 
-#define ADC_RESULTS_BUFFER_INDEX_ADC0 (0)
-#define ADC_RESULTS_BUFFER_INDEX_ADC1 (1)
-#define ADC_RESULTS_BUFFER_INDEX_ADC2 (2)
-#define ADC_RESULTS_BUFFER_INDEX_ADC3 (3)
-#define ADC_RESULTS_BUFFER_INDEX_ADC4 (4)
-#define ADC_RESULTS_BUFFER_INDEX_ADC5 (5)
-#define ADC_RESULTS_BUFFER_INDEX_ADC6 (6)
-#define ADC_RESULTS_BUFFER_INDEX_ADC7 (7)
-#define ADC_RESULTS_BUFFER_INDEX_TEMP (8)
-#define ADC_RESULTS_BUFFER_INDEX_REF  (9)
-#define ADC_RESULTS_BUFFER_INDEX_GND  (10)
+// How many slots the schedule has in all.
+#define ADC_SCHEDULE_LENGTH ( \
+  ADC_SLOTS_ADC0 + ADC_SLOTS_ADC1 + ADC_SLOTS_ADC2 + ADC_SLOTS_ADC3 + \
+  ADC_SLOTS_ADC4 + ADC_SLOTS_ADC5 + ADC_SLOTS_ADC6 + ADC_SLOTS_ADC7 + \
+  ADC_SLOTS_TEMP + ADC_SLOTS_REF  + ADC_SLOTS_GND                     )
 
-//////////////// Static Variable Definitions ///////////////////////////////////
+#if ADC_SCHEDULE_LENGTH == 0
+  #error "At least one ADC channel needs a slot in the schedule."
+#endif
 
-// A buffer that stores the most-recently-converted values for each channel.
-#define ADC_CHANNEL_COUNT (11)
-static adc_result_t adc_results_buffer[ADC_CHANNEL_COUNT];
+//////////////// Private Type Definitions //////////////////////////////////////
 
-// The sequence of MUX values to rotate through. Includes only the enabled
-// channels.
-static char adc_mux_sequence[] = {
-#ifdef ADC_ENABLE_ADC0
-  ADC_MUX_ADC0,
-#endif
-#ifdef ADC_ENABLE_ADC1
-  ADC_MUX_ADC1,
-#endif
-#ifdef ADC_ENABLE_ADC2
-  ADC_MUX_ADC2,
-#endif
-#ifdef ADC_ENABLE_ADC3
-  ADC_MUX_ADC3,
-#endif
-#ifdef ADC_ENABLE_ADC4
-  ADC_MUX_ADC4,
-#endif
-#ifdef ADC_ENABLE_ADC5
-  ADC_MUX_ADC5,
-#endif
-#ifdef ADC_ENABLE_ADC6
-  ADC_MUX_ADC6,
-#endif
-#ifdef ADC_ENABLE_ADC7
-  ADC_MUX_ADC7,
-#endif
-#ifdef ADC_ENABLE_TEMP
-  ADC_MUX_TEMP,
-#endif
-#ifdef ADC_ENABLE_REF
-  ADC_MUX_REF,
-#endif
-#ifdef ADC_ENABLE_GND
-  ADC_MUX_GND,
-#endif
-};
+// How a channel is sampled. Indexed by adc_channel_t.
+typedef struct {
+  uint8_t mux;        // what goes in ADMUX's MUX bits
+  uint8_t slots;      // ADC_SLOTS_*
+  uint8_t oversample; // ADC_OVERSAMPLE_*
+} adc_channel_config_t;
 
-// The sequence of results buffer indices to run through. Includes only enabled
-// channels.
-static int adc_results_buffer_index_sequence[] = {
-#ifdef ADC_ENABLE_ADC0
-  ADC_RESULTS_BUFFER_INDEX_ADC0,
-#endif
-#ifdef ADC_ENABLE_ADC1
-  ADC_RESULTS_BUFFER_INDEX_ADC1,
-#endif
-#ifdef ADC_ENABLE_ADC2
-  ADC_RESULTS_BUFFER_INDEX_ADC2,
-#endif
-#ifdef ADC_ENABLE_ADC3
-  ADC_RESULTS_BUFFER_INDEX_ADC3,
-#endif
-#ifdef ADC_ENABLE_ADC4
-  ADC_RESULTS_BUFFER_INDEX_ADC4,
-#endif
-#ifdef ADC_ENABLE_ADC5
-  ADC_RESULTS_BUFFER_INDEX_ADC5,
-#endif
-#ifdef ADC_ENABLE_ADC6
-  ADC_RESULTS_BUFFER_INDEX_ADC6,
-#endif
-#ifdef ADC_ENABLE_ADC7
-  ADC_RESULTS_BUFFER_INDEX_ADC7,
-#endif
-#ifdef ADC_ENABLE_TEMP
-  ADC_RESULTS_BUFFER_INDEX_TEMP,
-#endif
-#ifdef ADC_ENABLE_REF
-  ADC_RESULTS_BUFFER_INDEX_REF,
-#endif
-#ifdef ADC_ENABLE_GND
-  ADC_RESULTS_BUFFER_INDEX_GND,
-#endif
+// Where a channel is in putting together its next result.
+typedef struct {
+  uint16_t sum;       // the conversions so far
+  uint8_t count;      // how many there have been
+} adc_accumulator_t;
+
+//////////////// Static Variable Definitions ///////////////////////////////////
+
+static const adc_channel_config_t adc_channel_config[ADC_CHANNEL_COUNT] = {
+  [ADC_CHANNEL_ADC0] = { ADC_MUX_ADC0, ADC_SLOTS_ADC0, ADC_OVERSAMPLE_ADC0 },
+  [ADC_CHANNEL_ADC1] = { ADC_MUX_ADC1, ADC_SLOTS_ADC1, ADC_OVERSAMPLE_ADC1 },
+  [ADC_CHANNEL_ADC2] = { ADC_MUX_ADC2, ADC_SLOTS_ADC2, ADC_OVERSAMPLE_ADC2 },
+  [ADC_CHANNEL_ADC3] = { ADC_MUX_ADC3, ADC_SLOTS_ADC3, ADC_OVERSAMPLE_ADC3 },
+  [ADC_CHANNEL_ADC4] = { ADC_MUX_ADC4, ADC_SLOTS_ADC4, ADC_OVERSAMPLE_ADC4 },
+  [ADC_CHANNEL_ADC5] = { ADC_MUX_ADC5, ADC_SLOTS_ADC5, ADC_OVERSAMPLE_ADC5 },
+  [ADC_CHANNEL_ADC6] = { ADC_MUX_ADC6, ADC_SLOTS_ADC6, ADC_OVERSAMPLE_ADC6 },
+  [ADC_CHANNEL_ADC7] = { ADC_MUX_ADC7, ADC_SLOTS_ADC7, ADC_OVERSAMPLE_ADC7 },
+  [ADC_CHANNEL_TEMP] = { ADC_MUX_TEMP, ADC_SLOTS_TEMP, ADC_OVERSAMPLE_TEMP },
+  [ADC_CHANNEL_REF]  = { ADC_MUX_REF,  ADC_SLOTS_REF,  ADC_OVERSAMPLE_REF  },
+  [ADC_CHANNEL_GND]  = { ADC_MUX_GND,  ADC_SLOTS_GND,  ADC_OVERSAMPLE_GND  },
 };
 
-// The length of the adc channel sequence. Equal to the length of both
-// adc_mux_sequence and adc_results_buffer_index_sequence.
-int adc_sequence_length = sizeof(adc_mux_sequence) / sizeof(*adc_mux_sequence);
+// The most recent result for each channel, indexed by adc_channel_t.
+static volatile adc_sample_t adc_results_buffer[ADC_CHANNEL_COUNT];
+
+// The conversions going into each channel's next result.
+static adc_accumulator_t adc_accumulators[ADC_CHANNEL_COUNT];
+
+// The channel each slot of the schedule samples.
+static uint8_t adc_schedule[ADC_SCHEDULE_LENGTH];
+
+// The slot being converted right now.
+static uint8_t adc_schedule_index;
+
+// Triplets are double-buffered. The ISR fills in the one readers aren't
+// looking at, then flips adc_triplet_front over to it.
+static adc_triplet_t adc_triplets[2];
+static volatile uint8_t adc_triplet_front;
+
+// Which of the triplet's channels have a new result since the last triplet.
+static uint8_t adc_triplet_pending;
+
+//////////////// Private Function Bodies ///////////////////////////////////////
+
+// Lays out the schedule. Every channel with a slot left gets one in each
+// round, so a channel's slots end up spread over the whole schedule instead
+// of bunched together.
+static void adc_build_schedule(void) {
 
-// Tracks what the next ADC channel to be sampled is. Indexes both 
-// adc_mux_sequence and adc_results_buffer_index_sequence.
-int adc_sequence_index;
+  uint8_t length = 0;
+  uint8_t round;
+  uint8_t channel;
+
+  for (round = 0; length < ADC_SCHEDULE_LENGTH; round++) {
+    for (channel = 0; channel < ADC_CHANNEL_COUNT; channel++) {
+      if (adc_channel_config[channel].slots > round) {
+        adc_schedule[length++] = channel;
+      }
+    }
+  }
+
+}
 
 //////////////// Public Function Bodies ////////////////////////////////////////
 
 // Initializes the ADC, including configuring the appropriate pins.
 void adc_initialize(void) {
 
-  // Clears the results buffer
+  // Clears the results and accumulators.
   int i;
   for (i = 0; i < ADC_CHANNEL_COUNT; i++) {
-    adc_results_buffer[i] = 0;
+    adc_results_buffer[i].value = 0;
+    adc_results_buffer[i].sequence = 0;
+    adc_accumulators[i].sum = 0;
+    adc_accumulators[i].count = 0;
   }
 
-  adc_sequence_index = 0;
+  adc_build_schedule();
+  adc_schedule_index = 0;
+
+  adc_triplet_front = 0;
+  adc_triplet_pending = 0;
+  adc_triplets[0].sequence = 0;
 
   // Set up ADC registers
 
@@ -195,119 +185,155 @@ void adc_initialize(void) {
   #ifdef SETTINGS_PARANOID_REGISTERS
     ADMUX &= (ADC_REFS_MASK | ADC_MUX_MASK);
   #endif
-  ADMUX = (ADC_REFS | adc_mux_sequence[0]);
+  ADMUX = (ADC_REFS | adc_channel_config[adc_schedule[0]].mux);
 
-  // Enable or disable digital inputs for appropriate pins.
+  // Disable the digital inputs on the pins that are being sampled.
   DIDR0 = (
     0
-    #ifdef ADC_ENABLE_ADC0
+    #if ADC_SLOTS_ADC0 > 0
       | _BV(ADC0D)
     #endif
-    #ifdef ADC_ENABLE_ADC1
+    #if ADC_SLOTS_ADC1 > 0
       | _BV(ADC1D)
     #endif
-    #ifdef ADC_ENABLE_ADC2
+    #if ADC_SLOTS_ADC2 > 0
       | _BV(ADC2D)
     #endif
-    #ifdef ADC_ENABLE_ADC3
+    #if ADC_SLOTS_ADC3 > 0
       | _BV(ADC3D)
     #endif
-    #ifdef ADC_ENABLE_ADC4
+    #if ADC_SLOTS_ADC4 > 0
       | _BV(ADC4D)
     #endif
-    #ifdef ADC_ENABLE_ADC5
+    #if ADC_SLOTS_ADC5 > 0
       | _BV(ADC5D)
     #endif
   );
 
-  // Begin the first conversion.
-  ADCSRA |= _BV(ADSC);
+  #if ADC_AUTO_TRIGGER
+    // Start each conversion on TIMER0's compare match A.
+    ADCSRB = (ADCSRB & ~(_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0))) | _BV(ADTS1) | _BV(ADTS0);
+    ADCSRA |= _BV(ADATE);
+  #else
+    // Begin the first conversion.
+    ADCSRA |= _BV(ADSC);
+  #endif
 
 }
 
-// Gets the most recent value of a particular ADC channel.
+// Gets the most recent (averaged) value of a particular ADC channel.
 adc_result_t adc_get_channel_result(adc_channel_t channel) {
+  return adc_get_channel_sample(channel).value;
+}
+
+// Gets the most recent value of a channel along with its sequence stamp.
+adc_sample_t adc_get_channel_sample(adc_channel_t channel) {
+
+  adc_sample_t sample = { 0, 0 };
 
-  switch (channel)
-  {
-  case ADC_CHANNEL_ADC0:
-    return adc_results_buffer[ADC_RESULTS_BUFFER_INDEX_ADC0];
-    break;
-
-  case ADC_CHANNEL_ADC1:
-    return adc_results_buffer[ADC_RESULTS_BUFFER_INDEX_ADC1];
-    break;
-
-  case ADC_CHANNEL_ADC2:
-    return adc_results_buffer[ADC_RESULTS_BUFFER_INDEX_ADC2];
-    break;
-
-  case ADC_CHANNEL_ADC3:
-    return adc_results_buffer[ADC_RESULTS_BUFFER_INDEX_ADC3];
-    break;
-
-  case ADC_CHANNEL_ADC4:
-    return adc_results_buffer[ADC_RESULTS_BUFFER_INDEX_ADC4];
-    break;
-
-  case ADC_CHANNEL_ADC5:
-    return adc_results_buffer[ADC_RESULTS_BUFFER_INDEX_ADC5];
-    break;
-
-  case ADC_CHANNEL_ADC6:
-    return adc_results_buffer[ADC_RESULTS_BUFFER_INDEX_ADC6];
-    break;
-
-  case ADC_CHANNEL_ADC7:
-    return adc_results_buffer[ADC_RESULTS_BUFFER_INDEX_ADC7];
-    break;
-
-  case ADC_CHANNEL_TEMP:
-    return adc_results_buffer[ADC_RESULTS_BUFFER_INDEX_TEMP];
-    break;
-
-  case ADC_CHANNEL_REF:
-    return adc_results_buffer[ADC_RESULTS_BUFFER_INDEX_REF];
-    break;
-
-  case ADC_CHANNEL_GND:
-    return adc_results_buffer[ADC_RESULTS_BUFFER_INDEX_GND];
-    break;
-  
-  default:
-    return 69;
-    break;
+  if (channel >= ADC_CHANNEL_COUNT) {
+    return sample;
+  }
+
+  // The ISR writes the bytes separately.
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    sample = adc_results_buffer[channel];
+  }
+
+  return sample;
+
+}
+
+// Gets the most recent triplet of the ADC_TRIPLET_CHANNEL_* channels.
+adc_triplet_t adc_get_triplet(void) {
+
+  adc_triplet_t triplet;
+  uint8_t front;
+
+  // If the ISR flipped the buffers while we were copying, copy again. The one
+  // we were reading could be the one it's filling in next.
+  do {
+    front = adc_triplet_front;
+    triplet = adc_triplets[front];
+  } while (front != adc_triplet_front);
+
+  return triplet;
+
+}
+
+//////////////// Private Function Bodies (ISR) /////////////////////////////////
+
+// Called from the ISR with every new result. Publishes a triplet once all
+// three of its channels have one.
+static inline void adc_update_triplet(uint8_t channel, adc_result_t value) {
+
+  uint8_t back = adc_triplet_front ^ 1;
+  uint8_t slot;
+
+  if (channel == ADC_TRIPLET_CHANNEL_0) {
+    slot = 0;
+  } else if (channel == ADC_TRIPLET_CHANNEL_1) {
+    slot = 1;
+  } else if (channel == ADC_TRIPLET_CHANNEL_2) {
+    slot = 2;
+  } else {
+    return;
+  }
+
+  adc_triplets[back].value[slot] = value;
+  adc_triplet_pending |= _BV(slot);
+
+  if (adc_triplet_pending == 0x07) {
+    adc_triplets[back].sequence = adc_triplets[adc_triplet_front].sequence + 1;
+    adc_triplet_front = back;
+    adc_triplet_pending = 0;
   }
 
 }
 
 ///////////// Interrupt Service Routines ///////////////////////////////////////
 
-// Runs each time a conversion finishes. Stores the result of the conversion
-// and begins the next conversion.
+// Runs each time a conversion finishes. Adds the result to its channel's
+// accumulator, and sets up the next slot's conversion.
 ISR(ADC_vect) {
 
+  PROFILE_BEGIN(PROFILE_ADC_ISR);
+
   // Reads out the ADC conversion result.
-  adc_result_t result;
+  uint16_t result;
   result = ADCL;
   result = result + (ADCH << 8);
 
-  // Stores the result.
-  // (Goodness gracious this is an ugly line)
-  adc_results_buffer[adc_results_buffer_index_sequence[adc_sequence_index]] = result;
+  // Adds it to the channel's accumulator. Once there are enough, their
+  // average is the new result.
+  uint8_t channel = adc_schedule[adc_schedule_index];
+  uint8_t oversample = adc_channel_config[channel].oversample;
+  adc_accumulator_t* accumulator = &adc_accumulators[channel];
+  accumulator->sum += result;
+  accumulator->count++;
+  if (accumulator->count >= (1 << oversample)) {
+    adc_results_buffer[channel].value = (adc_result_t) (accumulator->sum >> oversample);
+    adc_results_buffer[channel].sequence++;
+    adc_update_triplet(channel, adc_results_buffer[channel].value);
+    accumulator->sum = 0;
+    accumulator->count = 0;
+  }
 
-  // Moves on to the next channel.
-  if (adc_sequence_index == adc_sequence_length - 1) {
-    adc_sequence_index = 0;
-  } else {
-    adc_sequence_index = adc_sequence_index + 1;
+  // Moves on to the next slot.
+  adc_schedule_index++;
+  if (adc_schedule_index == ADC_SCHEDULE_LENGTH) {
+    adc_schedule_index = 0;
   }
 
   // Selects the next channel.
   ADMUX &= ~ADC_MUX_MASK;
-  ADMUX |= adc_mux_sequence[adc_sequence_index];
+  ADMUX |= adc_channel_config[adc_schedule[adc_schedule_index]].mux;
+
+  // With the auto trigger, the timer starts it. Otherwise, start it now.
+  #if !ADC_AUTO_TRIGGER
+    ADCSRA |= _BV(ADSC);
+  #endif
 
-  // Starts the new conversion.
-  ADCSRA |= _BV(ADSC);
+  PROFILE_END(PROFILE_ADC_ISR);
 
-}
\ No newline at end of file
+}
@@ -25,18 +25,59 @@
 // Must be a power of 2 between 2 and 128, inclusive.
 //#define ADC_PRESCALAR (8) // 8 allows the system clock to be 1 MHz or below.
 
-// Define these macros to configure which channels should be enabled.
-#define ADC_ENABLE_ADC0
-#define ADC_ENABLE_ADC1
-#define ADC_ENABLE_ADC2
-#define ADC_ENABLE_ADC3
-#define ADC_ENABLE_ADC4
-#define ADC_ENABLE_ADC5
-#define ADC_ENABLE_ADC6
-#define ADC_ENABLE_ADC7
-#define ADC_ENABLE_TEMP
-#define ADC_ENABLE_REF
-#define ADC_ENABLE_GND
+// If this is 1, each conversion is started by TIMER0's compare match A, the
+// same one that drives the 1 ms counters (timer.h), so the ADC runs at
+// exactly TIMER_COUNTER_HZ conversions per second no matter how long the ISR
+// takes. timer_counter_initialize has to be called for anything to happen.
+// If this is 0, the ISR starts the next conversion as soon as one finishes,
+// as fast as the prescaler allows.
+#define ADC_AUTO_TRIGGER (1)
+
+// The sampling schedule. Each channel gets ADC_SLOTS_<channel> of the
+// schedule's slots, and the conversions run through the slots over and over.
+// A channel with more slots is sampled more often. 0 turns a channel off.
+// A channel's slots are spread out over the schedule, so a channel with 2 of
+// 8 slots is sampled every 4 conversions.
+//
+// The rover only reads ADC0 (the IR sensor) and ADC1-3 (the accelerometer).
+#define ADC_SLOTS_ADC0 (2)
+#define ADC_SLOTS_ADC1 (2)
+#define ADC_SLOTS_ADC2 (2)
+#define ADC_SLOTS_ADC3 (2)
+#define ADC_SLOTS_ADC4 (0)
+#define ADC_SLOTS_ADC5 (0)
+#define ADC_SLOTS_ADC6 (0)
+#define ADC_SLOTS_ADC7 (0)
+#define ADC_SLOTS_TEMP (0)
+#define ADC_SLOTS_REF  (0)
+#define ADC_SLOTS_GND  (0)
+
+// Oversampling. A channel's result is the average of 2^ADC_OVERSAMPLE_<channel>
+// conversions, which takes the edge off the noise without changing the scale.
+// The result is updated once per that many conversions. At most 6.
+//
+// With the auto trigger, a channel gets a new result
+// TIMER_COUNTER_HZ * slots / schedule length / 2^oversample times a second.
+// That's about 122 Hz for the accelerometer, the same rate the launch check samples at,
+// and about 61 Hz for the IR sensor.
+#define ADC_OVERSAMPLE_ADC0 (2)
+#define ADC_OVERSAMPLE_ADC1 (1)
+#define ADC_OVERSAMPLE_ADC2 (1)
+#define ADC_OVERSAMPLE_ADC3 (1)
+#define ADC_OVERSAMPLE_ADC4 (0)
+#define ADC_OVERSAMPLE_ADC5 (0)
+#define ADC_OVERSAMPLE_ADC6 (0)
+#define ADC_OVERSAMPLE_ADC7 (0)
+#define ADC_OVERSAMPLE_TEMP (0)
+#define ADC_OVERSAMPLE_REF  (0)
+#define ADC_OVERSAMPLE_GND  (0)
+
+// Three channels that are read together, like the accelerometer's axes. Once
+// all three have a new result, the ISR publishes them as one triplet, so a
+// reader never gets X from one round and Z from the next. See adc_get_triplet.
+#define ADC_TRIPLET_CHANNEL_0 ADC_CHANNEL_ADC2  // accelerometer X
+#define ADC_TRIPLET_CHANNEL_1 ADC_CHANNEL_ADC1  // accelerometer Y
+#define ADC_TRIPLET_CHANNEL_2 ADC_CHANNEL_ADC3  // accelerometer Z
 
 ///////////////////// Type Definitions /////////////////////////////////////////
 
@@ -55,16 +96,39 @@ enum adc_channel_enum {
   ADC_CHANNEL_ADC7,
   ADC_CHANNEL_TEMP,
   ADC_CHANNEL_REF,
-  ADC_CHANNEL_GND
+  ADC_CHANNEL_GND,
+  ADC_CHANNEL_COUNT
 };
 typedef enum adc_channel_enum adc_channel_t;
 
+// A channel's result, and which one it is. sequence goes up by one (wrapping
+// around) every time the channel gets a new result, so anything reading at a
+// fixed rate can tell a new sample from one it already has, and whether it
+// missed any.
+typedef struct {
+  adc_result_t value;
+  uint8_t sequence;
+} adc_sample_t;
+
+// Results of the ADC_TRIPLET_CHANNEL_* channels from the same round.
+// sequence goes up by one with every new triplet.
+typedef struct {
+  adc_result_t value[3];
+  uint8_t sequence;
+} adc_triplet_t;
+
 ///////////////////// Public Function Prototypes ///////////////////////////////
 
 // Initializes the ADC, including configuring the appropriate pins.
 void adc_initialize(void);
 
-// Gets the most recent value of a particular ADC channel.
+// Gets the most recent (averaged) value of a particular ADC channel.
 adc_result_t adc_get_channel_result(adc_channel_t channel);
 
+// Gets the most recent value of a channel along with its sequence stamp.
+adc_sample_t adc_get_channel_sample(adc_channel_t channel);
+
+// Gets the most recent triplet of the ADC_TRIPLET_CHANNEL_* channels.
+adc_triplet_t adc_get_triplet(void);
+
 #endif
\ No newline at end of file
@@ -1,19 +1,42 @@
 #include "avoid_obstacles.h"
+#include "config.h"
 #include "ir.h"
 #include "motors.h"
+#include "pid.h"
+#include "timer.h"
 
 
+static pid_controller_t wall_follow;
+static bool wall_follow_initialized = false;
+
+
+// Runs the wall following controller once per control period (CONTROL_RATE_HZ), and does nothing in between.
 void avoid(bool is_upside_down) {
+    uint8_t ticks = take_control_ticks();
+    if (ticks == 0) {
+        return;
+    }
+
+    if (!wall_follow_initialized) {
+        pid_initialize(&wall_follow, WALL_FOLLOW_KP_Q8, WALL_FOLLOW_KI_Q8, WALL_FOLLOW_KD_Q8, WALL_FOLLOW_INTEGRAL_LIMIT, SPEED_MAX);
+        wall_follow_initialized = true;
+    }
+    else if (ticks > 2) {
+        // We haven't been steering for a while (dispensing, or a different state), so start fresh
+        pid_reset(&wall_follow);
+    }
+
+    int16_t distance = ir_distance_read();     // filtered, and only looked at once
+    int16_t steer = pid_step(&wall_follow, distance - WALL_FOLLOW_SETPOINT_CM);
+
     motor(RIGHT_MOTOR, FORWARD ^ is_upside_down, SPEED_MAX);
-        
-        if (ir_distance_read() > 26) {
-            motor(LEFT_MOTOR, FORWARD ^ is_upside_down, (uint8_t)(8 * (ir_distance_read()-25)));
-        }
-        else if (ir_distance_read() < 24) {
-            motor(LEFT_MOTOR, REVERSE ^ is_upside_down, (uint8_t)(8 * (25-ir_distance_read())));
-        }
-        else {
-            motor(LEFT_MOTOR, FORWARD ^ is_upside_down, 0);
-        }
+
+    // Too far from the wall: left motor forward to turn toward it. Too close: left motor in reverse to turn away.
+    if (steer >= 0) {
+        motor(LEFT_MOTOR, FORWARD ^ is_upside_down, (uint8_t) steer);
+    }
+    else {
+        motor(LEFT_MOTOR, REVERSE ^ is_upside_down, (uint8_t) -steer);
+    }
     return;
-}
\ No newline at end of file
+}
@@ -46,12 +46,23 @@ indescriminent of which orientation it is in.
 // The speed (0-249) at which the rover drives after exiting the canister
 #define DRIVE_SPEED     249
 
+// The left and right motors ramp MOTOR_RAMP_STEP speed every MOTOR_RAMP_PERIOD_MS toward whatever they're set to,
+// so 0 to full speed takes about (249 / 4) * 4 ms = 250 ms. When a motor changes direction it sits stopped for
+// MOTOR_REVERSE_HOLD_STEPS periods in between, so the back EMF dies down
+#define MOTOR_RAMP_PERIOD_MS        4
+#define MOTOR_RAMP_STEP             4
+#define MOTOR_REVERSE_HOLD_STEPS    25      // 100 ms of MOTOR_RAMP_PERIOD_MS
+
 ////////// Rover drive speeds //////////////////////////////////////////////////////////////
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////
 ////////// Timing for different states of the rover's main state machine ///////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////
+
+// The main loop sleeps between events, and wakes up at least this often to run the state machines (events.h)
+#define MAIN_LOOP_PERIOD_MS             10
+
 /*
 Do not change the flight values for testing!
 Instead, commment out the flight section and uncomment the test section
@@ -61,9 +72,10 @@ Instead, commment out the flight section and uncomment the test section
 #define WAIT_FOR_LAUNCH_LED_OFF_TIME    ((uint32_t) 10 * ONE_SECOND)         // LED turns green for this amount of time before turning off
 #define WAIT_FOR_LANDING_LED_OFF_TIME   ((uint32_t) 10 * ONE_SECOND)         // LED turns red for this amount of time before turning off
 
-#define WAIT_FOR_LANDING_TIME           ((uint32_t) 30 * ONE_MINUTE)         // Rover waits this amount of time after launch before attempting to exit the canister
+#define LANDING_MIN_TIME                ((uint32_t) 3  * ONE_MINUTE)         // Landing isn't looked for until this long after launch
+#define LANDING_STILL_TIME              ((uint32_t) 30 * ONE_SECOND)         // After an impact, the rover has to be still this long to count as landed
+#define WAIT_FOR_LANDING_TIME           ((uint32_t) 30 * ONE_MINUTE)         // If the rover hasn't seen itself land by now, it attempts to exit the canister anyway
 #define EXIT_TIME                       ((uint32_t) 20 * ONE_SECOND)         // Rover drives forward this amount of time in an attempt to exit the canister
-#define DRIVE_FORWARD_DELAY             ((uint32_t) 100)                     // Delay between exiting canister and driving forward to reduce back EMF if the rover wheels change direction
 #define DRIVE_TIME                      ((uint32_t) 10  * ONE_SECOND)        // Rover drives forward this amount of time between dispensing each cube. Joey drives just under 0.6 ft/s
 #define DISPENSE_TIME                   ((uint32_t) 12 * ONE_SECOND)         // Rover runs dispenser motor this amount of time to dispense one cube
 ////////// FLIGHT //////////
@@ -73,9 +85,10 @@ Instead, commment out the flight section and uncomment the test section
 // #define WAIT_FOR_LAUNCH_LED_OFF_TIME    ((uint32_t) 2  * ONE_SECOND)
 // #define WAIT_FOR_LANDING_LED_OFF_TIME   ((uint32_t) 2  * ONE_SECOND)
 
+// #define LANDING_MIN_TIME                ((uint32_t) 1  * ONE_SECOND)
+// #define LANDING_STILL_TIME              ((uint32_t) 1  * ONE_SECOND)
 // #define WAIT_FOR_LANDING_TIME           ((uint32_t) 3  * ONE_SECOND)    // ((uint32_t) 90 * ONE_SECOND)
 // #define EXIT_TIME                       ((uint32_t) 20 * ONE_SECOND)    // ((uint32_t) 20 * ONE_SECOND)
-// #define DRIVE_FORWARD_DELAY             ((uint32_t) 100)
 // #define DRIVE_TIME                      ((uint32_t) 14 * ONE_SECOND)    // About 0.6 ft/s
 // #define DISPENSE_TIME                   ((uint32_t) 14 * ONE_SECOND)    // To dispense one cube
 
@@ -88,9 +101,10 @@ Instead, commment out the flight section and uncomment the test section
 // #define WAIT_FOR_LAUNCH_LED_OFF_TIME    ((uint32_t) 2  * ONE_SECOND)
 // #define WAIT_FOR_LANDING_LED_OFF_TIME   ((uint32_t) 2  * ONE_SECOND)
 
+// #define LANDING_MIN_TIME                ((uint32_t) 1  * ONE_SECOND)
+// #define LANDING_STILL_TIME              ((uint32_t) 1  * ONE_SECOND)
 // #define WAIT_FOR_LANDING_TIME           ((uint32_t) 3  * ONE_SECOND)
 // #define EXIT_TIME                       ((uint32_t) 1)
-// #define DRIVE_FORWARD_DELAY             ((uint32_t) 100)
 // #define DRIVE_TIME                      ((uint32_t) 10 * ONE_SECOND)    //84 * ONE_SECOND      // About 0.6 ft/s
 // #define DISPENSE_TIME                   ((uint32_t) 12 * ONE_SECOND)    // To dispense one cube
 ////////// DEMO //////////
@@ -99,6 +113,57 @@ Instead, commment out the flight section and uncomment the test section
 
 
 
+////////////////////////////////////////////////////////////////////////////////////////////
+////////// Wall following //////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////
+/*
+avoid() keeps the rover WALL_FOLLOW_SETPOINT_CM from whatever the IR sensor sees, with a
+PID controller on the left motor. The right motor always drives forward at SPEED_MAX.
+Gains are in 1/256ths, so 256 is a gain of 1 (motor speed per cm of error).
+*/
+
+#define CONTROL_RATE_HZ                 50      // How often the controller runs
+#define WALL_FOLLOW_SETPOINT_CM         25      // Distance to keep from the wall
+#define WALL_FOLLOW_KP_Q8               (8 * 256)   // 8 speed per cm, what the old bang-bang steering used
+#define WALL_FOLLOW_KI_Q8               (16)        // per 1/CONTROL_RATE_HZ step
+#define WALL_FOLLOW_KD_Q8               (64 * 256)  // per cm of change per step
+#define WALL_FOLLOW_INTEGRAL_LIMIT      (2000)      // cm * steps
+
+////////// Wall following //////////////////////////////////////////////////////////////////
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////
+////////// Flight recorder /////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////
+/*
+The recorder (recorder.h) is armed when the launch check starts, and triggered by the
+launch. At about 5 bytes a sample, the EEPROM holds around 200 samples: 0.6 s before the
+launch and 4.4 s after at these settings.
+*/
+
+#define RECORDER_PERIOD_MS              25      // Time between samples
+#define RECORDER_PRETRIGGER_SAMPLES     24      // Samples kept from before the trigger
+#define RECORDER_RING_SAMPLES           32      // RAM for samples waiting on the EEPROM. A power of two, at least RECORDER_PRETRIGGER_SAMPLES
+
+////////// Flight recorder /////////////////////////////////////////////////////////////////
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////
+////////// Transceiver link ////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////
+/*
+The rover tells its transceiver cube what it's doing over the UART (trx_link.h), and the
+transceiver passes it on to this cube. The transceiver is started at landing.
+*/
+
+#define TRX_LINK_DEST_PORT              0x3A    // Cube 0. 0x30 is every cube, which holds the transceiver up longer
+
+////////// Transceiver link ////////////////////////////////////////////////////////////////
+
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////
 ////////// Skip to data cube demo ///////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////
@@ -121,6 +186,10 @@ Instead, commment out the flight section and uncomment the test section
 
 #define LAUNCH_FORCE_CNT_THRESHOLD 2                      // TEST //
 
+#define ACCEL_CHECK_PERIOD_MS 8                             // The launch and no motion checks take a sample every this many TIMER0 ticks (about 122 Hz)
+
+#define LAUNCH_WINDOW_LENGTH 64                             // Number of samples (one per ACCEL_CHECK_PERIOD_MS) LAUNCH_FORCE_CNT_THRESHOLD is counted over, up to 64
+
 ////////// Launch detection settings ///////////////////////////////////////////////////////
 
 
@@ -134,6 +203,33 @@ Instead, commment out the flight section and uncomment the test section
 // No motion is 19.6 (1/2) m/s/s
 #define NO_MOVEMENT_TOLERANCE 5
 
+#define NO_MOTION_WINDOW_LENGTH 64                          // Number of samples (one per ACCEL_CHECK_PERIOD_MS) the no motion check looks at, up to 64
+#define NO_MOTION_CNT_THRESHOLD 58                          // Number of those samples that must be within NO_MOVEMENT_TOLERANCE to trigger is_no_motion
+                                                            // 58 is 90% of 64 samples
+
+////////// No movement detection settings //////////////////////////////////////////////////
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////
+////////// Landing detection settings //////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////
+/*
+Under the parachute the rover feels about 1 G, the same as sitting on the ground, so no
+motion alone doesn't mean it's landed. Impact detection only starts LANDING_MIN_TIME
+after launch, since boost and coasting look like impacts too. After that it has to see
+an impact (or a stretch of free fall), then be still for LANDING_STILL_TIME from the
+last one. WAIT_FOR_LANDING_TIME is the latest it waits.
+*/
+
+#define LANDING_IMPACT_FORCE 4                              // Force in Gs of one sample that counts as an impact
+
+#define FREE_FALL_FORCE_TENTHS 3                            // Samples under this (in tenths of a G) count toward free fall
+#define FREE_FALL_WINDOW_LENGTH 32                          // Number of samples (one per ACCEL_CHECK_PERIOD_MS) free fall is counted over, up to 64
+#define FREE_FALL_CNT_THRESHOLD 24                          // Number of those samples that must be under FREE_FALL_FORCE_TENTHS
+
+////////// Landing detection settings //////////////////////////////////////////////////////
+
 ////////// No movement detection settings //////////////////////////////////////////////////
 
 
@@ -0,0 +1,45 @@
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+
+#include "events.h"
+#include "config.h"
+#include "timer.h"
+
+static volatile event_mask_t pending = 0;
+
+
+static void main_loop_tick(void) {
+    pending |= EVENT_TICK;
+}
+
+void events_initialize(void) {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    timer_every(main_loop_tick, MAIN_LOOP_PERIOD_MS);
+}
+
+void event_post(event_mask_t events) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        pending |= events;
+    }
+}
+
+event_mask_t event_wait(void) {
+    event_mask_t events;
+
+    cli();
+    while (pending == 0) {
+        // sei() holds off interrupts for one more instruction, so one can't
+        // post an event between checking and going to sleep
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+        cli();
+    }
+    events = pending;
+    pending = 0;
+    sei();
+
+    return events;
+}
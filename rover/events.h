@@ -0,0 +1,44 @@
+#ifndef _EVENTS_H
+#define _EVENTS_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Events
+//
+// Lets the main loop sleep until there's something to do. Interrupts and
+// software timers post events, and event_wait() idles the CPU
+// (SLEEP_MODE_IDLE) until at least one is pending. The timers, the ADC and
+// the U(S)ART keep running while it sleeps, and any of their interrupts
+// wakes it back up.
+//
+// EVENT_TICK comes every MAIN_LOOP_PERIOD_MS no matter what, so a state that
+// only watches the clock or the switches still reacts within that long.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+
+///////////////////// Type Definitions /////////////////////////////////////////
+
+// One bit per event. Posting one that's already pending does nothing.
+typedef uint8_t event_mask_t;
+
+#define EVENT_TICK          (1 << 0)    // every MAIN_LOOP_PERIOD_MS
+#define EVENT_CONTROL       (1 << 1)    // every 1/CONTROL_RATE_HZ (timer.c)
+#define EVENT_LAUNCH        (1 << 2)    // is_launched() just saw the launch (accelerometer.c)
+#define EVENT_NO_MOTION     (1 << 3)    // is_no_motion() just saw the rover stop (accelerometer.c)
+#define EVENT_RECORD        (1 << 4)    // the flight recorder is due a sample (recorder.c)
+
+///////////////////// Public Function Prototypes ///////////////////////////////
+
+// Schedules EVENT_TICK. timer_counter_initialize has to be called first
+void events_initialize(void);
+
+// Marks events as pending. Fine to call from an interrupt
+void event_post(event_mask_t events);
+
+// Sleeps until at least one event is pending, then returns all of them and
+// clears them. Returns right away if some already are
+event_mask_t event_wait(void);
+
+#endif
@@ -11,6 +11,8 @@
 #include <avr/interrupt.h>
 
 #include <stdio.h>
+#include <string.h>
+#include <avr/pgmspace.h>
 
 #include "adc.h"
 #include "ir.h"
@@ -19,7 +21,77 @@
 #define IR_POWER_PORT    PORTB
 #define IR_POWER_INDEX   PIN7
 
-///////////////////// Public Function Prototypes ///////////////////////////////
+///////////////////// Calibration //////////////////////////////////////////////
+
+// Filtered ADC readings and the distances in centimeters they mean, from the
+// closest (highest reading) to the farthest. Readings in between are
+// interpolated. Readings below the last point are out of range.
+//
+// These points follow the straight-line fit this file used before
+// (61 - reading / 12) through the middle of the range, and flatten out near
+// the sensor where the GP2Y0E02A's output saturates. Measure the sensor
+// against a ruler and put the real numbers here.
+typedef struct {
+    int16_t reading;
+    int16_t distance_cm;
+} ir_calibration_point_t;
+
+static const ir_calibration_point_t ir_calibration[] PROGMEM = {
+    { 700,  4 },
+    { 636,  8 },
+    { 540, 16 },
+    { 444, 24 },
+    { 348, 32 },
+    { 252, 40 },
+    { 156, 48 },
+    {  60, 56 },
+    {  36, 58 },
+};
+
+#define IR_CALIBRATION_POINTS (sizeof(ir_calibration) / sizeof(*ir_calibration))
+
+///////////////////// Static Variables /////////////////////////////////////////
+
+static int16_t ir_history[3];           // the last three samples, for the median
+static uint8_t ir_history_count = 0;
+static int32_t ir_average;              // the moving average, times 2^IR_EMA_SHIFT
+static uint8_t ir_last_sequence;
+static int16_t ir_distance_cm = IR_DISTANCE_OUT_OF_RANGE;
+
+///////////////////// Private Function Bodies //////////////////////////////////
+
+static int16_t ir_median_of_3(int16_t a, int16_t b, int16_t c) {
+    if (a > b) {
+        int16_t t = a; a = b; b = t;
+    }
+    if (b > c) {
+        b = c;
+    }
+    return a > b ? a : b;
+}
+
+// Looks a filtered reading up in the calibration table.
+static int16_t ir_reading_to_cm(int16_t reading) {
+    ir_calibration_point_t near, far;
+
+    memcpy_P(&near, &ir_calibration[0], sizeof(near));
+    if (reading >= near.reading) {
+        return near.distance_cm;
+    }
+
+    for (uint8_t i = 1; i < IR_CALIBRATION_POINTS; i++) {
+        memcpy_P(&far, &ir_calibration[i], sizeof(far));
+        if (reading >= far.reading) {
+            return near.distance_cm + (int16_t) ((int32_t) (near.reading - reading)
+                * (far.distance_cm - near.distance_cm) / (near.reading - far.reading));
+        }
+        near = far;
+    }
+
+    return IR_DISTANCE_OUT_OF_RANGE;
+}
+
+///////////////////// Public Function Bodies ///////////////////////////////////
 
 // Initializes IR power pin to an output
 void ir_initialize(void) {
@@ -39,28 +111,32 @@ void ir_power(output_state_t state) {
     }
 }
 
-// Requests and returns a distance from the IR sensor in centemeters.
-int16_t ir_distance_read(void) {
-
-    // Define variable types
-    int16_t ir_distance_cm_comp;                                        // Final deadband compensated distance in centimeters
-    int16_t offset = 61;                                                // Equation offset (b)
-    int16_t conversion = adc_get_channel_result(ADC_CHANNEL_ADC0)/12;   // Equation linear coefficent (m)
-
-    // Compute distance equation (y=mx+b)
-    int16_t ir_distance_cm_uncomp = offset - conversion;
-
-    // Deadband compensation
-    if (ir_distance_cm_uncomp >= offset-2)              // If measured distance is within deadband or out of range
-    {
-        ir_distance_cm_comp = 50;                        // Return compensated value of 0
+// Takes in the IR sensor's latest ADC sample, if there's a new one.
+void ir_update(void) {
+    adc_sample_t sample = adc_get_channel_sample(ADC_CHANNEL_ADC0);
+    if (ir_history_count > 0 && sample.sequence == ir_last_sequence) {
+        return;
     }
-    else                                                // Else 
-    {   
-        ir_distance_cm_comp = ir_distance_cm_uncomp;    // Return uncompensated value
+    ir_last_sequence = sample.sequence;
+
+    // Until there are three samples, they all count as the first one.
+    if (ir_history_count == 0) {
+        ir_history[0] = ir_history[1] = ir_history[2] = sample.value;
+        ir_average = (int32_t) sample.value << IR_EMA_SHIFT;
+        ir_history_count = 1;
     }
+    ir_history[2] = ir_history[1];
+    ir_history[1] = ir_history[0];
+    ir_history[0] = sample.value;
 
-    // Return distance in centimeters
-    return ir_distance_cm_comp;
+    int16_t median = ir_median_of_3(ir_history[0], ir_history[1], ir_history[2]);
+    ir_average += median - (ir_average >> IR_EMA_SHIFT);
 
-}
\ No newline at end of file
+    ir_distance_cm = ir_reading_to_cm((int16_t) (ir_average >> IR_EMA_SHIFT));
+}
+
+// Returns the filtered distance from the IR sensor in centemeters.
+int16_t ir_distance_read(void) {
+    ir_update();
+    return ir_distance_cm;
+}
@@ -8,10 +8,23 @@
 // Provides functions that convert ATMega328p's 10-bit ADC value read from
 // the GP2Y0E02A IR distance sensor into centimeters.
 //
+// Each new ADC sample goes through a median-of-3 filter (to throw out single
+// spikes) and then an exponential moving average, and the result is turned
+// into centimeters through a calibration table. The distance is worked out
+// once per sample and kept, so reading it is cheap.
+//
 ////////////////////////////////////////////////////////////////////////////////
 
 #include "digital_io.h"
 
+///////////////////// IR Settings //////////////////////////////////////////////
+
+// What ir_distance_read returns when nothing is in range.
+#define IR_DISTANCE_OUT_OF_RANGE (50)
+
+// How much each new sample moves the average: 1 / 2^IR_EMA_SHIFT of the way.
+#define IR_EMA_SHIFT (2)
+
 ///////////////////// Public Function Prototypes ///////////////////////////////
 
 // Initializes IR power pin to an output
@@ -20,7 +33,11 @@ void ir_initialize(void);
 // Turns on or off the IR sensor.
 void ir_power(output_state_t state);
 
-// Requests and returns a distance from the IR sensor in centemeters.
+// Takes in the IR sensor's latest ADC sample, if there's a new one. Call this
+// at least as often as the ADC's IR rate (see adc.h) to use every sample.
+void ir_update(void);
+
+// Returns the filtered distance from the IR sensor in centemeters.
 int16_t ir_distance_read(void);
 
-#endif
\ No newline at end of file
+#endif
@@ -8,6 +8,7 @@
 #include <avr/interrupt.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
 
 #include "config.h"
@@ -19,6 +20,10 @@
 #include "accelerometer.h"
 #include "ir.h"
 #include "avoid_obstacles.h"
+#include "events.h"
+#include "recorder.h"
+#include "trx_link.h"
+#include "profile.h"
 
 
 
@@ -68,6 +73,14 @@ static volatile bool is_upside_down;
 // Keeps track of number of data cubes dispensed by the rover.
 static volatile uint8_t cubes_dispensed = 0;
 
+// When the rover last moved while waiting for landing, on counter_alpha.
+static uint32_t landing_last_motion_time = 0;
+
+// Whether impact detection has been armed, LANDING_MIN_TIME after launch, and whether it has seen an impact since.
+// Boost and free fall after burnout look like impacts too, so anything from before then doesn't count.
+static bool landing_impact_armed = false;
+static bool landing_impact_seen = false;
+
 
 
 /////////////////// Private Function Prototypes ///////////////////////////////
@@ -82,6 +95,9 @@ rover_mode_t rover_mode_state_reset(void);
 rover_mode_t rover_mode_state_manual_load(void);
 rover_mode_t rover_mode_state_flight(bool reset_flight_state);
 
+// Prints the name of the state the rover is going into, and tells the transceiver too.
+static void announce_state(const char* name);
+
 // The flight_state state machine is inside the rover_mode state machine's flight_mode state
 flight_state_t flight_state_wait_for_launch(void);
 flight_state_t flight_state_wait_for_landing(void);
@@ -108,9 +124,15 @@ int main() {
     motors_initialize();                // PWM must be initialized seperately
 
     timer_counter_initialize();
+    events_initialize();
+    trx_link_initialize();
 
 
     while(1) { // Begin main loop
+        event_wait();           // Sleep until a tick, a control period or the launch check says to run again
+        recorder_poll();
+        trx_link_poll();
+
         if (end_operation == true) {
             break;
         }
@@ -149,6 +171,13 @@ int main() {
     motor(RIGHT_MOTOR, FORWARD, 0);
     motor(DISPENSER_MOTOR, FORWARD, 0);
 
+    // Let the recording finish before the interrupts that write it go off
+    recorder_disarm();
+    recorder_flush();
+
+    // How long the hot paths took, in a PROFILE build
+    profile_print();
+
     // Disable interrupts
     cli();
 
@@ -160,6 +189,13 @@ int main() {
 
 
 
+static void announce_state(const char* name) {
+    uart_transmit_formatted_message("%s\r\n", name);
+    trx_link_send(TRX_LINK_TYPE_STATE, (const uint8_t*) name, strlen(name));
+}
+
+
+
 // reset state
 rover_mode_t rover_mode_state_reset(void) {
     rover_mode_t rover_mode_next = RESET;       // return value
@@ -172,15 +208,12 @@ rover_mode_t rover_mode_state_reset(void) {
     // exit condition: unconditional
     if (SW_read(ROVER_MODE_SW) == 1) {  // change state to manual load mode if switch is turned to manual load
         uart_transmit_formatted_message("MANUAL_LOAD_MODE\r\n");
-        UART_WAIT_UNTIL_DONE();
         rover_mode_next = MANUAL_LOAD_MODE;
     }
     else {                              // change state to flight if switch is turned to flight mode
         LED_set(GREEN, ON);
-        uart_transmit_formatted_message("FLIGHT_MODE\r\n");
-        UART_WAIT_UNTIL_DONE();
-        uart_transmit_formatted_message("WAIT_FOR_LAUNCH\r\n");
-        UART_WAIT_UNTIL_DONE();
+        announce_state("FLIGHT_MODE");
+        announce_state("WAIT_FOR_LAUNCH");
         reset_launch_is_a_go();
         reset_no_motion();
         reset_timer_counter(counter_alpha);
@@ -212,6 +245,8 @@ rover_mode_t rover_mode_state_manual_load(void) {
     if (SW_read(ROVER_MODE_SW) == 0) {
         rover_mode_next = RESET;
     }
+
+    return rover_mode_next;
 }   // end rover_mode_state_manual_load()
 
 
@@ -270,6 +305,8 @@ rover_mode_t rover_mode_state_flight(bool reset_flight_state) {
         motor(RIGHT_MOTOR, FORWARD, 0);
         motor(DISPENSER_MOTOR, FORWARD, 0);
         launch_check_disable();
+        no_motion_check_disable();
+        recorder_disarm();
         rover_mode_next = RESET;
     }
 
@@ -294,15 +331,22 @@ flight_state_t flight_state_wait_for_launch(void) {
     if (current_time >= WAIT_FOR_LAUNCH_LED_OFF_TIME) {
         LED_set(YELLOW, OFF);
         launch_check_enable();
+        recorder_arm();
     }
 
     // exit condition: rocket launch detected
     if (get_launch_is_a_go() == true) {
         launch_check_disable();
+        recorder_trigger();
+        reset_no_motion();
+        reset_impact_seen();
+        landing_last_motion_time = 0;
+        landing_impact_armed = false;
+        landing_impact_seen = false;
+        no_motion_check_enable();
         LED_set(RED, ON);
         LED_set(GREEN, OFF);
-        uart_transmit_formatted_message("WAIT_FOR_LANDING\r\n");
-        UART_WAIT_UNTIL_DONE();
+        announce_state("WAIT_FOR_LANDING");
         reset_timer_counter(counter_alpha);
         flight_state_next = WAIT_FOR_LANDING;
     }
@@ -323,15 +367,36 @@ flight_state_t flight_state_wait_for_landing(void) {
         LED_set(YELLOW, OFF);
     }
 
-    // exit condition: time delay elapsed
-    if (current_time >= WAIT_FOR_LANDING_TIME) {
+    if (get_no_motion() == false) {
+        landing_last_motion_time = current_time;
+    }
+
+    // Forget whatever the flight itself set off, then start looking for impacts
+    if (!landing_impact_armed && current_time >= LANDING_MIN_TIME) {
+        reset_impact_seen();
+        landing_impact_armed = true;
+    }
+
+    // Each impact starts the stillness window over, so it has to be still after the last one
+    if (landing_impact_armed && get_impact_seen() == true) {
+        reset_impact_seen();
+        landing_impact_seen = true;
+        landing_last_motion_time = current_time;
+    }
+
+    // exit condition: still for a while after an impact, or the time delay elapsed
+    bool landed = landing_impact_seen && (current_time - landing_last_motion_time >= LANDING_STILL_TIME);
+
+    if (landed || current_time >= WAIT_FOR_LANDING_TIME) {
+        no_motion_check_disable();
+        uart_transmit_formatted_message(landed ? "LANDED %lu s\r\n" : "LANDING TIMEOUT %lu s\r\n", current_time / ONE_SECOND);
         LED_set(YELLOW, OFF);
         #ifdef JOEY_EXIT_METHOD
             is_upside_down = !is_up();
         #endif
+        signal_data_cube(ON);       // On the ground, so the transceiver can start passing on what the rover tells it
         PWM_enable();
-        uart_transmit_formatted_message("EXIT_CANISTER\r\n");
-        UART_WAIT_UNTIL_DONE();
+        announce_state("EXIT_CANISTER");
         reset_timer_counter(counter_alpha);
         flight_state_next = EXIT_CANISTER;
     }
@@ -366,8 +431,7 @@ flight_state_t flight_state_exit_canister(void) {
         #ifdef WOMBAT_EXIT_METHOD
             is_upside_down = !is_up();
         #endif
-        uart_transmit_formatted_message("DRIVE_FORWARD\r\n");
-        UART_WAIT_UNTIL_DONE();
+        announce_state("DRIVE_FORWARD");
         reset_timer_counter(counter_alpha);
         flight_state_next = DRIVE_FORWARD;
     }
@@ -384,9 +448,7 @@ flight_state_t flight_state_drive_forward(void) {
 
     current_time = get_timer_counter(counter_alpha);
 
-    if (current_time >= DRIVE_FORWARD_DELAY) {
-        avoid(is_upside_down);
-    }
+    avoid(is_upside_down);          // the motor ramp stops the wheels before they change direction
 
     // exit condition: time delay elapsed
     if (current_time >= DRIVE_TIME) {
@@ -394,7 +456,7 @@ flight_state_t flight_state_drive_forward(void) {
         motor(RIGHT_MOTOR, FORWARD, 0);
         ir_power(OFF);
         uart_transmit_formatted_message("DISPENSE_DATA_CUBE %d\r\n", cubes_dispensed+1);
-        UART_WAIT_UNTIL_DONE();
+        trx_link_send(TRX_LINK_TYPE_STATE, (const uint8_t*) "DISPENSE_DATA_CUBE", sizeof("DISPENSE_DATA_CUBE") - 1);
         reset_timer_counter(counter_alpha);
         flight_state_next = DISPENSE_DATA_CUBE;
     }
@@ -417,15 +479,13 @@ flight_state_t flight_state_dispense_data_cube(void) {
         motor(DISPENSER_MOTOR, FORWARD, 0);
         ir_power(ON);
         cubes_dispensed++;
-        uart_transmit_formatted_message("DRIVE_FORWARD\r\n");
-        UART_WAIT_UNTIL_DONE();
+        announce_state("DRIVE_FORWARD");
         reset_timer_counter(counter_alpha);
         flight_state_next = DRIVE_FORWARD;
     }
     else if (current_time >= DISPENSE_TIME) {   // change state to signal data cube if all data cubes dispensed (drive on state transition)
         motor(DISPENSER_MOTOR, FORWARD, 0);
-        uart_transmit_formatted_message("SIGNAL_ONBOARD_DATA_CUBE\r\n");
-        UART_WAIT_UNTIL_DONE();
+        announce_state("SIGNAL_ONBOARD_DATA_CUBE");
         reset_timer_counter(counter_alpha);
         flight_state_next = SIGNAL_ONBOARD_DATA_CUBE;
     }
@@ -451,8 +511,7 @@ flight_state_t flight_state_signal_onboard_data_cube(void) {
         signal_data_cube(ON);
         LED_set(GREEN, ON);
         LED_set(RED, OFF);
-        uart_transmit_formatted_message("DEAD_LOOP\r\n");
-        UART_WAIT_UNTIL_DONE();
+        announce_state("DEAD_LOOP");
         flight_state_next = DEAD_LOOP;
     }
 
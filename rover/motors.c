@@ -1,7 +1,10 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 
 #include "motors.h"
+#include "config.h"
+#include "timer.h"
 
 
 //////////////////// Macros for Accessing Registers ////////////////////
@@ -52,6 +55,22 @@
 
 
 
+//////////////////// Ramp State ////////////////////
+// Speeds are signed here: positive is FORWARD, negative is REVERSE.
+// motor() sets the target, and motors_ramp_tick() moves the current speed toward it.
+#define RAMPED_MOTORS 2                         // LEFT_MOTOR and RIGHT_MOTOR
+
+static volatile int16_t ramp_target[RAMPED_MOTORS];
+static int16_t ramp_current[RAMPED_MOTORS];
+static uint8_t ramp_hold[RAMPED_MOTORS];         // steps left to sit at zero before reversing
+//////////////////// Ramp State ////////////////////
+
+
+
+static void motor_apply(motor_name_t motor_name, motor_direction_t direction, uint8_t speed);
+
+
+
 void motors_initialize(void) {
     // Configure as an outputs
     LEFT1_DDR       |= _BV(LEFT1_INDEX);
@@ -91,11 +110,85 @@ void PWM_enable(void) {
     LEFT2_OCR  = 255;
     RIGHT1_OCR = 255;
     RIGHT2_OCR = 255;
+
+    // Everything starts from a standstill
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for (uint8_t i = 0; i < RAMPED_MOTORS; i++) {
+            ramp_target[i] = 0;
+            ramp_current[i] = 0;
+            ramp_hold[i] = 0;
+        }
+    }
+    timer_every(motors_ramp_tick, MOTOR_RAMP_PERIOD_MS);
 }
 
 
 
+// Sets the speed and direction of a specified motor. The left and right motors get there gradually (see motors.h)
 void motor(motor_name_t motor_name, motor_direction_t direction, uint8_t speed) {
+    if (motor_name == LEFT_MOTOR || motor_name == RIGHT_MOTOR) {
+        int16_t target = speed > SPEED_MAX ? SPEED_MAX : speed;
+        if (direction == REVERSE) {
+            target = -target;
+        }
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            ramp_target[motor_name] = target;
+        }
+    }
+    else {
+        motor_apply(motor_name, direction, speed);  // The dispenser is only ever on or off
+    }
+}
+
+
+
+// Called by a software timer (timer.c) every MOTOR_RAMP_PERIOD_MS. Moves each motor MOTOR_RAMP_STEP closer to its
+// target. A motor that has to change direction slows to a stop, sits there for MOTOR_REVERSE_HOLD_STEPS, and then
+// speeds up the other way.
+void motors_ramp_tick(void) {
+    for (uint8_t i = 0; i < RAMPED_MOTORS; i++) {
+        int16_t target = ramp_target[i];
+        int16_t current = ramp_current[i];
+
+        if (current == target) {
+            continue;
+        }
+
+        // Going the other way? Stop at zero first.
+        if ((current > 0 && target < 0) || (current < 0 && target > 0)) {
+            target = 0;
+        }
+
+        if (current == 0 && ramp_hold[i] > 0) {
+            ramp_hold[i]--;
+            continue;
+        }
+
+        if (current < target) {
+            current = (target - current > MOTOR_RAMP_STEP) ? current + MOTOR_RAMP_STEP : target;
+        }
+        else if (current > target) {
+            current = (current - target > MOTOR_RAMP_STEP) ? current - MOTOR_RAMP_STEP : target;
+        }
+
+        if (current == 0 && ramp_target[i] != 0) {
+            ramp_hold[i] = MOTOR_REVERSE_HOLD_STEPS;
+        }
+
+        ramp_current[i] = current;
+        if (current >= 0) {
+            motor_apply((motor_name_t) i, FORWARD, (uint8_t) current);
+        }
+        else {
+            motor_apply((motor_name_t) i, REVERSE, (uint8_t) -current);
+        }
+    }
+}
+
+
+
+// Sets the speed and direction of a motor right away
+static void motor_apply(motor_name_t motor_name, motor_direction_t direction, uint8_t speed) {
     uint8_t ocr_val;
 
     if (speed < 0) {                // Account for if the control code doesn't like directions
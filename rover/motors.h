@@ -25,10 +25,16 @@ typedef enum motor_name_enum motor_name_t;
 // Initializes motor IO pins. PWM must be initialized seperately
 void motors_initialize(void);
 
-// Enables PWM for left and right (but not dispenser) motors. Cannot function if PWM_enable (from motors.c) is called
+// Enables PWM for left and right (but not dispenser) motors and starts the ramp (motors_ramp_tick)
 void PWM_enable(void);
 
 // Sets the speed and direction of a specified motor. Dispenser to dispense is forward
+// The left and right motors don't jump to the new speed. They ramp there at MOTOR_RAMP_STEP per MOTOR_RAMP_PERIOD_MS
+// (config.h), and stop before changing direction, which keeps the current spikes and back EMF down. The dispenser
+// changes right away
 void motor(motor_name_t motor_name, motor_direction_t direction, uint8_t speed);
 
+// Moves the left and right motors toward their targets. PWM_enable schedules it every MOTOR_RAMP_PERIOD_MS (timer.h)
+void motors_ramp_tick(void);
+
 #endif //MOTORS_H
@@ -0,0 +1,41 @@
+#include "pid.h"
+
+void pid_initialize(pid_controller_t* pid, int16_t kp_q8, int16_t ki_q8, int16_t kd_q8, int16_t integral_limit, int16_t output_limit) {
+    pid->kp_q8 = kp_q8;
+    pid->ki_q8 = ki_q8;
+    pid->kd_q8 = kd_q8;
+    pid->integral_limit = integral_limit;
+    pid->output_limit = output_limit;
+    pid_reset(pid);
+}
+
+void pid_reset(pid_controller_t* pid) {
+    pid->integral = 0;
+    pid->last_error = 0;
+    pid->started = false;
+}
+
+static int16_t pid_clamp(int32_t value, int16_t limit) {
+    if (value > limit) {
+        return limit;
+    }
+    if (value < -limit) {
+        return -limit;
+    }
+    return (int16_t) value;
+}
+
+int16_t pid_step(pid_controller_t* pid, int16_t error) {
+    // No derivative kick on the first step.
+    int16_t derivative = pid->started ? error - pid->last_error : 0;
+    pid->last_error = error;
+    pid->started = true;
+
+    pid->integral = pid_clamp((int32_t) pid->integral + error, pid->integral_limit);
+
+    int32_t output_q8 = (int32_t) pid->kp_q8 * error
+                      + (int32_t) pid->ki_q8 * pid->integral
+                      + (int32_t) pid->kd_q8 * derivative;
+
+    return pid_clamp(output_q8 / 256, pid->output_limit);
+}
@@ -0,0 +1,43 @@
+#ifndef _PID_H_
+#define _PID_H_
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// PID
+//
+// A fixed-point PID controller meant to be stepped at a fixed rate. Gains are
+// in 1/256ths (Q8), so a gain of 256 is 1.0. The integral is clamped so it
+// can't wind up while the output is pinned at its limit.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+
+///////////////////// Type Definitions /////////////////////////////////////////
+
+typedef struct {
+    int16_t kp_q8;              // proportional gain
+    int16_t ki_q8;              // integral gain, per step
+    int16_t kd_q8;              // derivative gain, per step
+    int16_t integral_limit;     // the integral stays within +/- this
+    int16_t output_limit;       // the output stays within +/- this
+    int16_t integral;           // sum of the errors so far
+    int16_t last_error;
+    bool started;               // last_error is valid
+} pid_controller_t;
+
+///////////////////// Public Function Prototypes ///////////////////////////////
+
+// Sets the gains and limits, and resets the controller.
+void pid_initialize(pid_controller_t* pid, int16_t kp_q8, int16_t ki_q8, int16_t kd_q8, int16_t integral_limit, int16_t output_limit);
+
+// Forgets the integral and the last error, for when the controller hasn't
+// been running for a while.
+void pid_reset(pid_controller_t* pid);
+
+// Takes one step with the error (setpoint - measurement, or the other way
+// around, as long as it's consistent), and returns the output.
+int16_t pid_step(pid_controller_t* pid, int16_t error);
+
+#endif
@@ -0,0 +1,341 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <string.h>
+
+#include "recorder.h"
+#include "config.h"
+#include "events.h"
+#include "timer.h"
+#include "accelerometer.h"
+#include "ir.h"
+#include "trx_link.h"
+
+#if (RECORDER_RING_SAMPLES & (RECORDER_RING_SAMPLES - 1)) != 0 || RECORDER_RING_SAMPLES > 128
+    #error "RECORDER_RING_SAMPLES must be a power of two, no more than 128."
+#endif
+
+#if RECORDER_PRETRIGGER_SAMPLES > RECORDER_RING_SAMPLES
+    #error "RECORDER_PRETRIGGER_SAMPLES can't be more than RECORDER_RING_SAMPLES."
+#endif
+
+#if RECORDER_EEPROM_LEN != E2END + 1
+    #error "RECORDER_EEPROM_LEN doesn't match this part's EEPROM."
+#endif
+
+#define RECORDER_WRITE_RING_LEN (64)
+
+typedef struct {
+    uint16_t time_ms;           // low bits of counter_beta
+    int16_t x;
+    int16_t y;
+    int16_t z;
+    uint8_t ir_cm;
+} recorder_sample_t;
+
+static volatile bool armed = false;
+static bool triggered = false;
+static volatile uint8_t samples_due = 0;     // Only the sampling timer counts these up
+
+// Samples not yet encoded. Before the trigger the oldest fall off the end, so
+// these are the last RECORDER_PRETRIGGER_SAMPLES. After it, this is the
+// backlog waiting for room in the write ring, and new samples are dropped if
+// it's full (the next one's time shows the gap). Counts up forever and wraps,
+// like the rings in uart.c.
+static recorder_sample_t sample_ring[RECORDER_RING_SAMPLES];
+static uint8_t sample_ring_head = 0;
+static uint8_t sample_ring_tail = 0;
+
+// The last sample encoded, which the next one is the difference from.
+static recorder_sample_t last;
+
+// Samples on their way to the transceiver (trx_link.h), encoded the same way.
+// Each batch starts over from zero so it can be decoded without the others,
+// which can get lost.
+static uint8_t link_batch[TRX_LINK_MAX_MESSAGE_LEN - 1];
+static uint8_t link_batch_len = 0;
+static recorder_sample_t link_last;
+
+// Where the next encoded byte goes in the EEPROM.
+static uint16_t next_addr = 0;
+
+// Bytes waiting to be written. Only the interrupt moves write_ring_tail and
+// write_addr, and only recorder_poll moves write_ring_head.
+static uint8_t write_ring[RECORDER_WRITE_RING_LEN];
+static volatile uint8_t write_ring_head = 0;
+static volatile uint8_t write_ring_tail = 0;
+static volatile uint16_t write_addr = 0;
+
+// The length in the header, and how far the interrupt is through changing it.
+static uint16_t length_written = 0;
+static uint16_t length_writing = 0;
+static uint8_t length_step = 0;
+
+
+
+static void recorder_tick(void) {
+    if (samples_due < 255) {
+        samples_due++;
+    }
+    event_post(EVENT_RECORD);
+}
+
+
+
+static uint8_t write_ring_free(void) {
+    return RECORDER_WRITE_RING_LEN - (uint8_t) (write_ring_head - write_ring_tail);
+}
+
+
+
+static void write_byte(uint8_t data) {
+    write_ring[write_ring_head & (RECORDER_WRITE_RING_LEN - 1)] = data;
+    write_ring_head++;
+    next_addr++;
+    EECR |= _BV(EERIE);
+}
+
+
+
+static uint8_t put_varint(uint8_t* out, uint16_t value) {
+    uint8_t len = 0;
+    while (value >= 0x80) {
+        out[len++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    out[len++] = value;
+    return len;
+}
+
+
+
+static void take_sample(void) {
+    recorder_sample_t sample;
+    vector_t acceleration;
+
+    accelerometer_snapshot(&acceleration);
+    int16_t ir_cm = ir_distance_read();
+
+    sample.time_ms = (uint16_t) get_timer_counter(counter_beta);
+    sample.x = acceleration.x;
+    sample.y = acceleration.y;
+    sample.z = acceleration.z;
+    sample.ir_cm = ir_cm < 0 ? 0 : ir_cm > 255 ? 255 : ir_cm;
+
+    uint8_t count = sample_ring_head - sample_ring_tail;
+    if (!triggered && count >= RECORDER_PRETRIGGER_SAMPLES) {
+        sample_ring_tail++;                 // Drop the oldest
+    }
+    else if (triggered && count >= RECORDER_RING_SAMPLES) {
+        return;                             // Drop this one
+    }
+
+    sample_ring[sample_ring_head & (RECORDER_RING_SAMPLES - 1)] = sample;
+    sample_ring_head++;
+}
+
+
+
+// Puts the difference between sample and prev in out. Returns how long it is.
+static uint8_t encode(uint8_t* out, const recorder_sample_t* sample, const recorder_sample_t* prev) {
+    uint8_t len = 0;
+
+    len += put_varint(&out[len], sample->time_ms - prev->time_ms);
+    len += put_varint(&out[len], RECORDER_ZIGZAG(sample->x - prev->x));
+    len += put_varint(&out[len], RECORDER_ZIGZAG(sample->y - prev->y));
+    len += put_varint(&out[len], RECORDER_ZIGZAG(sample->z - prev->z));
+    len += put_varint(&out[len], RECORDER_ZIGZAG(sample->ir_cm - prev->ir_cm));
+    return len;
+}
+
+
+
+static void link_batch_send(void) {
+    if (link_batch_len > 0) {
+        trx_link_send(TRX_LINK_TYPE_RECORD, link_batch, link_batch_len);     // The EEPROM has it if this doesn't make it
+    }
+    link_batch_len = 0;
+    memset(&link_last, 0, sizeof(link_last));
+}
+
+
+
+static void link_batch_add(const recorder_sample_t* sample) {
+    uint8_t encoded[RECORDER_SAMPLE_MAX_LEN];
+    uint8_t len = encode(encoded, sample, &link_last);
+
+    if (link_batch_len + len > sizeof(link_batch)) {
+        link_batch_send();
+        len = encode(encoded, sample, &link_last);
+    }
+    memcpy(&link_batch[link_batch_len], encoded, len);
+    link_batch_len += len;
+    link_last = *sample;
+}
+
+
+
+// Encodes as many samples as there's room for.
+static void encode_samples(void) {
+    uint8_t encoded[RECORDER_SAMPLE_MAX_LEN];
+
+    while (sample_ring_head != sample_ring_tail && write_ring_free() >= RECORDER_SAMPLE_MAX_LEN) {
+
+        if (next_addr + RECORDER_SAMPLE_MAX_LEN > RECORDER_EEPROM_LEN) {
+            recorder_disarm();              // The EEPROM is full
+            sample_ring_tail = sample_ring_head;
+            return;
+        }
+
+        recorder_sample_t* sample = &sample_ring[sample_ring_tail & (RECORDER_RING_SAMPLES - 1)];
+        uint8_t len = encode(encoded, sample, &last);
+
+        for (uint8_t i = 0; i < len; i++) {
+            write_byte(encoded[i]);
+        }
+        link_batch_add(sample);
+
+        last = *sample;
+        sample_ring_tail++;
+    }
+}
+
+
+
+void recorder_arm(void) {
+    if (armed) {
+        return;
+    }
+
+    recorder_flush();                       // Don't pull the last recording out from under the interrupt
+
+    sample_ring_head = 0;
+    sample_ring_tail = 0;
+    triggered = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        samples_due = 0;
+    }
+    armed = true;
+
+    timer_every(recorder_tick, RECORDER_PERIOD_MS);
+}
+
+
+
+void recorder_disarm(void) {
+    timer_cancel(recorder_tick);
+    armed = false;
+    link_batch_send();
+}
+
+
+
+void recorder_trigger(void) {
+    if (!armed || triggered) {
+        return;
+    }
+
+    uint32_t now = get_timer_counter(counter_beta);
+    uint8_t count = sample_ring_head - sample_ring_tail;
+    uint16_t first_time_ms = count > 0 ? sample_ring[sample_ring_tail & (RECORDER_RING_SAMPLES - 1)].time_ms : (uint16_t) now;
+    uint32_t start_time = now - (uint16_t) ((uint16_t) now - first_time_ms);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        write_addr = 0;                     // The write ring is empty, recorder_arm flushed it
+        length_written = 0;
+        length_step = 0;
+    }
+    next_addr = 0;
+
+    // The header. The length stays 0 until the samples are in.
+    write_byte(RECORDER_MAGIC);
+    write_byte(RECORDER_VERSION);
+    write_byte(0);
+    write_byte(0);
+    for (uint8_t i = 0; i < 4; i++) {
+        write_byte(start_time >> (8 * i));
+    }
+    write_byte(RECORDER_PERIOD_MS);
+    write_byte(count);
+    while (next_addr < RECORDER_HEADER_LEN) {
+        write_byte(0xFF);
+    }
+
+    last.time_ms = first_time_ms;
+    last.x = 0;
+    last.y = 0;
+    last.z = 0;
+    last.ir_cm = 0;
+    link_batch_len = 0;
+    memset(&link_last, 0, sizeof(link_last));
+
+    triggered = true;
+}
+
+
+
+void recorder_poll(void) {
+    uint8_t due;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        due = samples_due;
+        samples_due = 0;
+    }
+
+    // Only one, even if a few came due while the main loop was busy. The
+    // times show how far apart they really were.
+    if (due > 0 && armed) {
+        take_sample();
+    }
+
+    if (triggered) {
+        encode_samples();
+    }
+}
+
+
+
+void recorder_flush(void) {
+    while ((EECR & _BV(EERIE)) != 0);
+}
+
+
+
+// Writes the write ring out a byte at a time, then the length.
+ISR(EE_READY_vect) {
+    uint16_t addr;
+    uint8_t data;
+    uint16_t length = write_addr > RECORDER_HEADER_LEN ? write_addr - RECORDER_HEADER_LEN : 0;
+
+    if (length_step == 1) {
+        addr = RECORDER_LENGTH_ADDR + 1;
+        data = length_writing >> 8;
+        length_written = length_writing;
+        length_step = 0;
+    }
+    else if (write_ring_head != write_ring_tail) {
+        data = write_ring[write_ring_tail & (RECORDER_WRITE_RING_LEN - 1)];
+        write_ring_tail++;
+        addr = write_addr++;
+    }
+    else if (length != length_written) {
+        length_writing = length;
+        addr = RECORDER_LENGTH_ADDR;
+        data = length_writing & 0xFF;
+        length_step = 1;
+    }
+    else {
+        EECR &= ~_BV(EERIE);                // recorder_poll turns it back on
+        return;
+    }
+
+    // Like eeprom_update_byte, leave it alone if it's already right. The
+    // interrupt comes right back, since nothing is being written.
+    EEAR = addr;
+    EECR |= _BV(EERE);
+    if (EEDR == data) return;
+
+    EEDR = data;
+    EECR |= _BV(EEMPE);
+    EECR |= _BV(EEPE);
+}
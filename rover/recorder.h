@@ -0,0 +1,94 @@
+#ifndef _RECORDER_H
+#define _RECORDER_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Recorder
+//
+// A flight data recorder for the accelerometer and the IR sensor. Once it's
+// armed, a sample is taken every RECORDER_PERIOD_MS and kept in a RAM ring, so
+// the last RECORDER_PRETRIGGER_SAMPLES are always around. recorder_trigger()
+// (at launch) writes those to the EEPROM, and every sample after them until
+// the EEPROM is full.
+//
+// Samples are delta encoded: each field is stored as the difference from the
+// last sample, zigzagged (so small negative numbers are small too) and written
+// as a varint, 7 bits a byte with the high bit set on all but the last. A
+// rover sitting still costs about 5 bytes a sample.
+//
+// The EEPROM is written a byte at a time from the EEPROM ready interrupt, so
+// recording never waits on it. Read it back with make eeprom_read and decode
+// it with build/recorder_decode eeprom_read.hex (rover/recorder_decode.c).
+//
+// The same samples also go to the transceiver (trx_link.h) in
+// TRX_LINK_TYPE_RECORD messages, a few at a time. Each message is encoded the
+// same way, but starts over from zero (the first time is the low 16 bits of
+// its ms since power up), so one can be decoded without the ones before it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+    EEPROM Layout
+
+    eeprom[0]           = RECORDER_MAGIC if there's a recording
+    eeprom[1]           = RECORDER_VERSION
+    eeprom[2..3]        = how many bytes of samples made it to the EEPROM, low byte first
+    eeprom[4..7]        = time of the first sample, in ms since power up, low byte first
+    eeprom[8]           = RECORDER_PERIOD_MS the samples were taken at
+    eeprom[9]           = how many samples came before the trigger
+    eeprom[10..15]      = <reserved>
+    eeprom[16..1023]    = the samples
+
+    Each sample is five varints, each the zigzagged difference from the same
+    field of the sample before (the first is the difference from 0):
+
+    ms since the last sample (never negative, so not zigzagged)
+    X, Y and Z acceleration in (1/2)*m/(s^2)
+    IR distance in cm
+
+    The length is written after the samples, whenever the write ring empties,
+    so anything it counts is already there.
+*/
+
+#define RECORDER_MAGIC              (0xF7)
+#define RECORDER_VERSION            (1)
+
+#define RECORDER_LENGTH_ADDR        (2)
+#define RECORDER_START_TIME_ADDR    (4)
+#define RECORDER_PERIOD_ADDR        (8)
+#define RECORDER_PRETRIGGER_ADDR    (9)
+#define RECORDER_HEADER_LEN         (16)
+#define RECORDER_EEPROM_LEN         (1024)
+
+// The most bytes one sample can take: 3 for the time and 3 for each field.
+#define RECORDER_SAMPLE_MAX_LEN     (15)
+
+// Zigzag moves the sign to the bottom bit: 0, -1, 1, -2... become 0, 1, 2, 3...
+#define RECORDER_ZIGZAG(n)          ((uint16_t) (((uint16_t) (n) << 1) ^ (uint16_t) ((int16_t) (n) >> 15)))
+#define RECORDER_UNZIGZAG(n)        ((int16_t) (((uint16_t) (n) >> 1) ^ (uint16_t) -(int16_t) ((n) & 1)))
+
+///////////////////// Public Function Prototypes ///////////////////////////////
+
+// Starts sampling into the RAM ring. Anything recorded before is written over
+// when the next trigger comes.
+void recorder_arm(void);
+
+// Stops sampling. Whatever's already on its way to the EEPROM still gets there
+void recorder_disarm(void);
+
+// Starts writing to the EEPROM, from RECORDER_PRETRIGGER_SAMPLES before now.
+// Only the first trigger after recorder_arm counts.
+void recorder_trigger(void);
+
+// Takes any samples that are due and hands them to the EEPROM. Call it every
+// time around the main loop
+void recorder_poll(void);
+
+// Waits until everything recorded so far is in the EEPROM. Call it before
+// interrupts go off for good
+void recorder_flush(void);
+
+#endif // _RECORDER_H
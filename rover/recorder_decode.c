@@ -0,0 +1,128 @@
+// Turns a rover EEPROM dump back into the flight recorder's samples, one CSV
+// line each. Reads the Intel HEX that make eeprom_read writes, or a raw dump
+// (avrdude -U eeprom:r:dump.bin:r).
+//
+// Usage: build/recorder_decode eeprom_read.hex
+//        build/recorder_decode < dump.bin
+
+#include "recorder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static uint8_t eeprom[RECORDER_EEPROM_LEN];
+
+static int hex_byte(const char* text) {
+    unsigned int value;
+    if (sscanf(text, "%2x", &value) != 1) return -1;
+    return (int) value;
+}
+
+// Fills in eeprom from Intel HEX data records. Returns 0 if it all parsed.
+static int read_ihex(FILE* in) {
+    char line[600];
+    while (fgets(line, sizeof(line), in) != NULL) {
+        if (line[0] != ':') continue;
+
+        int len = hex_byte(&line[1]);
+        int addr_hi = hex_byte(&line[3]);
+        int addr_lo = hex_byte(&line[5]);
+        int type = hex_byte(&line[7]);
+        if (len < 0 || addr_hi < 0 || addr_lo < 0 || type < 0) return -1;
+
+        if (type == 0x01) break;            // end of file
+        if (type != 0x00) continue;
+
+        int addr = (addr_hi << 8) | addr_lo;
+        for (int i = 0; i < len; i++) {
+            int data = hex_byte(&line[9 + 2 * i]);
+            if (data < 0) return -1;
+            if (addr + i < RECORDER_EEPROM_LEN) eeprom[addr + i] = (uint8_t) data;
+        }
+    }
+    return 0;
+}
+
+// Reads a varint at *pos. Returns -1 if it runs past end.
+static long get_varint(uint16_t* pos, uint16_t end) {
+    long value = 0;
+    for (int shift = 0; shift < 21; shift += 7) {
+        if (*pos >= end) return -1;
+        uint8_t b = eeprom[(*pos)++];
+        value |= (long) (b & 0x7F) << shift;
+        if ((b & 0x80) == 0) return value;
+    }
+    return -1;
+}
+
+int main(int argc, char** argv) {
+
+    FILE* in = stdin;
+    if (argc > 1) {
+        in = fopen(argv[1], "rb");
+        if (in == NULL) {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    for (int i = 0; i < RECORDER_EEPROM_LEN; i++) eeprom[i] = 0xFF;
+
+    int c = fgetc(in);
+    if (c == ':') {
+        ungetc(c, in);
+        if (read_ihex(in) != 0) {
+            fprintf(stderr, "bad Intel HEX\n");
+            return 1;
+        }
+    }
+    else if (c != EOF) {
+        ungetc(c, in);
+        fread(eeprom, 1, RECORDER_EEPROM_LEN, in);
+    }
+    if (in != stdin) fclose(in);
+
+    if (eeprom[0] != RECORDER_MAGIC || eeprom[1] != RECORDER_VERSION) {
+        fprintf(stderr, "no recording (magic %02x, version %d)\n", eeprom[0], eeprom[1]);
+        return 1;
+    }
+
+    uint16_t length = eeprom[RECORDER_LENGTH_ADDR] | (eeprom[RECORDER_LENGTH_ADDR + 1] << 8);
+    uint32_t time_ms = 0;
+    for (int i = 0; i < 4; i++) time_ms |= (uint32_t) eeprom[RECORDER_START_TIME_ADDR + i] << (8 * i);
+    int period_ms = eeprom[RECORDER_PERIOD_ADDR];
+    int pretrigger = eeprom[RECORDER_PRETRIGGER_ADDR];
+
+    if (length > RECORDER_EEPROM_LEN - RECORDER_HEADER_LEN) {
+        fprintf(stderr, "bad length %u\n", length);
+        return 1;
+    }
+
+    printf("# %u bytes, every %d ms, %d samples before the trigger\n", length, period_ms, pretrigger);
+    printf("sample,time_ms,x,y,z,ir_cm,triggered\n");
+
+    uint16_t pos = RECORDER_HEADER_LEN;
+    uint16_t end = RECORDER_HEADER_LEN + length;
+    int16_t x = 0, y = 0, z = 0, ir_cm = 0;
+
+    for (int n = 0; pos < end; n++) {
+        long fields[5];
+        for (int i = 0; i < 5; i++) {
+            fields[i] = get_varint(&pos, end);
+            if (fields[i] < 0) {
+                printf("# cut off in sample %d\n", n);
+                return 0;
+            }
+        }
+
+        time_ms += (uint16_t) fields[0];    // 0 for the first sample, which is at the start time
+        x += RECORDER_UNZIGZAG((uint16_t) fields[1]);
+        y += RECORDER_UNZIGZAG((uint16_t) fields[2]);
+        z += RECORDER_UNZIGZAG((uint16_t) fields[3]);
+        ir_cm += RECORDER_UNZIGZAG((uint16_t) fields[4]);
+
+        printf("%d,%lu,%d,%d,%d,%d,%d\n", n, (unsigned long) time_ms, x, y, z, ir_cm, n >= pretrigger);
+    }
+
+    return 0;
+}
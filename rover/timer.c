@@ -1,16 +1,40 @@
+#include <stddef.h>
+#include <util/atomic.h>
+
 #include "timer.h"
+#include "events.h"
+#include "profile.h"
 
 static volatile uint32_t counter_alpha_cnt = 0;         // Only timer interrupt allowed to change
 static volatile uint32_t counter_beta_cnt = 0;          // Only timer interrupt allowed to change
+static volatile uint8_t control_ticks = 0;              // Control periods not yet taken by take_control_ticks
+
+// The software timers. Every TIMER0 tick counts each one down, and calls it when it gets to zero
+struct soft_timer_struct {
+    timer_callback_t callback;      // NULL if the slot is free
+    uint16_t period;                // Ticks between calls, 0 for a one-shot
+    uint16_t remaining;             // Ticks until the next call
+};
+typedef struct soft_timer_struct soft_timer_t;
+
+static volatile soft_timer_t soft_timers[TIMER_SOFT_SLOTS];
+
+#define CONTROL_TICK_PERIOD (TIMER_COUNTER_HZ / CONTROL_RATE_HZ)   // 1 ms ticks per control period
+
+
+static void control_tick(void);
 
 
-// Initializes TIMER0 which is used for two seperate counters. Can be used at the same time as Left and Right motor PWM
+
+// Initializes TIMER0, which drives the counters and the software timers. Can be used at the same time as Left and Right motor PWM
 void timer_counter_initialize(void) {
-    TCCR0B |= _BV(CS02);                // Select the 256 prescaler
+    TCCR0B |= TIMER_COUNTER_CS;         // Select the prescaler from clock.h
     TCCR0A |= _BV(WGM01);               // Set timer to CTC mode
     TIMSK0 |= _BV(OCIE0A);              // Enable output compare channel A interrupt
 
-    OCR0A = 31;                         // 1000 Hz interrupt frequency (1 ms)
+    OCR0A = TIMER_COUNTER_OCR0A;        // 1000 Hz interrupt frequency (1 ms)
+
+    timer_every(control_tick, CONTROL_TICK_PERIOD);
 
     SREG   |= _BV(SREG_I);              // Enable global interrupts
 }
@@ -73,97 +97,171 @@ uint32_t get_timer_counter(counter_name_t counter) {
 
 
 
-// Enables timer2 channel A interrupt used to sample acceleration in is_launched() (accelerometer.c)
-// Cannot use the timer counter while launch check is enabled
-void launch_check_enable(void) {
-    TCCR2B |= _BV(CS22) | _BV(CS21);    // Select the 256 prescaler
-    TCCR2A |= _BV(WGM21);               // Set timer to CTC mode
-    TIMSK2 |= _BV(OCIE2A);              // Enable output compare channel A interrupt
+uint8_t take_control_ticks(void) {
+    cli();                      // Disable interrupts
+    uint8_t ticks = control_ticks;
+    control_ticks = 0;
+    sei();                      // Enable interrupts
+    return ticks;
+}
 
-    OCR0A = 244;                         // 128 Hz interrupt frequency (approx. 64 samples in 0.5 s)
 
-    SREG   |= _BV(SREG_I);              // Enable global interrupts
+
+// Finds callback's slot, or a free one if it isn't scheduled. Returns TIMER_SOFT_SLOTS if neither. Interrupts must be off
+static uint8_t soft_timer_find(timer_callback_t callback) {
+    uint8_t free_slot = TIMER_SOFT_SLOTS;
+
+    for (uint8_t i = 0; i < TIMER_SOFT_SLOTS; i++) {
+        if (soft_timers[i].callback == callback) {
+            return i;
+        }
+        if (soft_timers[i].callback == NULL && free_slot == TIMER_SOFT_SLOTS) {
+            free_slot = i;
+        }
+    }
+    return free_slot;
 }
 
 
 
-// Disables timer2 channel A interrupt
-void launch_check_disable(void) {
-    TIMSK2 &= ~_BV(OCIE2A);              // Disable output compare channel A interrupt
-    timer_counter_initialize();
+static bool soft_timer_schedule(timer_callback_t callback, uint16_t ticks, bool repeat) {
+    bool scheduled = false;
+
+    if (ticks == 0) {
+        ticks = 1;          // The soonest it can be called is the next tick
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uint8_t i = soft_timer_find(callback);
+        if (i < TIMER_SOFT_SLOTS) {
+            if (soft_timers[i].callback == NULL || !repeat) {
+                soft_timers[i].remaining = ticks;   // New, or a one-shot starting over
+            }
+            soft_timers[i].period = repeat ? ticks : 0;
+            soft_timers[i].callback = callback;
+            scheduled = true;
+        }
+    }
+
+    if (!scheduled) {
+        LED_set(RED, ON);
+        LED_set(GREEN, OFF);
+        uart_transmit_formatted_message("ERROR 160: no free software timer\r\n");
+        UART_WAIT_UNTIL_DONE();
+    }
+    return scheduled;
 }
 
 
 
-// Enables timer2 channel B interrupt. Cannot function if either PWM_enable (from motors.c) or launch_check_enable are called
-void no_motion_check_enable(void) {
-    TCCR2B |= _BV(CS22) | _BV(CS21);    // Select the 256 prescaler
-    TCCR2A |= _BV(WGM21);               // Set timer to CTC mode
-    TIMSK2 |= _BV(OCIE2B);              // Enable output compare channel B interrupt
+bool timer_every(timer_callback_t callback, uint16_t period_ms) {
+    return soft_timer_schedule(callback, period_ms, true);
+}
 
-    OCR0A = 244;                         // 128 Hz interrupt frequency (approx. 64 samples in 0.5 s)
 
-    SREG   |= _BV(SREG_I);              // Enable global interrupts
+
+bool timer_after(timer_callback_t callback, uint16_t delay_ms) {
+    return soft_timer_schedule(callback, delay_ms, false);
 }
 
 
 
-// Disables timer2 channel B interrupt
-void no_motion_check_disable(void) {
-    TIMSK2 &= ~_BV(OCIE2B);              // Disable output compare channel A interrupt
-    timer_counter_initialize();
+void timer_cancel(timer_callback_t callback) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for (uint8_t i = 0; i < TIMER_SOFT_SLOTS; i++) {
+            if (soft_timers[i].callback == callback) {
+                soft_timers[i].callback = NULL;
+            }
+        }
+    }
 }
 
 
 
-////////////////////////////////////////////////////////////////////////////////////////////
-////////// Interrupt Service Routines //////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////
+// Samples acceleration for is_launched() (accelerometer.c)
+static void launch_check_sample(void) {
+    PROFILE_BEGIN(PROFILE_LAUNCH_CHECK);
+    uint32_t gamma;                             // acceleration aggragate magnitude squared
 
-// Interrupt service routine used for 1 ms counters
-ISR(TIMER0_COMPA_vect) {
-    counter_alpha_cnt++;                    // Overflows after 4,294,967,296 ms which is about 50 days
-    counter_beta_cnt++;
+    gamma = acceleration_agg_mag();             // remember, this is magnitude squared
+
+    is_launched(gamma >= LAUNCH_FORCE_SQUARED);                  // add to the window to see if we've launched
+    PROFILE_END(PROFILE_LAUNCH_CHECK);
 }
 
 
 
-// Interrupt service routine used for launch check
-ISR(TIMER2_COMPA_vect) {
-    static logic_vector G_force_samples = 0;        // Don't let it's appearance fool you, this is a bool array[64]
+// Samples acceleration for is_no_motion() (accelerometer.c)
+static void no_motion_check_sample(void) {
     uint32_t gamma;                             // acceleration aggragate magnitude squared
 
     gamma = acceleration_agg_mag();             // remember, this is magnitude squared
 
-    G_force_samples = G_force_samples << 1;         // shift bottom half of array
-    if (gamma >= LAUNCH_FORCE_SQUARED) {
-        G_force_samples += 1;                     // insert a 1 into the LSB of bottom half
-    }
-    else {
-        // insert a zero (happens by definition)
+    is_no_motion(gamma >= (ONE_G_SQUARED - NO_MOVEMENT_TOLERANCE_SQUARED) && gamma <= (ONE_G_SQUARED + NO_MOVEMENT_TOLERANCE_SQUARED));  // add to the window to see if we've stopped
+    is_impact(gamma >= LANDING_IMPACT_FORCE_SQUARED, gamma <= FREE_FALL_FORCE_SQUARED);                                                // and whether we've hit something on the way down
+}
+
+
+
+// Counts control periods for take_control_ticks
+static void control_tick(void) {
+    if (control_ticks < 255) {
+        control_ticks++;
     }
+    event_post(EVENT_CONTROL);
+}
+
 
-    is_launched(G_force_samples);                                // check array to see if we've launched
+
+void launch_check_enable(void) {
+    timer_every(launch_check_sample, ACCEL_CHECK_PERIOD_MS);
 }
 
 
 
-// Interrupt service routine used for launch check
-ISR(TIMER2_COMPB_vect) {
-    static logic_vector G_force_samples = 0;    // Don't let it's appearance fool you, this is a bool array[64]
-    uint32_t gamma;                             // acceleration aggragate magnitude squared
+void launch_check_disable(void) {
+    timer_cancel(launch_check_sample);
+}
 
-    gamma = acceleration_agg_mag();             // remember, this is magnitude squared
 
-    G_force_samples = G_force_samples << 1;         // shift bottom half of array
-    if (gamma >= (ONE_G_SQUARED - NO_MOVEMENT_TOLERANCE_SQUARED) && gamma <= (ONE_G_SQUARED + NO_MOVEMENT_TOLERANCE_SQUARED)) {
-        G_force_samples += 1;                     // insert a 1 into the LSB of bottom half
-    }
-    else {
-        // insert a zero (happens by definition)
-    }
 
-    is_no_motion(G_force_samples);                                // check array to see if we've launched
+void no_motion_check_enable(void) {
+    timer_every(no_motion_check_sample, ACCEL_CHECK_PERIOD_MS);
+}
+
+
+
+void no_motion_check_disable(void) {
+    timer_cancel(no_motion_check_sample);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////
+////////// Interrupt Service Routines //////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////
+
+// Interrupt service routine used for 1 ms counters and the software timers
+ISR(TIMER0_COMPA_vect) {
+    PROFILE_TICK();
+    counter_alpha_cnt++;                    // Overflows after 4,294,967,296 ms which is about 50 days
+    counter_beta_cnt++;
+
+    for (uint8_t i = 0; i < TIMER_SOFT_SLOTS; i++) {
+        timer_callback_t callback = soft_timers[i].callback;
+
+        if (callback == NULL || --soft_timers[i].remaining != 0) {
+            continue;
+        }
+
+        if (soft_timers[i].period != 0) {
+            soft_timers[i].remaining = soft_timers[i].period;
+        }
+        else {
+            soft_timers[i].callback = NULL;     // One-shot, free the slot before it runs so it can schedule itself again
+        }
+        callback();
+    }
 }
 
 ////////// Interrupt Service Routines //////////////////////////////////////////////////////
@@ -6,6 +6,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "clock.h"
 #include "digital_io.h"
 #include "uart.h"
 #include "accelerometer.h"
@@ -13,8 +14,20 @@
 #define ONE_SECOND (1000)
 #define ONE_MINUTE (60000)
 
+// TIMER0 counts from the prescaler clock.h picked for F_CPU and matches every
+// TIMER_COUNTER_OCR0A + 1 counts: once a millisecond, the same as the cubes'
+// clock. The ADC is triggered off the same compare match (see adc.h).
+#define TIMER_COUNTER_CS    CLOCK_TIMER0_CS
+#define TIMER_COUNTER_OCR0A CLOCK_TIMER0_OCR0A
+#define TIMER_COUNTER_HZ    (F_CPU / CLOCK_TIMER0_PRESCALER / (TIMER_COUNTER_OCR0A + 1))
+
+
+// How many software timers can be scheduled at once (see timer_every)
+#define TIMER_SOFT_SLOTS    (8)
+
+// Something for a software timer to call. Runs inside the TIMER0 interrupt, so keep it short
+typedef void (*timer_callback_t)(void);
 
-typedef uint64_t logic_vector;
 
 enum counter_name_enum {
     counter_alpha,
@@ -23,23 +36,37 @@ enum counter_name_enum {
 typedef enum counter_name_enum counter_name_t;
 
 
-// Initializes TIMER0 which is used for two seperate counters. Can be used at the same time as Left and Right motor PWM
-// Cannot be used while either launch_check or no_motion_check are enabled.
+// Initializes TIMER0, the one tick everything runs from: the two counters, the software timers below and the ADC
+// trigger. Can be used at the same time as Left and Right motor PWM
 void timer_counter_initialize(void);
 void reset_timer_counter(counter_name_t counter);
 uint32_t get_timer_counter(counter_name_t counter);
 
-// Enables timer2 channel A interrupt. Cannot function if either PWM_enable (from motors.c) no_motion_check_enable are called
-// Cannot use the timer counter while launch check is enabled
+// Returns how many 1/CONTROL_RATE_HZ control periods have gone by since the last call (up to 255), and starts
+// counting again. Driven by the TIMER0 counter tick, so timer_counter_initialize has to be called
+uint8_t take_control_ticks(void);
+
+// Calls callback every period_ms 1 ms ticks until timer_cancel. If callback is already scheduled, only its period
+// changes, so this is safe to call every time through the main loop. Returns false if all TIMER_SOFT_SLOTS are taken
+bool timer_every(timer_callback_t callback, uint16_t period_ms);
+
+// Calls callback once, delay_ms 1 ms ticks from now. If callback is already scheduled, the delay starts over.
+// Returns false if all TIMER_SOFT_SLOTS are taken
+bool timer_after(timer_callback_t callback, uint16_t delay_ms);
+
+// Stops callback from being called. Does nothing if it isn't scheduled
+void timer_cancel(timer_callback_t callback);
+
+// Starts sampling acceleration for is_launched() (accelerometer.c) every ACCEL_CHECK_PERIOD_MS
 void launch_check_enable(void);
 
-// Disables timer2 channel A interrupt
+// Stops the launch check
 void launch_check_disable(void);
 
-// Enables timer2 channel B interrupt. Cannot function if either PWM_enable (from motors.c) or launch_check_enable are called
+// Starts sampling acceleration for is_no_motion() (accelerometer.c) every ACCEL_CHECK_PERIOD_MS
 void no_motion_check_enable(void);
 
-// Disables timer2 channel B interrupt
+// Stops the no motion check
 void no_motion_check_disable(void);
 
 #endif // TIMER_H
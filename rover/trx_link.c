@@ -0,0 +1,173 @@
+#include <string.h>
+
+#include "trx_link.h"
+#include "config.h"
+#include "uart.h"
+#include "timer.h"
+
+#if (TRX_LINK_QUEUE_LEN & (TRX_LINK_QUEUE_LEN - 1)) != 0 || TRX_LINK_QUEUE_LEN > 128
+    #error "TRX_LINK_QUEUE_LEN must be a power of two, no more than 128."
+#endif
+
+// The bridge's answers start with this.
+#define TRX_LINK_REPLY_PREFIX       "[BRIDGE] "
+#define TRX_LINK_REPLY_PREFIX_LEN   (sizeof(TRX_LINK_REPLY_PREFIX) - 1)
+
+// And it says this once when it starts.
+#define TRX_LINK_BANNER             "::: Bridge mode"
+#define TRX_LINK_BANNER_LEN         (sizeof(TRX_LINK_BANNER) - 1)
+
+// Only the start of a line matters, so the rest is cut off.
+#define TRX_LINK_LINE_LEN           (24)
+
+// Messages waiting to go out, each its length and then its bytes. The one at
+// the tail is the one that's out, while waiting is true. Counts up forever
+// and wraps, like the rings in uart.c.
+static uint8_t queue[TRX_LINK_QUEUE_LEN];
+static uint8_t queue_head = 0;
+static uint8_t queue_tail = 0;
+
+static bool up = false;
+static bool waiting = false;
+static uint32_t sent_at = 0;
+static uint16_t lost = 0;
+
+// The line the transceiver is sending.
+static char line[TRX_LINK_LINE_LEN];
+static uint8_t line_len = 0;
+
+
+
+static uint8_t queue_byte(uint8_t offset) {
+    return queue[(uint8_t) (queue_tail + offset) & (TRX_LINK_QUEUE_LEN - 1)];
+}
+
+
+
+static void drop_front(void) {
+    queue_tail += 1 + queue_byte(0);
+}
+
+
+
+static void send_front(void) {
+    uint8_t frame[4 + TRX_LINK_MAX_MESSAGE_LEN + 1];
+    uint8_t len = queue_byte(0);
+    uint8_t checksum = 0;
+
+    frame[0] = TRX_LINK_SYNC;
+    frame[1] = TRX_LINK_DEST_PORT;
+    frame[2] = 0;
+    frame[3] = len;
+    for (uint8_t i = 0; i < len; i++) {
+        frame[4 + i] = queue_byte(1 + i);
+    }
+    for (uint8_t i = 1; i < 4 + len; i++) {
+        checksum += frame[i];
+    }
+    frame[4 + len] = checksum;
+
+    uart_transmit_bytes(frame, 5 + len);
+    waiting = true;
+    sent_at = get_timer_counter(counter_beta);
+}
+
+
+
+static void handle_line(void) {
+    if (line_len >= TRX_LINK_BANNER_LEN && strncmp(line, TRX_LINK_BANNER, TRX_LINK_BANNER_LEN) == 0) {
+        up = true;
+        return;
+    }
+
+    if (line_len < TRX_LINK_REPLY_PREFIX_LEN || strncmp(line, TRX_LINK_REPLY_PREFIX, TRX_LINK_REPLY_PREFIX_LEN) != 0) {
+        return;                             // Something else the transceiver had to say
+    }
+
+    up = true;
+    if (!waiting) {
+        return;
+    }
+
+    // "[BRIDGE] 3a OK" or "[BRIDGE] 3a FAIL". "[BRIDGE] Bad checksum..." means
+    // the frame never made it into the network at all.
+    if (!(line_len >= 2 && line[line_len - 2] == 'O' && line[line_len - 1] == 'K')) {
+        lost++;
+    }
+    drop_front();
+    waiting = false;
+}
+
+
+
+void trx_link_initialize(void) {
+    queue_head = 0;
+    queue_tail = 0;
+    up = false;
+    waiting = false;
+    line_len = 0;
+}
+
+
+
+bool trx_link_send(uint8_t type, const uint8_t* message, uint8_t message_len) {
+    if (message_len + 1 > TRX_LINK_MAX_MESSAGE_LEN) {
+        return false;
+    }
+
+    // Until the bridge is up, make room by dropping the oldest.
+    while ((uint8_t) (TRX_LINK_QUEUE_LEN - (uint8_t) (queue_head - queue_tail)) < message_len + 2) {
+        if (up || waiting) {
+            return false;
+        }
+        drop_front();
+        lost++;
+    }
+
+    queue[queue_head++ & (TRX_LINK_QUEUE_LEN - 1)] = message_len + 1;
+    queue[queue_head++ & (TRX_LINK_QUEUE_LEN - 1)] = type;
+    for (uint8_t i = 0; i < message_len; i++) {
+        queue[queue_head++ & (TRX_LINK_QUEUE_LEN - 1)] = message[i];
+    }
+    return true;
+}
+
+
+
+void trx_link_poll(void) {
+    uint8_t c;
+
+    while (uart_try_receive(&c)) {
+        if (c == '\r' || c == '\n') {
+            if (line_len > 0) {
+                handle_line();
+            }
+            line_len = 0;
+        }
+        else if (line_len < TRX_LINK_LINE_LEN) {
+            line[line_len++] = c;
+        }
+    }
+
+    if (waiting && get_timer_counter(counter_beta) - sent_at >= TRX_LINK_REPLY_TIMEOUT_MS) {
+        drop_front();
+        waiting = false;
+        lost++;
+    }
+
+    if (up && !waiting && queue_head != queue_tail) {
+        send_front();
+    }
+}
+
+
+
+bool trx_link_is_up(void) {
+    return up;
+}
+
+
+
+uint16_t trx_link_lost(void) {
+    return lost;
+}
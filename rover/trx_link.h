@@ -0,0 +1,74 @@
+#ifndef _TRX_LINK_H
+#define _TRX_LINK_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Transceiver Link
+//
+// Sends messages to the rover's transceiver cube over the UART, for it to
+// pass on over the network. The transceiver has to be running its bridge
+// (APPLICATION_BRIDGE_MODE in cube/rover_trx/application.c), which takes
+// frames like this:
+//
+// TRX_LINK_SYNC, destination port, length (high byte first), the message,
+// then the sum of everything after TRX_LINK_SYNC, modulo 256.
+//
+// and answers each one with a "[BRIDGE] <port> OK" or "FAIL" line once the
+// network is done with it. That line is the flow control: only one frame is
+// out at a time, and the next waits for it (or for TRX_LINK_REPLY_TIMEOUT_MS).
+// Messages queue up here in the meantime, and trx_link_send turns new ones
+// away once TRX_LINK_QUEUE_LEN is full.
+//
+// Nothing is sent until the bridge says it's up, so the messages from
+// before the transceiver starts wait in the queue (the oldest are dropped to
+// make room for new ones).
+//
+// The rest of the rover's UART output goes over the same line. The bridge
+// skips anything that isn't a frame, so just keep TRX_LINK_SYNC ('~') out of
+// it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+
+///////////////////// Link Settings ////////////////////////////////////////////
+
+#define TRX_LINK_SYNC               (0x7E)
+
+// The longest message, and how many bytes of them can wait (each takes one
+// more for its length). The queue is a power of two, no more than 128. A
+// frame has to fit in the transceiver's 64 byte receive ring with room to
+// spare for whatever else the rover prints while it's being sent.
+#define TRX_LINK_MAX_MESSAGE_LEN    (40)
+#define TRX_LINK_QUEUE_LEN          (128)
+
+// How long to wait for the bridge's answer before giving up on a frame. A
+// send that needs every retry takes a few seconds.
+#define TRX_LINK_REPLY_TIMEOUT_MS   (8000)
+
+// Message types, the first byte of each message.
+#define TRX_LINK_TYPE_STATE         ('S')   // the rest is the name of the flight state the rover just went into
+#define TRX_LINK_TYPE_RECORD        ('R')   // the rest is flight recorder samples (recorder.h)
+
+///////////////////// Public Function Prototypes ///////////////////////////////
+
+// Empties the queue and waits for the bridge to come up.
+void trx_link_initialize(void);
+
+// Queues a message for TRX_LINK_DEST_PORT (config.h). Returns false if it's
+// too long, or there isn't room for it.
+bool trx_link_send(uint8_t type, const uint8_t* message, uint8_t message_len);
+
+// Reads what the transceiver sent back and sends the next frame when it's
+// time. Call it every time around the main loop.
+void trx_link_poll(void);
+
+// Whether the bridge has said it's up.
+bool trx_link_is_up(void);
+
+// How many messages didn't make it: the bridge said FAIL, it never answered,
+// or they were dropped from a full queue before the bridge came up.
+uint16_t trx_link_lost(void);
+
+#endif // _TRX_LINK_H
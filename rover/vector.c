@@ -0,0 +1,89 @@
+#include "vector.h"
+
+#include <avr/pgmspace.h>
+
+// asin(i / 16) in degrees, for i = 0 to 12. Past 12 (about 49 degrees) the
+// other component is the smaller one, so it's never needed.
+static const uint8_t vector_asin_table[13] PROGMEM = {
+    0, 4, 7, 11, 14, 18, 22, 26, 30, 34, 39, 43, 49
+};
+
+// asin(numerator / denominator) in degrees, for numerator <= denominator / sqrt(2)
+static uint8_t vector_asin_degrees(uint16_t numerator, uint16_t denominator) {
+    // As 1/256ths, then interpolated between the table's entries, which are
+    // 16/256ths apart.
+    uint16_t ratio_q8 = (uint16_t) (((uint32_t) numerator << 8) / denominator);
+    uint8_t i = ratio_q8 >> 4;
+    uint8_t fraction = ratio_q8 & 0x0F;
+    if (i >= 12) {
+        return pgm_read_byte(&vector_asin_table[12]);
+    }
+    uint8_t low = pgm_read_byte(&vector_asin_table[i]);
+    uint8_t high = pgm_read_byte(&vector_asin_table[i + 1]);
+    return low + (uint8_t) (((uint16_t) (high - low) * fraction) >> 4);
+}
+
+uint32_t vector_magnitude_squared(const vector_t* v) {
+    int32_t x = v->x;
+    int32_t y = v->y;
+    int32_t z = v->z;
+    return (uint32_t) (x * x) + (uint32_t) (y * y) + (uint32_t) (z * z);
+}
+
+// One bit at a time, from the top. 16 rounds of shifts and subtracts.
+uint16_t vector_sqrt(uint32_t n) {
+    uint32_t root = 0;
+    uint32_t bit = (uint32_t) 1 << 30;
+
+    while (bit > n) {
+        bit >>= 2;
+    }
+
+    while (bit != 0) {
+        if (n >= root + bit) {
+            n -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (uint16_t) root;
+}
+
+uint8_t vector_tilt_degrees(const vector_t* v, uint32_t magnitude_squared) {
+    uint16_t magnitude = vector_sqrt(magnitude_squared);
+    if (magnitude == 0) {
+        return 0;
+    }
+
+    int32_t x = v->x;
+    int32_t y = v->y;
+    uint16_t horizontal = vector_sqrt((uint32_t) (x * x) + (uint32_t) (y * y));
+    uint16_t vertical = v->z < 0 ? -v->z : v->z;
+
+    // asin is only accurate for the smaller of the two, so work out the
+    // angle from whichever that is.
+    uint8_t degrees;
+    if (horizontal <= vertical) {
+        degrees = vector_asin_degrees(horizontal, magnitude);
+    }
+    else {
+        degrees = 90 - vector_asin_degrees(vertical, magnitude);
+    }
+
+    return v->z < 0 ? 180 - degrees : degrees;
+}
+
+vector_orientation_t vector_orientation(const vector_t* v) {
+    int16_t ax = v->x < 0 ? -v->x : v->x;
+    int16_t ay = v->y < 0 ? -v->y : v->y;
+    int16_t az = v->z < 0 ? -v->z : v->z;
+
+    if (az < ax || az < ay) {
+        return VECTOR_ORIENTATION_SIDEWAYS;
+    }
+    return v->z > 0 ? VECTOR_ORIENTATION_UP : VECTOR_ORIENTATION_DOWN;
+}
@@ -0,0 +1,49 @@
+#ifndef _VECTOR_H
+#define _VECTOR_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Vector
+//
+// Fixed-point 3D vector math for the accelerometer. Everything is integers:
+// no floats, no math.h. Units are whatever the vector is in; the
+// accelerometer's are (1/2)*m/(s^2).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+
+///////////////////// Type Definitions /////////////////////////////////////////
+
+typedef struct {
+    int16_t x;
+    int16_t y;
+    int16_t z;
+} vector_t;
+
+// Which way the Z axis points, roughly.
+enum vector_orientation_enum {
+    VECTOR_ORIENTATION_UP,          // Z is the biggest component, and positive
+    VECTOR_ORIENTATION_DOWN,        // Z is the biggest component, and negative
+    VECTOR_ORIENTATION_SIDEWAYS     // X or Y is bigger than Z
+};
+typedef enum vector_orientation_enum vector_orientation_t;
+
+///////////////////// Public Function Prototypes ///////////////////////////////
+
+// Returns x^2 + y^2 + z^2. Compare it against a squared threshold instead of
+// taking the square root.
+uint32_t vector_magnitude_squared(const vector_t* v);
+
+// Returns the integer square root of n, rounded down.
+uint16_t vector_sqrt(uint32_t n);
+
+// Returns the angle between the vector and the +Z axis, in degrees (0-180).
+// 0 for a zero vector.
+uint8_t vector_tilt_degrees(const vector_t* v, uint32_t magnitude_squared);
+
+// Returns which way the Z axis points.
+vector_orientation_t vector_orientation(const vector_t* v);
+
+#endif // _VECTOR_H
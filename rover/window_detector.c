@@ -0,0 +1,43 @@
+#include "window_detector.h"
+
+void window_detector_initialize(window_detector_t* detector, uint8_t length, uint8_t threshold) {
+    for (uint8_t i = 0; i < sizeof(detector->bits); i++) {
+        detector->bits[i] = 0;
+    }
+    if (length > WINDOW_DETECTOR_MAX_LENGTH) {
+        length = WINDOW_DETECTOR_MAX_LENGTH;
+    }
+    detector->length = length;
+    detector->threshold = threshold;
+    detector->index = 0;
+    detector->count = 0;
+}
+
+bool window_detector_update(window_detector_t* detector, bool sample) {
+    uint8_t* byte = &detector->bits[detector->index >> 3];
+    uint8_t mask = 1 << (detector->index & 0x07);
+
+    // Drop the oldest sample, which is the one this one replaces.
+    if (*byte & mask) {
+        detector->count--;
+    }
+
+    if (sample) {
+        *byte |= mask;
+        detector->count++;
+    }
+    else {
+        *byte &= ~mask;
+    }
+
+    detector->index++;
+    if (detector->index >= detector->length) {
+        detector->index = 0;
+    }
+
+    return detector->count >= detector->threshold;
+}
+
+uint8_t window_detector_count(const window_detector_t* detector) {
+    return detector->count;
+}
@@ -0,0 +1,53 @@
+#ifndef _WINDOW_DETECTOR_H
+#define _WINDOW_DETECTOR_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Window Detector
+//
+// Counts how many of the last n samples met some condition, and says when
+// that's at least a threshold. Launch, no-motion and any other "has this been
+// happening for a while" check can run on one of these.
+//
+// The window is a ring of bits with a running count. Each new sample replaces
+// the oldest one and adjusts the count by whatever changed, so an update
+// costs the same no matter how long the window is.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+
+///////////////////// Macro Definitions /////////////////////////////////////////
+
+// The longest window there's room for, in samples.
+#define WINDOW_DETECTOR_MAX_LENGTH 64
+
+// For declaring a detector that's ready to go, with an empty window:
+// static window_detector_t launch = WINDOW_DETECTOR_INIT(64, 58);
+#define WINDOW_DETECTOR_INIT(len, thresh) { .length = (len), .threshold = (thresh) }
+
+///////////////////// Type Definitions /////////////////////////////////////////
+
+typedef struct {
+    uint8_t bits[WINDOW_DETECTOR_MAX_LENGTH / 8];  // bit i is sample i of the ring
+    uint8_t length;                                 // samples in the window
+    uint8_t threshold;                              // how many have to be true
+    uint8_t index;                                  // where the next sample goes
+    uint8_t count;                                  // how many in the window are true
+} window_detector_t;
+
+///////////////////// Public Function Prototypes ///////////////////////////////
+
+// Empties the window and sets its length (at most WINDOW_DETECTOR_MAX_LENGTH)
+// and threshold.
+void window_detector_initialize(window_detector_t* detector, uint8_t length, uint8_t threshold);
+
+// Adds a sample, dropping the oldest. Returns true if at least threshold of
+// the samples in the window are true.
+bool window_detector_update(window_detector_t* detector, bool sample);
+
+// How many of the samples in the window are true.
+uint8_t window_detector_count(const window_detector_t* detector);
+
+#endif // _WINDOW_DETECTOR_H